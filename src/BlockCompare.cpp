@@ -0,0 +1,108 @@
+/**
+* @file BlockCompare.cpp
+* @brief Vectorized comparison of two blocks of memory
+*/
+
+#include "BlockCompare.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // For the SSE2 and AVX2 intrinsics
+#define BLOCK_COMPARE_X86
+#endif
+
+/**
+ * @brief Byte by byte comparison, used for the tail of a block and on CPUs without SIMD.
+ *
+ * @param[in] lhs The first block
+ * @param[in] rhs The second block
+ * @param[in] offset The offset to start comparing from
+ * @param[in] length The total length of the blocks
+ *
+ * @return The offset of the first byte that differs, or length if the blocks match.
+ */
+static size_t FindFirstMismatchScalar(const uint8_t *lhs, const uint8_t *rhs, size_t offset, const size_t length)
+{
+    for (; offset < length; ++offset)
+    {
+        if (lhs[offset] != rhs[offset])
+        {
+            break;
+        }
+    }
+    return offset;
+}
+
+#ifdef BLOCK_COMPARE_X86
+
+/**
+ * @brief Compares the blocks 16 bytes at a time. SSE2 is part of the x86-64 baseline.
+ */
+__attribute__((target("sse2")))
+static size_t FindFirstMismatchSse2(const uint8_t *lhs, const uint8_t *rhs, const size_t length)
+{
+    static constexpr size_t VECTOR_LENGTH = 16;
+    static constexpr uint32_t ALL_EQUAL   = 0xFFFF;
+
+    size_t offset = 0;
+    for (; (offset + VECTOR_LENGTH) <= length; offset += VECTOR_LENGTH)
+    {
+        const __m128i lhs_vector = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lhs + offset));
+        const __m128i rhs_vector = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs + offset));
+        const uint32_t equal_mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(lhs_vector, rhs_vector)));
+        if (equal_mask != ALL_EQUAL)
+        {
+            return offset + __builtin_ctz(~equal_mask);
+        }
+    }
+    return FindFirstMismatchScalar(lhs, rhs, offset, length);
+}
+
+/**
+ * @brief Compares the blocks 64 bytes at a time, checking two 32 byte vectors per iteration.
+ */
+__attribute__((target("avx2")))
+static size_t FindFirstMismatchAvx2(const uint8_t *lhs, const uint8_t *rhs, const size_t length)
+{
+    static constexpr size_t VECTOR_LENGTH = 32;
+
+    size_t offset = 0;
+    for (; (offset + (2 * VECTOR_LENGTH)) <= length; offset += (2 * VECTOR_LENGTH))
+    {
+        const __m256i lhs_low  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lhs + offset));
+        const __m256i rhs_low  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rhs + offset));
+        const __m256i lhs_high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lhs + offset + VECTOR_LENGTH));
+        const __m256i rhs_high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rhs + offset + VECTOR_LENGTH));
+        const __m256i equal_low  = _mm256_cmpeq_epi8(lhs_low, rhs_low);
+        const __m256i equal_high = _mm256_cmpeq_epi8(lhs_high, rhs_high);
+
+        // Only find the exact byte once a difference has been detected in either vector
+        if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(equal_low, equal_high))) != 0xFFFFFFFF)
+        {
+            const uint32_t low_mask = static_cast<uint32_t>(_mm256_movemask_epi8(equal_low));
+            if (low_mask != 0xFFFFFFFF)
+            {
+                return offset + __builtin_ctz(~low_mask);
+            }
+            const uint32_t high_mask = static_cast<uint32_t>(_mm256_movemask_epi8(equal_high));
+            return offset + VECTOR_LENGTH + __builtin_ctz(~high_mask);
+        }
+    }
+    return offset + FindFirstMismatchSse2(lhs + offset, rhs + offset, length - offset);
+}
+
+#endif
+
+size_t FindFirstMismatch(const uint8_t *lhs, const uint8_t *rhs, const size_t length)
+{
+#ifdef BLOCK_COMPARE_X86
+    // Check the CPU once, rather than on every block
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2)
+    {
+        return FindFirstMismatchAvx2(lhs, rhs, length);
+    }
+    return FindFirstMismatchSse2(lhs, rhs, length);
+#else
+    return FindFirstMismatchScalar(lhs, rhs, 0, length);
+#endif
+}
@@ -0,0 +1,22 @@
+/**
+* @file BlockCompare.hpp
+* @brief Vectorized comparison of two blocks of memory
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Compares two blocks of memory and finds where they first differ.
+ *        Uses AVX2 when the CPU supports it, SSE2 otherwise, and plain byte
+ *        comparisons on CPUs without either.
+ *
+ * @param[in] lhs The first block
+ * @param[in] rhs The second block
+ * @param[in] length The number of bytes to compare
+ *
+ * @return The offset of the first byte that differs, or length if the blocks match.
+ */
+size_t FindFirstMismatch(const uint8_t *lhs, const uint8_t *rhs, const size_t length);
@@ -0,0 +1,65 @@
+/**
+* @file BufferPool.cpp
+* @brief Fixed set of equally sized buffers that are handed out and returned
+*/
+
+#include "BufferPool.hpp"
+#include <cstdlib> // For aligned_alloc, free
+#include <new>     // For std::bad_alloc
+
+/**
+ * @param[in] buffer_size The size of each buffer in bytes. Rounded up to BUFFER_ALIGNMENT.
+ * @param[in] buffer_count The number of buffers
+ */
+BufferPool::BufferPool(const size_t buffer_size, const size_t buffer_count) :
+    mBufferSize(((buffer_size + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT) * BUFFER_ALIGNMENT),
+    mBufferCount((buffer_count > 0) ? buffer_count : 1),
+    mStorage(static_cast<uint8_t *>(aligned_alloc(BUFFER_ALIGNMENT, mBufferSize * mBufferCount)), free),
+    mFreeBuffers(mBufferCount)
+{
+    if (!mStorage)
+    {
+        throw std::bad_alloc();
+    }
+
+    for (size_t index = 0; index < mBufferCount; ++index)
+    {
+        mFreeBuffers.Push(mStorage.get() + (index * mBufferSize));
+    }
+}
+
+/**
+ * @brief Takes a buffer from the pool, waiting for one to be released if all are in use.
+ *
+ * @return A buffer of BufferSize() bytes
+ */
+uint8_t *BufferPool::Acquire()
+{
+    uint8_t *buffer = nullptr;
+    mFreeBuffers.Pop(buffer);
+    return buffer;
+}
+
+/**
+ * @brief Takes a buffer from the pool if one is free, without waiting.
+ *
+ * @return A buffer of BufferSize() bytes, or nullptr if every buffer is in use
+ */
+uint8_t *BufferPool::TryAcquire()
+{
+    uint8_t *buffer = nullptr;
+    mFreeBuffers.TryPop(buffer);
+    return buffer;
+}
+
+/**
+ * @brief Returns a buffer taken with Acquire or TryAcquire to the pool.
+ *
+ * @param[in] buffer The buffer to return
+ *
+ * @return None
+ */
+void BufferPool::Release(uint8_t *buffer)
+{
+    mFreeBuffers.Push(buffer);
+}
@@ -0,0 +1,44 @@
+/**
+* @file BufferPool.hpp
+* @brief Fixed set of equally sized buffers that are handed out and returned
+*/
+
+#pragma once
+
+#include "LockFreeQueue.hpp"
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Owns a fixed number of buffers, allocated once up front.
+ *        Acquire waits while every buffer is in use, so the memory held by a
+ *        pipeline never grows past BufferCount * BufferSize.
+ */
+class BufferPool
+{
+private:
+
+    // Aligned so the buffers can also be used for O_DIRECT transfers
+    static constexpr size_t BUFFER_ALIGNMENT = 4096;
+
+    const size_t mBufferSize;
+    const size_t mBufferCount;
+    std::unique_ptr<uint8_t, void (*)(void *)> mStorage;
+    LockFreeQueue<uint8_t *> mFreeBuffers;
+
+public:
+    BufferPool(const size_t buffer_size, const size_t buffer_count);
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    const size_t BufferSize() const {return mBufferSize;}
+    const size_t BufferCount() const {return mBufferCount;}
+    uint8_t *Storage() const {return mStorage.get();}
+    const size_t StorageSize() const {return mBufferSize * mBufferCount;}
+
+    uint8_t *Acquire();
+    uint8_t *TryAcquire();
+    void Release(uint8_t *buffer);
+};
@@ -0,0 +1,143 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../DedupIndex.hpp"
+#include "../XxHash64.hpp"
+#include "TestFolder.hpp"
+
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(DedupIndexTests)
+{
+   static constexpr size_t PHOTO_SIZE = 5000;
+
+   TestFolder Folder;
+   DedupIndex Index;
+   std::vector<uint8_t> Photo;
+   std::vector<uint8_t> OtherPhoto;
+   uint64_t PhotoDigest;
+   uint64_t OtherDigest;
+
+   void setup()
+   {
+      Photo = TestContents(PHOTO_SIZE, 1);
+      OtherPhoto = TestContents(PHOTO_SIZE, 2);
+      PhotoDigest = XxHash64::Hash(Photo.data(), Photo.size());
+      OtherDigest = XxHash64::Hash(OtherPhoto.data(), OtherPhoto.size());
+   }
+
+   /**
+    * @brief Looks up a new photo the way the ingest does, reserving it first
+    */
+   const std::string Find(const fs::path &Source, const uint64_t Digest, std::vector<DedupIndex::HashedFile> &NewlyHashed)
+   {
+      uint64_t Ticket = 0;
+      Index.Reserve(PHOTO_SIZE, Source.string(), Ticket);
+      Index.SetReservedDigest(Ticket, Digest);
+      const std::string Match = Index.Find(Source, PHOTO_SIZE, Digest, Ticket, NewlyHashed);
+      Index.Release(Ticket);
+      return Match;
+   }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+TEST(DedupIndexTests, FindsHashedLibraryFile)
+{
+   const fs::path Library = Folder.Write("library.jpg", Photo);
+   const fs::path OtherLibrary = Folder.Write("other.jpg", OtherPhoto);
+   Index.AddHashed(PHOTO_SIZE, OtherDigest, OtherLibrary.string());
+   Index.AddHashed(PHOTO_SIZE, PhotoDigest, Library.string());
+   CHECK_EQUAL(2, Index.FileCount());
+
+   std::vector<DedupIndex::HashedFile> NewlyHashed;
+   STRCMP_EQUAL(Library.c_str(), Find(Folder.Write("new.jpg", Photo), PhotoDigest, NewlyHashed).c_str());
+   CHECK_TRUE(NewlyHashed.empty());
+}
+
+TEST(DedupIndexTests, MissesPhotoNotInLibrary)
+{
+   Index.AddHashed(PHOTO_SIZE, OtherDigest, Folder.Write("other.jpg", OtherPhoto).string());
+
+   std::vector<DedupIndex::HashedFile> NewlyHashed;
+   CHECK_TRUE(Find(Folder.Write("new.jpg", Photo), PhotoDigest, NewlyHashed).empty());
+
+   // A photo of a size no library file has is known not to be a duplicate without a lookup
+   uint64_t Ticket = 0;
+   CHECK_FALSE(Index.Reserve(PHOTO_SIZE + 1, (Folder.Path / "bigger.jpg").string(), Ticket));
+   CHECK_TRUE(Index.MayContainSize(PHOTO_SIZE + 1));
+   Index.Release(Ticket);
+}
+
+TEST(DedupIndexTests, CollidingDigestIsNotDuplicate)
+{
+   // A library file listed under the photo's digest, but whose contents differ
+   Index.AddHashed(PHOTO_SIZE, PhotoDigest, Folder.Write("other.jpg", OtherPhoto).string());
+
+   std::vector<DedupIndex::HashedFile> NewlyHashed;
+   CHECK_TRUE(Find(Folder.Write("new.jpg", Photo), PhotoDigest, NewlyHashed).empty());
+}
+
+TEST(DedupIndexTests, UnhashedLibraryFilesAreHashedOnce)
+{
+   const fs::path Library = Folder.Write("library.jpg", Photo);
+   const fs::path OtherLibrary = Folder.Write("other.jpg", OtherPhoto);
+   Index.AddUnhashed(PHOTO_SIZE, OtherLibrary.string());
+   Index.AddUnhashed(PHOTO_SIZE, Library.string());
+   CHECK_EQUAL(2, Index.FileCount());
+
+   const fs::path Source = Folder.Write("new.jpg", Photo);
+   std::vector<DedupIndex::HashedFile> NewlyHashed;
+   STRCMP_EQUAL(Library.c_str(), Find(Source, PhotoDigest, NewlyHashed).c_str());
+   CHECK_EQUAL(2, NewlyHashed.size());
+   for (const DedupIndex::HashedFile &File : NewlyHashed)
+   {
+      CHECK_EQUAL((File.Path == Library.string()) ? PhotoDigest : OtherDigest, File.Digest);
+   }
+   CHECK_EQUAL(2, Index.FileCount());
+
+   NewlyHashed.clear();
+   STRCMP_EQUAL(Library.c_str(), Find(Source, PhotoDigest, NewlyHashed).c_str());
+   CHECK_TRUE(NewlyHashed.empty());
+}
+
+TEST(DedupIndexTests, WaitsForPhotoInFlight)
+{
+   const fs::path First = Folder.Write("first.jpg", Photo);
+   const fs::path Second = Folder.Write("second.jpg", Photo);
+   uint64_t FirstTicket = 0;
+   CHECK_FALSE(Index.Reserve(PHOTO_SIZE, First.string(), FirstTicket));
+   Index.SetReservedDigest(FirstTicket, PhotoDigest);
+
+   std::string Match;
+   std::thread Lookup([&]()
+   {
+      std::vector<DedupIndex::HashedFile> NewlyHashed;
+      Match = Find(Second, PhotoDigest, NewlyHashed);
+   });
+
+   // The lookup can only finish once the first photo's copy is committed
+   const fs::path Copy = Folder.Write("copy.jpg", Photo);
+   Index.Commit(FirstTicket, Copy.string());
+   Lookup.join();
+   STRCMP_EQUAL(Copy.c_str(), Match.c_str());
+}
+
+TEST(DedupIndexTests, PhotoInFlightThatFailsIsNotDuplicate)
+{
+   const fs::path First = Folder.Write("first.jpg", Photo);
+   const fs::path Second = Folder.Write("second.jpg", Photo);
+   uint64_t FirstTicket = 0;
+   Index.Reserve(PHOTO_SIZE, First.string(), FirstTicket);
+   Index.SetReservedDigest(FirstTicket, PhotoDigest);
+
+   std::string Match = "not looked up";
+   std::thread Lookup([&]()
+   {
+      std::vector<DedupIndex::HashedFile> NewlyHashed;
+      Match = Find(Second, PhotoDigest, NewlyHashed);
+   });
+   Index.Release(FirstTicket);
+   Lookup.join();
+   CHECK_TRUE(Match.empty());
+}
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define private public
+#define protected public
+
+#include "../Filesystem.hpp"
+#include "../XxHash64.hpp"
+#include "TestFolder.hpp"
+
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(FilesystemTests)
+{
+   // Several chunks with a part chunk at the end, so the streamed copies and verifies
+   // go round more than once
+   static constexpr size_t CHUNK_SIZE = Filesystem::MIN_CHUNK_SIZE;
+   static constexpr size_t FILE_SIZE  = (CHUNK_SIZE * 11) + 123;
+
+   TestFolder Folder;
+   std::vector<uint8_t> Contents;
+   fs::path Source;
+
+   void setup()
+   {
+      Filesystem::SetChunkSize(CHUNK_SIZE);
+      Contents = TestContents(FILE_SIZE, 3);
+      Source = Folder.Write("source.jpg", Contents);
+   }
+
+   void teardown()
+   {
+      Filesystem::SetChunkSize(Filesystem::DEFAULT_CHUNK_SIZE);
+   }
+
+   /**
+    * @brief Copies the source with one copy strategy
+    *
+    * @return The strategy's result
+    */
+   template <typename Strategy>
+   int CopyWith(const fs::path &Destination, Strategy CopyStrategy)
+   {
+      const int SourceFd = open(Source.c_str(), O_RDONLY | O_CLOEXEC);
+      const int DestFd = open(Destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      Filesystem::CopyStreams Streams = {{nullptr, SourceFd, IoScheduler::TRAFFIC_COPY, IoScheduler::IO_READ},
+                                         {nullptr, DestFd, IoScheduler::TRAFFIC_COPY, IoScheduler::IO_WRITE}};
+      uint64_t Copied = 0;
+      const int Result = CopyStrategy(SourceFd, DestFd, Copied, Streams);
+      close(SourceFd);
+      close(DestFd);
+      return Result;
+   }
+
+   /**
+    * @brief Checks a copy matches the source in every verify mode, and that a change to
+    *        one byte of it is found in every mode
+    */
+   void CheckEveryVerifyMode(const fs::path &Copy)
+   {
+      CHECK_TRUE(TestFolder::Read(Copy) == Contents);
+      const uint64_t Digest = XxHash64::Hash(Contents.data(), Contents.size());
+      for (const Filesystem::VerifyMode Mode : {Filesystem::VERIFY_BUFFERED, Filesystem::VERIFY_MAPPED, Filesystem::VERIFY_UNCACHED})
+      {
+         uint64_t MismatchOffset = 0;
+         CHECK_EQUAL(Filesystem::NO_ERROR, Filesystem::Verify(Source, Copy, Mode, MismatchOffset));
+         CHECK_EQUAL(FILE_SIZE, MismatchOffset);
+         CHECK_EQUAL(Filesystem::NO_ERROR, Filesystem::VerifyDigest(Copy, Digest, Mode));
+      }
+
+      static constexpr size_t CHANGED_OFFSET = (CHUNK_SIZE * 7) + 5;
+      std::vector<uint8_t> Changed = Contents;
+      Changed[CHANGED_OFFSET] ^= 0x01;
+      const fs::path ChangedCopy = Folder.Write("changed.jpg", Changed);
+      for (const Filesystem::VerifyMode Mode : {Filesystem::VERIFY_BUFFERED, Filesystem::VERIFY_MAPPED, Filesystem::VERIFY_UNCACHED})
+      {
+         uint64_t MismatchOffset = 0;
+         CHECK_TRUE(Filesystem::Verify(Source, ChangedCopy, Mode, MismatchOffset) != Filesystem::NO_ERROR);
+         CHECK_EQUAL(CHANGED_OFFSET, MismatchOffset);
+         CHECK_TRUE(Filesystem::VerifyDigest(ChangedCopy, Digest, Mode) != Filesystem::NO_ERROR);
+      }
+   }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+TEST(FilesystemTests, CopyFile)
+{
+   const fs::path Copy = Folder.Path / "copy.jpg";
+   Filesystem::CopyStrategy StrategyUsed = Filesystem::BUFFERED;
+   CHECK_EQUAL(Filesystem::NO_ERROR, Filesystem::CopyFile(Source, Copy, StrategyUsed));
+   CheckEveryVerifyMode(Copy);
+
+   // An empty file needs no strategy at all
+   const fs::path Empty = Folder.Write("empty.jpg", {});
+   CHECK_EQUAL(Filesystem::NO_ERROR, Filesystem::CopyFile(Empty, Folder.Path / "empty copy.jpg", StrategyUsed));
+   CHECK_EQUAL(Filesystem::REFLINK, StrategyUsed);
+   CHECK_EQUAL(0, fs::file_size(Folder.Path / "empty copy.jpg"));
+
+   CHECK_EQUAL(Filesystem::SOURCE_FILE_OPEN_ERR, Filesystem::CopyFile(Folder.Path / "missing.jpg", Copy));
+   CHECK_EQUAL(Filesystem::DEST_FILE_OPEN_ERR, Filesystem::CopyFile(Source, Folder.Path / "missing" / "copy.jpg"));
+}
+
+TEST(FilesystemTests, Reflink)
+{
+   // Most filesystems can not clone, and say so rather than failing
+   const fs::path Copy = Folder.Path / "clone.jpg";
+   const int Result = CopyWith(Copy, [](const int SourceFd, const int DestFd, uint64_t &, Filesystem::CopyStreams &)
+   {
+      return Filesystem::TryReflink(SourceFd, DestFd);
+   });
+   CHECK_TRUE((Result == Filesystem::NO_ERROR) || (Result == Filesystem::STRATEGY_UNSUPPORTED));
+   if (Result == Filesystem::NO_ERROR)
+   {
+      CheckEveryVerifyMode(Copy);
+   }
+}
+
+TEST(FilesystemTests, CopyFileRange)
+{
+   const fs::path Copy = Folder.Path / "copy.jpg";
+   CHECK_EQUAL(Filesystem::NO_ERROR, CopyWith(Copy, [](const int SourceFd, const int DestFd, uint64_t &Copied, Filesystem::CopyStreams &Streams)
+   {
+      return Filesystem::CopyWithCopyFileRange(SourceFd, DestFd, FILE_SIZE, Copied, Streams);
+   }));
+   CheckEveryVerifyMode(Copy);
+}
+
+TEST(FilesystemTests, Sendfile)
+{
+   const fs::path Copy = Folder.Path / "copy.jpg";
+   CHECK_EQUAL(Filesystem::NO_ERROR, CopyWith(Copy, [](const int SourceFd, const int DestFd, uint64_t &Copied, Filesystem::CopyStreams &Streams)
+   {
+      return Filesystem::CopyWithSendfile(SourceFd, DestFd, FILE_SIZE, Copied, Streams);
+   }));
+   CheckEveryVerifyMode(Copy);
+}
+
+TEST(FilesystemTests, Buffered)
+{
+   const fs::path Copy = Folder.Path / "copy.jpg";
+   CHECK_EQUAL(Filesystem::NO_ERROR, CopyWith(Copy, [](const int SourceFd, const int DestFd, uint64_t &Copied, Filesystem::CopyStreams &Streams)
+   {
+      return Filesystem::CopyBuffered(SourceFd, DestFd, FILE_SIZE, Copied, Streams);
+   }));
+   CheckEveryVerifyMode(Copy);
+}
+
+TEST(FilesystemTests, CopyFileWithDigest)
+{
+   const fs::path Copy = Folder.Path / "copy.jpg";
+   uint64_t Digest = 0;
+   CHECK_EQUAL(Filesystem::NO_ERROR, Filesystem::CopyFileWithDigest(Source, Copy, Digest));
+   CHECK_EQUAL(XxHash64::Hash(Contents.data(), Contents.size()), Digest);
+
+   uint64_t ComputedDigest = 0;
+   CHECK_EQUAL(Filesystem::NO_ERROR, Filesystem::ComputeDigest(Source, ComputedDigest));
+   CHECK_EQUAL(Digest, ComputedDigest);
+   CheckEveryVerifyMode(Copy);
+}
+
+TEST(FilesystemTests, SizesThatDiffer)
+{
+   std::vector<uint8_t> Shorter(Contents.begin(), Contents.end() - 1);
+   const fs::path ShortCopy = Folder.Write("short.jpg", Shorter);
+   uint64_t MismatchOffset = 0;
+   CHECK_TRUE(Filesystem::Verify(Source, ShortCopy, Filesystem::VERIFY_BUFFERED, MismatchOffset) != Filesystem::NO_ERROR);
+   CHECK_EQUAL(FILE_SIZE - 1, MismatchOffset);
+}
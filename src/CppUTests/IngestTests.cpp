@@ -0,0 +1,49 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <errno.h>
+
+#define private public
+#define protected public
+
+#include "../Ingest.hpp"
+#include "TestFolder.hpp"
+
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(IngestTests)
+{
+   TestFolder Folder;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+TEST(IngestTests, RenameNoReplace)
+{
+   const std::vector<uint8_t> Photo = TestContents(100, 4);
+   const std::vector<uint8_t> LibraryPhoto = TestContents(200, 5);
+   const fs::path From = Folder.Write(".photo.jpg.1.0.partial", Photo);
+   const fs::path To = Folder.Write("photo.jpg", LibraryPhoto);
+
+   // The photo already in the library is never overwritten
+   CHECK_EQUAL(EEXIST, Ingest::RenameNoReplace(From, To));
+   CHECK_TRUE(TestFolder::Read(To) == LibraryPhoto);
+   CHECK_TRUE(TestFolder::Read(From) == Photo);
+
+   const fs::path NewName = Folder.Path / "new.jpg";
+   CHECK_EQUAL(0, Ingest::RenameNoReplace(From, NewName));
+   CHECK_TRUE(TestFolder::Read(NewName) == Photo);
+   CHECK_FALSE(fs::exists(From));
+
+   CHECK_EQUAL(ENOENT, Ingest::RenameNoReplace(From, Folder.Path / "other.jpg"));
+}
@@ -0,0 +1,115 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../Manifest.hpp"
+#include "TestFolder.hpp"
+
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(ManifestTests)
+{
+   TestFolder Folder;
+   fs::path   ManifestFile;
+
+   void setup()
+   {
+      ManifestFile = Folder.Path / Manifest::DEFAULT_FILE_NAME;
+   }
+
+   /**
+    * @brief Counts the photos recorded in a manifest
+    */
+   size_t EntryCount(Manifest &History)
+   {
+      size_t Count = 0;
+      History.ForEachEntry([&Count](const std::string &, const Manifest::Entry &) {++Count;});
+      return Count;
+   }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+TEST(ManifestTests, RecordsSurviveReopening)
+{
+   {
+      Manifest History;
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Open(ManifestFile));
+      CHECK_TRUE(History.IsNew());
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Record("/photos/a.jpg", {Manifest::ENTRY_COPYING, 100, 5, 0, "/library/.a.jpg.1.0.partial"}));
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Record("/photos/tab\there.jpg", {Manifest::ENTRY_VERIFIED, 200, -7, 0xFEDCBA9876543210ULL, "/library/tab\there.jpg"}));
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Record("/photos/undated.jpg", {Manifest::ENTRY_NO_DATE, 300, 9, 0, ""}));
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Record("/photos/b.jpg", {Manifest::ENTRY_COPYING, 400, 11, 0, "/library/.b.jpg.1.1.partial"}));
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Record("/photos/b.jpg", {Manifest::ENTRY_VERIFIED, 400, 11, 0x1234, "/library/b.jpg"}));
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Close());
+   }
+
+   Manifest History;
+   CHECK_EQUAL(Manifest::NO_ERROR, History.Open(ManifestFile));
+   CHECK_FALSE(History.IsNew());
+   CHECK_EQUAL(4, EntryCount(History));
+
+   // The last record of a photo replaces the ones before it
+   CHECK_TRUE(History.IsUnchanged("/photos/b.jpg", 400, 11, false));
+   CHECK_TRUE(History.IsUnchanged("/photos/tab\there.jpg", 200, -7, false));
+   CHECK_FALSE(History.IsUnchanged("/photos/tab\there.jpg", 201, -7, false));
+   CHECK_FALSE(History.IsUnchanged("/photos/tab\there.jpg", 200, 8, false));
+   CHECK_FALSE(History.IsUnchanged("/photos/a.jpg", 100, 5, true));
+   CHECK_FALSE(History.IsUnchanged("/photos/undated.jpg", 300, 9, false));
+   CHECK_TRUE(History.IsUnchanged("/photos/undated.jpg", 300, 9, true));
+
+   const std::vector<fs::path> Incomplete = History.IncompleteCopies();
+   CHECK_EQUAL(1, Incomplete.size());
+   CHECK_TRUE(Incomplete.front() == "/library/.a.jpg.1.0.partial");
+
+   History.ForEachEntry([](const std::string &Source, const Manifest::Entry &Entry)
+   {
+      if (Source == "/photos/tab\there.jpg")
+      {
+         CHECK_EQUAL(0xFEDCBA9876543210ULL, Entry.Digest);
+         STRCMP_EQUAL("/library/tab\there.jpg", Entry.Destination.c_str());
+      }
+   });
+}
+
+TEST(ManifestTests, TruncatedLastLineIsIgnored)
+{
+   {
+      Manifest History;
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Open(ManifestFile));
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Record("/photos/a.jpg", {Manifest::ENTRY_VERIFIED, 100, 5, 0xAB, "/library/a.jpg"}));
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Record("/photos/b.jpg", {Manifest::ENTRY_VERIFIED, 200, 6, 0xCD, "/library/b.jpg"}));
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Close());
+   }
+
+   // A record cut short by a crash, without its line ending
+   {
+      std::ofstream Out(ManifestFile, std::ios::app);
+      Out << "V\t300\t7\t00000000000000ef\t/photos/c.jpg";
+   }
+
+   {
+      Manifest History;
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Open(ManifestFile));
+      CHECK_EQUAL(2, EntryCount(History));
+      CHECK_TRUE(History.IsUnchanged("/photos/b.jpg", 200, 6, false));
+      CHECK_FALSE(History.IsUnchanged("/photos/c.jpg", 300, 7, false));
+
+      // Records appended after the cut line are not joined to it
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Record("/photos/d.jpg", {Manifest::ENTRY_VERIFIED, 400, 8, 0xEF, "/library/d.jpg"}));
+      CHECK_EQUAL(Manifest::NO_ERROR, History.Close());
+   }
+
+   Manifest History;
+   CHECK_EQUAL(Manifest::NO_ERROR, History.Open(ManifestFile));
+   CHECK_EQUAL(3, EntryCount(History));
+   CHECK_TRUE(History.IsUnchanged("/photos/a.jpg", 100, 5, false));
+   CHECK_TRUE(History.IsUnchanged("/photos/d.jpg", 400, 8, false));
+}
+
+TEST(ManifestTests, OtherFilesAreNotManifests)
+{
+   Folder.Write(Manifest::DEFAULT_FILE_NAME, {'J', 'P', 'E', 'G', '\n'});
+   Manifest History;
+   CHECK_EQUAL(Manifest::MANIFEST_READ_ERR, History.Open(ManifestFile));
+   CHECK_EQUAL(Manifest::MANIFEST_WRITE_ERR, History.Record("/photos/a.jpg", {Manifest::ENTRY_NO_DATE, 1, 1, 0, ""}));
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief A folder under /tmp that holds one test's files, removed with everything in it
+ *        when the test ends.
+ */
+struct TestFolder
+{
+   fs::path Path;
+
+   TestFolder()
+   {
+      std::string Name = "/tmp/PhotoProjectTestXXXXXX";
+      if (mkdtemp(&Name[0]) != nullptr)
+      {
+         Path = Name;
+      }
+   }
+
+   ~TestFolder()
+   {
+      std::error_code Error;
+      fs::remove_all(Path, Error);
+   }
+
+   TestFolder(const TestFolder &) = delete;
+   TestFolder &operator=(const TestFolder &) = delete;
+
+   /**
+    * @brief Writes a file in the folder, replacing any file of the same name.
+    *
+    * @return The file's path
+    */
+   const fs::path Write(const std::string &Name, const std::vector<uint8_t> &Contents) const
+   {
+      const fs::path File = Path / Name;
+      std::ofstream Out(File, std::ios::binary | std::ios::trunc);
+      Out.write(reinterpret_cast<const char *>(Contents.data()), static_cast<std::streamsize>(Contents.size()));
+      return File;
+   }
+
+   /**
+    * @brief Reads a whole file, or nothing if it can not be opened.
+    */
+   static const std::vector<uint8_t> Read(const fs::path &File)
+   {
+      std::ifstream In(File, std::ios::binary);
+      return std::vector<uint8_t>(std::istreambuf_iterator<char>(In), std::istreambuf_iterator<char>());
+   }
+};
+
+/**
+ * @brief Contents that differ from byte to byte and from one seed to the next
+ */
+inline const std::vector<uint8_t> TestContents(const size_t Length, const uint32_t Seed)
+{
+   std::vector<uint8_t> Contents(Length);
+   uint32_t State = Seed;
+   for (uint8_t &Byte : Contents)
+   {
+      State = (State * 1103515245) + 12345;
+      Byte = static_cast<uint8_t>(State >> 16);
+   }
+   return Contents;
+}
@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+#include "../XxHash64.hpp"
+
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(XxHash64Tests)
+{
+};
+
+TEST(XxHash64Tests, ReferenceDigests)
+{
+   CHECK_EQUAL(0xEF46DB3751D8E999ULL, XxHash64::Hash("", 0));
+   CHECK_EQUAL(0xD24EC4F1A98C6E5BULL, XxHash64::Hash("a", 1));
+   CHECK_EQUAL(0x44BC2CF5AD770999ULL, XxHash64::Hash("abc", 3));
+
+   XxHash64 Hash;
+   CHECK_EQUAL(0xEF46DB3751D8E999ULL, Hash.Digest());
+   Hash.Update("abc", 3);
+   CHECK_EQUAL(0x44BC2CF5AD770999ULL, Hash.Digest());
+   Hash.Reset();
+   Hash.Update("a", 1);
+   CHECK_EQUAL(0xD24EC4F1A98C6E5BULL, Hash.Digest());
+}
+
+TEST(XxHash64Tests, ReferenceDigestsOfSeveralStripes)
+{
+   // Bytes 0 to 99 fill three stripes and leave a tail of four bytes.
+   // The digests are those of the reference implementation.
+   std::vector<uint8_t> Data(100);
+   for (size_t Index = 0; Index < Data.size(); ++Index)
+   {
+      Data[Index] = static_cast<uint8_t>(Index);
+   }
+   CHECK_EQUAL(0xCBF59C5116FF32B4ULL, XxHash64::Hash(Data.data(), 32));
+   CHECK_EQUAL(0x6AC1E58032166597ULL, XxHash64::Hash(Data.data(), Data.size()));
+   CHECK_EQUAL(0x3B97D91EBA03E785ULL, XxHash64::Hash(Data.data(), Data.size(), 0x9E3779B97F4A7C15ULL));
+
+   XxHash64 Hash(0x9E3779B97F4A7C15ULL);
+   Hash.Update(Data.data(), 50);
+   Hash.Update(nullptr, 0);
+   Hash.Update(Data.data() + 50, 50);
+   CHECK_EQUAL(0x3B97D91EBA03E785ULL, Hash.Digest());
+}
+
+TEST(XxHash64Tests, ChunkedUpdatesMatchOneShot)
+{
+   // Long enough for several stripes, with a tail shorter than a stripe
+   std::vector<uint8_t> Data(1000);
+   for (size_t Index = 0; Index < Data.size(); ++Index)
+   {
+      Data[Index] = static_cast<uint8_t>((Index * 31) + 7);
+   }
+   const uint64_t Expected = XxHash64::Hash(Data.data(), Data.size());
+
+   for (const size_t ChunkLength : {1, 3, 31, 32, 33, 64, 999})
+   {
+      XxHash64 Hash;
+      for (size_t Offset = 0; Offset < Data.size(); Offset += ChunkLength)
+      {
+         Hash.Update(Data.data() + Offset, std::min(ChunkLength, Data.size() - Offset));
+      }
+      CHECK_EQUAL(Expected, Hash.Digest());
+   }
+
+   // Each length from empty up to more than a stripe, so every tail length is covered
+   for (size_t Length = 0; Length <= 40; ++Length)
+   {
+      XxHash64 Hash;
+      Hash.Update(Data.data(), Length / 2);
+      Hash.Update(Data.data() + (Length / 2), Length - (Length / 2));
+      CHECK_EQUAL(XxHash64::Hash(Data.data(), Length), Hash.Digest());
+   }
+}
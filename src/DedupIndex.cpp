@@ -0,0 +1,436 @@
+/**
+* @file DedupIndex.cpp
+* @brief Finds files in the destination library with the same contents as a new photo
+*/
+
+#include "DedupIndex.hpp"
+#include "Filesystem.hpp"
+#include <string.h>   // For memcpy
+#include <algorithm>  // For std::sort, std::lower_bound, std::find, std::find_if, std::any_of
+
+DedupIndex::DedupIndex() :
+    mSlots(INITIAL_SLOT_COUNT, HashedSlot{0, EMPTY_SLOT}),
+    mHashedCount(0),
+    mUnhashed(),
+    mUnhashedSorted(true),
+    mPaths(),
+    mSizeFilter(SIZE_FILTER_BITS / 64, 0),
+    mHashingSizes(),
+    mPending(),
+    mNextTicket(1),
+    mMutex(),
+    mChanged()
+{
+}
+
+/**
+ * @brief Spreads the bits of a size or digest so nearby values land in different slots.
+ *        The finalizer of MurmurHash3.
+ */
+const uint64_t DedupIndex::Mix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDULL;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+/**
+ * @brief Packs a file's size and path onto the end of mPaths.
+ *
+ * @return The offset of the file in mPaths
+ */
+const uint64_t DedupIndex::StorePath(const uint64_t size, const std::string &path)
+{
+    const uint64_t offset = mPaths.size();
+    mPaths.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    mPaths.append(path);
+    mPaths.push_back('\0');
+    return offset;
+}
+
+const uint64_t DedupIndex::StoredSize(const uint64_t path_offset) const
+{
+    uint64_t size = 0;
+    memcpy(&size, mPaths.data() + path_offset, sizeof(size));
+    return size;
+}
+
+const char *DedupIndex::StoredPath(const uint64_t path_offset) const
+{
+    return mPaths.data() + path_offset + sizeof(uint64_t);
+}
+
+void DedupIndex::MarkSize(const uint64_t size)
+{
+    const uint64_t bit = Mix(size) & (SIZE_FILTER_BITS - 1);
+    mSizeFilter[bit / 64] |= (1ULL << (bit % 64));
+}
+
+/**
+ * @brief Doubles the size of the hash table.
+ *
+ * @return None
+ */
+void DedupIndex::Grow()
+{
+    std::vector<HashedSlot> old_slots(mSlots.size() * 2, HashedSlot{0, EMPTY_SLOT});
+    old_slots.swap(mSlots);
+    mHashedCount = 0;
+    for (const HashedSlot &slot : old_slots)
+    {
+        if (slot.PathOffset != EMPTY_SLOT)
+        {
+            InsertHashed(slot.Digest, slot.PathOffset);
+        }
+    }
+}
+
+/**
+ * @brief Adds a file already packed into mPaths to the hash table, using linear probing.
+ *
+ * @return None
+ */
+void DedupIndex::InsertHashed(const uint64_t digest, const uint64_t path_offset)
+{
+    if (((mHashedCount + 1) * 100) > (mSlots.size() * MAX_LOAD_PERCENT))
+    {
+        Grow();
+    }
+
+    const size_t mask = mSlots.size() - 1;
+    for (size_t index = Mix(digest) & mask; ; index = (index + 1) & mask)
+    {
+        if (mSlots[index].PathOffset == EMPTY_SLOT)
+        {
+            mSlots[index] = {digest, path_offset};
+            ++mHashedCount;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Checks if a file with this size and digest is already in the hash table.
+ */
+const bool DedupIndex::ContainsHashed(const uint64_t size, const uint64_t digest) const
+{
+    const size_t mask = mSlots.size() - 1;
+    for (size_t index = Mix(digest) & mask; mSlots[index].PathOffset != EMPTY_SLOT; index = (index + 1) & mask)
+    {
+        const HashedSlot &slot = mSlots[index];
+        if ((slot.Digest == digest) && (StoredSize(slot.PathOffset) == size))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Adds a library file whose digest is known.
+ *        Ignored if a file with the same contents is already in the index.
+ *
+ * @param[in] size The file's size
+ * @param[in] digest The XXH64 digest of the file's contents
+ * @param[in] path Where the file is
+ *
+ * @return None
+ */
+void DedupIndex::AddHashed(const uint64_t size, const uint64_t digest, const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (ContainsHashed(size, digest))
+    {
+        return;
+    }
+    MarkSize(size);
+    InsertHashed(digest, StorePath(size, path));
+}
+
+/**
+ * @brief Adds a library file whose digest has not been computed yet.
+ *
+ * @param[in] size The file's size
+ * @param[in] path Where the file is
+ *
+ * @return None
+ */
+void DedupIndex::AddUnhashed(const uint64_t size, const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    MarkSize(size);
+    mUnhashed.push_back({size, StorePath(size, path)});
+    mUnhashedSorted = false;
+}
+
+/**
+ * @brief Checks if the library might hold a file of this size. False positives are
+ *        possible, but a false result means no file in the library can be a duplicate.
+ *
+ * @param[in] size The size of the new photo
+ *
+ * @return False if no library file has this size
+ */
+const bool DedupIndex::MayContainSize(const uint64_t size) const
+{
+    const uint64_t bit = Mix(size) & (SIZE_FILTER_BITS - 1);
+    std::lock_guard<std::mutex> lock(mMutex);
+    return (mSizeFilter[bit / 64] & (1ULL << (bit % 64))) != 0;
+}
+
+/**
+ * @brief Reserves a place in the index for a photo the run is about to copy, so photos
+ *        with the same contents found before it is committed are matched against it.
+ *        The reservation lasts until Commit or Release is called with its ticket.
+ *
+ * @param[in] size The size of the photo
+ * @param[in] source_file The photo
+ * @param[out] ticket Identifies the reservation
+ *
+ * @return False if no library file or other reserved photo has this size, so the
+ *         photo can not be a duplicate and does not need to be looked up
+ */
+const bool DedupIndex::Reserve(const uint64_t size, const std::string &source_file, uint64_t &ticket)
+{
+    const uint64_t bit = Mix(size) & (SIZE_FILTER_BITS - 1);
+    std::lock_guard<std::mutex> lock(mMutex);
+    const bool size_seen = (mSizeFilter[bit / 64] & (1ULL << (bit % 64))) != 0;
+    MarkSize(size);
+    ticket = mNextTicket++;
+    mPending.push_back({ticket, size, 0, false, source_file});
+    return size_seen;
+}
+
+const std::vector<DedupIndex::PendingCopy>::iterator DedupIndex::FindPending(const uint64_t ticket)
+{
+    return std::find_if(mPending.begin(), mPending.end(),
+                        [ticket](const PendingCopy &pending) {return pending.Ticket == ticket;});
+}
+
+/**
+ * @brief Sets the digest of a reserved photo once it has been read.
+ *
+ * @param[in] ticket The reservation
+ * @param[in] digest The XXH64 digest of the photo
+ *
+ * @return None
+ */
+void DedupIndex::SetReservedDigest(const uint64_t ticket, const uint64_t digest)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto pending = FindPending(ticket);
+        if (pending == mPending.end())
+        {
+            return;
+        }
+        pending->Digest = digest;
+        pending->Hashed = true;
+    }
+    mChanged.notify_all();
+}
+
+/**
+ * @brief Ends a reservation once its photo is in the library, adding the copy to the index.
+ *
+ * @param[in] ticket The reservation, whose digest must have been set
+ * @param[in] path Where the copy is
+ *
+ * @return None
+ */
+void DedupIndex::Commit(const uint64_t ticket, const std::string &path)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto pending = FindPending(ticket);
+        if (pending == mPending.end())
+        {
+            return;
+        }
+        if (pending->Hashed && !ContainsHashed(pending->Size, pending->Digest))
+        {
+            InsertHashed(pending->Digest, StorePath(pending->Size, path));
+        }
+        mPending.erase(pending);
+    }
+    mChanged.notify_all();
+}
+
+/**
+ * @brief Ends a reservation whose photo was not copied.
+ *
+ * @param[in] ticket The reservation
+ *
+ * @return None
+ */
+void DedupIndex::Release(const uint64_t ticket)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto pending = FindPending(ticket);
+        if (pending == mPending.end())
+        {
+            return;
+        }
+        mPending.erase(pending);
+    }
+    mChanged.notify_all();
+}
+
+/**
+ * @brief Looks for a library file with the same contents as a new photo.
+ *        Library files of the same size that were never hashed are hashed now,
+ *        without holding the index's lock. Other lookups of that size wait until
+ *        they are hashed, so none of them misses a duplicate among those files.
+ *        A library file whose digest matches is compared with the photo byte for
+ *        byte before it is returned, so two different photos whose digests collide
+ *        are never taken for duplicates.
+ *
+ *        Photos reserved before this one are looked at too. The lookup waits for the
+ *        digest of each one of the same size, and for one with the same contents to
+ *        be committed, then returns its copy. If it fails instead, the lookup carries on
+ *        without it. Only earlier reservations are waited for, so two lookups never
+ *        wait for each other.
+ *
+ * @param[in] source_file The new photo
+ * @param[in] size The size of the new photo
+ * @param[in] digest The XXH64 digest of the new photo
+ * @param[in] ticket The new photo's reservation. Its digest must have been set.
+ * @param[out] newly_hashed Library files hashed by this call, so their digests can be saved
+ *
+ * @return The path of a library file with the same contents, or an empty string if there is none
+ */
+const std::string DedupIndex::Find(const fs::path &source_file, const uint64_t size, const uint64_t digest,
+                                   const uint64_t ticket, std::vector<HashedFile> &newly_hashed)
+{
+    // Only read for digests that match, which is rarely the case for photos that are not duplicates
+    const auto same_contents = [&source_file](const std::string &other_file)
+    {
+        uint64_t mismatch_offset = 0;
+        return Filesystem::Verify(source_file, other_file, Filesystem::VERIFY_BUFFERED, mismatch_offset) == 0;
+    };
+
+    for (;;)
+    {
+        std::vector<std::string> candidates;
+        std::vector<std::string> unhashed;
+        std::vector<PendingCopy> in_flight;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            // Library files of this size that another lookup is hashing could be the duplicate,
+            // and so could earlier reserved photos of this size that are still being read
+            mChanged.wait(lock, [this, size, ticket]()
+            {
+                const bool earlier_unhashed = std::any_of(mPending.begin(), mPending.end(),
+                    [size, ticket](const PendingCopy &pending)
+                    {
+                        return (pending.Ticket < ticket) && (pending.Size == size) && !pending.Hashed;
+                    });
+                return !earlier_unhashed &&
+                       (std::find(mHashingSizes.begin(), mHashingSizes.end(), size) == mHashingSizes.end());
+            });
+
+            const size_t mask = mSlots.size() - 1;
+            for (size_t index = Mix(digest) & mask; mSlots[index].PathOffset != EMPTY_SLOT; index = (index + 1) & mask)
+            {
+                const HashedSlot &slot = mSlots[index];
+                if ((slot.Digest == digest) && (StoredSize(slot.PathOffset) == size))
+                {
+                    candidates.push_back(StoredPath(slot.PathOffset));
+                }
+            }
+
+            for (const PendingCopy &pending : mPending)
+            {
+                if ((pending.Ticket < ticket) && (pending.Size == size) && (pending.Digest == digest))
+                {
+                    in_flight.push_back(pending);
+                }
+            }
+
+            // Each unhashed file is taken out of the list by the first lookup that needs it
+            if (!mUnhashedSorted)
+            {
+                std::sort(mUnhashed.begin(), mUnhashed.end(),
+                          [](const UnhashedFile &lhs, const UnhashedFile &rhs) {return lhs.Size < rhs.Size;});
+                mUnhashedSorted = true;
+            }
+            auto file = std::lower_bound(mUnhashed.begin(), mUnhashed.end(), size,
+                                         [](const UnhashedFile &lhs, const uint64_t rhs) {return lhs.Size < rhs;});
+            for (; (file != mUnhashed.end()) && (file->Size == size); ++file)
+            {
+                if (file->PathOffset != TAKEN)
+                {
+                    unhashed.push_back(StoredPath(file->PathOffset));
+                    file->PathOffset = TAKEN;
+                }
+            }
+            if (!unhashed.empty())
+            {
+                mHashingSizes.push_back(size);
+            }
+        }
+
+        if (!unhashed.empty())
+        {
+            for (const std::string &library_file : unhashed)
+            {
+                uint64_t library_digest = 0;
+                if (Filesystem::ComputeDigest(library_file, library_digest) != 0)
+                {
+                    continue;
+                }
+                AddHashed(size, library_digest, library_file);
+                newly_hashed.push_back({library_file, size, library_digest});
+                if (library_digest == digest)
+                {
+                    candidates.push_back(library_file);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mHashingSizes.erase(std::find(mHashingSizes.begin(), mHashingSizes.end(), size));
+            }
+            mChanged.notify_all();
+        }
+
+        for (const std::string &candidate : candidates)
+        {
+            if (same_contents(candidate))
+            {
+                return candidate;
+            }
+        }
+
+        // A photo with the same contents is still in flight. Once it is committed its copy
+        // is in the table, and the table is searched again.
+        const auto same_pending = std::find_if(in_flight.begin(), in_flight.end(),
+            [&same_contents](const PendingCopy &pending) {return same_contents(pending.SourceFile);});
+        if (same_pending == in_flight.end())
+        {
+            return std::string();
+        }
+        std::unique_lock<std::mutex> lock(mMutex);
+        const uint64_t pending_ticket = same_pending->Ticket;
+        mChanged.wait(lock, [this, pending_ticket]() {return FindPending(pending_ticket) == mPending.end();});
+    }
+}
+
+/**
+ * @return The number of library files in the index, hashed or not
+ */
+const size_t DedupIndex::FileCount()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    size_t unhashed_count = 0;
+    for (const UnhashedFile &file : mUnhashed)
+    {
+        unhashed_count += (file.PathOffset != TAKEN) ? 1 : 0;
+    }
+    return mHashedCount + unhashed_count;
+}
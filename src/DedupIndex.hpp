@@ -0,0 +1,126 @@
+/**
+* @file DedupIndex.hpp
+* @brief Finds files in the destination library with the same contents as a new photo
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Index of the files in the destination library, keyed by size and XXH64 digest.
+ *
+ *        Files whose digest is already known, such as those recorded in the manifest,
+ *        go straight into a hash table. Files only known by their size are hashed the
+ *        first time a new photo of the same size is looked up, so a library that was
+ *        never hashed costs nothing until a possible duplicate turns up.
+ *
+ *        Photos being copied by the run are reserved in the index as soon as they are
+ *        read, so a second copy of a photo found while the first is still in flight is
+ *        matched against it once it is committed, rather than copied again.
+ *
+ *        Built to hold millions of files. Paths are packed end to end in one block,
+ *        each table slot is 16 bytes, and a 1 MiB bit filter of sizes answers most
+ *        lookups without touching the table.
+ *
+ *        Every member can be called from any thread.
+ */
+class DedupIndex
+{
+public:
+
+    /**
+     * @brief A library file whose digest was computed by Find
+     */
+    struct HashedFile
+    {
+        std::string Path;
+        uint64_t    Size;
+        uint64_t    Digest;
+    };
+
+    DedupIndex();
+
+    DedupIndex(const DedupIndex &) = delete;
+    DedupIndex &operator=(const DedupIndex &) = delete;
+
+    void AddHashed(const uint64_t size, const uint64_t digest, const std::string &path);
+    void AddUnhashed(const uint64_t size, const std::string &path);
+    const bool MayContainSize(const uint64_t size) const;
+    const bool Reserve(const uint64_t size, const std::string &source_file, uint64_t &ticket);
+    void SetReservedDigest(const uint64_t ticket, const uint64_t digest);
+    void Commit(const uint64_t ticket, const std::string &path);
+    void Release(const uint64_t ticket);
+    const std::string Find(const fs::path &source_file, const uint64_t size, const uint64_t digest,
+                           const uint64_t ticket, std::vector<HashedFile> &newly_hashed);
+    const size_t FileCount();
+
+private:
+
+    /**
+     * @brief A file in the hash table. Its size and path are kept in mPaths at PathOffset.
+     */
+    struct HashedSlot
+    {
+        uint64_t Digest;
+        uint64_t PathOffset;
+    };
+
+    /**
+     * @brief A file whose digest has not been computed yet
+     */
+    struct UnhashedFile
+    {
+        uint64_t Size;
+        uint64_t PathOffset;
+    };
+
+    /**
+     * @brief A photo the run is copying into the library, reserved until it is committed or fails
+     */
+    struct PendingCopy
+    {
+        uint64_t    Ticket;
+        uint64_t    Size;
+        uint64_t    Digest;
+        bool        Hashed;     ///< Digest is known
+        std::string SourceFile;
+    };
+
+    static constexpr uint64_t EMPTY_SLOT = ~0ULL; ///< PathOffset of a slot that holds no file
+    static constexpr uint64_t TAKEN      = ~0ULL; ///< PathOffset of an unhashed file that a lookup took to hash
+
+    static constexpr size_t INITIAL_SLOT_COUNT = 1024; ///< Must be a power of two
+    static constexpr size_t MAX_LOAD_PERCENT   = 70;
+    static constexpr size_t SIZE_FILTER_BITS   = 1 << 23;
+
+    std::vector<HashedSlot>   mSlots;
+    size_t                    mHashedCount;
+    std::vector<UnhashedFile> mUnhashed;  ///< Sorted by size once a lookup needs it
+    bool                      mUnhashedSorted;
+    std::string               mPaths;     ///< Each file's size, then its path, then a terminating zero
+    std::vector<uint64_t>     mSizeFilter;
+    std::vector<uint64_t>     mHashingSizes; ///< Sizes whose taken files a lookup is still hashing
+    std::vector<PendingCopy>  mPending;      ///< In the order they were reserved
+    uint64_t                  mNextTicket;
+    mutable std::mutex        mMutex;
+    std::condition_variable   mChanged;      ///< Signalled when a size is hashed or a reservation ends
+
+    static const uint64_t Mix(uint64_t value);
+    const uint64_t StorePath(const uint64_t size, const std::string &path);
+    const uint64_t StoredSize(const uint64_t path_offset) const;
+    const char    *StoredPath(const uint64_t path_offset) const;
+    void           MarkSize(const uint64_t size);
+    void           InsertHashed(const uint64_t digest, const uint64_t path_offset);
+    void           Grow();
+    const bool     ContainsHashed(const uint64_t size, const uint64_t digest) const;
+    const std::vector<PendingCopy>::iterator FindPending(const uint64_t ticket);
+};
@@ -0,0 +1,230 @@
+/**
+* @file DirectoryWalker.cpp
+* @brief Lists every file under a folder, with several threads listing folders at once
+*/
+
+#include "DirectoryWalker.hpp"
+#include <dirent.h>      // For DT_DIR, DT_REG, DT_LNK, DT_UNKNOWN
+#include <errno.h>       // For errno
+#include <fcntl.h>       // For open
+#include <stdint.h>
+#include <unistd.h>      // For close, syscall
+#include <sys/stat.h>    // For fstatat
+#include <sys/syscall.h> // For SYS_getdents64
+#include <chrono>        // For std::chrono::microseconds
+#include <cstddef>       // For offsetof
+#include <thread>        // For std::thread, std::this_thread
+
+/**
+ * @brief The record getdents64 returns for each entry. glibc before 2.30 does not wrap
+ *        getdents64, so the call is made directly and the record is declared here.
+ */
+struct LinuxDirent64
+{
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[1]; ///< The entry's name, ending in a zero byte
+};
+
+static long GetDents64(const int directory_fd, char *buffer, const size_t length)
+{
+    return syscall(SYS_getdents64, directory_fd, buffer, length);
+}
+
+/**
+ * @param[in] thread_count Threads that list folders, including the thread that calls Walk
+ */
+DirectoryWalker::DirectoryWalker(const size_t thread_count) :
+    mThreadCount((thread_count > 0) ? thread_count : 1),
+    mQueues(),
+    mPending(0),
+    mDirectoryCount(0)
+{
+    for (size_t index = 0; index < mThreadCount; ++index)
+    {
+        mQueues.emplace_back(new WorkQueue());
+    }
+}
+
+/**
+ * @brief Lists every file under a folder and its subfolders. Returns once every folder is listed.
+ *
+ * @param[in] root The folder to walk
+ * @param[in] on_file Called for each regular file, and each symbolic link to one, from any walk thread
+ * @param[in] on_error Called for each folder that could not be listed, from any walk thread
+ *
+ * @return The number of folders listed
+ */
+const size_t DirectoryWalker::Walk(const std::string &root, const FileVisitor &on_file, const ErrorVisitor &on_error)
+{
+    mDirectoryCount = 0;
+    mPending = 1;
+    mQueues[0]->Directories.push_back((root.size() > 1) && (root.back() == '/') ? root.substr(0, root.size() - 1) : root);
+
+    std::vector<std::thread> threads;
+    for (size_t index = 1; index < mThreadCount; ++index)
+    {
+        threads.emplace_back(&DirectoryWalker::WalkThread, this, index, std::cref(on_file), std::cref(on_error));
+    }
+    WalkThread(0, on_file, on_error);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    return mDirectoryCount;
+}
+
+/**
+ * @brief Lists folders until every folder in the tree has been listed.
+ *
+ * @param[in] index The thread's queue
+ * @param[in] on_file Called for each file
+ * @param[in] on_error Called for each folder that could not be listed
+ *
+ * @return None
+ */
+void DirectoryWalker::WalkThread(const size_t index, const FileVisitor &on_file, const ErrorVisitor &on_error)
+{
+    std::vector<char> buffer(LISTING_BUFFER_SIZE);
+    std::string directory;
+    unsigned int idle_count = 0;
+    while (mPending.load(std::memory_order_acquire) > 0)
+    {
+        if (!TakeDirectory(index, directory))
+        {
+            // Another thread is still listing a folder, and may yet queue subfolders
+            if (++idle_count < IDLE_YIELD_LIMIT)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(IDLE_SLEEP_US));
+            }
+            continue;
+        }
+
+        idle_count = 0;
+        ListDirectory(index, directory, buffer, on_file, on_error);
+        mPending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+/**
+ * @brief Takes the newest folder from the thread's own queue, or else the oldest folder from
+ *        another thread's queue. The oldest folders are nearest the root, so a stolen folder
+ *        is likely to hold a large part of the tree.
+ *
+ * @param[in] index The thread's queue
+ * @param[out] directory The folder to list
+ *
+ * @return True if a folder was taken
+ */
+const bool DirectoryWalker::TakeDirectory(const size_t index, std::string &directory)
+{
+    {
+        WorkQueue &own = *mQueues[index];
+        std::lock_guard<std::mutex> lock(own.Mutex);
+        if (!own.Directories.empty())
+        {
+            directory = std::move(own.Directories.back());
+            own.Directories.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t offset = 1; offset < mThreadCount; ++offset)
+    {
+        WorkQueue &victim = *mQueues[(index + offset) % mThreadCount];
+        std::lock_guard<std::mutex> lock(victim.Mutex);
+        if (!victim.Directories.empty())
+        {
+            directory = std::move(victim.Directories.front());
+            victim.Directories.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Lists one folder. Files are passed to on_file and subfolders are queued on the thread's own queue.
+ *
+ * @param[in] index The thread's queue
+ * @param[in] directory The folder
+ * @param[in,out] buffer Holds the entries read from the folder
+ * @param[in] on_file Called for each file
+ * @param[in] on_error Called if the folder could not be listed
+ *
+ * @return None
+ */
+void DirectoryWalker::ListDirectory(const size_t index, const std::string &directory, std::vector<char> &buffer,
+                                    const FileVisitor &on_file, const ErrorVisitor &on_error)
+{
+    const int directory_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory_fd < 0)
+    {
+        on_error(directory, errno);
+        return;
+    }
+    ++mDirectoryCount;
+
+    WorkQueue &own = *mQueues[index];
+    for (;;)
+    {
+        const long length = GetDents64(directory_fd, buffer.data(), buffer.size());
+        if ((length < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        if (length < 0)
+        {
+            on_error(directory, errno);
+            break;
+        }
+        if (length == 0)
+        {
+            break;
+        }
+
+        for (long offset = 0; offset < length; )
+        {
+            const char *record_start = buffer.data() + offset;
+            const LinuxDirent64 *record = reinterpret_cast<const LinuxDirent64 *>(record_start);
+            const char *name = record_start + offsetof(LinuxDirent64, d_name);
+            offset += record->d_reclen;
+            if ((name[0] == '.') && ((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0'))))
+            {
+                continue;
+            }
+
+            unsigned char type = record->d_type;
+            if ((type == DT_UNKNOWN) || (type == DT_LNK))
+            {
+                // Links are followed to files, but never to folders, so a link can not make the walk loop
+                struct stat entry_info = {};
+                const int flags = (type == DT_LNK) ? 0 : AT_SYMLINK_NOFOLLOW;
+                if (fstatat(directory_fd, name, &entry_info, flags) != 0)
+                {
+                    continue;
+                }
+                type = S_ISREG(entry_info.st_mode) ? DT_REG :
+                       ((S_ISDIR(entry_info.st_mode) && (record->d_type == DT_UNKNOWN)) ? DT_DIR : DT_UNKNOWN);
+            }
+
+            if (type == DT_REG)
+            {
+                on_file({directory_fd, directory, name});
+            }
+            else if (type == DT_DIR)
+            {
+                mPending.fetch_add(1, std::memory_order_acq_rel);
+                std::lock_guard<std::mutex> lock(own.Mutex);
+                own.Directories.push_back(directory + '/' + name);
+            }
+        }
+    }
+    close(directory_fd);
+}
@@ -0,0 +1,80 @@
+/**
+* @file DirectoryWalker.hpp
+* @brief Lists every file under a folder, with several threads listing folders at once
+*/
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+/**
+ * @brief Walks a folder tree with a pool of threads. Each thread lists folders from its own
+ *        queue, newest first, and takes the oldest folder from another thread's queue once its
+ *        own is empty, so a wide or deep tree keeps every thread busy.
+ *
+ *        Folders are read with getdents64 into a large buffer, so a folder of thousands of
+ *        entries on a network filesystem takes a few requests. The type of each entry comes
+ *        from the listing itself. Only entries whose filesystem does not report a type, and
+ *        symbolic links, are looked up with fstatat. Symbolic links to folders are not followed.
+ *
+ *        Files are passed to the visitor as soon as they are listed, from whichever thread
+ *        listed them, so the visitor must be safe to call from several threads at once.
+ */
+class DirectoryWalker
+{
+public:
+
+    /**
+     * @brief A file found by the walk. Only valid while the visitor runs.
+     */
+    struct Entry
+    {
+        int                DirectoryFd; ///< The open folder holding the file, for fstatat and openat
+        const std::string &Directory;   ///< The folder's path, without a trailing slash
+        const char        *Name;
+
+        const std::string Path() const {return Directory + '/' + Name;}
+    };
+
+    using FileVisitor  = std::function<void(const Entry &file)>;
+    using ErrorVisitor = std::function<void(const std::string &directory, const int error)>;
+
+    explicit DirectoryWalker(const size_t thread_count);
+
+    DirectoryWalker(const DirectoryWalker &) = delete;
+    DirectoryWalker &operator=(const DirectoryWalker &) = delete;
+
+    const size_t Walk(const std::string &root, const FileVisitor &on_file, const ErrorVisitor &on_error);
+
+private:
+
+    static constexpr size_t LISTING_BUFFER_SIZE = 262144; ///< Bytes of entries read from a folder at a time
+    static constexpr unsigned int IDLE_YIELD_LIMIT = 64;  ///< Times an idle thread yields before it sleeps
+    static constexpr unsigned int IDLE_SLEEP_US    = 200;
+
+    /**
+     * @brief Folders waiting to be listed by one thread, or stolen by another
+     */
+    struct WorkQueue
+    {
+        std::mutex              Mutex;
+        std::deque<std::string> Directories;
+    };
+
+    const size_t mThreadCount;
+    std::vector<std::unique_ptr<WorkQueue>> mQueues;
+    std::atomic<size_t> mPending;        ///< Folders queued or being listed. The walk ends when it reaches zero.
+    std::atomic<size_t> mDirectoryCount; ///< Folders listed by the current walk
+
+    void WalkThread(const size_t index, const FileVisitor &on_file, const ErrorVisitor &on_error);
+    const bool TakeDirectory(const size_t index, std::string &directory);
+    void ListDirectory(const size_t index, const std::string &directory, std::vector<char> &buffer,
+                       const FileVisitor &on_file, const ErrorVisitor &on_error);
+};
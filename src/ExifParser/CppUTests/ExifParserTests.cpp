@@ -1,3 +1,11 @@
+#include <new>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 #define private public
 #define protected public
 
@@ -26,9 +34,9 @@ TEST(ExifTests, ReadTwoBytes_LittleEndian)
    cApp0 TestApp;
    TestApp.mLittleEndian = true;
    std::vector<uint8_t> TestVector{0x8D, 0x00};
-   CHECK_EQUAL(0x8D, TestApp.ReadTwoBytes(TestVector.begin()));
+   CHECK_EQUAL(0x8D, TestApp.ReadTwoBytes(TestVector, 0));
    TestVector.at(1) = 0x9A;
-   CHECK_EQUAL(0x9A8D, TestApp.ReadTwoBytes(TestVector.begin()));
+   CHECK_EQUAL(0x9A8D, TestApp.ReadTwoBytes(TestVector, 0));
 }
 
 TEST(ExifTests, ReadTwoBytes_BigEndian)
@@ -36,9 +44,9 @@ TEST(ExifTests, ReadTwoBytes_BigEndian)
    cApp0 TestApp;
    TestApp.mLittleEndian = false;
    std::vector<uint8_t> TestVector{0x8D, 0x00};
-   CHECK_EQUAL(0x8D00, TestApp.ReadTwoBytes(TestVector.begin()));
+   CHECK_EQUAL(0x8D00, TestApp.ReadTwoBytes(TestVector, 0));
    TestVector.at(1) = 0x9A;
-   CHECK_EQUAL(0x8D9A, TestApp.ReadTwoBytes(TestVector.begin()));
+   CHECK_EQUAL(0x8D9A, TestApp.ReadTwoBytes(TestVector, 0));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -47,7 +55,7 @@ TEST(ExifTests, ReadFourBytes_LittleEndian)
    cApp0 TestApp;
    TestApp.mLittleEndian = true;
    std::vector<uint8_t> TestVector{0x8D, 0x9D, 0xAD, 0xBD};
-   CHECK_EQUAL(0xBDAD9D8D, TestApp.ReadFourBytes(TestVector.begin()));
+   CHECK_EQUAL(0xBDAD9D8D, TestApp.ReadFourBytes(TestVector, 0));
 }
 
 TEST(ExifTests, ReadFourBytes_BigEndian)
@@ -55,7 +63,7 @@ TEST(ExifTests, ReadFourBytes_BigEndian)
    cApp0 TestApp;
    TestApp.mLittleEndian = false;
    std::vector<uint8_t> TestVector{0x8D, 0x9D, 0xAD, 0xBD};
-   CHECK_EQUAL(0x8D9DADBD, TestApp.ReadFourBytes(TestVector.begin()));
+   CHECK_EQUAL(0x8D9DADBD, TestApp.ReadFourBytes(TestVector, 0));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -63,19 +71,19 @@ TEST(ExifTests, ReadFourBytes_BigEndian)
 TEST(ExifTests, StartOfImageFound)
 {
    std::vector<uint8_t> TestVector{0xFF, 0xD8, 0xFD, 0xD7};
-   CHECK_TRUE(pTestParser->DoesStartOfImageExist(TestVector.begin()));
+   CHECK_TRUE(pTestParser->DoesStartOfImageExist(TestVector));
 }
 
 TEST(ExifTests, StartOfImageNotFound)
 {
    std::vector<uint8_t> TestVector{0xFF, 0xD7, 0xFD, 0xD7};
-   CHECK_FALSE(pTestParser->DoesStartOfImageExist(TestVector.begin()));
+   CHECK_FALSE(pTestParser->DoesStartOfImageExist(TestVector));
 
    TestVector.at(0) = 0xF8;
-   CHECK_FALSE(pTestParser->DoesStartOfImageExist(TestVector.begin()));
+   CHECK_FALSE(pTestParser->DoesStartOfImageExist(TestVector));
 
    TestVector.at(1) = 0xD6;
-   CHECK_FALSE(pTestParser->DoesStartOfImageExist(TestVector.begin()));
+   CHECK_FALSE(pTestParser->DoesStartOfImageExist(TestVector));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -83,20 +91,16 @@ TEST(ExifTests, StartOfImageNotFound)
 TEST(ExifTests, DoesAppMarkerExist_AppMarkerFound)
 {
    std::vector<uint8_t> TestVector{0xFF, 0xD8, 0xFF, 0xE0};
-   std::vector<uint8_t>::iterator TestIter = TestVector.begin();
-   std::advance(TestIter, cExifParser::SOI_MARKER_LENGTH_BYTES);
-   CHECK_TRUE(pTestParser->App0.DoesAppMarkerExist(TestIter, cApp0::MARKER_NUMBER));
+   CHECK_TRUE(pTestParser->App0.DoesAppMarkerExist(TestVector, cExifParser::SOI_MARKER_LENGTH_BYTES, cApp0::MARKER_NUMBER));
 
    TestVector.at(3) = 0xE1;
-   CHECK_TRUE(pTestParser->App1.DoesAppMarkerExist(TestIter, cApp1::MARKER_NUMBER));
+   CHECK_TRUE(pTestParser->App1.DoesAppMarkerExist(TestVector, cExifParser::SOI_MARKER_LENGTH_BYTES, cApp1::MARKER_NUMBER));
 }
 
 TEST(ExifTests, DoesAppMarkerExist_AppMarkerNotFound)
 {
    std::vector<uint8_t> TestVector{0xFF, 0xD8, 0xFF, 0xE1};
-   std::vector<uint8_t>::iterator TestIter = TestVector.begin();
-   std::advance(TestIter, cExifParser::SOI_MARKER_LENGTH_BYTES);
-   CHECK_FALSE(pTestParser->App0.DoesAppMarkerExist(TestIter, cApp0::MARKER_NUMBER));
+   CHECK_FALSE(pTestParser->App0.DoesAppMarkerExist(TestVector, cExifParser::SOI_MARKER_LENGTH_BYTES, cApp0::MARKER_NUMBER));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -105,7 +109,7 @@ TEST(ExifTests, App0_ParseApp)
 {
    std::vector<uint8_t> TestVector{0x00, 0x10};
    cApp0 mApp0;
-   uint32_t BytesRead = mApp0.ParseApp(TestVector.begin());
+   uint32_t BytesRead = mApp0.ParseApp(TestVector);
    CHECK_EQUAL(0x10, BytesRead);
 }
 
@@ -115,7 +119,7 @@ TEST(ExifTests, App1_GetEndianess_LittleEndian)
 {
    std::vector<uint8_t> TestVector{0x49, 0x49};
    cApp1 TestApp;
-   CHECK_TRUE(TestApp.GetEndianess(TestVector.begin()));
+   CHECK_TRUE(TestApp.GetEndianess(TestVector, 0));
    CHECK_TRUE(TestApp.mLittleEndian);
 }
 
@@ -123,7 +127,7 @@ TEST(ExifTests, App1_GetEndianess_BigEndian)
 {
    std::vector<uint8_t> TestVector{0x4D, 0x4D};
    cApp1 TestApp;
-   CHECK_TRUE(TestApp.GetEndianess(TestVector.begin()));
+   CHECK_TRUE(TestApp.GetEndianess(TestVector, 0));
    CHECK_FALSE(TestApp.mLittleEndian);
 }
 
@@ -131,7 +135,7 @@ TEST(ExifTests, App1_GetEndianess_UnknownEndian)
 {
    std::vector<uint8_t> TestVector{0x4F, 0x4D};
    cApp1 TestApp;
-   CHECK_FALSE(TestApp.GetEndianess(TestVector.begin()));
+   CHECK_FALSE(TestApp.GetEndianess(TestVector, 0));
    CHECK_FALSE(TestApp.mLittleEndian);
 }
 
@@ -149,8 +153,7 @@ TEST(ExifTests, App1_VerifyExifHeader_ValidHeader)
    TestExifVector.push_back(0x0);
 
    cApp1 TestApp;
-   std::vector<uint8_t>::iterator TestAppIter = TestExifVector.begin();
-   CHECK_TRUE(TestApp.VerifyExifHeader(TestAppIter));
+   CHECK_TRUE(TestApp.VerifyExifHeader(TestExifVector, 0));
 }
 
 TEST(ExifTests, App1_VerifyExifHeader_ExifNotInHeader)
@@ -165,8 +168,7 @@ TEST(ExifTests, App1_VerifyExifHeader_ExifNotInHeader)
    TestExifVector.push_back(0x0);
 
    cApp1 TestApp;
-   std::vector<uint8_t>::iterator TestAppIter = TestExifVector.begin();
-   CHECK_FALSE(TestApp.VerifyExifHeader(TestAppIter));
+   CHECK_FALSE(TestApp.VerifyExifHeader(TestExifVector, 0));
 }
 
 TEST(ExifTests, App1_VerifyExifHeader_BlankBytesNotInHeader)
@@ -180,8 +182,7 @@ TEST(ExifTests, App1_VerifyExifHeader_BlankBytesNotInHeader)
    TestExifVector.push_back(0x0);
 
    cApp1 TestApp;
-   std::vector<uint8_t>::iterator TestAppIter = TestExifVector.begin();
-   CHECK_FALSE(TestApp.VerifyExifHeader(TestAppIter));
+   CHECK_FALSE(TestApp.VerifyExifHeader(TestExifVector, 0));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -197,8 +198,7 @@ TEST(ExifTests, App1_ParseDateTime_ExpectedResult)
    TestDateVector.push_back(0x0);
 
    cApp1 TestApp;
-   std::vector<uint8_t>::iterator TestAppIter = TestDateVector.begin();
-   TestApp.ParseDateTime(TestAppIter, TestDateVector.size());
+   TestApp.ParseDateTime(TestDateVector, 0, TestDateVector.size());
    CHECK_EQUAL(123, TestApp.mDateTime.tm_year); // Expecting 2023 - 1900
    CHECK_EQUAL(3, TestApp.mDateTime.tm_mon);
    CHECK_EQUAL(29, TestApp.mDateTime.tm_mday);
@@ -214,8 +214,7 @@ TEST(ExifTests, App1_ParseDateTime_CountLessThanExpected)
    }
 
    cApp1 TestApp;
-   std::vector<uint8_t>::iterator TestAppIter = TestDateVector.begin();
-   TestApp.ParseDateTime(TestAppIter, TestDateString.length());
+   TestApp.ParseDateTime(TestDateVector, 0, TestDateString.length());
    CHECK_EQUAL(0, TestApp.mDateTime.tm_year);
    CHECK_EQUAL(0, TestApp.mDateTime.tm_mon);
    CHECK_EQUAL(0, TestApp.mDateTime.tm_mday);
@@ -231,8 +230,7 @@ TEST(ExifTests, App1_ParseDateTime_CountGreaterThanExpected)
    }
 
    cApp1 TestApp;
-   std::vector<uint8_t>::iterator TestAppIter = TestDateVector.begin();
-   TestApp.ParseDateTime(TestAppIter, TestDateString.length());
+   TestApp.ParseDateTime(TestDateVector, 0, TestDateString.length());
    CHECK_EQUAL(0, TestApp.mDateTime.tm_year);
    CHECK_EQUAL(0, TestApp.mDateTime.tm_mon);
    CHECK_EQUAL(0, TestApp.mDateTime.tm_mday);
@@ -248,9 +246,692 @@ TEST(ExifTests, App1_ParseDateTime_FinalByteIsNotBlank)
    }
 
    cApp1 TestApp;
-   std::vector<uint8_t>::iterator TestAppIter = TestDateVector.begin();
-   TestApp.ParseDateTime(TestAppIter, TestDateString.length());
+   TestApp.ParseDateTime(TestDateVector, 0, TestDateString.length());
    CHECK_EQUAL(0, TestApp.mDateTime.tm_year);
    CHECK_EQUAL(0, TestApp.mDateTime.tm_mon);
    CHECK_EQUAL(0, TestApp.mDateTime.tm_mday);
-}
\ No newline at end of file
+}
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Builds an APP1 segment, including the marker, containing a little endian
+ *        TIFF header and a 0th IFD with a single DateTime entry.
+ */
+static std::vector<uint8_t> BuildExifApp1(const std::string &DateTime)
+{
+   std::vector<uint8_t> Tiff{0x49, 0x49, 0x2A, 0x00, 0x08, 0x00, 0x00, 0x00, // Little endian, 0th IFD at offset 8
+                             0x01, 0x00,                                     // One IFD entry
+                             0x32, 0x01, 0x02, 0x00,                         // DateTime, ASCII
+                             0x14, 0x00, 0x00, 0x00,                         // Count of 20
+                             0x1A, 0x00, 0x00, 0x00,                         // Value at offset 26
+                             0x00, 0x00, 0x00, 0x00};                        // No next IFD
+   for (char ch : DateTime)
+   {
+      Tiff.push_back(static_cast<uint8_t>(ch));
+   }
+   Tiff.push_back(0x0);
+
+   const uint16_t SegmentLength = static_cast<uint16_t>(2 + 6 + Tiff.size());
+   std::vector<uint8_t> App1{0xFF, 0xE1, static_cast<uint8_t>(SegmentLength >> 8), static_cast<uint8_t>(SegmentLength),
+                             'E', 'x', 'i', 'f', 0x00, 0x00};
+   App1.insert(App1.end(), Tiff.begin(), Tiff.end());
+   return App1;
+}
+
+static std::string ToStreamData(const std::vector<uint8_t> &Bytes)
+{
+   return std::string(Bytes.begin(), Bytes.end());
+}
+
+static const std::vector<uint8_t> TEST_SOI{0xFF, 0xD8};
+static const std::vector<uint8_t> TEST_APP0{0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01,
+                                            0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00};
+static const std::vector<uint8_t> TEST_SOS{0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00};
+
+TEST(ExifTests, ParseExifData_App0ThenApp1)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   Image.insert(Image.end(), TEST_APP0.begin(), TEST_APP0.end());
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+   Image.insert(Image.end(), TEST_SOS.begin(), TEST_SOS.end());
+
+   std::istringstream ImageStream(ToStreamData(Image));
+   pTestParser->ParseExifData(ImageStream);
+   CHECK_EQUAL(123, pTestParser->GetDateTime().tm_year);
+   CHECK_EQUAL(3, pTestParser->GetDateTime().tm_mon);
+   CHECK_EQUAL(29, pTestParser->GetDateTime().tm_mday);
+}
+
+TEST(ExifTests, ParseExifData_App1WithoutApp0)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildExifApp1("2021:06:05 08:00:00");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+   Image.insert(Image.end(), TEST_SOS.begin(), TEST_SOS.end());
+
+   std::istringstream ImageStream(ToStreamData(Image));
+   pTestParser->ParseExifData(ImageStream);
+   CHECK_EQUAL(121, pTestParser->GetDateTime().tm_year);
+   CHECK_EQUAL(5, pTestParser->GetDateTime().tm_mon);
+   CHECK_EQUAL(5, pTestParser->GetDateTime().tm_mday);
+}
+
+TEST(ExifTests, ParseExifData_SkipsXmpApp1)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> Xmp{0xFF, 0xE1, 0x00, 0x06, 'h', 't', 't', 'p'};
+   Image.insert(Image.end(), Xmp.begin(), Xmp.end());
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+
+   std::istringstream ImageStream(ToStreamData(Image));
+   pTestParser->ParseExifData(ImageStream);
+   CHECK_EQUAL(123, pTestParser->GetDateTime().tm_year);
+}
+
+TEST(ExifTests, ParseExifData_StopsAtStartOfScan)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   Image.insert(Image.end(), TEST_APP0.begin(), TEST_APP0.end());
+   Image.insert(Image.end(), TEST_SOS.begin(), TEST_SOS.begin() + 4);
+   const std::streamoff EndOfSosHeader = static_cast<std::streamoff>(Image.size());
+   Image.insert(Image.end(), TEST_SOS.begin() + 4, TEST_SOS.end());
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+
+   std::istringstream ImageStream(ToStreamData(Image));
+   pTestParser->ParseExifData(ImageStream);
+   CHECK_EQUAL(0, pTestParser->GetDateTime().tm_year);
+   CHECK_EQUAL(EndOfSosHeader, static_cast<std::streamoff>(ImageStream.tellg()));
+}
+
+TEST(ExifTests, ParseExifData_TruncatedApp1)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end() - 10);
+
+   std::istringstream ImageStream(ToStreamData(Image));
+   pTestParser->ParseExifData(ImageStream);
+   CHECK_EQUAL(0, pTestParser->GetDateTime().tm_year);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+TEST(ExifTests, ParseExifData_Span)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   Image.insert(Image.end(), TEST_APP0.begin(), TEST_APP0.end());
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+   Image.insert(Image.end(), TEST_SOS.begin(), TEST_SOS.end());
+
+   const ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size()));
+   CHECK_TRUE(Metadata.HasDateTime);
+   CHECK_EQUAL(123, Metadata.DateTime.tm_year);
+   CHECK_EQUAL(3, Metadata.DateTime.tm_mon);
+   CHECK_EQUAL(29, Metadata.DateTime.tm_mday);
+   CHECK_EQUAL(19, Metadata.DateTime.tm_hour);
+}
+
+TEST(ExifTests, ParseExifData_SpanEndsInsideApp1)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+
+   // Every length that cuts the APP1 segment short must be rejected without reading past the span
+   for (size_t Length = 0; Length < Image.size(); ++Length)
+   {
+      const ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), Length));
+      CHECK_FALSE(Metadata.HasDateTime);
+   }
+}
+
+TEST(ExifTests, ParseExifData_DateOutsideOfApp1)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   App1.at(30) = 0xF0; // Point the DateTime value past the end of APP1
+   Image.insert(Image.end(), App1.begin(), App1.end());
+
+   const ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size()));
+   CHECK_FALSE(Metadata.HasDateTime);
+}
+
+TEST(ExifTests, ParseExifData_ParserReused)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+   CHECK_TRUE(pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size())).HasDateTime);
+
+   // An image without EXIF data must not report the previous image's date
+   const ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(TEST_SOI.data(), TEST_SOI.size()));
+   CHECK_FALSE(Metadata.HasDateTime);
+   CHECK_EQUAL(0, pTestParser->GetDateTime().tm_year);
+}
+
+TEST(ExifTests, ParseExifData_Status)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   Image.insert(Image.end(), TEST_APP0.begin(), TEST_APP0.end());
+   const size_t App1Offset = Image.size() + 2; // After the APP1 marker
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+   Image.insert(Image.end(), TEST_SOS.begin(), TEST_SOS.end());
+
+   ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size()));
+   CHECK_EQUAL(EXIF_OK, Metadata.Status);
+   CHECK_EQUAL(App1Offset, Metadata.App1Offset);
+   CHECK_EQUAL(App1Offset - 2 + App1.size(), Metadata.BytesConsumed);
+   CHECK_EQUAL(cApp1::TagBit(cApp1::TAG_DATE_TIME), Metadata.FoundTags & cApp1::TagBit(cApp1::TAG_DATE_TIME));
+
+   std::istringstream ImageStream(ToStreamData(Image));
+   Metadata = pTestParser->ParseExifData(ImageStream);
+   CHECK_EQUAL(EXIF_OK, Metadata.Status);
+   CHECK_EQUAL(App1Offset, Metadata.App1Offset);
+   CHECK_EQUAL(App1Offset - 2 + App1.size(), Metadata.BytesConsumed);
+
+   Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), App1Offset + 10));
+   CHECK_EQUAL(EXIF_CUT_SHORT, Metadata.Status);
+   CHECK_EQUAL(App1Offset - 2, Metadata.BytesConsumed);
+
+   Metadata = pTestParser->ParseExifData(cByteSpan(TEST_APP0.data(), TEST_APP0.size()));
+   CHECK_EQUAL(EXIF_NOT_JPEG, Metadata.Status);
+
+   std::vector<uint8_t> NoExif = TEST_SOI;
+   NoExif.insert(NoExif.end(), TEST_SOS.begin(), TEST_SOS.end());
+   Metadata = pTestParser->ParseExifData(cByteSpan(NoExif.data(), NoExif.size()));
+   CHECK_EQUAL(EXIF_NOT_FOUND, Metadata.Status);
+   CHECK_EQUAL(0, Metadata.App1Offset);
+
+   std::vector<uint8_t> BadEndian = Image;
+   BadEndian.at(App1Offset + 8) = 0x00; // The first byte of the endian marker
+   Metadata = pTestParser->ParseExifData(cByteSpan(BadEndian.data(), BadEndian.size()));
+   CHECK_EQUAL(EXIF_MALFORMED, Metadata.Status);
+   CHECK_EQUAL(App1Offset, Metadata.App1Offset);
+
+   std::vector<uint8_t> BadDate = TEST_SOI;
+   const std::vector<uint8_t> BadDateApp1 = BuildExifApp1("2023:13:29 19:38:33");
+   BadDate.insert(BadDate.end(), BadDateApp1.begin(), BadDateApp1.end());
+   Metadata = pTestParser->ParseExifData(cByteSpan(BadDate.data(), BadDate.size()));
+   CHECK_EQUAL(EXIF_NO_DATE_TIME, Metadata.Status);
+   CHECK_FALSE(Metadata.HasDateTime);
+}
+
+/**
+ * @brief Writes an image to a temporary file, which is removed when the test is done.
+ */
+class cTestImageFile
+{
+public:
+   std::string Name;
+
+   cTestImageFile(const std::vector<uint8_t> &Image) : Name("/tmp/ExifParserTestXXXXXX")
+   {
+      const int Fd = mkstemp(&Name[0]);
+      CHECK_TRUE(Fd >= 0);
+      CHECK_EQUAL(static_cast<ssize_t>(Image.size()), write(Fd, Image.data(), Image.size()));
+      close(Fd);
+   }
+
+   ~cTestImageFile()
+   {
+      unlink(Name.c_str());
+   }
+};
+
+/**
+ * @brief Checks if a temporary file of a thumbnail was left in the thumbnail's folder
+ */
+static bool HasTemporaryFile(const std::string &ThumbnailFileName)
+{
+   const size_t NameStart = ThumbnailFileName.find_last_of('/') + 1;
+   const std::string Prefix = "." + ThumbnailFileName.substr(NameStart) + ".";
+   DIR *Folder = opendir(ThumbnailFileName.substr(0, NameStart).c_str());
+   bool Found = false;
+   for (dirent *Entry = readdir(Folder); (Entry != nullptr) && !Found; Entry = readdir(Folder))
+   {
+      Found = (strncmp(Entry->d_name, Prefix.c_str(), Prefix.size()) == 0);
+   }
+   closedir(Folder);
+   return Found;
+}
+
+TEST(ExifTests, ParseExifData_FileDescriptor)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   Image.insert(Image.end(), TEST_APP0.begin(), TEST_APP0.end());
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+   Image.insert(Image.end(), TEST_SOS.begin(), TEST_SOS.end());
+   cTestImageFile ImageFile(Image);
+
+   const int ImageFd = open(ImageFile.Name.c_str(), O_RDONLY);
+   const ExifMetadata Metadata = pTestParser->ParseExifData(ImageFd);
+   close(ImageFd);
+   CHECK_TRUE(Metadata.HasDateTime);
+   CHECK_EQUAL(123, Metadata.DateTime.tm_year);
+   CHECK_EQUAL(29, Metadata.DateTime.tm_mday);
+}
+
+TEST(ExifTests, Constructor_ParsesFile)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+   Image.insert(Image.end(), TEST_SOS.begin(), TEST_SOS.end());
+   cTestImageFile ImageFile(Image);
+
+   // Built over memory that is not zero, so a member left uninitialized is not hidden
+   alignas(cExifParser) unsigned char Storage[sizeof(cExifParser)];
+   memset(Storage, 0xA5, sizeof(Storage));
+   cExifParser *FileParser = new (Storage) cExifParser(ImageFile.Name);
+   CHECK_EQUAL(123, FileParser->GetDateTime().tm_year);
+   CHECK_EQUAL(29, FileParser->GetDateTime().tm_mday);
+   FileParser->~cExifParser();
+
+   memset(Storage, 0xA5, sizeof(Storage));
+   cExifParser *MissingParser = new (Storage) cExifParser(std::string("/nonexistent/image.jpg"));
+   CHECK_FALSE(MissingParser->ParseExifData(std::string("/nonexistent/image.jpg")).HasDateTime);
+   MissingParser->~cExifParser();
+}
+
+TEST(ExifTests, ParseExifData_FileDescriptorApp1AfterFirstWindow)
+{
+   // Two large APP2 segments push APP1 past the end of the first read window
+   std::vector<uint8_t> Image = TEST_SOI;
+   for (int Segment = 0; Segment < 2; ++Segment)
+   {
+      const std::vector<uint8_t> App2{0xFF, 0xE2, 0xFF, 0x00};
+      Image.insert(Image.end(), App2.begin(), App2.end());
+      Image.insert(Image.end(), 0xFF00 - 2, 0xAB);
+   }
+   const std::vector<uint8_t> App1 = BuildExifApp1("2021:06:05 08:00:00");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+   Image.insert(Image.end(), TEST_SOS.begin(), TEST_SOS.end());
+   cTestImageFile ImageFile(Image);
+
+   const int ImageFd = open(ImageFile.Name.c_str(), O_RDONLY);
+   const ExifMetadata Metadata = pTestParser->ParseExifData(ImageFd);
+   close(ImageFd);
+   CHECK_TRUE(Metadata.HasDateTime);
+   CHECK_EQUAL(121, Metadata.DateTime.tm_year);
+}
+
+TEST(ExifTests, BatchParser_ResultsInOrder)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+   cTestImageFile DatedImage(Image);
+   cTestImageFile UndatedImage(TEST_SOI);
+
+   cExifBatchParser BatchParser;
+   ExifBatchResults Results;
+   BatchParser.ParseFiles({DatedImage.Name, "/tmp/ExifParserTestMissing.jpg", UndatedImage.Name, DatedImage.Name}, Results);
+   CHECK_EQUAL(4, Results.Count());
+   CHECK_EQUAL(1, Results.HasDateTime[0]);
+   CHECK_EQUAL(1682797113, Results.DateTime[0]);
+   CHECK_EQUAL(0, Results.HasDateTime[1]);
+   CHECK_EQUAL(0, Results.DateTime[1]);
+   CHECK_EQUAL(0, Results.HasDateTime[2]);
+   CHECK_EQUAL(1, Results.HasDateTime[3]);
+   CHECK_EQUAL(1682797113, Results.DateTime[3]);
+
+   // A second batch replaces the results of the first
+   BatchParser.ParseFiles({UndatedImage.Name}, Results);
+   CHECK_EQUAL(1, Results.Count());
+   CHECK_EQUAL(0, Results.HasDateTime[0]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static const std::vector<uint8_t> TEST_THUMBNAIL{0xFF, 0xD8, 0xFF, 0xDB, 0x00, 0x02, 0xFF, 0xD9};
+
+static void AppendBigEndian(std::vector<uint8_t> &Data, const uint32_t Value, const size_t Length)
+{
+   for (size_t Index = Length; Index > 0; --Index)
+   {
+      Data.push_back(static_cast<uint8_t>(Value >> ((Index - 1) * 8)));
+   }
+}
+
+static void AppendIfdEntry(std::vector<uint8_t> &Tiff, const uint16_t Tag, const uint16_t Type, const uint32_t Count, const uint32_t Value)
+{
+   AppendBigEndian(Tiff, Tag, 2);
+   AppendBigEndian(Tiff, Type, 2);
+   AppendBigEndian(Tiff, Count, 4);
+   AppendBigEndian(Tiff, Value, 4);
+}
+
+static void AppendText(std::vector<uint8_t> &Tiff, const std::string &Text)
+{
+   Tiff.insert(Tiff.end(), Text.begin(), Text.end());
+   Tiff.push_back(0x0);
+}
+
+/**
+ * @brief Builds an APP1 segment, including the marker, with a big endian TIFF header,
+ *        an IFD0 that links to an EXIF IFD, a GPS IFD and an IFD1, and an IFD1 that
+ *        links back to IFD0 and holds a JPEG thumbnail.
+ */
+static std::vector<uint8_t> BuildFullExifApp1()
+{
+   // Offsets from the start of the TIFF header
+   const uint32_t ExifIfd = 62, GpsIfd = 104, Ifd1 = 158;
+   const uint32_t Model = 200, DateTime = 208, DateTimeOriginal = 228, OffsetTime = 248, Latitude = 256, Longitude = 280;
+   const uint32_t Thumbnail = 304;
+
+   std::vector<uint8_t> Tiff{0x4D, 0x4D, 0x00, 0x2A, 0x00, 0x00, 0x00, 0x08};
+   AppendBigEndian(Tiff, 4, 2);
+   AppendIfdEntry(Tiff, 0x0110, 2, 8, Model);
+   AppendIfdEntry(Tiff, 0x0132, 2, 20, DateTime);
+   AppendIfdEntry(Tiff, 0x8769, 4, 1, ExifIfd);
+   AppendIfdEntry(Tiff, 0x8825, 4, 1, GpsIfd);
+   AppendBigEndian(Tiff, Ifd1, 4);
+
+   AppendBigEndian(Tiff, 3, 2);
+   AppendIfdEntry(Tiff, 0x9003, 2, 20, DateTimeOriginal);
+   AppendIfdEntry(Tiff, 0x9291, 2, 3, 0x34320000); // "42" stored in the entry
+   AppendIfdEntry(Tiff, 0x9011, 2, 7, OffsetTime);
+   AppendBigEndian(Tiff, 0, 4);
+
+   AppendBigEndian(Tiff, 4, 2);
+   AppendIfdEntry(Tiff, 0x0001, 2, 2, 0x53000000); // "S"
+   AppendIfdEntry(Tiff, 0x0002, 5, 3, Latitude);
+   AppendIfdEntry(Tiff, 0x0003, 2, 2, 0x45000000); // "E"
+   AppendIfdEntry(Tiff, 0x0004, 5, 3, Longitude);
+   AppendBigEndian(Tiff, 0, 4);
+
+   AppendBigEndian(Tiff, 3, 2);
+   AppendIfdEntry(Tiff, 0x0103, 3, 1, 0x00060000); // JPEG compressed thumbnail
+   AppendIfdEntry(Tiff, 0x0201, 4, 1, Thumbnail);
+   AppendIfdEntry(Tiff, 0x0202, 4, 1, TEST_THUMBNAIL.size());
+   AppendBigEndian(Tiff, 8, 4);
+
+   AppendText(Tiff, "Pixel 7");
+   AppendText(Tiff, "2020:01:01 00:00:00");
+   AppendText(Tiff, "2019:07:14 10:20:30");
+   AppendText(Tiff, "+09:00");
+   Tiff.push_back(0x0);
+   for (uint32_t Part : {35u, 1u, 30u, 1u, 0u, 1u, 139u, 1u, 45u, 1u, 3600u, 100u})
+   {
+      AppendBigEndian(Tiff, Part, 4);
+   }
+   Tiff.insert(Tiff.end(), TEST_THUMBNAIL.begin(), TEST_THUMBNAIL.end());
+
+   const uint16_t SegmentLength = static_cast<uint16_t>(2 + 6 + Tiff.size());
+   std::vector<uint8_t> App1{0xFF, 0xE1, static_cast<uint8_t>(SegmentLength >> 8), static_cast<uint8_t>(SegmentLength),
+                             'E', 'x', 'i', 'f', 0x00, 0x00};
+   App1.insert(App1.end(), Tiff.begin(), Tiff.end());
+   return App1;
+}
+
+static std::string ToString(const cByteSpan &Text)
+{
+   return std::string(reinterpret_cast<const char *>(Text.Data()), Text.Length());
+}
+
+TEST(ExifTests, App1_ParseApp_IndexesEveryIfd)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildFullExifApp1();
+   Image.insert(Image.end(), App1.begin(), App1.end());
+
+   const ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size()));
+   CHECK_TRUE(Metadata.HasDateTime);
+   CHECK_EQUAL(119, Metadata.DateTime.tm_year); // DateTimeOriginal is used rather than DateTime
+   CHECK_EQUAL(6, Metadata.DateTime.tm_mon);
+   CHECK_EQUAL(14, Metadata.DateTime.tm_mday);
+
+   cByteSpan Text;
+   CHECK_TRUE(pTestParser->GetModel(Text));
+   STRCMP_EQUAL("Pixel 7", ToString(Text).c_str());
+   CHECK_TRUE(pTestParser->GetSubSecTime(Text));
+   STRCMP_EQUAL("42", ToString(Text).c_str());
+   CHECK_TRUE(pTestParser->GetOffsetTime(Text));
+   STRCMP_EQUAL("+09:00", ToString(Text).c_str());
+
+   double Latitude = 0.0;
+   double Longitude = 0.0;
+   CHECK_TRUE(pTestParser->GetGpsPosition(Latitude, Longitude));
+   DOUBLES_EQUAL(-35.5, Latitude, 1e-9);
+   DOUBLES_EQUAL(139.76, Longitude, 1e-9);
+
+   // Every entry except IFD1's compression is in the tag table
+   CHECK_EQUAL(cApp1::ALL_TAGS & ~(cApp1::TagBit(cApp1::TAG_OFFSET_TIME) | cApp1::TagBit(cApp1::TAG_SUB_SEC_TIME)),
+               pTestParser->App1.mFoundTags);
+}
+
+TEST(ExifTests, App1_ParseApp_OnlyWantedTags)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildFullExifApp1();
+   Image.insert(Image.end(), App1.begin(), App1.end());
+
+   pTestParser->SetWantedTags(cApp1::TagBit(cApp1::TAG_DATE_TIME_ORIGINAL) | cApp1::TagBit(cApp1::TAG_MODEL));
+   const ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size()));
+   CHECK_TRUE(Metadata.HasDateTime);
+   CHECK_EQUAL(119, Metadata.DateTime.tm_year);
+
+   cByteSpan Text;
+   double Latitude = 0.0;
+   double Longitude = 0.0;
+   CHECK_TRUE(pTestParser->GetModel(Text));
+   CHECK_FALSE(pTestParser->GetSubSecTime(Text));
+   CHECK_FALSE(pTestParser->GetGpsPosition(Latitude, Longitude));
+}
+
+TEST(ExifTests, App1_ParseApp_SkipsUnexpectedType)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   App1.at(22) = 0x07; // Change DateTime from ASCII to UNDEFINED
+   Image.insert(Image.end(), App1.begin(), App1.end());
+
+   const ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size()));
+   CHECK_FALSE(Metadata.HasDateTime);
+}
+
+TEST(ExifTests, App1_ParseApp_OnlyIfd0)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildExifApp1("2023:04:29 19:38:33");
+   Image.insert(Image.end(), App1.begin(), App1.end());
+
+   const ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size()));
+   CHECK_TRUE(Metadata.HasDateTime);
+   CHECK_EQUAL(123, Metadata.DateTime.tm_year);
+
+   cByteSpan Text;
+   double Latitude = 0.0;
+   double Longitude = 0.0;
+   CHECK_FALSE(pTestParser->GetModel(Text));
+   CHECK_FALSE(pTestParser->GetSubSecTime(Text));
+   CHECK_FALSE(pTestParser->GetOffsetTime(Text));
+   CHECK_FALSE(pTestParser->GetGpsPosition(Latitude, Longitude));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static std::vector<uint8_t> ToDateTimeBytes(const std::string &DateTime)
+{
+   std::vector<uint8_t> Bytes(DateTime.begin(), DateTime.end());
+   Bytes.push_back(0x0);
+   return Bytes;
+}
+
+TEST(ExifTests, App1_ParseDateTime_Timestamp)
+{
+   const std::vector<uint8_t> TestDateVector = ToDateTimeBytes("2024:02:29 23:59:60");
+   cApp1 TestApp;
+   TestApp.ParseDateTime(TestDateVector, 0, TestDateVector.size());
+   CHECK_TRUE(TestApp.mDateTimeFound);
+   CHECK_EQUAL(1709251200, TestApp.mTimestamp);
+   CHECK_EQUAL(4, TestApp.mDateTime.tm_wday); // Thursday
+   CHECK_EQUAL(59, TestApp.mDateTime.tm_yday);
+   CHECK_EQUAL(60, TestApp.mDateTime.tm_sec);
+}
+
+TEST(ExifTests, App1_ParseDateTime_InvalidText)
+{
+   for (const char *DateTime : {"2023:04:2x 19:38:33", "2023:04:29T19:38:33", "2023-04-29 19:38:33", "2023:13:29 19:38:33",
+                                "2023:02:29 19:38:33", "2023:04:29 24:00:00", "2023:04:29 19:60:33", "0000:00:00 00:00:00",
+                                "    :  :     :  :  ", "2023:04:29 19:38:3/"})
+   {
+      const std::vector<uint8_t> TestDateVector = ToDateTimeBytes(DateTime);
+      cApp1 TestApp;
+      TestApp.ParseDateTime(TestDateVector, 0, TestDateVector.size());
+      CHECK_FALSE(TestApp.mDateTimeFound);
+      CHECK_EQUAL(0, TestApp.mDateTime.tm_year);
+      CHECK_EQUAL(0, TestApp.mTimestamp);
+   }
+}
+
+TEST(ExifTests, App1_SubSecondAndUtcOffset)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildFullExifApp1();
+   Image.insert(Image.end(), App1.begin(), App1.end());
+
+   const ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size()));
+   CHECK_EQUAL(1563099630, Metadata.Timestamp);
+
+   uint32_t Nanoseconds = 0;
+   int32_t OffsetSeconds = 0;
+   CHECK_TRUE(pTestParser->GetSubSecond(Nanoseconds));
+   CHECK_EQUAL(420000000, Nanoseconds);
+   CHECK_TRUE(pTestParser->GetUtcOffset(OffsetSeconds));
+   CHECK_EQUAL(9 * 3600, OffsetSeconds);
+}
+
+TEST(ExifTests, App1_InvalidDateTimeOriginalFallsBackToDateTime)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   std::vector<uint8_t> App1 = BuildFullExifApp1();
+   // Month 13 in DateTimeOriginal, which starts 228 bytes into the TIFF data
+   App1[10 + 228 + 5] = '1';
+   App1[10 + 228 + 6] = '3';
+   Image.insert(Image.end(), App1.begin(), App1.end());
+
+   const ExifMetadata Metadata = pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size()));
+   CHECK_TRUE(Metadata.HasDateTime);
+   CHECK_EQUAL(1577836800, Metadata.Timestamp);
+
+   // The sub second and offset tags of DateTimeOriginal do not belong to DateTime
+   uint32_t Nanoseconds = 0;
+   int32_t OffsetSeconds = 0;
+   CHECK_FALSE(pTestParser->GetSubSecond(Nanoseconds));
+   CHECK_FALSE(pTestParser->GetUtcOffset(OffsetSeconds));
+}
+
+TEST(ExifTests, Diagnostics_RingSinkKeepsWarnings)
+{
+   const std::vector<uint8_t> TestDateVector = ToDateTimeBytes("2023:13:29 19:38:33");
+   cRingDiagnosticSink Sink(SEVERITY_WARNING);
+   cApp1 TestApp;
+   TestApp.SetDiagnosticSink(Sink);
+   TestApp.ParseDateTime(TestDateVector, 0, TestDateVector.size());
+
+   std::vector<Diagnostic> Diagnostics;
+   CHECK_EQUAL(0, Sink.Drain(Diagnostics));
+   CHECK_EQUAL(1, Diagnostics.size());
+   CHECK_EQUAL(SEVERITY_WARNING, Diagnostics[0].Severity);
+   CHECK_EQUAL(DIAG_DATE_TIME_INVALID, Diagnostics[0].Code);
+
+   // A valid date is only reported at debug severity, which this sink does not want
+   const std::vector<uint8_t> ValidDateVector = ToDateTimeBytes("2023:04:29 19:38:33");
+   TestApp.ParseDateTime(ValidDateVector, 0, ValidDateVector.size());
+   Diagnostics.clear();
+   CHECK_EQUAL(0, Sink.Drain(Diagnostics));
+   CHECK_EQUAL(0, Diagnostics.size());
+}
+
+TEST(ExifTests, Diagnostics_FullRingCountsDropped)
+{
+   cRingDiagnosticSink Sink(SEVERITY_DEBUG, 3);
+   for (int Count = 0; Count < 6; ++Count)
+   {
+      Sink.Report({SEVERITY_WARNING, DIAG_IFD_CUT_SHORT, Count});
+   }
+
+   std::vector<Diagnostic> Diagnostics;
+   CHECK_EQUAL(2, Sink.Drain(Diagnostics));
+   CHECK_EQUAL(4, Diagnostics.size());
+   CHECK_EQUAL(0, Diagnostics[0].Value);
+   CHECK_EQUAL(3, Diagnostics[3].Value);
+
+   Sink.Report({SEVERITY_WARNING, DIAG_IFD_CUT_SHORT, 6});
+   Diagnostics.clear();
+   CHECK_EQUAL(0, Sink.Drain(Diagnostics));
+   CHECK_EQUAL(1, Diagnostics.size());
+   CHECK_EQUAL(6, Diagnostics[0].Value);
+}
+
+TEST(ExifTests, Diagnostics_MissingImage)
+{
+   cRingDiagnosticSink Sink(SEVERITY_WARNING);
+   pTestParser->SetDiagnosticSink(Sink);
+   const ExifMetadata Metadata = pTestParser->ParseExifData(std::string("/nonexistent/image.jpg"));
+   CHECK_FALSE(Metadata.HasDateTime);
+
+   std::vector<Diagnostic> Diagnostics;
+   Sink.Drain(Diagnostics);
+   CHECK_EQUAL(1, Diagnostics.size());
+   CHECK_EQUAL(SEVERITY_ERROR, Diagnostics[0].Severity);
+   CHECK_EQUAL(DIAG_IMAGE_NOT_FOUND, Diagnostics[0].Code);
+   STRCMP_EQUAL("Could not open the image", DiagnosticMessage(Diagnostics[0].Code));
+}
+
+TEST(ExifTests, App1_Thumbnail)
+{
+   std::vector<uint8_t> Image = TEST_SOI;
+   const std::vector<uint8_t> App1 = BuildFullExifApp1();
+   Image.insert(Image.end(), App1.begin(), App1.end());
+   pTestParser->ParseExifData(cByteSpan(Image.data(), Image.size()));
+
+   // The thumbnail is a view of the image data, not a copy
+   cByteSpan Thumbnail;
+   CHECK_TRUE(pTestParser->GetThumbnail(Thumbnail));
+   CHECK_EQUAL(TEST_THUMBNAIL.size(), Thumbnail.Length());
+   CHECK_TRUE(Thumbnail.Data() >= Image.data() && (Thumbnail.Data() + Thumbnail.Length()) <= (Image.data() + Image.size()));
+   CHECK_TRUE(std::equal(TEST_THUMBNAIL.begin(), TEST_THUMBNAIL.end(), Thumbnail.Data()));
+
+   // Only a unique name is wanted, so the file is removed for the thumbnail to take its place
+   cTestImageFile ThumbnailFile({});
+   unlink(ThumbnailFile.Name.c_str());
+   CHECK_TRUE(pTestParser->WriteThumbnail(ThumbnailFile.Name));
+   std::vector<uint8_t> Written(64);
+   int ThumbnailFd = open(ThumbnailFile.Name.c_str(), O_RDONLY);
+   Written.resize(static_cast<size_t>(read(ThumbnailFd, Written.data(), Written.size())));
+   close(ThumbnailFd);
+   CHECK_TRUE(Written == TEST_THUMBNAIL);
+   CHECK_FALSE(HasTemporaryFile(ThumbnailFile.Name));
+
+   // A file that already has the name is left alone
+   cTestImageFile ExistingFile({0x01, 0x02});
+   CHECK_FALSE(pTestParser->WriteThumbnail(ExistingFile.Name));
+   Written.resize(64);
+   ThumbnailFd = open(ExistingFile.Name.c_str(), O_RDONLY);
+   Written.resize(static_cast<size_t>(read(ThumbnailFd, Written.data(), Written.size())));
+   close(ThumbnailFd);
+   CHECK_TRUE(Written == std::vector<uint8_t>({0x01, 0x02}));
+   CHECK_FALSE(HasTemporaryFile(ExistingFile.Name));
+
+   // A thumbnail offset past the end of APP1 is rejected
+   std::vector<uint8_t> BadOffset = Image;
+   BadOffset.at(TEST_SOI.size() + 190) = 0x7F;
+   pTestParser->ParseExifData(cByteSpan(BadOffset.data(), BadOffset.size()));
+   CHECK_FALSE(pTestParser->GetThumbnail(Thumbnail));
+   CHECK_FALSE(pTestParser->WriteThumbnail(ThumbnailFile.Name));
+
+   // Images without a thumbnail have none
+   std::vector<uint8_t> NoThumbnail = TEST_SOI;
+   const std::vector<uint8_t> SimpleApp1 = BuildExifApp1("2023:04:29 19:38:33");
+   NoThumbnail.insert(NoThumbnail.end(), SimpleApp1.begin(), SimpleApp1.end());
+   pTestParser->ParseExifData(cByteSpan(NoThumbnail.data(), NoThumbnail.size()));
+   CHECK_FALSE(pTestParser->GetThumbnail(Thumbnail));
+}
@@ -0,0 +1,172 @@
+/**
+* @file ExifDiagnostics.cpp
+* @brief Reports problems found while parsing images, without writing to the console
+*/
+
+#include "ExifDiagnostics.hpp"
+
+namespace
+{
+
+/**
+ * @brief The ring the current thread last reported to, so reports after the first need no lookup
+ */
+struct ThreadRingCache
+{
+    uint64_t SinkId;
+    void    *Ring;
+};
+
+thread_local ThreadRingCache tRingCache = {0, nullptr};
+std::atomic<uint64_t> gNextSinkId(1);
+
+constexpr const char *DIAGNOSTIC_MESSAGES[] =
+{
+    "Parsing image",
+    "Found APP1",
+    "Offset to IFD0 in bytes",
+    "Number of IFD entries",
+    "Photo's date and time",
+    "Could not open the image",
+    "Could not read the image",
+    "Image does not start with SOI",
+    "Invalid segment length",
+    "APP1 data ends before the TIFF header ends",
+    "EXIF header is cut short",
+    "EXIF not found in the header",
+    "Expected zero bytes at the end of the EXIF header",
+    "Invalid endian marker",
+    "Unexpected value after the endian marker",
+    "IFD is outside of the APP1 data",
+    "APP1 data ends before the last IFD entry",
+    "Date time is outside of the APP1 data",
+    "Date time does not have 20 characters",
+    "Expected the final byte of the date time to be 0x00",
+    "Date time is not a valid date",
+    "Thumbnail is outside of the APP1 data",
+    "Thumbnail does not start with SOI",
+    "Could not write the thumbnail",
+};
+static_assert(sizeof(DIAGNOSTIC_MESSAGES) / sizeof(DIAGNOSTIC_MESSAGES[0]) == DIAG_CODE_COUNT, "Every code needs a message");
+
+} // namespace
+
+/**
+ * @brief Describes a diagnostic code
+ *
+ * @param[in] Code The code
+ *
+ * @return The code's message, which is never freed
+ */
+const char *DiagnosticMessage(const DiagnosticCode Code)
+{
+    return (Code < DIAG_CODE_COUNT) ? DIAGNOSTIC_MESSAGES[Code] : "Unknown diagnostic";
+}
+
+cNullDiagnosticSink &cNullDiagnosticSink::Instance()
+{
+    static cNullDiagnosticSink Sink;
+    return Sink;
+}
+
+cRingDiagnosticSink::cRingDiagnosticSink(const DiagnosticSeverity MinimumSeverity, const size_t Capacity) :
+    cDiagnosticSink(MinimumSeverity),
+    mId(gNextSinkId.fetch_add(1, std::memory_order_relaxed)),
+    mCapacity(RoundUpToPowerOfTwo(Capacity)),
+    mRings(),
+    mRingsMutex()
+{
+}
+
+/**
+ * @brief Ring capacities are a power of two, so a position can be masked rather than divided
+ */
+const size_t cRingDiagnosticSink::RoundUpToPowerOfTwo(const size_t Value)
+{
+    size_t Rounded = 1;
+    while (Rounded < Value)
+    {
+        Rounded <<= 1;
+    }
+    return Rounded;
+}
+
+/**
+ * @brief Finds the current thread's ring, creating it the first time the thread reports
+ *
+ * @return The ring
+ */
+cRingDiagnosticSink::Ring &cRingDiagnosticSink::ThreadRing()
+{
+    if (tRingCache.SinkId == mId)
+    {
+        return *static_cast<Ring *>(tRingCache.Ring);
+    }
+
+    std::lock_guard<std::mutex> lock(mRingsMutex);
+    const std::thread::id Owner = std::this_thread::get_id();
+    Ring *ThreadRing = nullptr;
+    for (const std::unique_ptr<Ring> &Candidate : mRings)
+    {
+        if (Candidate->Owner == Owner)
+        {
+            ThreadRing = Candidate.get();
+            break;
+        }
+    }
+    if (ThreadRing == nullptr)
+    {
+        mRings.push_back(std::unique_ptr<Ring>(new Ring(mCapacity, Owner)));
+        ThreadRing = mRings.back().get();
+    }
+
+    tRingCache = {mId, ThreadRing};
+    return *ThreadRing;
+}
+
+/**
+ * @brief Adds a diagnostic to the current thread's ring. Never blocks once the thread has a ring.
+ *
+ * @param[in] Entry The diagnostic
+ *
+ * @return None
+ */
+void cRingDiagnosticSink::Report(const Diagnostic &Entry)
+{
+    Ring &ThreadRing = this->ThreadRing();
+    const uint64_t Tail = ThreadRing.Tail.load(std::memory_order_relaxed);
+    if ((Tail - ThreadRing.Head.load(std::memory_order_acquire)) >= mCapacity)
+    {
+        ThreadRing.Dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ThreadRing.Entries[Tail & (mCapacity - 1)] = Entry;
+    ThreadRing.Tail.store(Tail + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Takes every diagnostic out of the rings. Diagnostics from one thread stay in the
+ *        order they were reported, but diagnostics from different threads are not interleaved
+ *        in time order.
+ *
+ * @param[out] Diagnostics The diagnostics are appended to this
+ *
+ * @return The number of diagnostics dropped because a ring was full, since the last drain
+ */
+const uint64_t cRingDiagnosticSink::Drain(std::vector<Diagnostic> &Diagnostics)
+{
+    std::lock_guard<std::mutex> lock(mRingsMutex);
+    uint64_t Dropped = 0;
+    for (const std::unique_ptr<Ring> &ThreadRing : mRings)
+    {
+        const uint64_t Head = ThreadRing->Head.load(std::memory_order_relaxed);
+        const uint64_t Tail = ThreadRing->Tail.load(std::memory_order_acquire);
+        for (uint64_t Position = Head; Position != Tail; ++Position)
+        {
+            Diagnostics.push_back(ThreadRing->Entries[Position & (mCapacity - 1)]);
+        }
+        ThreadRing->Head.store(Tail, std::memory_order_release);
+        Dropped += ThreadRing->Dropped.exchange(0, std::memory_order_relaxed);
+    }
+    return Dropped;
+}
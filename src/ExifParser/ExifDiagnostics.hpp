@@ -0,0 +1,143 @@
+/**
+* @file ExifDiagnostics.hpp
+* @brief Reports problems found while parsing images, without writing to the console
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+enum DiagnosticSeverity : uint8_t
+{
+    SEVERITY_DEBUG,   ///< Progress through an image that is parsed normally
+    SEVERITY_WARNING, ///< The image is malformed, so some metadata could not be read
+    SEVERITY_ERROR,   ///< The image could not be read at all
+    SEVERITY_NONE     ///< Used as a minimum severity to report nothing
+};
+
+/**
+ * @brief What was found. Each code has a message, see DiagnosticMessage.
+ */
+enum DiagnosticCode : uint8_t
+{
+    DIAG_PARSING_IMAGE,
+    DIAG_FOUND_APP1,
+    DIAG_IFD0_OFFSET,         ///< Value is the offset of IFD0
+    DIAG_IFD_ENTRY_COUNT,     ///< Value is the number of entries
+    DIAG_DATE_TIME,           ///< Value is the timestamp of the date and time
+    DIAG_IMAGE_NOT_FOUND,
+    DIAG_READ_FAILED,
+    DIAG_NO_START_OF_IMAGE,
+    DIAG_INVALID_SEGMENT_LENGTH, ///< Value is the segment length
+    DIAG_TIFF_HEADER_CUT_SHORT,
+    DIAG_EXIF_HEADER_CUT_SHORT,
+    DIAG_EXIF_HEADER_NOT_FOUND,  ///< Value is the four bytes found instead
+    DIAG_EXIF_HEADER_NOT_BLANK,  ///< Value is the two bytes found instead
+    DIAG_INVALID_ENDIAN_MARKER,  ///< Value is the marker
+    DIAG_INVALID_TIFF_MARKER,    ///< Value is the two bytes found instead of 0x002A
+    DIAG_IFD_OUT_OF_BOUNDS,      ///< Value is the cApp1::IfdId
+    DIAG_IFD_CUT_SHORT,          ///< Value is the cApp1::IfdId
+    DIAG_DATE_TIME_OUT_OF_BOUNDS,
+    DIAG_DATE_TIME_WRONG_LENGTH, ///< Value is the length found
+    DIAG_DATE_TIME_NOT_BLANK,    ///< Value is the final byte
+    DIAG_DATE_TIME_INVALID,
+    DIAG_THUMBNAIL_OUT_OF_BOUNDS,
+    DIAG_THUMBNAIL_NOT_JPEG,
+    DIAG_THUMBNAIL_WRITE_FAILED, ///< Value is errno
+    DIAG_CODE_COUNT
+};
+
+/**
+ * @brief One reported problem
+ */
+struct Diagnostic
+{
+    DiagnosticSeverity Severity;
+    DiagnosticCode     Code;
+    int64_t            Value; ///< Depends on Code. Zero if the code has no value.
+};
+
+const char *DiagnosticMessage(const DiagnosticCode Code);
+
+/**
+ * @brief Receives the diagnostics of a parser. Diagnostics below the minimum severity are
+ *        dropped by the parser before the sink is called.
+ */
+class cDiagnosticSink
+{
+private:
+    DiagnosticSeverity mMinimumSeverity;
+
+public:
+    cDiagnosticSink(const DiagnosticSeverity MinimumSeverity) : mMinimumSeverity(MinimumSeverity) {};
+    virtual ~cDiagnosticSink() {};
+
+    const bool Wants(const DiagnosticSeverity Severity) const {return Severity >= mMinimumSeverity;}
+    virtual void Report(const Diagnostic &Entry) = 0;
+};
+
+/**
+ * @brief Drops every diagnostic. Parsers use it unless they are given another sink.
+ */
+class cNullDiagnosticSink : public cDiagnosticSink
+{
+public:
+    cNullDiagnosticSink() : cDiagnosticSink(SEVERITY_NONE) {};
+
+    void Report(const Diagnostic &) {}
+    static cNullDiagnosticSink &Instance();
+};
+
+/**
+ * @brief Keeps diagnostics in a ring buffer for each thread that reports them, so parsers on
+ *        different threads never wait for each other or for the reader. A thread's ring is
+ *        created the first time it reports, and once a ring is full further diagnostics from
+ *        that thread are dropped and counted until they are drained.
+ *
+ *        Report can be called from any thread. Drain can be called from one thread at a time.
+ */
+class cRingDiagnosticSink : public cDiagnosticSink
+{
+private:
+
+    /**
+     * @brief Single producer, single consumer ring written by one thread
+     */
+    struct Ring
+    {
+        std::vector<Diagnostic> Entries;
+        std::atomic<uint64_t> Head;    ///< Next entry to drain. Written by the reader.
+        std::atomic<uint64_t> Tail;    ///< Next entry to write. Written by the reporting thread.
+        std::atomic<uint64_t> Dropped; ///< Diagnostics lost because the ring was full
+        const std::thread::id Owner;   ///< The thread that reports to this ring
+
+        Ring(const size_t Capacity, const std::thread::id ThreadId) :
+            Entries(Capacity), Head(0), Tail(0), Dropped(0), Owner(ThreadId) {};
+    };
+
+    const uint64_t mId;       ///< Tells sinks apart in each thread's cache, even if one is created where another was freed
+    const size_t   mCapacity; ///< Entries in each ring. A power of two.
+    std::vector<std::unique_ptr<Ring>> mRings;
+    std::mutex mRingsMutex;   ///< Held to add a ring, which each thread only does once
+
+    static const size_t RoundUpToPowerOfTwo(const size_t Value);
+    Ring &ThreadRing();
+
+public:
+
+    static constexpr size_t DEFAULT_CAPACITY = 256;
+
+    cRingDiagnosticSink(const DiagnosticSeverity MinimumSeverity, const size_t Capacity = DEFAULT_CAPACITY);
+
+    cRingDiagnosticSink(const cRingDiagnosticSink &) = delete;
+    cRingDiagnosticSink &operator=(const cRingDiagnosticSink &) = delete;
+
+    void Report(const Diagnostic &Entry);
+    const uint64_t Drain(std::vector<Diagnostic> &Diagnostics);
+};
@@ -8,25 +8,435 @@
 #include "ExifParser.hpp"
 #include <endian.h> // For endian correction
 #include <fstream>  // For ifstream
-#include <iostream> // For cout
 #include <string>   // For std::string
-#include <cstdio>   // For sscanf
+#include <cstring>  // For memcpy
 #include <ctime>    // For tm struct
+#include <algorithm> // For std::equal
+#include <errno.h>  // For errno
+#include <fcntl.h>  // For open
+#include <unistd.h> // For pread, write, close, link, unlink
+#include <cstdio>   // For rename
+#include <stdlib.h> // For mkostemp
+#include <sys/stat.h> // For lstat, fchmod
+
+namespace
+{
+
+/**
+ * @brief Loads a two byte value in the given byte order. memcpy is used so the value may
+ *        be at any alignment, and compiles to a single load, plus a byte swap if needed.
+ */
+template <bool LittleEndian>
+inline uint16_t LoadTwoBytes(const uint8_t *Data)
+{
+    uint16_t RawValue = 0;
+    memcpy(&RawValue, Data, sizeof(RawValue));
+    if constexpr (LittleEndian)
+    {
+        return le16toh(RawValue);
+    }
+    else
+    {
+        return be16toh(RawValue);
+    }
+}
+
+/**
+ * @brief Loads a four byte value in the given byte order. See LoadTwoBytes.
+ */
+template <bool LittleEndian>
+inline uint32_t LoadFourBytes(const uint8_t *Data)
+{
+    uint32_t RawValue = 0;
+    memcpy(&RawValue, Data, sizeof(RawValue));
+    if constexpr (LittleEndian)
+    {
+        return le32toh(RawValue);
+    }
+    else
+    {
+        return be32toh(RawValue);
+    }
+}
+
+// Tiff data types. See 4.6.2
+constexpr uint16_t TYPE_ASCII    = 2;
+constexpr uint16_t TYPE_LONG     = 4;
+constexpr uint16_t TYPE_RATIONAL = 5;
+constexpr uint16_t TYPE_IFD      = 13; //< A LONG that holds the offset of an IFD
+constexpr uint8_t  TYPE_LENGTHS[] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8, 4}; //< Length in bytes of each type, indexed by type
+
+constexpr uint16_t TypeBit(const uint16_t Type) {return static_cast<uint16_t>(1u << Type);}
+
+/**
+ * @brief What the parser expects of a tag it indexes. Entries of another type or count are skipped.
+ */
+struct TagDescriptor
+{
+    cApp1::TagId Id;
+    cApp1::IfdId Ifd;
+    uint16_t Tag;   ///< The tag number. See 4.6.4
+    uint16_t Types; ///< Bit N is set if type N is accepted
+    uint32_t Count; ///< The number of values expected, or zero if any number is accepted
+};
+
+/**
+ * @brief Every tag that can be indexed, in TagId order
+ */
+constexpr TagDescriptor TAG_DESCRIPTORS[] =
+{
+    {cApp1::TAG_MODEL,                 cApp1::IFD_0,    0x0110, TypeBit(TYPE_ASCII),                     0},
+    {cApp1::TAG_DATE_TIME,             cApp1::IFD_0,    0x0132, TypeBit(TYPE_ASCII),                     20},
+    {cApp1::TAG_EXIF_POINTER,          cApp1::IFD_0,    0x8769, TypeBit(TYPE_LONG) | TypeBit(TYPE_IFD),  1},
+    {cApp1::TAG_GPS_POINTER,           cApp1::IFD_0,    0x8825, TypeBit(TYPE_LONG) | TypeBit(TYPE_IFD),  1},
+    {cApp1::TAG_DATE_TIME_ORIGINAL,    cApp1::IFD_EXIF, 0x9003, TypeBit(TYPE_ASCII),                     20},
+    {cApp1::TAG_OFFSET_TIME,           cApp1::IFD_EXIF, 0x9010, TypeBit(TYPE_ASCII),                     0},
+    {cApp1::TAG_OFFSET_TIME_ORIGINAL,  cApp1::IFD_EXIF, 0x9011, TypeBit(TYPE_ASCII),                     0},
+    {cApp1::TAG_SUB_SEC_TIME,          cApp1::IFD_EXIF, 0x9290, TypeBit(TYPE_ASCII),                     0},
+    {cApp1::TAG_SUB_SEC_TIME_ORIGINAL, cApp1::IFD_EXIF, 0x9291, TypeBit(TYPE_ASCII),                     0},
+    {cApp1::TAG_GPS_LATITUDE_REF,      cApp1::IFD_GPS,  0x0001, TypeBit(TYPE_ASCII),                     2},
+    {cApp1::TAG_GPS_LATITUDE,          cApp1::IFD_GPS,  0x0002, TypeBit(TYPE_RATIONAL),                  3},
+    {cApp1::TAG_GPS_LONGITUDE_REF,     cApp1::IFD_GPS,  0x0003, TypeBit(TYPE_ASCII),                     2},
+    {cApp1::TAG_GPS_LONGITUDE,         cApp1::IFD_GPS,  0x0004, TypeBit(TYPE_RATIONAL),                  3},
+    {cApp1::TAG_THUMBNAIL_OFFSET,      cApp1::IFD_1,    0x0201, TypeBit(TYPE_LONG),                      1},
+    {cApp1::TAG_THUMBNAIL_LENGTH,      cApp1::IFD_1,    0x0202, TypeBit(TYPE_LONG),                      1},
+};
+
+constexpr bool IsInTagIdOrder()
+{
+    for (size_t Index = 0; Index < cApp1::TAG_COUNT; ++Index)
+    {
+        if (TAG_DESCRIPTORS[Index].Id != Index)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(sizeof(TAG_DESCRIPTORS) / sizeof(TAG_DESCRIPTORS[0]) == cApp1::TAG_COUNT, "Every TagId needs a descriptor");
+static_assert(IsInTagIdOrder(), "Descriptors must be in TagId order");
+static_assert(cApp1::TAG_COUNT <= 32, "Tag masks hold one bit per tag");
+
+// Tags are found with a perfect hash of their IFD and tag number, so skipping an unknown
+// entry costs one probe of the hash table no matter how many tags are in the table.
+constexpr uint32_t TAG_HASH_BITS  = 6;
+constexpr size_t   TAG_HASH_SLOTS = 1 << TAG_HASH_BITS;
+constexpr uint8_t  EMPTY_TAG_SLOT = 0xFF;
+static_assert(cApp1::TAG_COUNT < TAG_HASH_SLOTS, "The hash table needs room for every tag");
+
+constexpr uint32_t TagKey(const cApp1::IfdId Ifd, const uint16_t Tag)
+{
+    return (static_cast<uint32_t>(Ifd) << 16) | Tag;
+}
+
+constexpr size_t TagHashSlot(const uint32_t Key, const uint32_t Multiplier)
+{
+    return static_cast<size_t>((Key * Multiplier) >> (32 - TAG_HASH_BITS));
+}
+
+constexpr bool IsPerfectHash(const uint32_t Multiplier)
+{
+    bool SlotUsed[TAG_HASH_SLOTS] = {};
+    for (const TagDescriptor &Descriptor : TAG_DESCRIPTORS)
+    {
+        const size_t Slot = TagHashSlot(TagKey(Descriptor.Ifd, Descriptor.Tag), Multiplier);
+        if (SlotUsed[Slot])
+        {
+            return false;
+        }
+        SlotUsed[Slot] = true;
+    }
+    return true;
+}
+
+/**
+ * @brief Finds a multiplier that gives every tag its own slot, starting from the golden ratio
+ */
+constexpr uint32_t FindTagHashMultiplier()
+{
+    uint32_t Multiplier = 0x9E3779B1;
+    while (!IsPerfectHash(Multiplier))
+    {
+        Multiplier += 2;
+    }
+    return Multiplier;
+}
+
+constexpr uint32_t TAG_HASH_MULTIPLIER = FindTagHashMultiplier();
+
+/**
+ * @brief The TagId in each slot of the hash table
+ */
+struct TagHashTable
+{
+    uint8_t Slots[TAG_HASH_SLOTS];
+};
+
+constexpr TagHashTable BuildTagHashTable()
+{
+    TagHashTable Table = {};
+    for (uint8_t &Slot : Table.Slots)
+    {
+        Slot = EMPTY_TAG_SLOT;
+    }
+    for (const TagDescriptor &Descriptor : TAG_DESCRIPTORS)
+    {
+        Table.Slots[TagHashSlot(TagKey(Descriptor.Ifd, Descriptor.Tag), TAG_HASH_MULTIPLIER)] = Descriptor.Id;
+    }
+    return Table;
+}
+
+constexpr TagHashTable TAG_HASH_TABLE = BuildTagHashTable();
+
+/**
+ * @brief Gets the tags in one IFD, as a tag mask
+ */
+constexpr uint32_t TagsInIfd(const cApp1::IfdId Ifd)
+{
+    uint32_t Tags = 0;
+    for (const TagDescriptor &Descriptor : TAG_DESCRIPTORS)
+    {
+        Tags |= (Descriptor.Ifd == Ifd) ? cApp1::TagBit(Descriptor.Id) : 0;
+    }
+    return Tags;
+}
+
+/**
+ * @brief Looks up the descriptor of an IFD entry's tag
+ *
+ * @return The descriptor, or nullptr if the tag is not indexed
+ */
+const TagDescriptor *FindTagDescriptor(const cApp1::IfdId Ifd, const uint16_t Tag)
+{
+    const uint8_t Id = TAG_HASH_TABLE.Slots[TagHashSlot(TagKey(Ifd, Tag), TAG_HASH_MULTIPLIER)];
+    if ((Id == EMPTY_TAG_SLOT) || (TAG_DESCRIPTORS[Id].Tag != Tag) || (TAG_DESCRIPTORS[Id].Ifd != Ifd))
+    {
+        return nullptr;
+    }
+    return &TAG_DESCRIPTORS[Id];
+}
+
+/**
+ * @brief Masks used to check eight bytes of text against a pattern in a few word operations.
+ *        In a pattern, 'D' is a digit and any other character must match exactly.
+ */
+struct WordPattern
+{
+    uint64_t CheckMask;   ///< The high nibble of each digit and all of every other character
+    uint64_t Expected;    ///< 0x3 in the high nibble of each digit and every other character as is
+    uint64_t DigitNibble; ///< The high nibble of each digit
+    uint64_t AddSix;      ///< 0x06 in each digit byte
+};
+
+constexpr WordPattern MakeWordPattern(const char (&Pattern)[9])
+{
+    WordPattern Masks = {};
+    for (size_t Index = 0; Index < 8; ++Index)
+    {
+        const uint32_t Shift = static_cast<uint32_t>(Index * 8);
+        const bool IsDigit = (Pattern[Index] == 'D');
+        Masks.CheckMask   |= static_cast<uint64_t>(IsDigit ? 0xF0 : 0xFF) << Shift;
+        Masks.Expected    |= static_cast<uint64_t>(IsDigit ? '0' : static_cast<uint8_t>(Pattern[Index])) << Shift;
+        Masks.DigitNibble |= static_cast<uint64_t>(IsDigit ? 0xF0 : 0x00) << Shift;
+        Masks.AddSix      |= static_cast<uint64_t>(IsDigit ? 0x06 : 0x00) << Shift;
+    }
+    return Masks;
+}
+
+// "YYYY:MM:DD HH:MM:SS" is checked as three overlapping words
+constexpr WordPattern DATE_WORD      = MakeWordPattern("DDDD:DD:"); //< Bytes 0 to 7
+constexpr WordPattern DAY_HOUR_WORD  = MakeWordPattern("DD DD:DD"); //< Bytes 8 to 15
+constexpr WordPattern TIME_WORD      = MakeWordPattern("DD:DD:DD"); //< Bytes 11 to 18
+constexpr size_t DAY_HOUR_WORD_OFFSET = 8;
+constexpr size_t TIME_WORD_OFFSET     = 11;
+
+constexpr uint32_t SUB_SECOND_DIGITS = 9; //< Nanosecond precision
+constexpr size_t   UTC_OFFSET_LENGTH = 6; //< "+HH:MM"
+constexpr int64_t  SECONDS_PER_DAY   = 86400;
+
+/**
+ * @brief Checks eight bytes of text against a pattern. Every digit must have a high nibble
+ *        of 3, and adding 6 to it must not carry out of the low nibble, so its low nibble is
+ *        at most 9. A carry can not spill into the next byte, since the high nibble is 3.
+ */
+inline bool MatchesWord(const uint8_t *Text, const WordPattern &Pattern)
+{
+    uint64_t Word = 0;
+    memcpy(&Word, Text, sizeof(Word));
+    Word = le64toh(Word); // The first character is in the lowest byte, as in the pattern
+    return ((Word & Pattern.CheckMask) == Pattern.Expected) &&
+           (((Word + Pattern.AddSix) & Pattern.DigitNibble) == (Pattern.Expected & Pattern.DigitNibble));
+}
+
+inline int TwoDigits(const uint8_t *Text)
+{
+    return ((Text[0] - '0') * 10) + (Text[1] - '0');
+}
+
+/**
+ * @brief Counts the days from 1970-01-01 to a date in the proleptic Gregorian calendar
+ */
+constexpr int64_t DaysFromCivil(int64_t Year, const int Month, const int Day)
+{
+    Year -= (Month <= 2) ? 1 : 0;
+    const int64_t Era = ((Year >= 0) ? Year : (Year - 399)) / 400;
+    const int64_t YearOfEra = Year - (Era * 400);
+    const int64_t DayOfYear = (((153 * (Month + ((Month > 2) ? -3 : 9))) + 2) / 5) + Day - 1;
+    const int64_t DayOfEra = (YearOfEra * 365) + (YearOfEra / 4) - (YearOfEra / 100) + DayOfYear;
+    return (Era * 146097) + DayOfEra - 719468;
+}
+static_assert(DaysFromCivil(1970, 1, 1) == 0, "The epoch is day zero");
+static_assert(DaysFromCivil(2000, 3, 1) == 11017, "Leap days are counted");
+
+constexpr bool IsLeapYear(const int Year)
+{
+    return ((Year % 4) == 0) && (((Year % 100) != 0) || ((Year % 400) == 0));
+}
+
+/**
+ * @brief Parses an EXIF date and time without allocating memory, and without the locale
+ *        or time zone lookups of the C library.
+ *
+ * @param[in] Text The 19 characters of "YYYY:MM:DD HH:MM:SS". At least 20 bytes must be readable.
+ * @param[out] DateTime The date and time, including the day of the week and year. Unchanged if the text is not valid.
+ * @param[out] Timestamp Seconds since 1970-01-01 00:00:00, reading the date and time as UTC. Unchanged if the text is not valid.
+ *
+ * @return False if the text is not a valid date and time. A date of all zeros or spaces, which
+ *         EXIF uses when the date is unknown, is not valid.
+ */
+bool ParseDateTimeText(const uint8_t *Text, tm &DateTime, int64_t &Timestamp)
+{
+    if (!MatchesWord(Text, DATE_WORD) || !MatchesWord(Text + DAY_HOUR_WORD_OFFSET, DAY_HOUR_WORD) ||
+        !MatchesWord(Text + TIME_WORD_OFFSET, TIME_WORD))
+    {
+        return false;
+    }
+
+    static constexpr uint8_t DAYS_IN_MONTH[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    const int Year   = (TwoDigits(Text) * 100) + TwoDigits(Text + 2);
+    const int Month  = TwoDigits(Text + 5);
+    const int Day    = TwoDigits(Text + 8);
+    const int Hour   = TwoDigits(Text + 11);
+    const int Minute = TwoDigits(Text + 14);
+    const int Second = TwoDigits(Text + 17);
+    if ((Month < 1) || (Month > 12) || (Day < 1) || (Hour > 23) || (Minute > 59) || (Second > 60) ||
+        (Day > (DAYS_IN_MONTH[Month - 1] + (((Month == 2) && IsLeapYear(Year)) ? 1 : 0))))
+    {
+        return false;
+    }
+
+    const int64_t Days = DaysFromCivil(Year, Month, Day);
+    DateTime = tm();
+    DateTime.tm_year = Year - 1900; // tm_year expects the number of years since 1900
+    DateTime.tm_mon  = Month - 1;   // tm expects a zero based month
+    DateTime.tm_mday = Day;
+    DateTime.tm_hour = Hour;
+    DateTime.tm_min  = Minute;
+    DateTime.tm_sec  = Second;
+    DateTime.tm_yday = static_cast<int>(Days - DaysFromCivil(Year, 1, 1));
+    DateTime.tm_wday = static_cast<int>(((Days % 7) + 11) % 7); // 1970-01-01 was a Thursday
+    Timestamp = (Days * SECONDS_PER_DAY) + (Hour * 3600) + (Minute * 60) + Second;
+    return true;
+}
+
+/**
+ * @brief Parses the digits of SubSecTime, which are the fraction of a second after the decimal point.
+ *        Digits past nanosecond precision are ignored.
+ *
+ * @return False if the text is empty or holds anything other than digits
+ */
+bool ParseSubSecond(const cByteSpan &Text, uint32_t &Nanoseconds)
+{
+    uint32_t Value = 0;
+    uint32_t Scale = 1000000000;
+    for (size_t Index = 0; Index < Text.Length(); ++Index)
+    {
+        const uint8_t Digit = static_cast<uint8_t>(Text.Data()[Index] - '0');
+        if (Digit > 9)
+        {
+            return false;
+        }
+        if (Index < SUB_SECOND_DIGITS)
+        {
+            Scale /= 10;
+            Value += Digit * Scale;
+        }
+    }
+    Nanoseconds = Value;
+    return Text.Length() > 0;
+}
+
+/**
+ * @brief Parses OffsetTime, the offset from UTC written as "+HH:MM" or "-HH:MM"
+ *
+ * @return False if the text is not a valid offset
+ */
+bool ParseUtcOffset(const cByteSpan &Text, int32_t &OffsetSeconds)
+{
+    const uint8_t *Data = Text.Data();
+    if ((Text.Length() != UTC_OFFSET_LENGTH) || ((Data[0] != '+') && (Data[0] != '-')) || (Data[3] != ':'))
+    {
+        return false;
+    }
+    for (const size_t Index : {1, 2, 4, 5})
+    {
+        if (static_cast<uint8_t>(Data[Index] - '0') > 9)
+        {
+            return false;
+        }
+    }
+
+    const int Hours = TwoDigits(Data + 1);
+    const int Minutes = TwoDigits(Data + 4);
+    if ((Hours > 23) || (Minutes > 59))
+    {
+        return false;
+    }
+    OffsetSeconds = ((Hours * 3600) + (Minutes * 60)) * ((Data[0] == '-') ? -1 : 1);
+    return true;
+}
+
+constexpr const char *PARSE_STATUS_MESSAGES[] =
+{
+    "No EXIF data",
+    "EXIF date found",
+    "EXIF data has no valid date",
+    "EXIF data is malformed",
+    "Not a JPEG",
+    "Image ends before its EXIF data",
+    "Could not read the image",
+};
+static_assert(sizeof(PARSE_STATUS_MESSAGES) / sizeof(PARSE_STATUS_MESSAGES[0]) == EXIF_READ_ERROR + 1, "Every status needs a message");
+
+} // namespace
+
+/**
+ * @brief Describes the outcome of parsing an image
+ *
+ * @param[in] Status The outcome
+ *
+ * @return The status's message, which is never freed
+ */
+const char *ExifParseStatusMessage(const ExifParseStatus Status)
+{
+    return (Status <= EXIF_READ_ERROR) ? PARSE_STATUS_MESSAGES[Status] : "Unknown status";
+}
 
 /**
  * @brief Determines if the App Marker Exists
  *
- * @param[in] ReadBufferIter Iterator to the EXIF data
+ * @param[in] Data The EXIF data
+ * @param[in] Offset Offset of the app marker in Data
  * @param[in] app_marker The app marker to check
  *
  * @return True if the app marker exists.
  *         False if it does not.
  */
-const bool cAppBase::DoesAppMarkerExist(const std::vector<uint8_t>::iterator &ReadBufferIter, const uint16_t app_marker)
+const bool cAppBase::DoesAppMarkerExist(const cByteSpan &Data, const size_t Offset, const uint16_t app_marker)
 {
     bool app_marker_exists = false;
-    const uint16_t read_app_marker = ReadTwoBytes(ReadBufferIter);
-    if (read_app_marker == app_marker)
+    const uint16_t read_app_marker = ReadTwoBytes(Data, Offset);
+    if (Data.Contains(Offset, sizeof(uint16_t)) && (read_app_marker == app_marker))
     {
         app_marker_exists = true;
     }
@@ -37,59 +447,47 @@ const bool cAppBase::DoesAppMarkerExist(const std::vector<uint8_t>::iterator &Re
 /**
  * @brief Reads two bytes from the EXIF data, taking endianess into account.
  *
- * @param[in] ReadBufferIter Iterator to the EXIF data
+ * @param[in] Data The EXIF data
+ * @param[in] Offset Offset of the value in Data
  *
- * @return Two byte value from the EXIF data
+ * @return Two byte value from the EXIF data, or zero if the value is outside of Data
  */
-const uint16_t cAppBase::ReadTwoBytes(const std::vector<uint8_t>::iterator &ReadBufferIter)
+const uint16_t cAppBase::ReadTwoBytes(const cByteSpan &Data, const size_t Offset)
 {
-    uint16_t converted_value = 0;
-    uint16_t raw_value = *(reinterpret_cast<const std::vector<uint16_t>::iterator &>(ReadBufferIter));
-    if (mLittleEndian)
-    {
-        converted_value = le16toh(raw_value);
-    }
-    else
+    if (!Data.Contains(Offset, sizeof(uint16_t)))
     {
-        converted_value = be16toh(raw_value);
+        return 0;
     }
-    return converted_value;
+    return mLittleEndian ? LoadTwoBytes<true>(Data.Data() + Offset) : LoadTwoBytes<false>(Data.Data() + Offset);
 }
 
 /**
  * @brief Reads four bytes from the EXIF data, taking endianess into account.
  *
- * @param[in] ReadBufferIter Iterator to the EXIF data
+ * @param[in] Data The EXIF data
+ * @param[in] Offset Offset of the value in Data
  *
- * @return Four byte value from the EXIF data
+ * @return Four byte value from the EXIF data, or zero if the value is outside of Data
  */
-const uint32_t cAppBase::ReadFourBytes(const std::vector<uint8_t>::iterator &ReadBufferIter)
+const uint32_t cAppBase::ReadFourBytes(const cByteSpan &Data, const size_t Offset)
 {
-    uint32_t converted_value = 0;
-    uint32_t raw_value = *(reinterpret_cast<const std::vector<uint32_t>::iterator &>(ReadBufferIter));
-    if (mLittleEndian)
-    {
-        converted_value = le32toh(raw_value);
-    }
-    else
+    if (!Data.Contains(Offset, sizeof(uint32_t)))
     {
-        converted_value = be32toh(raw_value);
+        return 0;
     }
-    return converted_value;
+    return mLittleEndian ? LoadFourBytes<true>(Data.Data() + Offset) : LoadFourBytes<false>(Data.Data() + Offset);
 }
 
 /**
  * @brief Parses information for App0 data
  *
- * @pre The calling function has advanced the buffer iterator to the start of the App1 data
- *
- * @param[in] ReadBufferIter Iterator pointing to the App0 data
+ * @param[in] AppData The App0 data, starting at its length field
  *
  * @return The bytes read by this parsing function.
  */
-const uint32_t cApp0::ParseApp(const std::vector<uint8_t>::iterator &ReadBufferIter)
+const uint32_t cApp0::ParseApp(const cByteSpan &AppData)
 {
-    const uint16_t TotalBytesRead = ReadTwoBytes(ReadBufferIter);
+    const uint16_t TotalBytesRead = ReadTwoBytes(AppData, 0);
     // The next four bytes should be JFIF0
 
     return TotalBytesRead;
@@ -98,33 +496,30 @@ const uint32_t cApp0::ParseApp(const std::vector<uint8_t>::iterator &ReadBufferI
 /**
  * @brief Determines the endianess based on the EXIF header data
  *
- * @pre App1Iter starts at the beginning of the endianess datat
- *
- * @param[in] App1Iter Iterator to the EXIF data
+ * @param[in] App1Data The App1 data
+ * @param[in] Offset Offset of the endianess data in App1Data
  *
  * @return True if either a big or little endian tag was found
  *         False otherwise, which may indicate the file was corrupted or the
  *               file uses a standard this program doesn't support.
  */
-const bool cApp1::GetEndianess(const std::vector<uint8_t>::iterator &App1Iter)
+const bool cApp1::GetEndianess(const cByteSpan &App1Data, const size_t Offset)
 {
     bool valid_marker = false;
-    const uint16_t endianess_value = ReadTwoBytes(App1Iter);
+    const uint16_t endianess_value = ReadTwoBytes(App1Data, Offset);
     if (endianess_value == LITTLE_ENDIAN_TAG)
     {
-        // std::cout << "Little Endian" << std::endl;
         mLittleEndian = true;
         valid_marker = true;
     }
     else if (endianess_value == BIG_ENDIAN_TAG)
     {
-        // std::cout << "Big Endian" << std::endl;
         mLittleEndian = false;
         valid_marker = true;
     }
     else
     {
-        // std::cout << "Invalid Endian marker\n" << std::endl;
+        Report(SEVERITY_WARNING, DIAG_INVALID_ENDIAN_MARKER, endianess_value);
     }
 
     return valid_marker;
@@ -133,274 +528,1177 @@ const bool cApp1::GetEndianess(const std::vector<uint8_t>::iterator &App1Iter)
 /**
  * @brief Verifies the contents of the EXIF header
  *
- * @pre App1Iter points to the beginning of the EXIF header by the calling function
+ * @pre The endianess has not been read yet, so values are read as big endian
  *
- * @param App1Iter[in] Iterator to the App1 data
+ * @param App1Data[in] The App1 data
+ * @param Offset[in] Offset of the EXIF header in App1Data
  *
  * @return True if the EXIF header is correct
  *         False otherwise
 */
-const bool cApp1::VerifyExifHeader(const std::vector<uint8_t>::iterator &App1Iter)
+const bool cApp1::VerifyExifHeader(const cByteSpan &App1Data, const size_t Offset)
 {
     bool exif_header_valid = false;
 
-    // Copy the ReadBufferIter to a local iterator so we don't overwrite the iterator's position
-    std::vector<uint8_t>::iterator exif_iter = App1Iter;
+    if (!App1Data.Contains(Offset, EXIF_HEADER_LENGTH))
+    {
+        Report(SEVERITY_WARNING, DIAG_EXIF_HEADER_CUT_SHORT);
+        return exif_header_valid;
+    }
 
     // The next four bytes should be the word "EXIF" in ASCII
-    const uint32_t read_exif_tag = ReadFourBytes(exif_iter);
+    const uint32_t read_exif_tag = ReadFourBytes(App1Data, Offset);
     if (read_exif_tag == EXIF_TAG)
     {
-        std::advance(exif_iter, FOUR_BYTE_LENGTH);
-
-        const uint16_t zero_values = ReadTwoBytes(exif_iter);
+        const uint16_t zero_values = ReadTwoBytes(App1Data, Offset + FOUR_BYTE_LENGTH);
         if (zero_values == BLANK_BYTE)
         {
             exif_header_valid = true;
         }
         else
         {
-            std::cout << "Expected zero bytes at the end, found " << zero_values << "\n";
+            Report(SEVERITY_WARNING, DIAG_EXIF_HEADER_NOT_BLANK, zero_values);
         }
     }
     else
     {
-        std::cout << "EXIF not found in the header " << read_exif_tag << "\n";
+        Report(SEVERITY_WARNING, DIAG_EXIF_HEADER_NOT_FOUND, read_exif_tag);
     }
 
     return exif_header_valid;
 }
 
 /**
- * @brief Parses all of the IFDs in the EXIF data
+ * @brief Reads the entries of an IFD into mTags. Entries whose tag is not wanted, or whose
+ *        type or count is not what the tag table expects, are skipped.
  *
- * @pre App1Iter starts at the beginning of the IFD data
+ * @pre Offset is the beginning of the IFD entries, and there is room in App1Data for EntryCount entries
  *
- * @param[in] App1Iter Iterator to the EXIF data
+ * @param[in] App1Data The App1 data
+ * @param[in,out] Offset Offset of the IFD entries. Advanced past the entries that were read.
+ * @param[in] Ifd The IFD the entries are in
+ * @param[in] EntryCount The number of entries in the IFD
  *
  * @return None
  */
-void cApp1::GetTiffTagList(std::vector<uint8_t>::iterator &App1Iter)
+template <bool LittleEndian>
+void cApp1::GetTiffTagList(const cByteSpan &App1Data, size_t &Offset, const IfdId Ifd, const uint16_t EntryCount)
 {
-    for (TiffTagStruct &CurrIfd : mIfdList)
+    // The caller checked that every entry is inside of App1Data, so the entries are loaded without bounds checks
+    const uint8_t *Entry = App1Data.Data() + Offset;
+    for (uint16_t Index = 0; Index < EntryCount; ++Index, Entry += IFD_ENTRY_LENGTH)
     {
-        CurrIfd.Tag = ReadTwoBytes(App1Iter);
-        std::advance(App1Iter, TWO_BYTE_LENGTH);
-        CurrIfd.Type = ReadTwoBytes(App1Iter);
-        std::advance(App1Iter, TWO_BYTE_LENGTH);
-        CurrIfd.Count = ReadFourBytes(App1Iter);
-        std::advance(App1Iter, FOUR_BYTE_LENGTH);
-        CurrIfd.Offset = ReadFourBytes(App1Iter);
-        std::advance(App1Iter, FOUR_BYTE_LENGTH);
+        const TagDescriptor *Descriptor = FindTagDescriptor(Ifd, LoadTwoBytes<LittleEndian>(Entry));
+        if ((Descriptor == nullptr) || ((mWantedTags & ~mFoundTags & TagBit(Descriptor->Id)) == 0))
+        {
+            continue;
+        }
+
+        TiffTagStruct &CurrIfd = mTags[Descriptor->Id];
+        CurrIfd.Tag = Descriptor->Tag;
+        CurrIfd.Type = LoadTwoBytes<LittleEndian>(Entry + TWO_BYTE_LENGTH);
+        CurrIfd.Count = LoadFourBytes<LittleEndian>(Entry + TWO_BYTE_LENGTH + TWO_BYTE_LENGTH);
+        CurrIfd.Offset = LoadFourBytes<LittleEndian>(Entry + TWO_BYTE_LENGTH + TWO_BYTE_LENGTH + FOUR_BYTE_LENGTH);
+        CurrIfd.ValueFieldOffset = static_cast<uint32_t>((Entry - App1Data.Data()) + TWO_BYTE_LENGTH + TWO_BYTE_LENGTH + FOUR_BYTE_LENGTH);
+        if ((CurrIfd.Type < (sizeof(Descriptor->Types) * 8)) && ((Descriptor->Types & TypeBit(CurrIfd.Type)) != 0) &&
+            ((Descriptor->Count == 0) || (Descriptor->Count == CurrIfd.Count)))
+        {
+            mFoundTags |= TagBit(Descriptor->Id);
+        }
     }
+    Offset += static_cast<size_t>(EntryCount) * IFD_ENTRY_LENGTH;
 }
 
 /**
- * @brief Parses the date and time from the EXIF header
+ * @brief Adds the entries of an IFD to the tag index. Values are not decoded.
  *
- * @pre App1Iter starts at the beginning of the time date information
+ * @param[in] Ifd Which IFD is being read
+ * @param[in] IfdOffset Offset of the IFD from the start of the TIFF header
  *
- * @param[in] App1Iter Iterator to the EXIF data
- * @param[in] BytesToParse The number of characters to parse
- *
- * @return None
+ * @return The offset of the next IFD from the start of the TIFF header.
+ *         Zero if there is no next IFD, or if this IFD could not be read.
  */
-void cApp1::ParseDateTime(std::vector<uint8_t>::iterator &App1Iter, const uint32_t BytesToParse)
+template <bool LittleEndian>
+const uint32_t cApp1::IndexIfd(const IfdId Ifd, const uint32_t IfdOffset)
 {
-    if (BytesToParse == EXPECTED_DATE_TIME_LENGTH)
+    // An offset of zero would point at the TIFF header itself, which is never an IFD
+    size_t Offset = mTiffHeaderOffset + IfdOffset;
+    if ((IfdOffset == 0) || !mApp1Data.Contains(Offset, TWO_BYTE_LENGTH))
     {
-        // Get the expected bytes from the read buffer and push them into a string that will be
-        // used to parse the date and time.
-        std::string DateTimeStr;
-        for (uint32_t Offset = 0; Offset < BytesToParse; ++Offset)
-        {
-            DateTimeStr.push_back(static_cast<char>(*(App1Iter + Offset)));
-        }
+        Report(SEVERITY_WARNING, DIAG_IFD_OUT_OF_BOUNDS, Ifd);
+        return 0;
+    }
 
-        // The EXIF standard expects the final byte to be 0x00, which is a blank byte between
-        // the date and time information, and the next field to parse.
-        const uint8_t FinalByte = static_cast<uint8_t>(DateTimeStr.at(BytesToParse - 1));
-        if (FinalByte == BLANK_BYTE)
-        {
-            sscanf(DateTimeStr.c_str(), "%d:%d:%d %d:%d:%d", &mDateTime.tm_year, &mDateTime.tm_mon, &mDateTime.tm_mday,
-                                                             &mDateTime.tm_hour, &mDateTime.tm_min, &mDateTime.tm_sec);
+    // The first two bytes are the number of IFD entries
+    const uint16_t NumOfIFDs = LoadTwoBytes<LittleEndian>(mApp1Data.Data() + Offset);
+    Report(SEVERITY_DEBUG, DIAG_IFD_ENTRY_COUNT, NumOfIFDs);
+    Offset += TWO_BYTE_LENGTH;
 
-            --mDateTime.tm_mon; // EXIF month is ones based, but struct tm expects zero based.
-                                // Convert the EXIF month to zero based.
-            mDateTime.tm_year -= 1900; // tm_year expects the number of years since 1900, but EXIF data is years since 0 AD
-            std::cout << "Photo's date time is " << asctime(&mDateTime) << std::endl;
-        }
-        else
-        {
-            std::cout << "Expected the final byte to be 0x00, but got " << FinalByte << "\n";
-        }
-    }
-    else
+    if (!mApp1Data.Contains(Offset, static_cast<size_t>(NumOfIFDs) * IFD_ENTRY_LENGTH))
     {
-        std::cout << "Date time expects 20 characters to parse but found " << BytesToParse << "\n";
+        Report(SEVERITY_WARNING, DIAG_IFD_CUT_SHORT, Ifd);
+        return 0;
     }
 
+    GetTiffTagList<LittleEndian>(mApp1Data, Offset, Ifd, NumOfIFDs);
 
-}
-
-void cApp1::GetTiffTagData(uint32_t tiff_header_offset_start)
-{
-    for (const TiffTagStruct &CurrIfd : mIfdList)
-    {
-        const uint32_t offset_to_ifd_data = tiff_header_offset_start + CurrIfd.Offset;
-        std::vector<uint8_t>::iterator ifd_data_iter = start_of_file + offset_to_ifd_data;
-        switch (CurrIfd.Tag)
-        {
-            case IFD_DATE_TIME:
-            {
-                ParseDateTime(ifd_data_iter, CurrIfd.Count);
-                break;
-            }
-            default:
-            {
-                break;
-            }
-        }
-    }
+    // The entries are followed by the offset of the next IFD, which is zero if this is the last one
+    return mApp1Data.Contains(Offset, FOUR_BYTE_LENGTH) ? LoadFourBytes<LittleEndian>(mApp1Data.Data() + Offset) : 0;
 }
 
 /**
- * @brief Parses information for App1 data
- *
- * @pre The calling function has advanced the buffer iterator to the start of the App1 data
+ * @brief Indexes IFD0, and the EXIF, GPS and IFD1 IFDs that it links to.
+ *        IFD0 links to the EXIF and GPS IFDs through its entries, and to IFD1 through its next IFD offset.
+ *        Each IFD is read at most once, so IFDs that link to each other can not cause a loop.
+ *        IFDs without any wanted tags are not read at all.
  *
- * @param[in] ReadBufferIter Iterator pointing to the start of App1 data
+ * @param[in] IfdOffset Offset of IFD0 from the start of the TIFF header
  *
- * @return The bytes read by this parsing function.
+ * @return None
  */
-const uint32_t cApp1::ParseApp(const std::vector<uint8_t>::iterator &read_buffer_iter)
+template <bool LittleEndian>
+void cApp1::IndexIfds(const uint32_t IfdOffset)
 {
-    // Copy the ReadBufferIter to a local iterator so we don't overwrite the iterator's position
-    std::vector<uint8_t>::iterator App1Iter = read_buffer_iter;
-
-    // Get the length of App1
-    const uint16_t TotalBytesRead = ReadTwoBytes(App1Iter);
-    // std::cout << "App1 length in bytes is " << TotalBytesRead << "\n";
-    std::advance(App1Iter, APP_DATA_SIZE_LENGTH);
-
-    const bool valid_exif_header = VerifyExifHeader(App1Iter);
-    if (!valid_exif_header)
+    const uint32_t NextIfdOffset = IndexIfd<LittleEndian>(IFD_0, IfdOffset);
+    const TiffTagStruct *ExifPointer = FindTag(TAG_EXIF_POINTER);
+    const TiffTagStruct *GpsPointer = FindTag(TAG_GPS_POINTER);
+    if ((ExifPointer != nullptr) && ((mWantedTags & TagsInIfd(IFD_EXIF)) != 0))
     {
-        return TotalBytesRead;
+        IndexIfd<LittleEndian>(IFD_EXIF, ExifPointer->Offset);
     }
-    std::advance(App1Iter, EXIF_HEADER_LENGTH);
-
-    // Determine the endianness of the data.
-    const bool valid_endianess = GetEndianess(App1Iter);
-    if (!valid_endianess)
+    if ((GpsPointer != nullptr) && ((mWantedTags & TagsInIfd(IFD_GPS)) != 0))
     {
-        return TotalBytesRead;
+        IndexIfd<LittleEndian>(IFD_GPS, GpsPointer->Offset);
     }
-
-    // All IFD offsets are based on the start of the TIFF header.
-    // At this point ParseApp has reached the start of the TIFF header so determine
-    // and save this offset.
-    const uint32_t tiff_header_offset = std::distance(start_of_file, App1Iter);
-    std::advance(App1Iter, ENDIAN_LENGTH);
-
-    // The next two bytes should be 0x002A
-    const uint16_t read_two_alpha_value = ReadTwoBytes(App1Iter);
-
-    if (read_two_alpha_value != TWO_ALPHA_TAG)
+    if ((NextIfdOffset != 0) && ((mWantedTags & TagsInIfd(IFD_1)) != 0))
     {
-        std::cout << "Unexpected value after endian marker " << *App1Iter << std::endl;
-        return TotalBytesRead;
+        IndexIfd<LittleEndian>(IFD_1, NextIfdOffset);
     }
-    std::advance(App1Iter, TWO_BYTE_LENGTH);
-
-    // The next four bytes contains the offset of the 0th IFD in bytes
-    // According to the standard, if the value is 0x00000008 then the 0th IFD is right after
-    // the IFD offset.
-    const uint32_t IfdOffset = ReadFourBytes(App1Iter);
-    std::cout << "Offset to IFD is " << IfdOffset << " bytes" << std::endl;
-    std::advance(App1Iter, FOUR_BYTE_LENGTH);
-
-    // The next two bytes are the number of IFDs
-    const uint16_t NumOfIFDs = ReadTwoBytes(App1Iter);
-    std::cout << "Number of IFDs " << std::dec << NumOfIFDs << std::endl;
-    std::advance(App1Iter, TWO_BYTE_LENGTH);
-
-    mIfdList.resize(NumOfIFDs);
-    GetTiffTagList(App1Iter);
-    GetTiffTagData(tiff_header_offset);
+}
 
-    return TotalBytesRead;
+/**
+ * @brief Looks up an entry in the tag index
+ *
+ * @param[in] Tag The entry's tag
+ *
+ * @return The entry, or nullptr if it was not found. Only valid until the next parse.
+ */
+const cApp1::TiffTagStruct *cApp1::FindTag(const TagId Tag) const
+{
+    return ((mFoundTags & TagBit(Tag)) != 0) ? &mTags[Tag] : nullptr;
 }
 
-cExifParser::cExifParser(const std::string &ImageFileName) : App0(), App1()
+/**
+ * @brief Chooses the tags to index, so images can be parsed without looking at tags that
+ *        are not needed. The EXIF and GPS pointers are always indexed.
+ *
+ * @param[in] WantedTags A mask of TagBit values. The date is only found if TAG_DATE_TIME_ORIGINAL
+ *                       or TAG_DATE_TIME is wanted.
+ *
+ * @return None
+ */
+void cApp1::SetWantedTags(const uint32_t WantedTags)
 {
-    ParseExifData(ImageFileName);
+    mWantedTags = (WantedTags & ALL_TAGS) | TagBit(TAG_EXIF_POINTER) | TagBit(TAG_GPS_POINTER);
 }
 
 /**
- * @brief Checks to make sure the Start of Image (SOI) exists
+ * @brief Finds the data of an entry. Data that fits in four bytes is stored in the entry itself,
+ *        and larger data is stored at an offset from the start of the TIFF header.
  *
- * @param[in] ReadBufferIter Iterator which points to the start of the SOI
+ * @param[in] Entry The entry
  *
- * @return True if the first two bytes indicate the SOI tag
- *         False otherwise
+ * @return The entry's data, or an empty span if the type is unknown or the data is outside of the APP1 data
  */
-const bool cExifParser::DoesStartOfImageExist(const std::vector<uint8_t>::iterator &ReadBufferIter)
+const cByteSpan cApp1::GetTagValue(const TiffTagStruct &Entry) const
 {
-    bool soi_found = false;
-    const uint16_t soi = be16toh(*(reinterpret_cast<const std::vector<uint16_t>::iterator &>(ReadBufferIter)));
-    if (soi == START_OF_IMAGE_MARKER)
+    if (Entry.Type >= sizeof(TYPE_LENGTHS))
     {
-        soi_found = true;
+        return cByteSpan();
     }
 
-    return soi_found;
+    const uint64_t ValueLength = static_cast<uint64_t>(TYPE_LENGTHS[Entry.Type]) * Entry.Count;
+    const uint64_t ValueOffset = (ValueLength <= FOUR_BYTE_LENGTH) ? Entry.ValueFieldOffset :
+                                 (static_cast<uint64_t>(mTiffHeaderOffset) + Entry.Offset);
+    if ((ValueLength == 0) || (ValueOffset > mApp1Data.Length()) || !mApp1Data.Contains(ValueOffset, ValueLength))
+    {
+        return cByteSpan();
+    }
+    return mApp1Data.SubSpan(ValueOffset, ValueLength);
+}
+
+/**
+ * @brief Gets the text of an ASCII entry, without the zero bytes and spaces that pad its end
+ *
+ * @param[in] Tag The entry's tag
+ * @param[out] Text The text, which points into the APP1 data
+ *
+ * @return True if the entry was found and holds text
+ */
+const bool cApp1::GetAsciiTag(const TagId Tag, cByteSpan &Text) const
+{
+    const TiffTagStruct *Entry = FindTag(Tag);
+    if (Entry == nullptr)
+    {
+        return false;
+    }
+
+    const cByteSpan Value = GetTagValue(*Entry);
+    size_t TextLength = Value.Length();
+    while ((TextLength > 0) && ((Value.Data()[TextLength - 1] == BLANK_BYTE) || (Value.Data()[TextLength - 1] == ' ')))
+    {
+        --TextLength;
+    }
+    Text = Value.SubSpan(0, TextLength);
+    return TextLength > 0;
+}
+
+/**
+ * @brief Parses the date and time from the EXIF header
+ *
+ * @param[in] App1Data The App1 data
+ * @param[in] Offset Offset of the date and time information in App1Data
+ * @param[in] BytesToParse The number of characters to parse
+ *
+ * @return None
+ */
+void cApp1::ParseDateTime(const cByteSpan &App1Data, const size_t Offset, const uint32_t BytesToParse)
+{
+    if (!App1Data.Contains(Offset, BytesToParse))
+    {
+        Report(SEVERITY_WARNING, DIAG_DATE_TIME_OUT_OF_BOUNDS);
+    }
+    else if (BytesToParse == EXPECTED_DATE_TIME_LENGTH)
+    {
+        const uint8_t *DateTimeText = App1Data.Data() + Offset;
+
+        // The EXIF standard expects the final byte to be 0x00, which is a blank byte between
+        // the date and time information, and the next field to parse.
+        const uint8_t FinalByte = DateTimeText[EXPECTED_DATE_TIME_LENGTH - 1];
+        if (FinalByte != BLANK_BYTE)
+        {
+            Report(SEVERITY_WARNING, DIAG_DATE_TIME_NOT_BLANK, FinalByte);
+        }
+        else if (ParseDateTimeText(DateTimeText, mDateTime, mTimestamp))
+        {
+            mDateTimeFound = true;
+            Report(SEVERITY_DEBUG, DIAG_DATE_TIME, mTimestamp);
+        }
+        else
+        {
+            Report(SEVERITY_WARNING, DIAG_DATE_TIME_INVALID);
+        }
+    }
+    else
+    {
+        Report(SEVERITY_WARNING, DIAG_DATE_TIME_WRONG_LENGTH, BytesToParse);
+    }
+}
+
+/**
+ * @brief Decodes when the photo was taken. DateTimeOriginal is used if it is recorded,
+ *        since DateTime is changed by many photo editors. DateTime is used instead if
+ *        DateTimeOriginal is missing, out of bounds or not a valid date.
+ *
+ * @return None
+ */
+void cApp1::FindDateTime()
+{
+    static constexpr TagId DATE_TAGS[] = {TAG_DATE_TIME_ORIGINAL, TAG_DATE_TIME};
+    for (const TagId Tag : DATE_TAGS)
+    {
+        const TiffTagStruct *Entry = FindTag(Tag);
+        if (Entry == nullptr)
+        {
+            continue;
+        }
+
+        const uint64_t offset_to_ifd_data = static_cast<uint64_t>(mTiffHeaderOffset) + Entry->Offset;
+        // Skip values that point outside of the APP1 data
+        if (offset_to_ifd_data > mApp1Data.Length())
+        {
+            Report(SEVERITY_WARNING, DIAG_DATE_TIME_OUT_OF_BOUNDS);
+            continue;
+        }
+        ParseDateTime(mApp1Data, static_cast<size_t>(offset_to_ifd_data), Entry->Count);
+        if (mDateTimeFound)
+        {
+            mDateTimeOriginal = (Tag == TAG_DATE_TIME_ORIGINAL);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Gets the camera model
+ *
+ * @param[out] Model The model, which points into the APP1 data
+ *
+ * @return True if the model is recorded
+ */
+const bool cApp1::GetModel(cByteSpan &Model) const
+{
+    return GetAsciiTag(TAG_MODEL, Model);
+}
+
+/**
+ * @brief Gets the fraction of a second to add to the date and time, as decimal digits
+ *
+ * @param[out] SubSecTime The digits, which point into the APP1 data
+ *
+ * @return True if the fraction is recorded for the date and time that was parsed
+ */
+const bool cApp1::GetSubSecTime(cByteSpan &SubSecTime) const
+{
+    return mDateTimeFound && GetAsciiTag(mDateTimeOriginal ? TAG_SUB_SEC_TIME_ORIGINAL : TAG_SUB_SEC_TIME, SubSecTime);
+}
+
+/**
+ * @brief Gets the offset from UTC of the date and time, such as "+09:00"
+ *
+ * @param[out] OffsetTime The offset, which points into the APP1 data
+ *
+ * @return True if the offset is recorded for the date and time that was parsed
+ */
+const bool cApp1::GetOffsetTime(cByteSpan &OffsetTime) const
+{
+    return mDateTimeFound && GetAsciiTag(mDateTimeOriginal ? TAG_OFFSET_TIME_ORIGINAL : TAG_OFFSET_TIME, OffsetTime);
+}
+
+/**
+ * @brief Gets the fraction of a second to add to the date and time
+ *
+ * @param[out] Nanoseconds The fraction of a second, in nanoseconds
+ *
+ * @return True if the fraction is recorded for the date and time that was parsed, and is valid
+ */
+const bool cApp1::GetSubSecond(uint32_t &Nanoseconds) const
+{
+    cByteSpan SubSecTime;
+    return GetSubSecTime(SubSecTime) && ParseSubSecond(SubSecTime, Nanoseconds);
+}
+
+/**
+ * @brief Gets the offset from UTC of the date and time
+ *
+ * @param[out] OffsetSeconds Seconds to subtract from the date and time to get UTC
+ *
+ * @return True if the offset is recorded for the date and time that was parsed, and is valid
+ */
+const bool cApp1::GetUtcOffset(int32_t &OffsetSeconds) const
+{
+    cByteSpan OffsetTime;
+    return GetOffsetTime(OffsetTime) && ParseUtcOffset(OffsetTime, OffsetSeconds);
+}
+
+/**
+ * @brief Decodes a GPS latitude or longitude, which is stored as degrees, minutes and seconds
+ *
+ * @param[in] RefTag The tag of the coordinate's hemisphere
+ * @param[in] ValueTag The tag of the coordinate
+ * @param[in] NegativeRef The hemisphere whose coordinates are negative, 'S' or 'W'
+ * @param[out] Coordinate The coordinate in degrees
+ *
+ * @return True if the coordinate is recorded and valid
+ */
+const bool cApp1::GetGpsCoordinate(const TagId RefTag, const TagId ValueTag, const uint8_t NegativeRef, double &Coordinate)
+{
+    cByteSpan Ref;
+    const TiffTagStruct *Entry = FindTag(ValueTag);
+    if (!GetAsciiTag(RefTag, Ref) || (Entry == nullptr))
+    {
+        return false;
+    }
+
+    const cByteSpan Value = GetTagValue(*Entry);
+    if (Value.Length() == 0)
+    {
+        return false;
+    }
+
+    // Each part is a rational, a four byte numerator followed by a four byte denominator
+    double Parts[GPS_COORDINATE_COUNT] = {};
+    for (size_t Index = 0; Index < GPS_COORDINATE_COUNT; ++Index)
+    {
+        const uint32_t Numerator = ReadFourBytes(Value, Index * RATIONAL_LENGTH);
+        const uint32_t Denominator = ReadFourBytes(Value, Index * RATIONAL_LENGTH + FOUR_BYTE_LENGTH);
+        if (Denominator == 0)
+        {
+            return false;
+        }
+        Parts[Index] = static_cast<double>(Numerator) / Denominator;
+    }
+
+    Coordinate = Parts[0] + (Parts[1] / 60.0) + (Parts[2] / 3600.0);
+    if (Ref.Data()[0] == NegativeRef)
+    {
+        Coordinate = -Coordinate;
+    }
+    return true;
+}
+
+/**
+ * @brief Gets where the photo was taken
+ *
+ * @param[out] Latitude Degrees north of the equator. Negative in the southern hemisphere.
+ * @param[out] Longitude Degrees east of the prime meridian. Negative in the western hemisphere.
+ *
+ * @return True if both the latitude and longitude are recorded
+ */
+const bool cApp1::GetGpsPosition(double &Latitude, double &Longitude)
+{
+    return GetGpsCoordinate(TAG_GPS_LATITUDE_REF, TAG_GPS_LATITUDE, 'S', Latitude) &&
+           GetGpsCoordinate(TAG_GPS_LONGITUDE_REF, TAG_GPS_LONGITUDE, 'W', Longitude);
+}
+
+/**
+ * @brief Gets the JPEG thumbnail stored after IFD1, without copying or decoding it
+ *
+ * @param[out] Thumbnail The thumbnail, which points into the APP1 data
+ *
+ * @return True if the image has a thumbnail that is inside of the APP1 data and starts with SOI
+ */
+const bool cApp1::GetThumbnail(cByteSpan &Thumbnail)
+{
+    const TiffTagStruct *OffsetEntry = FindTag(TAG_THUMBNAIL_OFFSET);
+    const TiffTagStruct *LengthEntry = FindTag(TAG_THUMBNAIL_LENGTH);
+    if ((OffsetEntry == nullptr) || (LengthEntry == nullptr) || (LengthEntry->Offset == 0))
+    {
+        return false;
+    }
+
+    // The offset is from the start of the TIFF header, like the offsets of IFD data
+    const uint64_t ThumbnailOffset = static_cast<uint64_t>(mTiffHeaderOffset) + OffsetEntry->Offset;
+    if ((ThumbnailOffset > mApp1Data.Length()) || !mApp1Data.Contains(ThumbnailOffset, LengthEntry->Offset))
+    {
+        Report(SEVERITY_WARNING, DIAG_THUMBNAIL_OUT_OF_BOUNDS);
+        return false;
+    }
+
+    const cByteSpan Candidate = mApp1Data.SubSpan(ThumbnailOffset, LengthEntry->Offset);
+    if ((Candidate.Length() < TWO_BYTE_LENGTH) || (Candidate.Data()[0] != 0xFF) || (Candidate.Data()[1] != 0xD8))
+    {
+        Report(SEVERITY_WARNING, DIAG_THUMBNAIL_NOT_JPEG);
+        return false;
+    }
+    Thumbnail = Candidate;
+    return true;
+}
+
+/**
+ * @brief Forgets everything parsed from the previous image, so the parser can be reused.
+ *
+ * @return None
+ */
+void cApp1::Reset()
+{
+    mApp1Data = cByteSpan();
+    mTiffHeaderOffset = 0;
+    mLittleEndian = false;
+    mDateTime = tm();
+    mTimestamp = 0;
+    mDateTimeFound = false;
+    mDateTimeOriginal = false;
+    mHeaderValid = false;
+    mFoundTags = 0;
+}
+
+/**
+ * @brief Parses information for App1 data
+ *
+ * @param[in] App1Data The App1 data, starting at its length field. Every read is checked
+ *                     against the end of App1Data. The data must stay valid until parsing is done.
+ *
+ * @return The bytes read by this parsing function.
+ */
+const uint32_t cApp1::ParseApp(const cByteSpan &App1Data)
+{
+    Reset();
+    mApp1Data = App1Data;
+
+    size_t App1Offset = 0;
+
+    // Get the length of App1
+    const uint16_t TotalBytesRead = ReadTwoBytes(App1Data, App1Offset);
+    App1Offset += APP_DATA_SIZE_LENGTH;
+
+    // Make sure the EXIF header and TIFF header are inside of the APP1 data
+    if (!App1Data.Contains(App1Offset, EXIF_HEADER_LENGTH + TIFF_HEADER_LENGTH))
+    {
+        Report(SEVERITY_WARNING, DIAG_TIFF_HEADER_CUT_SHORT);
+        return TotalBytesRead;
+    }
+
+    const bool valid_exif_header = VerifyExifHeader(App1Data, App1Offset);
+    if (!valid_exif_header)
+    {
+        return TotalBytesRead;
+    }
+    App1Offset += EXIF_HEADER_LENGTH;
+
+    // Determine the endianness of the data.
+    const bool valid_endianess = GetEndianess(App1Data, App1Offset);
+    if (!valid_endianess)
+    {
+        return TotalBytesRead;
+    }
+
+    // All IFD offsets are based on the start of the TIFF header.
+    // At this point ParseApp has reached the start of the TIFF header so
+    // save this offset.
+    mTiffHeaderOffset = App1Offset;
+    App1Offset += ENDIAN_LENGTH;
+
+    // The next two bytes should be 0x002A
+    const uint16_t read_two_alpha_value = ReadTwoBytes(App1Data, App1Offset);
+
+    if (read_two_alpha_value != TWO_ALPHA_TAG)
+    {
+        Report(SEVERITY_WARNING, DIAG_INVALID_TIFF_MARKER, read_two_alpha_value);
+        return TotalBytesRead;
+    }
+    App1Offset += TWO_BYTE_LENGTH;
+
+    // The next four bytes contains the offset of the 0th IFD in bytes
+    // According to the standard, if the value is 0x00000008 then the 0th IFD is right after
+    // the IFD offset.
+    const uint32_t IfdOffset = ReadFourBytes(App1Data, App1Offset);
+    Report(SEVERITY_DEBUG, DIAG_IFD0_OFFSET, IfdOffset);
+
+    mHeaderValid = true;
+
+    // The byte order is fixed for the whole segment, so choose the matching decoder once
+    if (mLittleEndian)
+    {
+        IndexIfds<true>(IfdOffset);
+    }
+    else
+    {
+        IndexIfds<false>(IfdOffset);
+    }
+
+    FindDateTime();
+
+    return TotalBytesRead;
+}
+
+cExifParser::cExifParser(const std::string &ImageFileName) : cExifParser()
+{
+    ParseExifData(ImageFileName);
+}
+
+/**
+ * @brief Checks to make sure the Start of Image (SOI) exists
+ *
+ * @param[in] ImageData The image data, starting at the SOI
+ *
+ * @return True if the first two bytes indicate the SOI tag
+ *         False otherwise
+ */
+const bool cExifParser::DoesStartOfImageExist(const cByteSpan &ImageData)
+{
+    bool soi_found = false;
+    if (ImageData.Contains(0, SOI_MARKER_LENGTH_BYTES))
+    {
+        const uint16_t soi = static_cast<uint16_t>((ImageData.Data()[0] << 8) | ImageData.Data()[1]);
+        if (soi == START_OF_IMAGE_MARKER)
+        {
+            soi_found = true;
+        }
+    }
+
+    return soi_found;
+}
+
+/**
+ * @brief Determines if a marker stands on its own, without a segment length or payload.
+ *
+ * @param[in] Marker The marker, including the 0xFF prefix
+ *
+ * @return True if the marker has no segment
+ */
+const bool cExifParser::IsStandaloneMarker(const uint16_t Marker)
+{
+    const uint8_t MarkerCode = static_cast<uint8_t>(Marker & 0xFF);
+    return (MarkerCode == TEM_MARKER) ||
+           ((MarkerCode >= FIRST_RST_MARKER) && (MarkerCode <= LAST_RST_MARKER)) ||
+           (Marker == START_OF_IMAGE_MARKER) ||
+           (Marker == END_OF_IMAGE_MARKER);
+}
+
+/**
+ * @brief Determines if an APP1 segment holds EXIF data rather than XMP or other data.
+ *
+ * @param[in] Payload The APP1 payload, after the segment length
+ *
+ * @return True if the payload starts with the EXIF identifier
+ */
+const bool cExifParser::IsExifSegment(const cByteSpan &Payload)
+{
+    return Payload.Contains(0, EXIF_IDENTIFIER_LENGTH) &&
+           std::equal(EXIF_IDENTIFIER, EXIF_IDENTIFIER + EXIF_IDENTIFIER_LENGTH, Payload.Data());
+}
+
+/**
+ * @brief Parses an EXIF APP1 segment and collects the metadata that was found.
+ *
+ * @param[in] App1Data The APP1 segment, starting at its length field
+ * @param[in] App1Offset Where the segment's length field is in the image
+ *
+ * @return The metadata found in the segment
+ */
+const ExifMetadata cExifParser::ParseApp1(const cByteSpan &App1Data, const uint64_t App1Offset)
+{
+    Report(SEVERITY_DEBUG, DIAG_FOUND_APP1);
+    App1.ParseApp(App1Data);
+
+    ExifMetadata Metadata = {};
+    if (!App1.HasValidHeader())
+    {
+        Metadata.Status = EXIF_MALFORMED;
+    }
+    else
+    {
+        Metadata.Status = App1.HasDateTime() ? EXIF_OK : EXIF_NO_DATE_TIME;
+    }
+    Metadata.HasDateTime = App1.HasDateTime();
+    Metadata.DateTime = App1.GetDateTime();
+    Metadata.Timestamp = App1.GetTimestamp();
+    Metadata.FoundTags = App1.GetFoundTags();
+    Metadata.App1Offset = App1Offset;
+    Metadata.BytesConsumed = App1Offset + App1Data.Length();
+    return Metadata;
+}
+
+/**
+ * @brief Finds the next marker in the image and reads the length of its segment.
+ *
+ * @pre ImageStream is positioned at the start of a marker
+ *
+ * @param[in] ImageStream The image being parsed
+ * @param[out] Marker The marker that was found, including the 0xFF prefix
+ * @param[out] SegmentLength The length of the segment, which includes the two length bytes.
+ *                           Zero for markers that do not have a segment.
+ *
+ * @return True if a marker was read.
+ *         False if the stream ended or the data at the current position is not a marker.
+ */
+const bool cExifParser::ReadNextSegmentHeader(std::istream &ImageStream, uint16_t &Marker, uint16_t &SegmentLength)
+{
+    uint8_t MarkerBytes[APP_MARKER_LENGTH_BYTES] = {};
+    ImageStream.read(reinterpret_cast<char *>(MarkerBytes), APP_MARKER_LENGTH_BYTES);
+    if (!ImageStream || MarkerBytes[0] != MARKER_PREFIX)
+    {
+        return false;
+    }
+
+    // Any number of 0xFF fill bytes may come before the marker itself
+    while (MarkerBytes[1] == MARKER_PREFIX)
+    {
+        MarkerBytes[1] = static_cast<uint8_t>(ImageStream.get());
+        if (!ImageStream)
+        {
+            return false;
+        }
+    }
+    Marker = static_cast<uint16_t>((MarkerBytes[0] << 8) | MarkerBytes[1]);
+
+    SegmentLength = 0;
+    if (!IsStandaloneMarker(Marker))
+    {
+        uint8_t LengthBytes[SEGMENT_LENGTH_BYTES] = {};
+        ImageStream.read(reinterpret_cast<char *>(LengthBytes), SEGMENT_LENGTH_BYTES);
+        if (!ImageStream)
+        {
+            return false;
+        }
+        SegmentLength = static_cast<uint16_t>((LengthBytes[0] << 8) | LengthBytes[1]);
+    }
+
+    return true;
 }
 
 /**
 * @brief Starting point to parse EXIF data.
-*        Reads in the file and calls appropriate functions to parse the contents.
+*        Opens the file and parses the EXIF data in it.
 *
 * @param[in] ImageFileName The name of the image whose EXIF data needs to be parsed.
+*
+* @return The metadata found in the image
 */
-void cExifParser::ParseExifData(const std::string &ImageFileName)
+const ExifMetadata cExifParser::ParseExifData(const std::string &ImageFileName)
 {
+    ExifMetadata Metadata = {};
+    Report(SEVERITY_DEBUG, DIAG_PARSING_IMAGE);
     std::ifstream ImageFileStream(ImageFileName, std::ifstream::binary);
-    std::cout << "Parsing " << ImageFileName << "\n";
     if (ImageFileStream.is_open())
     {
-        std::vector<uint8_t> ReadBuffer(READ_BUFFER_LENGTH_BYTES);
-        ImageFileStream.read(reinterpret_cast<char *>(&ReadBuffer[0]), READ_BUFFER_LENGTH_BYTES);
-        std::vector<uint8_t>::iterator ExifIter = ReadBuffer.begin();
-        if (ImageFileStream && DoesStartOfImageExist(ExifIter))
+        Metadata = ParseExifData(ImageFileStream);
+        ImageFileStream.close();
+    }
+    else
+    {
+        Report(SEVERITY_ERROR, DIAG_IMAGE_NOT_FOUND);
+        Metadata.Status = EXIF_READ_ERROR;
+    }
+    return Metadata;
+}
+
+/**
+* @brief Walks the segments at the start of a JPEG and parses the EXIF data in APP1.
+*        Only the segment headers and the APP1 payload are read. Every other segment
+*        is skipped, and parsing stops at the start of the image data (SOS), so only a
+*        few KiB of a typical image are read.
+*
+* @param[in] ImageStream The image whose EXIF data needs to be parsed, positioned at the SOI marker.
+*
+* @return The metadata found in the image
+*/
+const ExifMetadata cExifParser::ParseExifData(std::istream &ImageStream)
+{
+    ExifMetadata Metadata = {};
+    App1.Reset();
+
+    const std::streampos ImageStart = ImageStream.tellg();
+    uint8_t SoiBuffer[SOI_MARKER_LENGTH_BYTES] = {};
+    ImageStream.read(reinterpret_cast<char *>(SoiBuffer), SOI_MARKER_LENGTH_BYTES);
+    if (!ImageStream || !DoesStartOfImageExist(cByteSpan(SoiBuffer, SOI_MARKER_LENGTH_BYTES)))
+    {
+        Report(SEVERITY_WARNING, DIAG_NO_START_OF_IMAGE);
+        Metadata.Status = ImageStream ? EXIF_NOT_JPEG : EXIF_CUT_SHORT;
+        return Metadata;
+    }
+
+    uint16_t Marker = 0;
+    uint16_t SegmentLength = 0;
+    while (ReadNextSegmentHeader(ImageStream, Marker, SegmentLength))
+    {
+        if ((Marker == START_OF_SCAN_MARKER) || (Marker == END_OF_IMAGE_MARKER))
         {
-            std::advance(ExifIter, SOI_MARKER_LENGTH_BYTES);
-            if (App0.DoesAppMarkerExist(ExifIter, cApp0::MARKER_NUMBER))
+            // The compressed image data follows, so there is no more metadata to find
+            break;
+        }
+        if (SegmentLength == 0)
+        {
+            continue;
+        }
+        if (SegmentLength < SEGMENT_LENGTH_BYTES)
+        {
+            Report(SEVERITY_WARNING, DIAG_INVALID_SEGMENT_LENGTH, SegmentLength);
+            break;
+        }
+
+        const uint32_t PayloadLength = SegmentLength - SEGMENT_LENGTH_BYTES;
+        if (Marker != cApp1::MARKER_NUMBER)
+        {
+            ImageStream.seekg(PayloadLength, std::ios_base::cur);
+            continue;
+        }
+
+        // ParseApp expects the buffer to start with the segment length, followed by the payload
+        mApp1Buffer.resize(SegmentLength);
+        mApp1Buffer[0] = static_cast<uint8_t>(SegmentLength >> 8);
+        mApp1Buffer[1] = static_cast<uint8_t>(SegmentLength & 0xFF);
+        ImageStream.read(reinterpret_cast<char *>(&mApp1Buffer[SEGMENT_LENGTH_BYTES]), PayloadLength);
+        if (!ImageStream)
+        {
+            Report(SEVERITY_ERROR, DIAG_READ_FAILED);
+            break;
+        }
+
+        // APP1 is also used for XMP data. Keep looking if this is not the EXIF segment.
+        const cByteSpan App1Data(mApp1Buffer);
+        if (!IsExifSegment(App1Data.SubSpan(SEGMENT_LENGTH_BYTES, PayloadLength)))
+        {
+            continue;
+        }
+
+        // The length field was read SegmentLength bytes before the current position
+        const std::streampos App1End = ImageStream.tellg();
+        const uint64_t App1Offset = ((ImageStart >= 0) && (App1End >= 0)) ?
+                                    static_cast<uint64_t>(App1End - ImageStart) - SegmentLength : 0;
+        return ParseApp1(App1Data, App1Offset);
+    }
+
+    // The stream ended part way through a segment header or payload
+    if (!ImageStream)
+    {
+        Metadata.Status = EXIF_CUT_SHORT;
+        ImageStream.clear();
+    }
+    const std::streampos SearchEnd = ImageStream.tellg();
+    if ((ImageStart >= 0) && (SearchEnd >= 0))
+    {
+        Metadata.BytesConsumed = static_cast<uint64_t>(SearchEnd - ImageStart);
+    }
+    return Metadata;
+}
+
+/**
+* @brief Walks the segments in part of a JPEG, looking for the EXIF APP1 segment.
+*        Segments are skipped using only their length, so the data of a skipped
+*        segment does not need to be present.
+*
+* @param[in] ImageData Part of the image
+* @param[in,out] Offset Where the next marker starts in ImageData. When the segment is found, set to
+*                       the start of its length field. When more data is needed, set to where the
+*                       search can resume once the data starting there is available.
+* @param[out] SegmentLength The length of the EXIF segment, which includes the two length bytes
+*
+* @return SEGMENT_FOUND if the EXIF segment is complete in ImageData.
+*         SEGMENT_NOT_FOUND if the image has no EXIF segment before its image data.
+*         SEGMENT_NEEDS_MORE_DATA if ImageData ends before the search is over.
+*/
+const cExifParser::SegmentSearch cExifParser::FindExifSegment(const cByteSpan &ImageData, size_t &Offset, uint16_t &SegmentLength)
+{
+    const uint8_t *Data = ImageData.Data();
+    while (ImageData.Contains(Offset, APP_MARKER_LENGTH_BYTES))
+    {
+        if (Data[Offset] != MARKER_PREFIX)
+        {
+            return SEGMENT_NOT_FOUND;
+        }
+
+        // Any number of 0xFF fill bytes may come before the marker itself
+        size_t PrefixOffset = Offset;
+        while (ImageData.Contains(PrefixOffset + 1, 1) && (Data[PrefixOffset + 1] == MARKER_PREFIX))
+        {
+            ++PrefixOffset;
+        }
+        const size_t LengthOffset = PrefixOffset + APP_MARKER_LENGTH_BYTES;
+        if (!ImageData.Contains(PrefixOffset, APP_MARKER_LENGTH_BYTES))
+        {
+            Offset = PrefixOffset;
+            return SEGMENT_NEEDS_MORE_DATA;
+        }
+        const uint16_t Marker = static_cast<uint16_t>((MARKER_PREFIX << 8) | Data[PrefixOffset + 1]);
+
+        if ((Marker == START_OF_SCAN_MARKER) || (Marker == END_OF_IMAGE_MARKER))
+        {
+            // The compressed image data follows, so there is no more metadata to find
+            return SEGMENT_NOT_FOUND;
+        }
+        if (IsStandaloneMarker(Marker))
+        {
+            Offset = LengthOffset;
+            continue;
+        }
+        if (!ImageData.Contains(LengthOffset, SEGMENT_LENGTH_BYTES))
+        {
+            Offset = PrefixOffset;
+            return SEGMENT_NEEDS_MORE_DATA;
+        }
+
+        SegmentLength = static_cast<uint16_t>((Data[LengthOffset] << 8) | Data[LengthOffset + 1]);
+        if (SegmentLength < SEGMENT_LENGTH_BYTES)
+        {
+            Report(SEVERITY_WARNING, DIAG_INVALID_SEGMENT_LENGTH, SegmentLength);
+            return SEGMENT_NOT_FOUND;
+        }
+
+        if (Marker == cApp1::MARKER_NUMBER)
+        {
+            if (!ImageData.Contains(LengthOffset, SegmentLength))
             {
-                std::cout << "Found APP0\n";
-                std::advance(ExifIter, APP_MARKER_LENGTH_BYTES);
-                const uint32_t BytesRead = App0.ParseApp(ExifIter);
-                std::advance(ExifIter, BytesRead);
+                Offset = PrefixOffset;
+                return SEGMENT_NEEDS_MORE_DATA;
             }
-            if (App1.DoesAppMarkerExist(ExifIter, cApp1::MARKER_NUMBER))
+            if (IsExifSegment(ImageData.SubSpan(LengthOffset + SEGMENT_LENGTH_BYTES, SegmentLength - SEGMENT_LENGTH_BYTES)))
             {
-                std::cout << "Found APP1\n";
-                std::advance(ExifIter, APP_MARKER_LENGTH_BYTES);
-                App1.SetStartOfFile(ReadBuffer.begin());
-                const uint32_t BytesRead = App1.ParseApp(ExifIter);
-                std::advance(ExifIter, BytesRead);
+                Offset = LengthOffset;
+                return SEGMENT_FOUND;
             }
         }
-        else
+        Offset = LengthOffset + SegmentLength;
+    }
+
+    return SEGMENT_NEEDS_MORE_DATA;
+}
+
+/**
+* @brief Walks the segments of a JPEG that is already in memory and parses the EXIF data in APP1.
+*        The data is parsed where it is, without being copied, and every read is checked against
+*        the end of ImageData.
+*
+* @param[in] ImageData The image, starting at the SOI marker. Only the start of the image up
+*                      to the end of APP1 needs to be present.
+*
+* @return The metadata found in the image
+*/
+const ExifMetadata cExifParser::ParseExifData(const cByteSpan &ImageData)
+{
+    ExifMetadata Metadata = {};
+    App1.Reset();
+
+    if (!DoesStartOfImageExist(ImageData))
+    {
+        Report(SEVERITY_WARNING, DIAG_NO_START_OF_IMAGE);
+        Metadata.Status = ImageData.Contains(0, SOI_MARKER_LENGTH_BYTES) ? EXIF_NOT_JPEG : EXIF_CUT_SHORT;
+        return Metadata;
+    }
+
+    size_t Offset = SOI_MARKER_LENGTH_BYTES;
+    uint16_t SegmentLength = 0;
+    const SegmentSearch Search = FindExifSegment(ImageData, Offset, SegmentLength);
+    if (Search == SEGMENT_FOUND)
+    {
+        return ParseApp1(ImageData.SubSpan(Offset, SegmentLength), Offset);
+    }
+
+    Metadata.Status = (Search == SEGMENT_NEEDS_MORE_DATA) ? EXIF_CUT_SHORT : EXIF_NOT_FOUND;
+    Metadata.BytesConsumed = (Offset < ImageData.Length()) ? Offset : ImageData.Length();
+    return Metadata;
+}
+
+/**
+* @brief Reads part of an image, retrying reads that were interrupted or cut short.
+*
+* @param[in] ImageFd The image
+* @param[in] WindowStart Where in the image to start reading
+* @param[out] Window Where to store the data
+* @param[in] WindowLength The number of bytes to read
+*
+* @return The number of bytes read, which is less than WindowLength at the end of the image,
+*         or -1 if the image could not be read.
+*/
+const long cExifParser::ReadWindow(const int ImageFd, const off_t WindowStart, uint8_t *Window, const size_t WindowLength)
+{
+    size_t BytesRead = 0;
+    while (BytesRead < WindowLength)
+    {
+        const ssize_t Result = pread(ImageFd, Window + BytesRead, WindowLength - BytesRead,
+                                     WindowStart + static_cast<off_t>(BytesRead));
+        if ((Result < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        if (Result < 0)
+        {
+            return -1;
+        }
+        if (Result == 0)
         {
-            std::cout << "Error reading the SOI bytes\n";
+            break;
         }
+        BytesRead += static_cast<size_t>(Result);
+    }
+    return static_cast<long>(BytesRead);
+}
 
-        ImageFileStream.close();
+/**
+* @brief Sends the parser's diagnostics to a sink instead of dropping them.
+*
+* @param[in] Sink The sink, which must outlive the parser
+*
+* @return None
+*/
+void cExifParser::SetDiagnosticSink(cDiagnosticSink &Sink)
+{
+    mDiagnostics = &Sink;
+    App0.SetDiagnosticSink(Sink);
+    App1.SetDiagnosticSink(Sink);
+}
+
+/**
+* @brief Writes the thumbnail of the image parsed last to its own file, such as a sidecar in a
+*        thumbnail cache. The thumbnail is written to a uniquely named temporary file that is
+*        moved into place, so a reader of the cache never sees part of a thumbnail. A file that already
+*        has the name is never replaced.
+*
+* @param[in] ThumbnailFileName Where to write the thumbnail. Its folder must exist.
+*
+* @return True if the image has a thumbnail and it was written
+*/
+const bool cExifParser::WriteThumbnail(const std::string &ThumbnailFileName)
+{
+    cByteSpan Thumbnail;
+    if (!App1.GetThumbnail(Thumbnail))
+    {
+        return false;
     }
-    else
+
+    // Each writer gets a hidden temporary file of its own beside the thumbnail, so writers
+    // of the same thumbnail never write into each other's file
+    const size_t NameStart = ThumbnailFileName.find_last_of('/') + 1;
+    std::string TemporaryFileName = ThumbnailFileName.substr(0, NameStart) + "." + ThumbnailFileName.substr(NameStart) + ".XXXXXX";
+    const int ThumbnailFd = mkostemp(&TemporaryFileName[0], O_CLOEXEC);
+    if (ThumbnailFd < 0)
+    {
+        Report(SEVERITY_WARNING, DIAG_THUMBNAIL_WRITE_FAILED, errno);
+        return false;
+    }
+
+    // mkostemp makes the file readable by its owner only
+    int Error = (fchmod(ThumbnailFd, 0644) == 0) ? 0 : errno;
+    size_t BytesWritten = 0;
+    while ((Error == 0) && (BytesWritten < Thumbnail.Length()))
+    {
+        const ssize_t Result = write(ThumbnailFd, Thumbnail.Data() + BytesWritten, Thumbnail.Length() - BytesWritten);
+        if ((Result < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        if (Result <= 0)
+        {
+            Error = (Result < 0) ? errno : EIO;
+            break;
+        }
+        BytesWritten += static_cast<size_t>(Result);
+    }
+    if ((close(ThumbnailFd) != 0) && (Error == 0))
+    {
+        Error = errno;
+    }
+
+    // A hard link fails rather than replace a file that has the name. Filesystems without
+    // hard links get a check for the name followed by a rename.
+    if (Error == 0)
+    {
+        struct stat ThumbnailInfo = {};
+        if (link(TemporaryFileName.c_str(), ThumbnailFileName.c_str()) != 0)
+        {
+            Error = errno;
+            if ((Error != EEXIST) && (lstat(ThumbnailFileName.c_str(), &ThumbnailInfo) == 0))
+            {
+                Error = EEXIST;
+            }
+            else if (Error != EEXIST)
+            {
+                Error = (rename(TemporaryFileName.c_str(), ThumbnailFileName.c_str()) == 0) ? 0 : errno;
+            }
+        }
+    }
+
+    unlink(TemporaryFileName.c_str());
+    if (Error != 0)
+    {
+        Report(SEVERITY_WARNING, DIAG_THUMBNAIL_WRITE_FAILED, Error);
+        return false;
+    }
+    return true;
+}
+
+/**
+* @brief Allocates the buffers used to parse images from a file descriptor, so that parsing
+*        does not allocate memory for any image.
+*
+* @return None
+*/
+void cExifParser::ReserveBuffers()
+{
+    mReadWindow.resize(READ_WINDOW_LENGTH);
+}
+
+/**
+* @brief Walks the segments of a JPEG file and parses the EXIF data in APP1.
+*        The start of the image is read into a window, and the window is only moved when
+*        the EXIF segment is not inside of it, so most images are parsed with one read.
+*        The window is the size of the largest segment, so it always holds a whole APP1.
+*
+* @param[in] ImageFd The image, opened for reading. Its file offset is not used or changed.
+*
+* @return The metadata found in the image
+*/
+const ExifMetadata cExifParser::ParseExifData(const int ImageFd)
+{
+    ExifMetadata Metadata = {};
+    App1.Reset();
+    if (mReadWindow.size() < READ_WINDOW_LENGTH)
     {
-        std::cout << "Could not find image\n";
+        ReserveBuffers();
     }
 
-}
\ No newline at end of file
+    off_t WindowStart = 0;
+    long WindowLength = ReadWindow(ImageFd, WindowStart, mReadWindow.data(), READ_WINDOW_LENGTH);
+    if (WindowLength < 0)
+    {
+        Report(SEVERITY_ERROR, DIAG_READ_FAILED);
+        Metadata.Status = EXIF_READ_ERROR;
+        return Metadata;
+    }
+    if (!DoesStartOfImageExist(cByteSpan(mReadWindow.data(), static_cast<size_t>(WindowLength))))
+    {
+        Report(SEVERITY_WARNING, DIAG_NO_START_OF_IMAGE);
+        Metadata.Status = (WindowLength >= static_cast<long>(SOI_MARKER_LENGTH_BYTES)) ? EXIF_NOT_JPEG : EXIF_CUT_SHORT;
+        return Metadata;
+    }
+
+    size_t Offset = SOI_MARKER_LENGTH_BYTES;
+    uint16_t SegmentLength = 0;
+    for (;;)
+    {
+        const cByteSpan Window(mReadWindow.data(), static_cast<size_t>(WindowLength));
+        const SegmentSearch Search = FindExifSegment(Window, Offset, SegmentLength);
+        if (Search == SEGMENT_FOUND)
+        {
+            return ParseApp1(Window.SubSpan(Offset, SegmentLength), static_cast<uint64_t>(WindowStart) + Offset);
+        }
+
+        // Stop at the end of the image, or if the window can not be moved any further forward
+        if ((Search == SEGMENT_NOT_FOUND) || (WindowLength < static_cast<long>(READ_WINDOW_LENGTH)) || (Offset == 0))
+        {
+            Metadata.Status = (Search == SEGMENT_NOT_FOUND) ? EXIF_NOT_FOUND : EXIF_CUT_SHORT;
+            Metadata.BytesConsumed = static_cast<uint64_t>(WindowStart) +
+                                     ((Offset < static_cast<size_t>(WindowLength)) ? Offset : static_cast<size_t>(WindowLength));
+            break;
+        }
+        WindowStart += static_cast<off_t>(Offset);
+        Offset = 0;
+        WindowLength = ReadWindow(ImageFd, WindowStart, mReadWindow.data(), READ_WINDOW_LENGTH);
+        if (WindowLength < 0)
+        {
+            Report(SEVERITY_ERROR, DIAG_READ_FAILED);
+            Metadata.Status = EXIF_READ_ERROR;
+            Metadata.BytesConsumed = static_cast<uint64_t>(WindowStart);
+            break;
+        }
+    }
+
+    return Metadata;
+}
+
+cExifBatchParser::cExifBatchParser() : mParser()
+{
+    mParser.ReserveBuffers();
+}
+
+/**
+* @brief Parses the EXIF data of each image in a list.
+*
+* @param[in] ImageFileNames The images to parse
+* @param[out] Results The metadata of each image, in the same order as ImageFileNames. Images
+*                     that could not be opened have no date. Reusing the same Results for
+*                     every batch keeps its arrays from being allocated again.
+*
+* @return None
+*/
+void cExifBatchParser::ParseFiles(const std::vector<std::string> &ImageFileNames, ExifBatchResults &Results)
+{
+    Results.Status.clear();
+    Results.HasDateTime.clear();
+    Results.DateTime.clear();
+    Results.Status.reserve(ImageFileNames.size());
+    Results.HasDateTime.reserve(ImageFileNames.size());
+    Results.DateTime.reserve(ImageFileNames.size());
+
+    for (const std::string &ImageFileName : ImageFileNames)
+    {
+        // Read through a descriptor into the parser's reserved window, so no memory is allocated
+        ExifMetadata Metadata = {};
+        mParser.Report(SEVERITY_DEBUG, DIAG_PARSING_IMAGE);
+        const int ImageFd = open(ImageFileName.c_str(), O_RDONLY | O_CLOEXEC);
+        if (ImageFd >= 0)
+        {
+            Metadata = mParser.ParseExifData(ImageFd);
+            close(ImageFd);
+        }
+        else
+        {
+            mParser.Report(SEVERITY_ERROR, DIAG_IMAGE_NOT_FOUND);
+            Metadata.Status = EXIF_READ_ERROR;
+        }
+        Results.Status.push_back(Metadata.Status);
+        Results.HasDateTime.push_back(Metadata.HasDateTime ? 1 : 0);
+        Results.DateTime.push_back(Metadata.Timestamp);
+    }
+}
@@ -5,22 +5,126 @@
 * @date 6-5-2021
 */
 
+#pragma once
+
+#include "ExifDiagnostics.hpp"
+#include <ctime>
+#include <istream>
 #include <string>
 #include <vector>
+#include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @brief Read-only view of a block of bytes, such as a memory mapped file or a buffer
+ *        that was already read while copying. Does not own or copy the data.
+ */
+class cByteSpan
+{
+private:
+    const uint8_t *mData;
+    size_t mLength;
+
+public:
+    cByteSpan() : mData(nullptr), mLength(0) {};
+    cByteSpan(const uint8_t *Data, const size_t Length) : mData(Data), mLength(Length) {};
+    cByteSpan(const std::vector<uint8_t> &Buffer) : mData(Buffer.data()), mLength(Buffer.size()) {};
+
+    const uint8_t *Data() const {return mData;}
+    const size_t Length() const {return mLength;}
+
+    /**
+     * @brief Checks if Count bytes starting at Offset are inside of the span
+     */
+    const bool Contains(const size_t Offset, const size_t Count) const {return (Offset <= mLength) && (Count <= (mLength - Offset));}
+
+    /**
+     * @brief Gets a view of part of the span. The view is cut short at the end of the span.
+     */
+    const cByteSpan SubSpan(const size_t Offset, const size_t Count) const
+    {
+        if (Offset > mLength)
+        {
+            return cByteSpan();
+        }
+        return cByteSpan(mData + Offset, (Count < (mLength - Offset)) ? Count : (mLength - Offset));
+    }
+};
+
+/**
+ * @brief Outcome of parsing an image's EXIF data. Zero is EXIF_NOT_FOUND, so metadata that is
+ *        value initialized and never filled in does not claim to have a date.
+ */
+enum ExifParseStatus : uint8_t
+{
+    EXIF_NOT_FOUND,    ///< No EXIF segment was found before the image data
+    EXIF_OK,           ///< The date and time was found
+    EXIF_NO_DATE_TIME, ///< The EXIF data was read, but has no valid date and time
+    EXIF_MALFORMED,    ///< The EXIF segment was found, but its headers are invalid so no tags were read
+    EXIF_NOT_JPEG,     ///< The image does not start with the SOI marker
+    EXIF_CUT_SHORT,    ///< The data ends before the EXIF segment was found or ruled out
+    EXIF_READ_ERROR    ///< The image could not be opened or read
+};
+
+const char *ExifParseStatusMessage(const ExifParseStatus Status);
+
+/**
+ * @brief Metadata extracted from an image's EXIF data
+ */
+struct ExifMetadata
+{
+    ExifParseStatus Status;
+    bool HasDateTime; ///< True if DateTime was found and parsed, the same as Status being EXIF_OK
+    tm   DateTime;    ///< When the photo was taken (DateTimeOriginal), or when the image was last
+                      ///< changed (DateTime) if that is not recorded or is not valid. Zero if HasDateTime is false.
+    int64_t  Timestamp;     ///< DateTime as seconds since 1970-01-01, reading it as UTC. Zero if HasDateTime is false.
+    uint32_t FoundTags;     ///< Bit cApp1::TagBit(Tag) is set for each wanted tag found in the EXIF data
+    uint64_t App1Offset;    ///< Where the EXIF segment's length field is in the image. Zero if it was not found.
+    uint64_t BytesConsumed; ///< How far into the image the parser read: the end of the EXIF segment if it
+                            ///< was found, otherwise where the search stopped. Zero if that is not known.
+};
+
+/**
+ * @brief Metadata extracted from a batch of images, kept as one array per field so a scan
+ *        of a large library stays compact. Entry N of each array belongs to the Nth image.
+ */
+struct ExifBatchResults
+{
+    std::vector<uint8_t> Status;      ///< The image's ExifParseStatus
+    std::vector<uint8_t> HasDateTime; ///< 1 if the image's DateTime was found and parsed
+    std::vector<int64_t> DateTime;    ///< Seconds since 1970-01-01, reading the EXIF date and time as UTC. Zero if not found.
+
+    const size_t Count() const {return HasDateTime.size();}
+};
 
 class cAppBase
 {
 protected:
     bool mLittleEndian;
+    cDiagnosticSink *mDiagnostics;
+
+    /**
+     * @brief Reports a diagnostic, unless the sink does not want diagnostics of this severity
+     */
+    void Report(const DiagnosticSeverity Severity, const DiagnosticCode Code, const int64_t Value = 0)
+    {
+        if (mDiagnostics->Wants(Severity))
+        {
+            mDiagnostics->Report({Severity, Code, Value});
+        }
+    }
+
 public:
-    cAppBase() : mLittleEndian(false) {};
+    cAppBase() : mLittleEndian(false), mDiagnostics(&cNullDiagnosticSink::Instance()) {};
     ~cAppBase() {};
 
-    const bool DoesAppMarkerExist(const std::vector<uint8_t>::iterator &ReadBufferIter, const uint16_t app_marker);
-    const uint16_t ReadTwoBytes(const std::vector<uint8_t>::iterator &ReadBufferIter);
-    const uint32_t ReadFourBytes(const std::vector<uint8_t>::iterator &ReadBufferIter);
-    virtual const uint32_t ParseApp(const std::vector<uint8_t>::iterator &ReadBufferIter) = 0;
+    void SetDiagnosticSink(cDiagnosticSink &Sink) {mDiagnostics = &Sink;}
+
+    const bool DoesAppMarkerExist(const cByteSpan &Data, const size_t Offset, const uint16_t app_marker);
+    const uint16_t ReadTwoBytes(const cByteSpan &Data, const size_t Offset);
+    const uint32_t ReadFourBytes(const cByteSpan &Data, const size_t Offset);
+    virtual const uint32_t ParseApp(const cByteSpan &AppData) = 0;
 };
 
 /**
@@ -33,14 +137,61 @@ public:
 
     static constexpr uint16_t MARKER_NUMBER = 0xFFE0;
 
-    const uint32_t ParseApp(const std::vector<uint8_t>::iterator &ReadBufferIter);
+    const uint32_t ParseApp(const cByteSpan &AppData);
 };
 
 /**
  * @brief Application Marker 1 is used to store EXIF metadata.
+ *
+ *        Parsing indexes the entries of IFD0, the EXIF IFD, the GPS IFD and IFD1 without
+ *        decoding their values. Only the date and time is decoded while parsing. Every
+ *        other value is decoded from the APP1 data when it is asked for, so the APP1 data
+ *        must stay valid until the values are no longer needed.
  */
 class cApp1 : public cAppBase
 {
+public:
+
+    /**
+     * @brief The IFDs that are indexed
+     */
+    enum IfdId : uint8_t
+    {
+        IFD_0,    ///< Describes the main image
+        IFD_EXIF, ///< EXIF specific values, such as when the photo was taken
+        IFD_GPS,  ///< Where the photo was taken
+        IFD_1,    ///< Describes the thumbnail image
+        IFD_COUNT
+    };
+
+    /**
+     * @brief The tags that can be indexed. Entries with any other tag are skipped.
+     *        The number, type and count of each tag is in the tag table in ExifParser.cpp.
+     */
+    enum TagId : uint8_t
+    {
+        TAG_MODEL,
+        TAG_DATE_TIME,
+        TAG_EXIF_POINTER,
+        TAG_GPS_POINTER,
+        TAG_DATE_TIME_ORIGINAL,
+        TAG_OFFSET_TIME,
+        TAG_OFFSET_TIME_ORIGINAL,
+        TAG_SUB_SEC_TIME,
+        TAG_SUB_SEC_TIME_ORIGINAL,
+        TAG_GPS_LATITUDE_REF,
+        TAG_GPS_LATITUDE,
+        TAG_GPS_LONGITUDE_REF,
+        TAG_GPS_LONGITUDE,
+        TAG_THUMBNAIL_OFFSET, ///< JPEGInterchangeFormat in IFD1
+        TAG_THUMBNAIL_LENGTH, ///< JPEGInterchangeFormatLength in IFD1
+        TAG_COUNT
+    };
+
+    static constexpr uint32_t ALL_TAGS = (1u << TAG_COUNT) - 1;
+
+    static constexpr uint32_t TagBit(const TagId Tag) {return 1u << Tag;}
+
 private:
 
     /**
@@ -51,17 +202,19 @@ private:
         uint16_t Tag;    ///< The type of information to read. See 4.6.4
         uint16_t Type;   ///< The type of data to read. See 4.6.2
         uint32_t Count;  ///< The number of values to read
-        uint32_t Offset; ///< The offset of the data to read from the start of the TIFF header
+        uint32_t Offset; ///< The offset of the data to read from the start of the TIFF header,
+                         ///< or the data itself if it fits in four bytes
+        uint32_t ValueFieldOffset; ///< Where the Offset field is in the APP1 data
     };
-    // Lengths in bytes to advance the iterator by
+    // Lengths in bytes to advance the read offset by
     static constexpr uint8_t APP_DATA_SIZE_LENGTH = 2;
     static constexpr uint8_t ENDIAN_LENGTH        = 2;
     static constexpr uint8_t TWO_BYTE_LENGTH      = 2;
     static constexpr uint8_t FOUR_BYTE_LENGTH     = 4;
     static constexpr uint8_t EXIF_HEADER_LENGTH   = 6;
+    static constexpr uint8_t RATIONAL_LENGTH      = 8; //< A four byte numerator and a four byte denominator
 
-    // Tiff tags
-    static constexpr uint16_t IFD_DATE_TIME = 0x0132;
+    static constexpr uint8_t GPS_COORDINATE_COUNT = 3; //< Degrees, minutes and seconds
 
     // Other constants
     static constexpr uint16_t LITTLE_ENDIAN_TAG = 0x4949;
@@ -70,27 +223,58 @@ private:
     static constexpr uint16_t TWO_ALPHA_TAG     = 0x2A;
     static constexpr uint8_t  BLANK_BYTE        = 0x00; //< Used to separate one IFD from another
     static constexpr uint8_t  EXPECTED_DATE_TIME_LENGTH = 20;
+    static constexpr uint8_t  TIFF_HEADER_LENGTH        = 8;  //< Endian marker, 0x002A and the offset to the 0th IFD
+    static constexpr uint8_t  IFD_ENTRY_LENGTH          = 12; //< Tag, type, count and offset
 
-    std::vector<uint8_t>::iterator start_of_file;
-    std::vector<TiffTagStruct> mIfdList;
+    cByteSpan mApp1Data; //< The APP1 segment being parsed, starting at its length field
+    size_t mTiffHeaderOffset; //< Where the TIFF header starts in mApp1Data. IFD offsets start from here.
+    TiffTagStruct mTags[TAG_COUNT]; //< The first entry found for each tag, indexed by TagId
+    uint32_t mFoundTags;  //< Bit N is set if mTags[N] was found
+    uint32_t mWantedTags; //< Bit N is set if tag N should be indexed
     tm mDateTime;
+    int64_t mTimestamp; //< mDateTime as seconds since 1970-01-01, reading it as UTC
+    bool mDateTimeFound;
+    bool mDateTimeOriginal; //< The date and time came from DateTimeOriginal rather than DateTime
+    bool mHeaderValid;      //< The EXIF and TIFF headers were valid, so the IFDs were indexed
 
-    const bool GetEndianess(const std::vector<uint8_t>::iterator &App1Iter);
-    const bool VerifyExifHeader(const std::vector<uint8_t>::iterator &App1Iter);
-    void GetTiffTagList(std::vector<uint8_t>::iterator &App1Iter);
-    void GetTiffTagData(uint32_t HeaderOffsetStart);
-    void ParseDateTime(std::vector<uint8_t>::iterator &App1Iter, const uint32_t BytesToParse);
+    const bool GetEndianess(const cByteSpan &App1Data, const size_t Offset);
+    const bool VerifyExifHeader(const cByteSpan &App1Data, const size_t Offset);
+    template <bool LittleEndian>
+    void GetTiffTagList(const cByteSpan &App1Data, size_t &Offset, const IfdId Ifd, const uint16_t EntryCount);
+    template <bool LittleEndian>
+    const uint32_t IndexIfd(const IfdId Ifd, const uint32_t IfdOffset);
+    template <bool LittleEndian>
+    void IndexIfds(const uint32_t IfdOffset);
+    const TiffTagStruct *FindTag(const TagId Tag) const;
+    const cByteSpan GetTagValue(const TiffTagStruct &Entry) const;
+    const bool GetAsciiTag(const TagId Tag, cByteSpan &Text) const;
+    const bool GetGpsCoordinate(const TagId RefTag, const TagId ValueTag, const uint8_t NegativeRef, double &Coordinate);
+    void FindDateTime();
+    void ParseDateTime(const cByteSpan &App1Data, const size_t Offset, const uint32_t BytesToParse);
 
 public:
 
     static constexpr uint16_t MARKER_NUMBER = 0xFFE1;
 
-    cApp1() : mIfdList(), mDateTime() {};
+    cApp1() : mApp1Data(), mTiffHeaderOffset(0), mTags(), mFoundTags(0), mWantedTags(ALL_TAGS),
+              mDateTime(), mTimestamp(0), mDateTimeFound(false), mDateTimeOriginal(false), mHeaderValid(false) {};
     ~cApp1() {}
 
-    const uint32_t ParseApp(const std::vector<uint8_t>::iterator &read_buffer_iter);
+    void Reset();
+    void SetWantedTags(const uint32_t WantedTags);
+    const uint32_t ParseApp(const cByteSpan &App1Data);
     const tm & GetDateTime() {return mDateTime;}
-    void SetStartOfFile(const std::vector<uint8_t>::iterator &new_start_of_file) {start_of_file = new_start_of_file;}
+    const int64_t GetTimestamp() const {return mTimestamp;}
+    const bool HasDateTime() const {return mDateTimeFound;}
+    const bool HasValidHeader() const {return mHeaderValid;}
+    const uint32_t GetFoundTags() const {return mFoundTags;}
+    const bool GetModel(cByteSpan &Model) const;
+    const bool GetSubSecTime(cByteSpan &SubSecTime) const;
+    const bool GetOffsetTime(cByteSpan &OffsetTime) const;
+    const bool GetSubSecond(uint32_t &Nanoseconds) const;
+    const bool GetUtcOffset(int32_t &OffsetSeconds) const;
+    const bool GetGpsPosition(double &Latitude, double &Longitude);
+    const bool GetThumbnail(cByteSpan &Thumbnail);
 };
 
 class cExifParser
@@ -98,27 +282,96 @@ class cExifParser
 
 private:
 
-    static constexpr uint32_t MAX_APPLICATION_DATA_LENGTH_BYTES = 0xFFFF;
     static constexpr uint32_t SOI_MARKER_LENGTH_BYTES = 2;
     static constexpr uint32_t APP_MARKER_LENGTH_BYTES = 2;
-    static constexpr uint32_t NUMBER_OF_MARKERS_TO_READ = 3; // SOI, APP0 and APP1
-    static constexpr uint32_t NUMBER_OF_DATA_REGIONS_TO_READ = 2; // APP0 and APP1
-    static constexpr uint32_t READ_BUFFER_LENGTH_BYTES = (SOI_MARKER_LENGTH_BYTES * NUMBER_OF_MARKERS_TO_READ) +
-                                                         (MAX_APPLICATION_DATA_LENGTH_BYTES * NUMBER_OF_DATA_REGIONS_TO_READ);
+    static constexpr uint32_t SEGMENT_LENGTH_BYTES    = 2;
+    static constexpr uint32_t EXIF_IDENTIFIER_LENGTH  = 6;
+    static constexpr uint32_t READ_WINDOW_LENGTH      = APP_MARKER_LENGTH_BYTES + 0xFFFF; //< Holds the largest segment, with its marker
 
     static constexpr uint16_t START_OF_IMAGE_MARKER = 0xFFD8;
+    static constexpr uint16_t END_OF_IMAGE_MARKER   = 0xFFD9;
+    static constexpr uint16_t START_OF_SCAN_MARKER  = 0xFFDA;
+    static constexpr uint8_t  MARKER_PREFIX         = 0xFF; //< Every marker starts with this byte, and it may be repeated as fill
+    static constexpr uint8_t  TEM_MARKER            = 0x01; //< Standalone marker without a length
+    static constexpr uint8_t  FIRST_RST_MARKER      = 0xD0; //< RST0 to RST7 are standalone markers without a length
+    static constexpr uint8_t  LAST_RST_MARKER       = 0xD7;
+
+    static constexpr uint8_t EXIF_IDENTIFIER[EXIF_IDENTIFIER_LENGTH] = {'E', 'x', 'i', 'f', 0x00, 0x00};
+
+    /**
+     * @brief Outcome of looking for the EXIF segment in part of an image
+     */
+    enum SegmentSearch
+    {
+        SEGMENT_FOUND,
+        SEGMENT_NOT_FOUND,
+        SEGMENT_NEEDS_MORE_DATA ///< The data ends before the EXIF segment was found or ruled out
+    };
 
     cApp0 App0;
     cApp1 App1;
+    cDiagnosticSink *mDiagnostics;
+    std::vector<uint8_t> mApp1Buffer; //< Holds the length and payload of the APP1 segment when reading from a stream
+    std::vector<uint8_t> mReadWindow; //< Holds the part of the image being searched when reading from a file descriptor
 
-    const bool DoesStartOfImageExist(const std::vector<uint8_t>::iterator &ReadBufferIter);
+    static const bool IsStandaloneMarker(const uint16_t Marker);
+    static const bool IsExifSegment(const cByteSpan &Payload);
+    static const long ReadWindow(const int ImageFd, const off_t WindowStart, uint8_t *Window, const size_t WindowLength);
+    const bool DoesStartOfImageExist(const cByteSpan &ImageData);
+    const bool ReadNextSegmentHeader(std::istream &ImageStream, uint16_t &Marker, uint16_t &SegmentLength);
+    const SegmentSearch FindExifSegment(const cByteSpan &ImageData, size_t &Offset, uint16_t &SegmentLength);
+    const ExifMetadata ParseApp1(const cByteSpan &App1Data, const uint64_t App1Offset);
+    void Report(const DiagnosticSeverity Severity, const DiagnosticCode Code, const int64_t Value = 0)
+    {
+        if (mDiagnostics->Wants(Severity))
+        {
+            mDiagnostics->Report({Severity, Code, Value});
+        }
+    }
+
+    friend class cExifBatchParser; // Reports images it could not open through the parser's sink
 
 public:
-    cExifParser() : App0(), App1() {};
+    cExifParser() : App0(), App1(), mDiagnostics(&cNullDiagnosticSink::Instance()), mApp1Buffer(), mReadWindow() {};
     cExifParser(const std::string &ImageFileName);
     ~cExifParser() {};
 
-    void ParseExifData(const std::string &ImageFileName);
+    void ReserveBuffers();
+    void SetWantedTags(const uint32_t WantedTags) {App1.SetWantedTags(WantedTags);}
+    void SetDiagnosticSink(cDiagnosticSink &Sink);
+    const ExifMetadata ParseExifData(const std::string &ImageFileName);
+    const ExifMetadata ParseExifData(std::istream &ImageStream);
+    const ExifMetadata ParseExifData(const cByteSpan &ImageData);
+    const ExifMetadata ParseExifData(const int ImageFd);
     const tm & GetDateTime() {return App1.GetDateTime();}
+    const bool GetModel(cByteSpan &Model) const {return App1.GetModel(Model);}
+    const bool GetSubSecTime(cByteSpan &SubSecTime) const {return App1.GetSubSecTime(SubSecTime);}
+    const bool GetOffsetTime(cByteSpan &OffsetTime) const {return App1.GetOffsetTime(OffsetTime);}
+    const bool GetSubSecond(uint32_t &Nanoseconds) const {return App1.GetSubSecond(Nanoseconds);}
+    const bool GetUtcOffset(int32_t &OffsetSeconds) const {return App1.GetUtcOffset(OffsetSeconds);}
+    const bool GetGpsPosition(double &Latitude, double &Longitude) {return App1.GetGpsPosition(Latitude, Longitude);}
+    const bool GetThumbnail(cByteSpan &Thumbnail) {return App1.GetThumbnail(Thumbnail);}
+    const bool WriteThumbnail(const std::string &ThumbnailFileName);
+
+};
 
-};
\ No newline at end of file
+/**
+ * @brief Parses the EXIF data of many images with one parser, so a scan of a large library
+ *        does not allocate memory for each image. Buffers are allocated up front, and the
+ *        results are appended to arrays that keep their memory from one batch to the next.
+ *
+ *        A batch parser must only be used by one thread at a time.
+ */
+class cExifBatchParser
+{
+private:
+    cExifParser mParser;
+
+public:
+    cExifBatchParser();
+    ~cExifBatchParser() {};
+
+    void SetDiagnosticSink(cDiagnosticSink &Sink) {mParser.SetDiagnosticSink(Sink);}
+
+    void ParseFiles(const std::vector<std::string> &ImageFileNames, ExifBatchResults &Results);
+};
@@ -1,5 +1,19 @@
-#include <string.h> // For memcmp
+#include <errno.h>      // For errno
+#include <fcntl.h>      // For open
+#include <unistd.h>     // For close, pread, pwrite
+#include <sys/ioctl.h>  // For ioctl
+#include <sys/sendfile.h> // For sendfile
+#include <sys/mman.h>   // For mmap, madvise
+#include <sys/stat.h>   // For fstat
+#include <linux/fs.h>   // For FICLONE
+#include <algorithm>    // For std::min, std::clamp, std::all_of
+#include <iterator>     // For std::begin, std::end
+#include <cstdlib>      // For aligned_alloc, free
+#include <memory>       // For std::unique_ptr
 #include "Filesystem.hpp"
+#include "BlockCompare.hpp"
+#include "IoRing.hpp"
+#include "XxHash64.hpp"
 
 /**
  * @brief Gets the size of a file pointed to by an ifstream
@@ -9,9 +23,9 @@
  * @param[in] infile The ifstream object to get the file size from
  *
  * @return If the file is open this function will return the file's size in bytes.
- *         If the file is not open this function will return zero bytes.
+ *         If the file is not open, or its size can not be found, this function will return zero bytes.
  */
-const unsigned int Filesystem::GetFileSize(std::ifstream &infile)
+const uint64_t Filesystem::GetFileSize(std::ifstream &infile)
 {
     if (!infile.is_open())
     {
@@ -19,159 +33,1321 @@ const unsigned int Filesystem::GetFileSize(std::ifstream &infile)
     }
 
     infile.seekg(0, infile.end);
-    unsigned int length = infile.tellg();
+    const std::streamoff length = infile.tellg();
     infile.seekg(0, infile.beg);
 
-    return length;
+    // tellg returns -1 if the stream failed, which would otherwise become a huge size
+    if (length < 0)
+    {
+        return 0;
+    }
+    return static_cast<uint64_t>(length);
 }
 
-const unsigned int Filesystem::GetFileSize(const fs::path file_path)
+const uint64_t Filesystem::GetFileSize(const fs::path file_path)
 {
     return fs::file_size(file_path);
 }
 
-const int Filesystem::CopyFile(const fs::path &source_file, const fs::path &destination_file)
+/**
+ * @brief Sets the size of the chunks streamed through user space by the buffered
+ *        copy and by Verify. Larger chunks mean fewer syscalls for large video files.
+ *
+ * @param[in] chunk_size The new chunk size in bytes. Clamped to MIN_CHUNK_SIZE and MAX_CHUNK_SIZE.
+ *
+ * @return None
+ */
+void Filesystem::SetChunkSize(const size_t chunk_size)
 {
-    std::ifstream infile;
-    std::ofstream outfile;
+    mChunkSize.store(std::clamp(chunk_size, MIN_CHUNK_SIZE, MAX_CHUNK_SIZE), std::memory_order_relaxed);
+}
 
-    infile.open(source_file.string(),std::ifstream::binary);
-    if (!infile)
+/**
+ * @brief Sets the scheduler that limits the bandwidth and streams of every copy, hash and
+ *        verify. Reads and writes on devices the scheduler has no limits for are not held back.
+ *
+ * @param[in] scheduler The scheduler, or nullptr to not limit anything. Must outlive every
+ *                      call made while it is set.
+ *
+ * @return None
+ */
+void Filesystem::SetScheduler(const IoScheduler *scheduler)
+{
+    mScheduler.store(scheduler, std::memory_order_release);
+}
+
+/**
+ * @brief Reads exactly length bytes from a file, retrying short reads.
+ *
+ * @param[in] fd Descriptor of the file to read
+ * @param[out] buffer Where to store the data. Must hold at least length bytes.
+ * @param[in] length The number of bytes to read
+ * @param[in] offset The offset in the file to start reading from
+ *
+ * @return NO_ERROR if every byte was read.
+ *         SOURCE_FILE_READ_ERR if the read failed or the file ended early.
+ */
+const int Filesystem::ReadFully(const int fd, char *buffer, const size_t length, const uint64_t offset)
+{
+    size_t bytes_read = 0;
+    while (bytes_read < length)
     {
-        return SOURCE_FILE_OPEN_ERR;
+        const ssize_t result = pread(fd, buffer + bytes_read, length - bytes_read, static_cast<off_t>(offset + bytes_read));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            return SOURCE_FILE_READ_ERR;
+        }
+        bytes_read += result;
     }
+    return NO_ERROR;
+}
 
-    outfile.open(destination_file.c_str(), std::ofstream::binary);
-    if (!outfile)
+/**
+ * @brief Determines if a failed copy_file_range, sendfile or FICLONE call means the
+ *        filesystems do not support the operation, rather than an I/O failure.
+ *
+ * @param[in] error_number The errno value set by the failed call
+ *
+ * @return True if the next copy strategy should be tried.
+ *         False if the error should be reported to the caller.
+ */
+static bool IsUnsupportedError(const int error_number)
+{
+    return (error_number == ENOSYS)     || (error_number == EXDEV) ||
+           (error_number == EINVAL)     || (error_number == EOPNOTSUPP) ||
+           (error_number == ENOTSUP)    || (error_number == ENOTTY) ||
+           (error_number == EBADF)      || (error_number == EPERM);
+}
+
+/**
+ * @brief Determines which file an error from a kernel side copy belongs to.
+ *
+ * @param[in] error_number The errno value set by the failed call
+ *
+ * @return DEST_FILE_READ_ERR if the destination could not be written,
+ *         SOURCE_FILE_READ_ERR otherwise.
+ */
+const int Filesystem::KernelCopyError(const int error_number)
+{
+    if ((error_number == ENOSPC) || (error_number == EFBIG) || (error_number == EDQUOT))
     {
-        infile.close();
-        return DEST_FILE_OPEN_ERR;
+        return DEST_FILE_READ_ERR;
     }
+    return SOURCE_FILE_READ_ERR;
+}
 
-    const unsigned int file_size = Filesystem::GetFileSize(infile);
-    unsigned long curr_byte = 0;
-    char buffer[CHUNK_SIZE] = {};
+/**
+ * @brief Clones the source file into the destination so they share the same extents.
+ *        Only supported when both files are on the same copy-on-write filesystem
+ *        (btrfs, XFS with reflink, etc).
+ *
+ * @param[in] source_fd Descriptor of the source file, opened for reading
+ * @param[in] dest_fd Descriptor of the empty destination file, opened for writing
+ *
+ * @return NO_ERROR if the clone succeeded.
+ *         STRATEGY_UNSUPPORTED if the filesystem could not clone the file.
+ */
+const int Filesystem::TryReflink(const int source_fd, const int dest_fd)
+{
+    if (ioctl(dest_fd, FICLONE, source_fd) == 0)
+    {
+        return NO_ERROR;
+    }
+    return STRATEGY_UNSUPPORTED;
+}
 
-    for(; (curr_byte + CHUNK_SIZE) < file_size; curr_byte += CHUNK_SIZE)
+/**
+ * @brief Picks how much of a file to hand to the kernel in one copy call. A throttled copy
+ *        is handed over a chunk at a time, so its bandwidth is spread over the whole copy.
+ *
+ * @param[in] remaining Bytes left to copy
+ * @param[in] streams The copy's scheduler streams
+ *
+ * @return The size of the next request
+ */
+const size_t Filesystem::KernelCopyRequest(const uint64_t remaining, const CopyStreams &streams)
+{
+    const size_t largest = streams.IsThrottled() ? GetChunkSize() : MAX_KERNEL_COPY_SIZE;
+    return static_cast<size_t>(std::min<uint64_t>(remaining, largest));
+}
+
+/**
+ * @brief Copies the file inside the kernel with copy_file_range.
+ *        Some filesystems offload this to the storage server so no data crosses the network.
+ *
+ * @param[in] source_fd Descriptor of the source file, opened for reading
+ * @param[in] dest_fd Descriptor of the destination file, opened for writing
+ * @param[in] file_size The number of bytes to copy
+ * @param[in,out] copied The number of bytes already copied. Updated as data is copied,
+ *                       so the next strategy can continue where this one stopped.
+ * @param[in,out] streams The copy's scheduler streams, which each request is throttled by
+ *
+ * @return NO_ERROR if every byte was copied.
+ *         STRATEGY_UNSUPPORTED if copy_file_range can not be used for these files.
+ *         SOURCE_FILE_READ_ERR or DEST_FILE_READ_ERR if the copy failed.
+ */
+const int Filesystem::CopyWithCopyFileRange(const int source_fd, const int dest_fd, const uint64_t file_size, uint64_t &copied,
+                                            CopyStreams &streams)
+{
+    while (copied < file_size)
     {
-        infile.read(buffer,CHUNK_SIZE);
-        if (!infile)
+        const size_t request = KernelCopyRequest(file_size - copied, streams);
+        streams.Throttle(request);
+        loff_t source_offset = static_cast<loff_t>(copied);
+        loff_t dest_offset   = static_cast<loff_t>(copied);
+        const ssize_t bytes_copied = copy_file_range(source_fd, &source_offset, dest_fd, &dest_offset, request, 0);
+        if (bytes_copied < 0)
         {
-            infile.close();
-            outfile.close();
-            return SOURCE_FILE_READ_ERR;
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return IsUnsupportedError(errno) ? STRATEGY_UNSUPPORTED : KernelCopyError(errno);
         }
-        outfile.write(buffer, CHUNK_SIZE);
-        if (!outfile)
+        if (bytes_copied == 0)
         {
-            infile.close();
-            outfile.close();
-            return DEST_FILE_READ_ERR;
+            // Some filesystems report zero bytes instead of an error when they
+            // can not service the request. Let the next strategy finish the copy.
+            return STRATEGY_UNSUPPORTED;
         }
+        copied += bytes_copied;
+    }
+    return NO_ERROR;
+}
+
+/**
+ * @brief Copies the file inside the kernel with sendfile.
+ *
+ * @param[in] source_fd Descriptor of the source file, opened for reading
+ * @param[in] dest_fd Descriptor of the destination file, opened for writing
+ * @param[in] file_size The number of bytes to copy
+ * @param[in,out] copied The number of bytes already copied. Updated as data is copied.
+ * @param[in,out] streams The copy's scheduler streams, which each request is throttled by
+ *
+ * @return NO_ERROR if every byte was copied.
+ *         STRATEGY_UNSUPPORTED if sendfile can not be used for these files.
+ *         SOURCE_FILE_READ_ERR or DEST_FILE_READ_ERR if the copy failed.
+ */
+const int Filesystem::CopyWithSendfile(const int source_fd, const int dest_fd, const uint64_t file_size, uint64_t &copied,
+                                       CopyStreams &streams)
+{
+    // sendfile writes at the destination's file position, which copy_file_range left untouched
+    if (lseek(dest_fd, static_cast<off_t>(copied), SEEK_SET) != static_cast<off_t>(copied))
+    {
+        return DEST_FILE_READ_ERR;
     }
 
-    if ((curr_byte < file_size) && infile && outfile)
+    while (copied < file_size)
     {
-        unsigned long BytesLeft = file_size - curr_byte;
-        infile.read(buffer,BytesLeft);
-        if (!infile)
+        const size_t request = KernelCopyRequest(file_size - copied, streams);
+        streams.Throttle(request);
+        off_t source_offset = static_cast<off_t>(copied);
+        const ssize_t bytes_copied = sendfile(dest_fd, source_fd, &source_offset, request);
+        if (bytes_copied < 0)
         {
-            infile.close();
-            outfile.close();
-            return SOURCE_FILE_READ_ERR;
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return IsUnsupportedError(errno) ? STRATEGY_UNSUPPORTED : KernelCopyError(errno);
         }
-        outfile.write(buffer, BytesLeft);
-        if (!outfile)
+        if (bytes_copied == 0)
         {
-            infile.close();
-            outfile.close();
-            return DEST_FILE_READ_ERR;
+            return STRATEGY_UNSUPPORTED;
         }
+        copied += bytes_copied;
     }
-    infile.close();
-    outfile.close();
     return NO_ERROR;
 }
 
-const int Filesystem::Verify(const fs::path &source_file, const fs::path &destination_file)
+/**
+ * @brief An IoRing and a registered block of buffers that a thread shares between the
+ *        read ahead streams it opens, so opening a stream for each small photo does not
+ *        set up a ring, map it and register buffers every time. Each thread keeps one,
+ *        with room for MAX_STREAMS streams at once, such as the two files Verify compares.
+ *        Requests of every stream on the ring are in flight together, and each completion
+ *        is handed to the stream that queued it.
+ */
+class Filesystem::StreamRing
 {
-    std::ifstream source_infile;
-    std::ifstream dest_infile;
+public:
+
+    static constexpr size_t MAX_STREAMS = 2;
+
+    explicit StreamRing(const size_t chunk_size) :
+        mChunkSize(chunk_size),
+        mBuffers(static_cast<uint8_t *>(aligned_alloc(DIRECT_IO_ALIGNMENT, BufferBytes(chunk_size))), free),
+        mRing(static_cast<unsigned int>(MAX_STREAMS * READ_AHEAD_DEPTH)),
+        mOwners()
+    {
+        if (mBuffers)
+        {
+            mRing.RegisterBuffer(mBuffers.get(), BufferBytes(chunk_size));
+        }
+    }
+
+    StreamRing(const StreamRing &) = delete;
+    StreamRing &operator=(const StreamRing &) = delete;
+
+    /**
+     * @brief Gets the calling thread's ring. A new one is made if the chunk size has
+     *        changed since the ring was made and no stream is using it.
+     */
+    static StreamRing &ForThisThread()
+    {
+        static thread_local std::unique_ptr<StreamRing> thread_ring;
+        if (!thread_ring || ((thread_ring->mChunkSize != GetChunkSize()) && thread_ring->IsIdle()))
+        {
+            thread_ring.reset();
+            thread_ring.reset(new StreamRing(GetChunkSize()));
+        }
+        return *thread_ring;
+    }
+
+    /**
+     * @brief Gives a stream READ_AHEAD_DEPTH buffers of ChunkSize() bytes and a share of the ring.
+     *
+     * @param[in] stream The stream
+     * @param[out] index The stream's place on the ring, passed to the other members
+     *
+     * @return False if the ring already has MAX_STREAMS streams or its buffers could not be allocated
+     */
+    const bool Attach(ReadAheadStream *stream, size_t &index)
+    {
+        for (index = 0; mBuffers && (index < MAX_STREAMS); ++index)
+        {
+            if (mOwners[index] == nullptr)
+            {
+                mOwners[index] = stream;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Detach(const size_t index) {mOwners[index] = nullptr;}
+
+    const size_t ChunkSize() const {return mChunkSize;}
+    uint8_t *BuffersFor(const size_t index) const {return mBuffers.get() + (index * READ_AHEAD_DEPTH * mChunkSize);}
+    IoRing &Ring() {return mRing;}
+
+    static const uint64_t Tag(const size_t index, const size_t slot) {return (static_cast<uint64_t>(index) << 32) | slot;}
+
+    const bool WaitOne();
+
+private:
+
+    const size_t mChunkSize;
+    std::unique_ptr<uint8_t, void (*)(void *)> mBuffers;
+    IoRing mRing;
+    ReadAheadStream *mOwners[MAX_STREAMS];
+
+    static const size_t BufferBytes(const size_t chunk_size)
+    {
+        return (((chunk_size * READ_AHEAD_DEPTH * MAX_STREAMS) + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT) * DIRECT_IO_ALIGNMENT;
+    }
+
+    const bool IsIdle() const
+    {
+        return std::all_of(std::begin(mOwners), std::end(mOwners), [](const ReadAheadStream *owner) {return owner == nullptr;});
+    }
+};
+
+/**
+ * @brief Streams part of a file through a small ring of buffers, keeping reads of the
+ *        chunks ahead of the caller in flight so the device is not left idle while the
+ *        caller hashes, compares or writes the current chunk. Chunks are handed out in
+ *        order, GetChunkSize() bytes at a time.
+ *
+ *        A chunk can also be written back out to another file. Its buffer is then only
+ *        reused once the write has finished, so one thread keeps reads of one file and
+ *        writes of another in flight at the same time.
+ *
+ *        Given a scheduler stream, each read waits for the device's bandwidth before it
+ *        is started.
+ *
+ *        The buffers and ring come from the thread's StreamRing. A thread that already
+ *        has StreamRing::MAX_STREAMS streams open gets a ring of its own for the stream.
+ */
+class Filesystem::ReadAheadStream
+{
+    friend class StreamRing;
+
+private:
+
+    enum SlotState
+    {
+        SLOT_FREE,    ///< Not in use
+        SLOT_READING, ///< A read into the slot is in flight
+        SLOT_READY,   ///< Holds a chunk the caller has not asked for yet
+        SLOT_HELD,    ///< Holds the chunk last handed to the caller
+        SLOT_WRITING  ///< A write from the slot is in flight
+    };
+
+    struct Slot
+    {
+        SlotState State;
+        uint64_t  Offset; ///< Offset of the slot's chunk in the file
+        size_t    Length; ///< Size of the slot's chunk
+        size_t    Done;   ///< Bytes of the chunk read or written so far
+    };
+
+    static constexpr size_t NO_SLOT = static_cast<size_t>(-1);
+
+    const int      mFd;
+    const uint64_t mEndOffset;
+    std::unique_ptr<StreamRing> mOwnRing; ///< Only made if the thread's ring is full
+    size_t         mRingIndex;  ///< The stream's place on its ring, set by AttachRing
+    StreamRing    *mStreamRing;
+    const size_t   mChunkSize;
+    const size_t   mSlotCount;
+    uint8_t       *mBuffers;
+    std::unique_ptr<Slot[]> mSlots;
+    size_t   mInFlight;    ///< Requests queued on the ring that have not completed
+    IoScheduler::Stream *mThrottle;
+    uint64_t mNextRead;    ///< Offset of the next chunk to start reading
+    uint64_t mNextHandOut; ///< Offset of the next chunk to hand to the caller
+    size_t   mHeldSlot;
+    int      mWriteFd;
+    int      mError;
+
+    static const size_t SlotCountFor(const uint64_t length, const size_t chunk_size)
+    {
+        const uint64_t chunk_count = (length + chunk_size - 1) / chunk_size;
+        return static_cast<size_t>(std::clamp<uint64_t>(chunk_count, 1, READ_AHEAD_DEPTH));
+    }
+
+    /**
+     * @brief Attaches to the thread's ring, or to a ring of the stream's own if that is full
+     */
+    StreamRing *AttachRing()
+    {
+        StreamRing &thread_ring = StreamRing::ForThisThread();
+        if (thread_ring.Attach(this, mRingIndex))
+        {
+            return &thread_ring;
+        }
+        mOwnRing.reset(new StreamRing(GetChunkSize()));
+        return mOwnRing->Attach(this, mRingIndex) ? mOwnRing.get() : nullptr;
+    }
+
+    const size_t SlotFor(const uint64_t offset) const {return static_cast<size_t>((offset / mChunkSize) % mSlotCount);}
+    uint8_t *BufferFor(const size_t slot) const {return mBuffers + (slot * mChunkSize);}
+
+    void QueueSlot(const size_t slot)
+    {
+        Slot &entry = mSlots[slot];
+        uint8_t *data = BufferFor(slot) + entry.Done;
+        const size_t remaining = entry.Length - entry.Done;
+        const uint64_t tag = StreamRing::Tag(mRingIndex, slot);
+        IoRing &ring = mStreamRing->Ring();
+        const bool queued = (entry.State == SLOT_READING) ? ring.PrepareRead(mFd, data, remaining, entry.Offset + entry.Done, tag)
+                                                          : ring.PrepareWrite(mWriteFd, data, remaining, entry.Offset + entry.Done, tag);
+        if (queued)
+        {
+            ++mInFlight;
+        }
+        else
+        {
+            entry.State = SLOT_FREE;
+            mError = (mError != NO_ERROR) ? mError : SOURCE_FILE_READ_ERR;
+        }
+    }
+
+    void StartReads()
+    {
+        while ((mError == NO_ERROR) && (mNextRead < mEndOffset))
+        {
+            const size_t slot = SlotFor(mNextRead);
+            Slot &entry = mSlots[slot];
+            if (entry.State != SLOT_FREE)
+            {
+                break;
+            }
+            entry.State  = SLOT_READING;
+            entry.Offset = mNextRead;
+            entry.Length = static_cast<size_t>(std::min<uint64_t>(mEndOffset - mNextRead, mChunkSize));
+            entry.Done   = 0;
+            if (mThrottle != nullptr)
+            {
+                mThrottle->Throttle(entry.Length);
+            }
+            QueueSlot(slot);
+            mNextRead += entry.Length;
+        }
+    }
+
+    void Submit()
+    {
+        if (mStreamRing->Ring().Submit() < 0)
+        {
+            mError = SOURCE_FILE_READ_ERR;
+        }
+    }
+
+    /**
+     * @brief Waits for one read or write on the ring to finish, which may belong to
+     *        another stream sharing the ring.
+     *
+     * @return False if nothing of this stream's was in flight to wait for
+     */
+    const bool WaitForSlot()
+    {
+        if ((mInFlight == 0) || !mStreamRing->WaitOne())
+        {
+            if (mError == NO_ERROR)
+            {
+                mError = SOURCE_FILE_READ_ERR;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Updates the slot of a read or write that finished.
+     *        Partial transfers are queued again for the rest of the chunk.
+     *
+     * @param[in] slot The slot
+     * @param[in] result The result of the read or write
+     *
+     * @return None
+     */
+    void Complete(const size_t slot, const int result)
+    {
+        --mInFlight;
+        Slot &entry = mSlots[slot];
+        const bool is_read = (entry.State == SLOT_READING);
+        if (result <= 0)
+        {
+            // A read returning no data means the file is shorter than expected
+            entry.State = SLOT_FREE;
+            if (mError == NO_ERROR)
+            {
+                mError = is_read ? SOURCE_FILE_READ_ERR : DEST_FILE_READ_ERR;
+            }
+            return;
+        }
+
+        entry.Done += static_cast<size_t>(result);
+        if (entry.Done < entry.Length)
+        {
+            QueueSlot(slot);
+            Submit();
+            return;
+        }
+        entry.State = is_read ? SLOT_READY : SLOT_FREE;
+    }
+
+    void ReleaseHeldSlot()
+    {
+        if (mHeldSlot != NO_SLOT)
+        {
+            mSlots[mHeldSlot].State = SLOT_FREE;
+            mHeldSlot = NO_SLOT;
+        }
+    }
+
+public:
+
+    /**
+     * @param[in] fd Descriptor of the file to read, owned by the caller
+     * @param[in] start_offset Where to start reading
+     * @param[in] end_offset Where to stop reading. Normally the size of the file.
+     * @param[in,out] throttle The stream the reads are throttled by, or nullptr to read at full speed
+     */
+    ReadAheadStream(const int fd, const uint64_t start_offset, const uint64_t end_offset,
+                    IoScheduler::Stream *throttle = nullptr) :
+        mFd(fd),
+        mEndOffset(end_offset),
+        mOwnRing(),
+        mRingIndex(0),
+        mStreamRing(AttachRing()),
+        mChunkSize((mStreamRing != nullptr) ? mStreamRing->ChunkSize() : GetChunkSize()),
+        mSlotCount(SlotCountFor(end_offset - std::min(start_offset, end_offset), mChunkSize)),
+        mBuffers((mStreamRing != nullptr) ? mStreamRing->BuffersFor(mRingIndex) : nullptr),
+        mSlots(new Slot[mSlotCount]()),
+        mInFlight(0),
+        mThrottle(throttle),
+        mNextRead(start_offset),
+        mNextHandOut(start_offset),
+        mHeldSlot(NO_SLOT),
+        mWriteFd(-1),
+        mError((mStreamRing != nullptr) ? NO_ERROR : SOURCE_FILE_READ_ERR)
+    {
+    }
+
+    ~ReadAheadStream()
+    {
+        // The kernel may still be using the buffers, so every request has to finish first
+        Finish();
+        if (mStreamRing != nullptr)
+        {
+            mStreamRing->Detach(mRingIndex);
+        }
+    }
+
+    ReadAheadStream(const ReadAheadStream &) = delete;
+    ReadAheadStream &operator=(const ReadAheadStream &) = delete;
+
+    /**
+     * @brief Gets the next chunk of the file. The chunk stays valid until the next call
+     *        to Next, WriteBack or Finish.
+     *
+     * @param[out] data The chunk, or nullptr once the end has been reached
+     * @param[out] length The size of the chunk, or zero once the end has been reached
+     *
+     * @return NO_ERROR, SOURCE_FILE_READ_ERR if the file could not be read, or
+     *         DEST_FILE_READ_ERR if an earlier WriteBack failed.
+     */
+    const int Next(const uint8_t *&data, size_t &length)
+    {
+        data   = nullptr;
+        length = 0;
+        ReleaseHeldSlot();
+        if ((mError != NO_ERROR) || (mNextHandOut >= mEndOffset))
+        {
+            return mError;
+        }
+
+        const size_t slot = SlotFor(mNextHandOut);
+        StartReads();
+        Submit();
+        while ((mError == NO_ERROR) && (mSlots[slot].State != SLOT_READY))
+        {
+            WaitForSlot();
+            StartReads();
+            Submit();
+        }
+        if (mError != NO_ERROR)
+        {
+            return mError;
+        }
+
+        mSlots[slot].State = SLOT_HELD;
+        mHeldSlot = slot;
+        data   = BufferFor(slot);
+        length = mSlots[slot].Length;
+        mNextHandOut += length;
+        return NO_ERROR;
+    }
+
+    /**
+     * @brief Writes the chunk last returned by Next to the same offset in another file.
+     *        The write finishes in the background.
+     *
+     * @param[in] dest_fd Descriptor of the file to write to. Must be the same for every call.
+     *
+     * @return None
+     */
+    void WriteBack(const int dest_fd)
+    {
+        if (mHeldSlot == NO_SLOT)
+        {
+            return;
+        }
+        mWriteFd = dest_fd;
+        Slot &entry = mSlots[mHeldSlot];
+        entry.State = SLOT_WRITING;
+        entry.Done  = 0;
+        QueueSlot(mHeldSlot);
+        mHeldSlot = NO_SLOT;
+        Submit();
+    }
+
+    /**
+     * @brief Waits for every read and write still in flight. No new reads are started.
+     *
+     * @return NO_ERROR if every read and write succeeded, or the first error seen
+     */
+    const int Finish()
+    {
+        ReleaseHeldSlot();
+        if (mStreamRing == nullptr)
+        {
+            return mError;
+        }
+        Submit();
+        while ((mInFlight > 0) && WaitForSlot())
+        {
+        }
+        return mError;
+    }
+};
+
+/**
+ * @brief Waits for one request on the ring to finish and hands it to the stream that queued it.
+ *
+ * @return False if nothing was in flight to wait for
+ */
+const bool Filesystem::StreamRing::WaitOne()
+{
+    IoRing::Completion completion = {};
+    if (!mRing.WaitCompletion(completion))
+    {
+        return false;
+    }
+    const size_t index = static_cast<size_t>(completion.UserData >> 32);
+    const size_t slot  = static_cast<size_t>(completion.UserData & 0xFFFFFFFFULL);
+    if ((index < MAX_STREAMS) && (mOwners[index] != nullptr))
+    {
+        mOwners[index]->Complete(slot, completion.Result);
+    }
+    return true;
+}
+
+/**
+ * @brief Copies the file through user space buffers.
+ *        Used when the kernel can not copy the file on its own. Reads of the chunks
+ *        ahead and writes of the chunks behind are kept in flight together.
+ *
+ * @param[in] source_fd Descriptor of the source file, opened for reading
+ * @param[in] dest_fd Descriptor of the destination file, opened for writing
+ * @param[in] file_size The number of bytes to copy
+ * @param[in,out] copied The number of bytes already copied. Set to file_size once every byte is copied.
+ * @param[in,out] streams The copy's scheduler streams, which each read and write is throttled by
+ * @param[in,out] hash If not null, every byte copied is also added to this hash
+ *
+ * @return NO_ERROR if every byte was copied.
+ *         SOURCE_FILE_READ_ERR or DEST_FILE_READ_ERR if the copy failed.
+ */
+const int Filesystem::CopyBuffered(const int source_fd, const int dest_fd, const uint64_t file_size, uint64_t &copied,
+                                   CopyStreams &streams, XxHash64 *hash)
+{
+    posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    ReadAheadStream source(source_fd, copied, file_size, &streams.Read);
+    const uint8_t *data = nullptr;
+    size_t length = 0;
+    for (;;)
+    {
+        const int result = source.Next(data, length);
+        if (result != NO_ERROR)
+        {
+            return result;
+        }
+        if (length == 0)
+        {
+            break;
+        }
+        if (hash != nullptr)
+        {
+            hash->Update(data, length);
+        }
+        streams.Write.Throttle(length);
+        source.WriteBack(dest_fd);
+    }
 
-    source_infile.open(source_file.string(),std::ifstream::binary);
-    if (!source_infile)
+    const int result = source.Finish();
+    if (result == NO_ERROR)
+    {
+        copied = file_size;
+    }
+    return result;
+}
+
+const int Filesystem::CopyFile(const fs::path &source_file, const fs::path &destination_file)
+{
+    CopyStrategy strategy_used = BUFFERED;
+    return CopyFile(source_file, destination_file, strategy_used);
+}
+
+/**
+ * @brief Copies a file, letting the kernel move the data whenever possible.
+ *        A reflink clone is tried first, then copy_file_range, then sendfile, and
+ *        only if none of those are supported is the data copied through a buffer.
+ *
+ * @param[in] source_file The file to copy
+ * @param[in] destination_file Where to copy the file to. Overwritten if it exists.
+ * @param[out] strategy_used The strategy that finished the copy
+ *
+ * @return NO_ERROR if the file was copied, or one of the ErrorCodes otherwise.
+ */
+const int Filesystem::CopyFile(const fs::path &source_file, const fs::path &destination_file, CopyStrategy &strategy_used)
+{
+    const int source_fd = open(source_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source_fd < 0)
     {
         return SOURCE_FILE_OPEN_ERR;
     }
 
-    dest_infile.open(destination_file.c_str(), std::ofstream::binary);
-    if (!dest_infile)
+    struct stat source_stat = {};
+    if (fstat(source_fd, &source_stat) != 0)
+    {
+        close(source_fd);
+        return SOURCE_FILE_READ_ERR;
+    }
+
+    const int dest_fd = open(destination_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (dest_fd < 0)
     {
-        source_infile.close();
+        close(source_fd);
         return DEST_FILE_OPEN_ERR;
     }
 
-    const unsigned int source_file_size = Filesystem::GetFileSize(source_infile);
-    const unsigned int dest_file_size   = Filesystem::GetFileSize(dest_infile);
+    const uint64_t file_size = static_cast<uint64_t>(source_stat.st_size);
+    uint64_t copied = 0;
+    int result = STRATEGY_UNSUPPORTED;
+    CopyStreams streams = {{GetScheduler(), source_fd, IoScheduler::TRAFFIC_COPY, IoScheduler::IO_READ},
+                           {GetScheduler(), dest_fd, IoScheduler::TRAFFIC_COPY, IoScheduler::IO_WRITE}};
 
-    if (source_file_size != dest_file_size)
+    strategy_used = REFLINK;
+    if (file_size > 0)
     {
-        return -1;
+        result = TryReflink(source_fd, dest_fd);
+    }
+    else
+    {
+        result = NO_ERROR;
+    }
+
+    if (result == STRATEGY_UNSUPPORTED)
+    {
+        strategy_used = COPY_FILE_RANGE;
+        result = CopyWithCopyFileRange(source_fd, dest_fd, file_size, copied, streams);
+    }
+
+    if (result == STRATEGY_UNSUPPORTED)
+    {
+        strategy_used = SENDFILE;
+        result = CopyWithSendfile(source_fd, dest_fd, file_size, copied, streams);
+    }
+
+    if (result == STRATEGY_UNSUPPORTED)
+    {
+        strategy_used = BUFFERED;
+        result = CopyBuffered(source_fd, dest_fd, file_size, copied, streams);
+    }
+
+    close(source_fd);
+    if (close(dest_fd) != 0 && result == NO_ERROR)
+    {
+        result = DEST_FILE_READ_ERR;
+    }
+    return result;
+}
+
+/**
+ * @brief Copies a file and hashes its contents in the same pass, so the source only
+ *        has to be read once. The copy can later be checked with VerifyDigest, which
+ *        only reads the destination.
+ *
+ *        The data has to pass through user space to be hashed, so the kernel copy
+ *        strategies are not used.
+ *
+ * @param[in] source_file The file to copy
+ * @param[in] destination_file Where to copy the file to. Overwritten if it exists.
+ * @param[out] digest The XXH64 digest of the source file's contents
+ *
+ * @return NO_ERROR if the file was copied, or one of the ErrorCodes otherwise.
+ */
+const int Filesystem::CopyFileWithDigest(const fs::path &source_file, const fs::path &destination_file, uint64_t &digest)
+{
+    const int source_fd = open(source_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source_fd < 0)
+    {
+        return SOURCE_FILE_OPEN_ERR;
+    }
+
+    struct stat source_stat = {};
+    if (fstat(source_fd, &source_stat) != 0)
+    {
+        close(source_fd);
+        return SOURCE_FILE_READ_ERR;
+    }
+
+    const int dest_fd = open(destination_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (dest_fd < 0)
+    {
+        close(source_fd);
+        return DEST_FILE_OPEN_ERR;
+    }
+
+    XxHash64 hash;
+    uint64_t copied = 0;
+    CopyStreams streams = {{GetScheduler(), source_fd, IoScheduler::TRAFFIC_COPY, IoScheduler::IO_READ},
+                           {GetScheduler(), dest_fd, IoScheduler::TRAFFIC_COPY, IoScheduler::IO_WRITE}};
+    int result = CopyBuffered(source_fd, dest_fd, static_cast<uint64_t>(source_stat.st_size), copied, streams, &hash);
+    digest = hash.Digest();
+
+    close(source_fd);
+    if (close(dest_fd) != 0 && result == NO_ERROR)
+    {
+        result = DEST_FILE_READ_ERR;
+    }
+    return result;
+}
+
+/**
+ * @brief Hashes the contents of an open file in chunks of GetChunkSize() bytes,
+ *        keeping reads of the next chunks in flight while the current one is hashed.
+ *
+ * @param[in] fd Descriptor of the file to hash
+ * @param[in] file_size The number of bytes to hash
+ * @param[out] digest The XXH64 digest of the file's contents
+ *
+ * @return NO_ERROR if the file was hashed.
+ *         SOURCE_FILE_READ_ERR if the file could not be read.
+ */
+const int Filesystem::HashFile(const int fd, const uint64_t file_size, uint64_t &digest)
+{
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    IoScheduler::Stream throttle(GetScheduler(), fd, IoScheduler::TRAFFIC_VERIFY, IoScheduler::IO_READ);
+    ReadAheadStream stream(fd, 0, file_size, &throttle);
+    XxHash64 hash;
+    const uint8_t *data = nullptr;
+    size_t length = 0;
+    for (;;)
+    {
+        if (stream.Next(data, length) != NO_ERROR)
+        {
+            return SOURCE_FILE_READ_ERR;
+        }
+        if (length == 0)
+        {
+            break;
+        }
+        hash.Update(data, length);
+    }
+
+    digest = hash.Digest();
+    return NO_ERROR;
+}
+
+/**
+ * @brief Computes the XXH64 digest of a file's contents.
+ *
+ * @param[in] file The file to hash
+ * @param[out] digest The digest of the file's contents
+ *
+ * @return NO_ERROR if the file was hashed, or one of the ErrorCodes otherwise.
+ */
+const int Filesystem::ComputeDigest(const fs::path &file, uint64_t &digest)
+{
+    const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return SOURCE_FILE_OPEN_ERR;
+    }
+
+    struct stat file_stat = {};
+    int result = SOURCE_FILE_READ_ERR;
+    if (fstat(fd, &file_stat) == 0)
+    {
+        result = HashFile(fd, static_cast<uint64_t>(file_stat.st_size), digest);
+    }
+
+    close(fd);
+    return result;
+}
+
+/**
+ * @brief Reads a file from the storage device rather than the page cache, and does not
+ *        leave the data it read in the page cache.
+ *
+ *        Any data still cached or waiting to be written is flushed first. The file is
+ *        then read with O_DIRECT into an aligned buffer. Filesystems that do not support
+ *        O_DIRECT are read normally, dropping each chunk from the page cache once read.
+ */
+class Filesystem::UncachedReader
+{
+private:
+    int mFd;           ///< Regular descriptor of the file, owned by the caller
+    int mDirectFd;     ///< O_DIRECT descriptor of the file, or -1 if O_DIRECT is not supported
+    size_t mChunkSize; ///< Bytes read per call, rounded up to DIRECT_IO_ALIGNMENT
+    char *mBuffer;
+
+public:
+    UncachedReader(const fs::path &file, const int fd) :
+        mFd(fd),
+        mDirectFd(-1),
+        mChunkSize(((GetChunkSize() + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT) * DIRECT_IO_ALIGNMENT),
+        mBuffer(static_cast<char *>(aligned_alloc(DIRECT_IO_ALIGNMENT, mChunkSize)))
+    {
+        // Write back anything still in flight, then drop the cached pages so the
+        // reads below have to come from the device.
+        fdatasync(mFd);
+        posix_fadvise(mFd, 0, 0, POSIX_FADV_DONTNEED);
+        mDirectFd = open(file.c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+    }
+
+    ~UncachedReader()
+    {
+        if (mDirectFd >= 0)
+        {
+            close(mDirectFd);
+        }
+        free(mBuffer);
+    }
+
+    UncachedReader(const UncachedReader &) = delete;
+    UncachedReader &operator=(const UncachedReader &) = delete;
+
+    const size_t ChunkSize() const {return mChunkSize;}
+
+    /**
+     * @brief Reads part of the file.
+     *
+     * @param[in] offset Where to start reading. Must be a multiple of ChunkSize().
+     * @param[in] length The number of bytes to read. No larger than ChunkSize().
+     *
+     * @return The data that was read, valid until the next call, or nullptr if the read failed.
+     */
+    const char *Read(const uint64_t offset, const size_t length)
+    {
+        if (mBuffer == nullptr)
+        {
+            return nullptr;
+        }
+
+        if (mDirectFd >= 0)
+        {
+            // Direct reads must cover whole blocks. Near the end of the file the
+            // kernel returns fewer bytes than requested.
+            const size_t aligned_length = ((length + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT) * DIRECT_IO_ALIGNMENT;
+            size_t bytes_read = 0;
+            while (bytes_read < length)
+            {
+                const ssize_t result = pread(mDirectFd, mBuffer + bytes_read, aligned_length - bytes_read,
+                                             static_cast<off_t>(offset + bytes_read));
+                if (result < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if ((result <= 0) || ((result % DIRECT_IO_ALIGNMENT) != 0 && (bytes_read + result) < length))
+                {
+                    break;
+                }
+                bytes_read += result;
+            }
+            if (bytes_read >= length)
+            {
+                return mBuffer;
+            }
+
+            // The filesystem accepted O_DIRECT but could not service the read.
+            // Read the rest of the file through the page cache instead.
+            close(mDirectFd);
+            mDirectFd = -1;
+        }
+
+        if (ReadFully(mFd, mBuffer, length, offset) != NO_ERROR)
+        {
+            return nullptr;
+        }
+        posix_fadvise(mFd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+        return mBuffer;
     }
-    unsigned long curr_byte = 0;
-    char source_buffer[CHUNK_SIZE] = {};
-    char dest_buffer[CHUNK_SIZE] = {};
+};
+
+/**
+ * @brief Compares two open files by streaming them through user space buffers of
+ *        GetChunkSize() bytes, so memory use is bounded regardless of the file size.
+ *        Reads of the next chunks of both files are kept in flight during each compare.
+ *
+ * @param[in] source_fd Descriptor of the original file
+ * @param[in] dest_fd Descriptor of the copy
+ * @param[in] file_size The size of both files
+ * @param[out] mismatch_offset The offset of the first byte that differs, or file_size if the files match
+ * @param[in,out] dest_throttle The stream the reads of the copy are throttled by
+ *
+ * @return NO_ERROR if the files match, -1 if they differ, or one of the read ErrorCodes.
+ */
+const int Filesystem::VerifyBuffered(const int source_fd, const int dest_fd, const uint64_t file_size, uint64_t &mismatch_offset,
+                                     IoScheduler::Stream &dest_throttle)
+{
+    posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(dest_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-    for(; (curr_byte + CHUNK_SIZE) < source_file_size; curr_byte += CHUNK_SIZE)
+    ReadAheadStream source_stream(source_fd, 0, file_size);
+    ReadAheadStream dest_stream(dest_fd, 0, file_size, &dest_throttle);
+    const uint8_t *source_data = nullptr;
+    const uint8_t *dest_data = nullptr;
+    size_t source_length = 0;
+    size_t dest_length = 0;
+
+    for (uint64_t curr_byte = 0; curr_byte < file_size; curr_byte += source_length)
     {
-        source_infile.read(source_buffer,CHUNK_SIZE);
-        if (!source_infile)
+        if (source_stream.Next(source_data, source_length) != NO_ERROR)
         {
-            source_infile.close();
-            dest_infile.close();
             return SOURCE_FILE_READ_ERR;
         }
-        dest_infile.read(dest_buffer, CHUNK_SIZE);
-        if (!dest_infile)
+        if (dest_stream.Next(dest_data, dest_length) != NO_ERROR)
         {
-            source_infile.close();
-            dest_infile.close();
             return DEST_FILE_READ_ERR;
         }
 
-        if (memcmp(source_buffer, dest_buffer, CHUNK_SIZE) != 0)
+        const size_t block_mismatch = FindFirstMismatch(source_data, dest_data, source_length);
+        if (block_mismatch != source_length)
         {
-            source_infile.close();
-            dest_infile.close();
+            mismatch_offset = curr_byte + block_mismatch;
             return -1;
         }
     }
 
-    if ((curr_byte < source_file_size) && source_infile && dest_infile)
+    mismatch_offset = file_size;
+    return NO_ERROR;
+}
+
+/**
+ * @brief Compares two open files by memory mapping both of them, so the data is
+ *        compared straight out of the page cache without being copied.
+ *
+ * @note The files must not be truncated while they are being compared.
+ *
+ * @param[in] source_fd Descriptor of the original file
+ * @param[in] dest_fd Descriptor of the copy
+ * @param[in] file_size The size of both files
+ * @param[out] mismatch_offset The offset of the first byte that differs, or file_size if the files match
+ *
+ * @return NO_ERROR if the files match, -1 if they differ.
+ *         STRATEGY_UNSUPPORTED if either file could not be mapped.
+ */
+const int Filesystem::VerifyMapped(const int source_fd, const int dest_fd, const uint64_t file_size, uint64_t &mismatch_offset)
+{
+    if (file_size > static_cast<uint64_t>(SIZE_MAX))
+    {
+        return STRATEGY_UNSUPPORTED;
+    }
+    const size_t map_length = static_cast<size_t>(file_size);
+
+    void *source_map = mmap(nullptr, map_length, PROT_READ, MAP_PRIVATE, source_fd, 0);
+    if (source_map == MAP_FAILED)
+    {
+        return STRATEGY_UNSUPPORTED;
+    }
+
+    void *dest_map = mmap(nullptr, map_length, PROT_READ, MAP_PRIVATE, dest_fd, 0);
+    if (dest_map == MAP_FAILED)
+    {
+        munmap(source_map, map_length);
+        return STRATEGY_UNSUPPORTED;
+    }
+
+    madvise(source_map, map_length, MADV_SEQUENTIAL);
+    madvise(dest_map, map_length, MADV_SEQUENTIAL);
+
+    const size_t mismatch = FindFirstMismatch(static_cast<const uint8_t *>(source_map),
+                                              static_cast<const uint8_t *>(dest_map),
+                                              map_length);
+
+    munmap(source_map, map_length);
+    munmap(dest_map, map_length);
+
+    mismatch_offset = mismatch;
+    return (mismatch == map_length) ? NO_ERROR : -1;
+}
+
+/**
+ * @brief Compares two open files, reading the destination from the storage device rather
+ *        than the page cache. Neither file is left in the page cache afterwards.
+ *
+ * @param[in] source_fd Descriptor of the original file
+ * @param[in] destination_file The path of the copy, needed to reopen it with O_DIRECT
+ * @param[in] dest_fd Descriptor of the copy
+ * @param[in] file_size The size of both files
+ * @param[out] mismatch_offset The offset of the first byte that differs, or file_size if the files match
+ * @param[in,out] dest_throttle The stream the reads of the copy are throttled by
+ *
+ * @return NO_ERROR if the files match, -1 if they differ, or one of the read ErrorCodes.
+ */
+const int Filesystem::VerifyUncached(const int source_fd, const fs::path &destination_file, const int dest_fd,
+                                     const uint64_t file_size, uint64_t &mismatch_offset, IoScheduler::Stream &dest_throttle)
+{
+    posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    UncachedReader dest_reader(destination_file, dest_fd);
+    const size_t chunk_size = dest_reader.ChunkSize();
+    std::unique_ptr<char[]> source_buffer(new char[chunk_size]);
+
+    for (uint64_t curr_byte = 0; curr_byte < file_size; curr_byte += chunk_size)
     {
-        unsigned long BytesLeft = source_file_size - curr_byte;
-        source_infile.read(source_buffer,BytesLeft);
-        if (!source_infile)
+        const size_t bytes_to_read = static_cast<size_t>(std::min<uint64_t>(file_size - curr_byte, chunk_size));
+        if (ReadFully(source_fd, source_buffer.get(), bytes_to_read, curr_byte) != NO_ERROR)
         {
-            source_infile.close();
-            dest_infile.close();
             return SOURCE_FILE_READ_ERR;
         }
-        dest_infile.read(dest_buffer, BytesLeft);
-        if (!dest_infile)
+        posix_fadvise(source_fd, static_cast<off_t>(curr_byte), static_cast<off_t>(bytes_to_read), POSIX_FADV_DONTNEED);
+
+        dest_throttle.Throttle(bytes_to_read);
+        const char *dest_data = dest_reader.Read(curr_byte, bytes_to_read);
+        if (dest_data == nullptr)
         {
-            source_infile.close();
-            dest_infile.close();
             return DEST_FILE_READ_ERR;
         }
-        if (memcmp(source_buffer, dest_buffer, BytesLeft) != 0)
+
+        const size_t block_mismatch = FindFirstMismatch(reinterpret_cast<const uint8_t *>(source_buffer.get()),
+                                                        reinterpret_cast<const uint8_t *>(dest_data),
+                                                        bytes_to_read);
+        if (block_mismatch != bytes_to_read)
         {
-            source_infile.close();
-            dest_infile.close();
+            mismatch_offset = curr_byte + block_mismatch;
             return -1;
         }
     }
-    source_infile.close();
-    dest_infile.close();
+
+    mismatch_offset = file_size;
     return NO_ERROR;
-}
\ No newline at end of file
+}
+
+const int Filesystem::Verify(const fs::path &source_file, const fs::path &destination_file)
+{
+    // Not mapped, since a mapped file on a network filesystem raises SIGBUS if the server drops it part way
+    uint64_t mismatch_offset = 0;
+    return Verify(source_file, destination_file, VERIFY_BUFFERED, mismatch_offset);
+}
+
+/**
+ * @brief Verifies the destination file is a byte for byte copy of the source file.
+ *
+ * @param[in] source_file The original file
+ * @param[in] destination_file The copy to check
+ * @param[in] mode How the files should be read
+ * @param[out] mismatch_offset The offset of the first byte that differs, or the file size if
+ *                             the files match. If the sizes differ, the size of the smaller file.
+ *
+ * @return NO_ERROR if the files match, or one of the ErrorCodes otherwise.
+ *         Files whose sizes or contents differ return -1.
+ */
+const int Filesystem::Verify(const fs::path &source_file, const fs::path &destination_file, const VerifyMode mode, uint64_t &mismatch_offset)
+{
+    const int source_fd = open(source_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source_fd < 0)
+    {
+        return SOURCE_FILE_OPEN_ERR;
+    }
+
+    const int dest_fd = open(destination_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (dest_fd < 0)
+    {
+        close(source_fd);
+        return DEST_FILE_OPEN_ERR;
+    }
+
+    struct stat source_stat = {};
+    struct stat dest_stat = {};
+    if ((fstat(source_fd, &source_stat) != 0) || (fstat(dest_fd, &dest_stat) != 0))
+    {
+        close(source_fd);
+        close(dest_fd);
+        return SOURCE_FILE_READ_ERR;
+    }
+
+    const uint64_t source_file_size = static_cast<uint64_t>(source_stat.st_size);
+    const uint64_t dest_file_size   = static_cast<uint64_t>(dest_stat.st_size);
+
+    if (source_file_size != dest_file_size)
+    {
+        mismatch_offset = std::min(source_file_size, dest_file_size);
+        close(source_fd);
+        close(dest_fd);
+        return -1;
+    }
+
+    // Verify traffic is limited on the copy's device, which is the one being checked
+    IoScheduler::Stream dest_throttle(GetScheduler(), dest_fd, IoScheduler::TRAFFIC_VERIFY, IoScheduler::IO_READ);
+    int result = STRATEGY_UNSUPPORTED;
+    if (source_file_size == 0)
+    {
+        mismatch_offset = 0;
+        result = NO_ERROR;
+    }
+    else if (mode == VERIFY_MAPPED)
+    {
+        result = VerifyMapped(source_fd, dest_fd, source_file_size, mismatch_offset);
+    }
+    else if (mode == VERIFY_UNCACHED)
+    {
+        result = VerifyUncached(source_fd, destination_file, dest_fd, source_file_size, mismatch_offset, dest_throttle);
+    }
+
+    if (result == STRATEGY_UNSUPPORTED)
+    {
+        result = VerifyBuffered(source_fd, dest_fd, source_file_size, mismatch_offset, dest_throttle);
+    }
+
+    close(source_fd);
+    close(dest_fd);
+    return result;
+}
+
+const int Filesystem::VerifyDigest(const fs::path &destination_file, const uint64_t expected_digest)
+{
+    return VerifyDigest(destination_file, expected_digest, VERIFY_BUFFERED);
+}
+
+/**
+ * @brief Verifies a copy made by CopyFileWithDigest by hashing only the destination
+ *        and comparing it to the digest computed while copying. The source is not read.
+ *
+ * @param[in] destination_file The copy to check
+ * @param[in] expected_digest The digest returned by CopyFileWithDigest
+ * @param[in] mode VERIFY_UNCACHED reads the destination from the storage device rather
+ *                 than the page cache. Any other mode reads it normally.
+ *
+ * @return NO_ERROR if the digests match, -1 if they differ.
+ *         DEST_FILE_OPEN_ERR or DEST_FILE_READ_ERR if the destination could not be read.
+ */
+const int Filesystem::VerifyDigest(const fs::path &destination_file, const uint64_t expected_digest, const VerifyMode mode)
+{
+    if (mode != VERIFY_UNCACHED)
+    {
+        uint64_t digest = 0;
+        const int result = ComputeDigest(destination_file, digest);
+        if (result == SOURCE_FILE_OPEN_ERR)
+        {
+            return DEST_FILE_OPEN_ERR;
+        }
+        if (result != NO_ERROR)
+        {
+            return DEST_FILE_READ_ERR;
+        }
+        return (digest == expected_digest) ? NO_ERROR : -1;
+    }
+
+    const int dest_fd = open(destination_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (dest_fd < 0)
+    {
+        return DEST_FILE_OPEN_ERR;
+    }
+
+    struct stat dest_stat = {};
+    if (fstat(dest_fd, &dest_stat) != 0)
+    {
+        close(dest_fd);
+        return DEST_FILE_READ_ERR;
+    }
+    const uint64_t file_size = static_cast<uint64_t>(dest_stat.st_size);
+
+    int result = NO_ERROR;
+    XxHash64 hash;
+    {
+        IoScheduler::Stream throttle(GetScheduler(), dest_fd, IoScheduler::TRAFFIC_VERIFY, IoScheduler::IO_READ);
+        UncachedReader dest_reader(destination_file, dest_fd);
+        const size_t chunk_size = dest_reader.ChunkSize();
+        for (uint64_t curr_byte = 0; curr_byte < file_size; curr_byte += chunk_size)
+        {
+            const size_t bytes_to_read = static_cast<size_t>(std::min<uint64_t>(file_size - curr_byte, chunk_size));
+            throttle.Throttle(bytes_to_read);
+            const char *dest_data = dest_reader.Read(curr_byte, bytes_to_read);
+            if (dest_data == nullptr)
+            {
+                result = DEST_FILE_READ_ERR;
+                break;
+            }
+            hash.Update(dest_data, bytes_to_read);
+        }
+    }
+
+    close(dest_fd);
+    if (result != NO_ERROR)
+    {
+        return result;
+    }
+    return (hash.Digest() == expected_digest) ? NO_ERROR : -1;
+}
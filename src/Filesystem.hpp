@@ -1,13 +1,67 @@
+#pragma once
+
+#include <atomic>
 #include <fstream>
 #include <filesystem>
+#include <stdint.h>
+#include "IoScheduler.hpp"
+
+class XxHash64;
 
 namespace fs = std::filesystem;
 
 class Filesystem
 {
+public:
+
+    /**
+     * @brief The mechanism CopyFile used to move the file's contents.
+     *        Strategies are tried in order, and the first one that the
+     *        filesystems support is used.
+     */
+    enum CopyStrategy
+    {
+        REFLINK,         ///< The destination shares the source's extents (FICLONE)
+        COPY_FILE_RANGE, ///< The kernel copied the data with copy_file_range
+        SENDFILE,        ///< The kernel copied the data with sendfile
+        BUFFERED         ///< The data was read into and written from a user space buffer
+    };
+
+    /**
+     * @brief How Verify reads the two files it compares.
+     */
+    enum VerifyMode
+    {
+        VERIFY_BUFFERED, ///< Both files are streamed through user space buffers
+        VERIFY_MAPPED,   ///< Both files are memory mapped. Falls back to buffered if they can not be mapped.
+                         ///< Only for local files, since a read error on a mapped file raises SIGBUS.
+        VERIFY_UNCACHED  ///< The destination is flushed and read from the storage device rather than the
+                         ///< page cache, and neither file is left in the page cache afterwards.
+    };
+
 private:
 
-    static constexpr unsigned int CHUNK_SIZE = 32768;
+    // Bounds and default for the size of the chunks streamed through user space
+    // by the buffered copy and by Verify.
+    static constexpr size_t MIN_CHUNK_SIZE     = 4096;
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 1048576;
+    static constexpr size_t MAX_CHUNK_SIZE     = 67108864;
+
+    // Chunks read ahead of the one being processed by the buffered copy, hash and verify.
+    // Each stream holds this many chunks in memory.
+    static constexpr size_t READ_AHEAD_DEPTH = 4;
+
+    // Largest request handed to copy_file_range or sendfile in a single call.
+    // Linux caps both at just under 2 GiB per call.
+    static constexpr size_t MAX_KERNEL_COPY_SIZE = 0x40000000;
+
+    // O_DIRECT transfers must be aligned to the device's logical block size.
+    // 4 KiB covers every device we ingest to.
+    static constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+    // Returned by the copy strategies when the filesystem does not support them,
+    // so the next strategy should be tried. Never returned by CopyFile itself.
+    static constexpr int STRATEGY_UNSUPPORTED = 1;
 
     enum ErrorCodes
     {
@@ -18,9 +72,56 @@ private:
         DEST_FILE_READ_ERR   = -4
     };
 
+    /**
+     * @brief The scheduler streams a copy holds on its source and destination devices
+     */
+    struct CopyStreams
+    {
+        IoScheduler::Stream Read;
+        IoScheduler::Stream Write;
+
+        const bool IsThrottled() const {return Read.IsThrottled() || Write.IsThrottled();}
+        void       Throttle(const size_t bytes) {Read.Throttle(bytes); Write.Throttle(bytes);}
+    };
+
+    static const int KernelCopyError(const int error_number);
+    static const int TryReflink(const int source_fd, const int dest_fd);
+    static const int CopyWithCopyFileRange(const int source_fd, const int dest_fd, const uint64_t file_size, uint64_t &copied,
+                                           CopyStreams &streams);
+    static const int CopyWithSendfile(const int source_fd, const int dest_fd, const uint64_t file_size, uint64_t &copied,
+                                      CopyStreams &streams);
+    static const int CopyBuffered(const int source_fd, const int dest_fd, const uint64_t file_size, uint64_t &copied,
+                                  CopyStreams &streams, XxHash64 *hash = nullptr);
+    static const int HashFile(const int fd, const uint64_t file_size, uint64_t &digest);
+    static const int ReadFully(const int fd, char *buffer, const size_t length, const uint64_t offset);
+    static const size_t KernelCopyRequest(const uint64_t remaining, const CopyStreams &streams);
+
+    class StreamRing;
+    class ReadAheadStream;
+    class UncachedReader;
+
+    static const int VerifyBuffered(const int source_fd, const int dest_fd, const uint64_t file_size, uint64_t &mismatch_offset,
+                                    IoScheduler::Stream &dest_throttle);
+    static const int VerifyMapped(const int source_fd, const int dest_fd, const uint64_t file_size, uint64_t &mismatch_offset);
+    static const int VerifyUncached(const int source_fd, const fs::path &destination_file, const int dest_fd,
+                                    const uint64_t file_size, uint64_t &mismatch_offset, IoScheduler::Stream &dest_throttle);
+
+    static inline std::atomic<size_t> mChunkSize{DEFAULT_CHUNK_SIZE};
+    static inline std::atomic<const IoScheduler *> mScheduler{nullptr};
+
 public:
-    static const unsigned int GetFileSize(std::ifstream &infile);
-    static const unsigned int GetFileSize(const fs::path file_path);
-    static const          int CopyFile(const fs::path &source_file, const fs::path &destination_file);
-    static const          int Verify(const fs::path &source_file, const fs::path &destination_file);
-};
\ No newline at end of file
+    static const uint64_t GetFileSize(std::ifstream &infile);
+    static const uint64_t GetFileSize(const fs::path file_path);
+    static const size_t   GetChunkSize() {return mChunkSize.load(std::memory_order_relaxed);}
+    static void           SetChunkSize(const size_t chunk_size);
+    static const IoScheduler *GetScheduler() {return mScheduler.load(std::memory_order_acquire);}
+    static void           SetScheduler(const IoScheduler *scheduler);
+    static const int      CopyFile(const fs::path &source_file, const fs::path &destination_file);
+    static const int      CopyFile(const fs::path &source_file, const fs::path &destination_file, CopyStrategy &strategy_used);
+    static const int      CopyFileWithDigest(const fs::path &source_file, const fs::path &destination_file, uint64_t &digest);
+    static const int      ComputeDigest(const fs::path &file, uint64_t &digest);
+    static const int      Verify(const fs::path &source_file, const fs::path &destination_file);
+    static const int      Verify(const fs::path &source_file, const fs::path &destination_file, const VerifyMode mode, uint64_t &mismatch_offset);
+    static const int      VerifyDigest(const fs::path &destination_file, const uint64_t expected_digest);
+    static const int      VerifyDigest(const fs::path &destination_file, const uint64_t expected_digest, const VerifyMode mode);
+};
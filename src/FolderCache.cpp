@@ -0,0 +1,213 @@
+/**
+* @file FolderCache.cpp
+* @brief Remembers which date folders of the library exist, so each one is created once
+*/
+
+#include "FolderCache.hpp"
+#include <errno.h>    // For errno
+#include <stdio.h>    // For snprintf, sscanf
+#include <string.h>   // For memcpy
+#include <sys/stat.h> // For mkdir
+#include <limits.h>   // For PATH_MAX
+
+FolderCache::FolderCache() :
+    mRoot(),
+    mRootPrefix(),
+    mSlots(new std::atomic<uint32_t>[SLOT_COUNT]),
+    mCount(0)
+{
+    for (size_t index = 0; index < SLOT_COUNT; ++index)
+    {
+        mSlots[index].store(EMPTY_SLOT, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Packs a date into a key. The day and month each have their own bits, so every date has its own key.
+ */
+const uint32_t FolderCache::Key(const int year, const int month, const int day)
+{
+    return (static_cast<uint32_t>(year) << 9) | (static_cast<uint32_t>(month) << 5) | static_cast<uint32_t>(day);
+}
+
+/**
+ * @brief Spreads the bits of a key so nearby dates land in different slots
+ */
+const uint32_t FolderCache::Mix(uint32_t key)
+{
+    key ^= key >> 16;
+    key *= 0x7FEB352D;
+    key ^= key >> 15;
+    return key;
+}
+
+/**
+ * @brief Formats the folder a date's photos go in, relative to the library root.
+ *
+ * @param[in] date The date
+ * @param[out] folder Where to write the folder, such as 2023/4-29-2023
+ * @param[in] length The size of folder. DATE_FOLDER_LENGTH always fits.
+ *
+ * @return The length of the folder, or zero if it did not fit
+ */
+const size_t FolderCache::FormatDateFolder(const tm &date, char *folder, const size_t length)
+{
+    const int year = date.tm_year + 1900;
+    const int written = snprintf(folder, length, "%d/%d-%d-%d", year, date.tm_mon + 1, date.tm_mday, year);
+    return ((written > 0) && (static_cast<size_t>(written) < length)) ? static_cast<size_t>(written) : 0;
+}
+
+/**
+ * @brief Sets the root folder, creating it if needed, and caches the date folders already in it.
+ *        Other folders and files under the root are ignored.
+ *
+ * @param[in] root The library's root folder
+ *
+ * @return The number of date folders found
+ */
+const size_t FolderCache::Open(const fs::path &root)
+{
+    mRoot = root;
+    mRootPrefix = root.string();
+    if (!mRootPrefix.empty() && (mRootPrefix.back() != '/'))
+    {
+        mRootPrefix.push_back('/');
+    }
+
+    std::error_code error;
+    fs::create_directories(mRoot, error);
+
+    size_t found = 0;
+    for (fs::directory_iterator year_entry(mRoot, error), end; !error && (year_entry != end); year_entry.increment(error))
+    {
+        std::error_code year_error;
+        if (!year_entry->is_directory(year_error))
+        {
+            continue;
+        }
+        const std::string year_name = year_entry->path().filename().string();
+        for (fs::directory_iterator day_entry(year_entry->path(), year_error);
+             !year_error && (day_entry != end); day_entry.increment(year_error))
+        {
+            // Only folders named exactly as FormatDateFolder names them are cached
+            const std::string folder = year_name + '/' + day_entry->path().filename().string();
+            tm date = {};
+            int folder_year = 0;
+            char expected[DATE_FOLDER_LENGTH] = {};
+            std::error_code day_error;
+            if ((sscanf(folder.c_str(), "%d/%d-%d-%d", &folder_year, &date.tm_mon, &date.tm_mday, &date.tm_year) != 4) ||
+                (date.tm_mon < 1) || (date.tm_mon > 12) || (date.tm_mday < 1) || (date.tm_mday > 31))
+            {
+                continue;
+            }
+            date.tm_year -= 1900;
+            date.tm_mon -= 1;
+            if ((FormatDateFolder(date, expected, sizeof(expected)) == 0) || (folder != expected) ||
+                !day_entry->is_directory(day_error))
+            {
+                continue;
+            }
+            InsertKey(Key(date.tm_year + 1900, date.tm_mon + 1, date.tm_mday));
+            ++found;
+        }
+    }
+    return found;
+}
+
+const bool FolderCache::ContainsKey(const uint32_t key) const
+{
+    const size_t mask = SLOT_COUNT - 1;
+    for (size_t index = Mix(key) & mask; ; index = (index + 1) & mask)
+    {
+        const uint32_t slot = mSlots[index].load(std::memory_order_acquire);
+        if (slot == key)
+        {
+            return true;
+        }
+        if (slot == EMPTY_SLOT)
+        {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Adds a date to the table with linear probing. Once the table is too full the date
+ *        is left out, which only costs each photo of that date an mkdir that finds the folder.
+ *
+ * @return None
+ */
+void FolderCache::InsertKey(const uint32_t key)
+{
+    if (((mCount.load(std::memory_order_relaxed) + 1) * 100) > (SLOT_COUNT * MAX_LOAD_PERCENT))
+    {
+        return;
+    }
+
+    const size_t mask = SLOT_COUNT - 1;
+    for (size_t index = Mix(key) & mask; ; index = (index + 1) & mask)
+    {
+        uint32_t expected = EMPTY_SLOT;
+        if (mSlots[index].compare_exchange_strong(expected, key, std::memory_order_acq_rel))
+        {
+            mCount.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (expected == key)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Creates one folder under the root. A folder that already exists is not an error.
+ *
+ * @param[in] relative_folder The folder, relative to the root
+ *
+ * @return True if the folder exists
+ */
+const bool FolderCache::MakeFolder(const char *relative_folder)
+{
+    char path[PATH_MAX];
+    const int written = snprintf(path, sizeof(path), "%s%s", mRootPrefix.c_str(), relative_folder);
+    if ((written <= 0) || (static_cast<size_t>(written) >= sizeof(path)))
+    {
+        return false;
+    }
+    return (mkdir(path, 0755) == 0) || (errno == EEXIST);
+}
+
+/**
+ * @brief Makes sure a date's folder exists. Only the first photo of each date makes any system calls.
+ *
+ * @param[in] date The date
+ *
+ * @return True if the folder exists
+ */
+const bool FolderCache::Create(const tm &date)
+{
+    const uint32_t key = Key(date.tm_year + 1900, date.tm_mon + 1, date.tm_mday);
+    if (ContainsKey(key))
+    {
+        return true;
+    }
+
+    char folder[DATE_FOLDER_LENGTH];
+    const size_t length = FormatDateFolder(date, folder, sizeof(folder));
+    const char *separator = static_cast<const char *>(memchr(folder, '/', length));
+    if ((length == 0) || (separator == nullptr))
+    {
+        return false;
+    }
+
+    // Two threads may race to make the same folder. The loser sees EEXIST, which is not an error.
+    char year_folder[DATE_FOLDER_LENGTH] = {};
+    memcpy(year_folder, folder, static_cast<size_t>(separator - folder));
+    if (!MakeFolder(year_folder) || !MakeFolder(folder))
+    {
+        return false;
+    }
+    InsertKey(key);
+    return true;
+}
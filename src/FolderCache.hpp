@@ -0,0 +1,60 @@
+/**
+* @file FolderCache.hpp
+* @brief Remembers which date folders of the library exist, so each one is created once
+*/
+
+#pragma once
+
+#include <atomic>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief The YYYY/M-D-YYYY date folders under one root folder that are known to exist.
+ *
+ *        The folders already in the library are listed once when the cache is opened, so a
+ *        photo whose folder exists costs no system calls at all. A missing folder is created
+ *        the first time a photo needs it, with one mkdir for the year and one for the day.
+ *
+ *        Dates are kept in a fixed open addressing table of atomic keys, so lookups and
+ *        inserts never take a lock. Every member except Open can be called from any thread.
+ */
+class FolderCache
+{
+public:
+
+    static constexpr size_t DATE_FOLDER_LENGTH = 32; ///< Holds any YYYY/M-D-YYYY folder, with its terminating zero
+
+    FolderCache();
+
+    FolderCache(const FolderCache &) = delete;
+    FolderCache &operator=(const FolderCache &) = delete;
+
+    const size_t Open(const fs::path &root);
+    const bool   Create(const tm &date);
+
+    static const size_t FormatDateFolder(const tm &date, char *folder, const size_t length);
+
+private:
+
+    static constexpr size_t   SLOT_COUNT       = 32768; ///< Must be a power of two. About 90 years of days.
+    static constexpr size_t   MAX_LOAD_PERCENT = 70;    ///< Past this, new folders are created but not cached
+    static constexpr uint32_t EMPTY_SLOT       = 0;     ///< No date has a key of zero, since days start at 1
+
+    fs::path    mRoot;
+    std::string mRootPrefix; ///< mRoot followed by a slash, so folder paths are built without fs::path
+    std::unique_ptr<std::atomic<uint32_t>[]> mSlots;
+    std::atomic<size_t> mCount;
+
+    static const uint32_t Key(const int year, const int month, const int day);
+    static const uint32_t Mix(const uint32_t key);
+    const bool ContainsKey(const uint32_t key) const;
+    void       InsertKey(const uint32_t key);
+    const bool MakeFolder(const char *relative_folder);
+};
@@ -0,0 +1,1415 @@
+/**
+* @file Ingest.cpp
+* @brief Copies photos from a source folder into a date sorted destination library
+*/
+
+#include "Ingest.hpp"
+#include "DirectoryWalker.hpp"
+#include "ExifParser.hpp"
+#include "Filesystem.hpp"
+#include "IoRing.hpp"
+#include <fcntl.h>       // For open, AT_FDCWD
+#include <string.h>      // For strrchr, strerror
+#include <strings.h>     // For strcasecmp
+#include <sys/stat.h>    // For fstat, fstatat, lstat
+#include <sys/syscall.h> // For SYS_renameat2
+#include <sys/vfs.h>     // For statfs
+#include <unistd.h>      // For pread, pwrite, close, unlink, link, syncfs, fdatasync, getpid
+#include <sys/ioctl.h>   // For ioctl
+#include <linux/fs.h>    // For RENAME_NOREPLACE, FICLONE
+#include <algorithm>     // For std::max, std::min, std::find, std::mismatch
+#include <cctype>        // For isdigit
+#include <cerrno>        // For errno
+#include <cstdio>        // For rename
+#include <iostream>      // For cout
+#include <string>        // For std::string, std::to_string
+#include <thread>        // For std::thread, hardware_concurrency
+#include <vector>        // For std::vector
+
+/**
+ * @brief Determines if a path is on a network filesystem such as SMB or NFS.
+ *
+ * @param[in] path The path to check
+ *
+ * @return True if the path is on a network filesystem
+ */
+const bool Ingest::IsNetworkFilesystem(const fs::path &path)
+{
+    static constexpr long CIFS_MAGIC_NUMBER = 0xFF534D42;
+    static constexpr long SMB2_MAGIC_NUMBER = 0xFE534D42;
+    static constexpr long SMB_SUPER_MAGIC   = 0x517B;
+    static constexpr long NFS_SUPER_MAGIC   = 0x6969;
+
+    struct statfs filesystem_info = {};
+    if (statfs(path.c_str(), &filesystem_info) != 0)
+    {
+        return false;
+    }
+
+    const long filesystem_type = static_cast<long>(filesystem_info.f_type);
+    return (filesystem_type == CIFS_MAGIC_NUMBER) || (filesystem_type == SMB2_MAGIC_NUMBER) ||
+           (filesystem_type == SMB_SUPER_MAGIC)   || (filesystem_type == NFS_SUPER_MAGIC);
+}
+
+/**
+ * @brief Picks how many threads to keep busy on the device a folder is on.
+ *
+ * @param[in] root The source folder or the root of the destination library
+ *
+ * @return The number of threads to use for the device
+ */
+const size_t Ingest::DefaultWorkerCount(const fs::path &root)
+{
+    if (IsNetworkFilesystem(root))
+    {
+        return NETWORK_WORKER_COUNT;
+    }
+    return std::max<size_t>(MIN_LOCAL_WORKER_COUNT, std::thread::hardware_concurrency());
+}
+
+/**
+ * @brief Determines if a file is a JPEG image based on its extension.
+ *
+ * @param[in] file The file to check
+ *
+ * @return True for .jpg and .jpeg files, in any case
+ */
+const bool Ingest::IsJpeg(const fs::path &file)
+{
+    return IsJpeg(file.filename().c_str());
+}
+
+/**
+ * @brief Determines if a file is a JPEG image based on its extension, without allocating.
+ *
+ * @param[in] name The file's name, without its folder
+ *
+ * @return True for .jpg and .jpeg files, in any case
+ */
+const bool Ingest::IsJpeg(const char *name)
+{
+    // A name that only has a dot at its start, such as .jpg, has no extension
+    const char *extension = strrchr(name, '.');
+    return (extension != nullptr) && (extension != name) &&
+           ((strcasecmp(extension, ".jpg") == 0) || (strcasecmp(extension, ".jpeg") == 0));
+}
+
+/**
+ * @brief Determines if a folder is another folder or is inside of it, after resolving
+ *        links and relative parts of both. Parts of either that do not exist yet are
+ *        compared by name.
+ *
+ * @param[in] folder The folder to check
+ * @param[in] root The folder it may be inside of
+ *
+ * @return True if folder is root or is inside of it
+ */
+const bool Ingest::IsWithin(const fs::path &folder, const fs::path &root)
+{
+    const auto resolve = [](const fs::path &path)
+    {
+        std::error_code error;
+        fs::path resolved = fs::weakly_canonical(fs::absolute(path, error), error).lexically_normal();
+        // A trailing separator leaves an empty last part
+        return resolved.has_filename() ? resolved : resolved.parent_path();
+    };
+    const fs::path resolved_folder = resolve(folder);
+    const fs::path resolved_root = resolve(root);
+    return std::mismatch(resolved_root.begin(), resolved_root.end(),
+                         resolved_folder.begin(), resolved_folder.end()).first == resolved_root.end();
+}
+
+/**
+ * @brief Sets the outcome of a photo unless an earlier stage already set one.
+ *
+ * @param[in,out] job The photo
+ * @param[in] status The outcome
+ *
+ * @return True if the outcome was set, false if the photo already had one
+ */
+const bool Ingest::SetStatus(FileJob &job, const FileStatus status)
+{
+    int expected = STATUS_PENDING;
+    return job.Status.compare_exchange_strong(expected, status, std::memory_order_acq_rel);
+}
+
+/**
+ * @brief Gets a file's modified time with the full precision the filesystem keeps.
+ *
+ * @param[in] file_info The file's status
+ *
+ * @return Nanoseconds since the epoch
+ */
+const int64_t Ingest::ModifiedTimeOf(const struct stat &file_info)
+{
+    static constexpr int64_t NANOSECONDS_PER_SECOND = 1000000000;
+    return (static_cast<int64_t>(file_info.st_mtim.tv_sec) * NANOSECONDS_PER_SECOND) + file_info.st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Opens the manifest of photos ingested by earlier runs, and removes any copies
+ *        that an earlier run started but never finished, so those photos are copied again.
+ *
+ * @param[in,out] pipeline The run's state. History is opened.
+ * @param[in] options Settings for the run
+ *
+ * @return True if the manifest can be used. The run goes ahead without one otherwise.
+ */
+const bool Ingest::OpenHistory(Pipeline &pipeline, const Options &options)
+{
+    fs::path manifest_file = options.ManifestFile;
+    if (manifest_file.empty())
+    {
+        manifest_file = options.DestinationRoot / Manifest::DEFAULT_FILE_NAME;
+    }
+
+    std::error_code error;
+    fs::create_directories(options.DestinationRoot, error);
+    if (pipeline.History.Open(manifest_file) != Manifest::NO_ERROR)
+    {
+        std::cerr << "Could not open the manifest " << manifest_file << ", every photo will be checked" << std::endl;
+        return false;
+    }
+
+    for (const fs::path &partial_copy : pipeline.History.IncompleteCopies())
+    {
+        if (unlink(partial_copy.c_str()) == 0)
+        {
+            std::cout << partial_copy << ": Removed an unfinished copy from an earlier run" << std::endl;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Fills the duplicate index from the manifest. The library itself is only listed
+ *        when there is no manifest to remember it by, such as the first run against an
+ *        existing library. Files found that way are only hashed when a new photo of the
+ *        same size turns up.
+ *
+ * @param[in,out] pipeline The run's state. Library is filled.
+ * @param[in] options Settings for the run
+ *
+ * @return None
+ */
+void Ingest::LoadLibraryIndex(Pipeline &pipeline, const Options &options)
+{
+    if (pipeline.OnDuplicate == DUPLICATE_COPY)
+    {
+        return;
+    }
+
+    if (pipeline.UseHistory)
+    {
+        pipeline.History.ForEachEntry([&pipeline](const std::string &source, const Manifest::Entry &entry)
+        {
+            if ((entry.Status == Manifest::ENTRY_VERIFIED) && (entry.Digest != 0))
+            {
+                pipeline.Library.AddHashed(entry.Size, entry.Digest, entry.Destination);
+            }
+            else if (entry.Status == Manifest::ENTRY_LIBRARY)
+            {
+                pipeline.Library.AddHashed(entry.Size, entry.Digest, source);
+            }
+            else if (entry.Status == Manifest::ENTRY_LIBRARY_UNHASHED)
+            {
+                pipeline.Library.AddUnhashed(entry.Size, source);
+            }
+        });
+        if (!pipeline.History.IsNew())
+        {
+            return;
+        }
+    }
+
+    // Folders that can not be listed are skipped, as they were when the library was walked one folder at a time
+    DirectoryWalker walker(DefaultWorkerCount(options.DestinationRoot));
+    walker.Walk(options.DestinationRoot.string(), [&pipeline](const DirectoryWalker::Entry &file)
+    {
+        struct stat file_info = {};
+        if (!IsJpeg(file.Name) || (fstatat(file.DirectoryFd, file.Name, &file_info, 0) != 0))
+        {
+            return;
+        }
+
+        const std::string library_file = file.Path();
+        const uint64_t size = static_cast<uint64_t>(file_info.st_size);
+        pipeline.Library.AddUnhashed(size, library_file);
+        if (pipeline.UseHistory)
+        {
+            pipeline.History.Record(library_file, {Manifest::ENTRY_LIBRARY_UNHASHED, size, ModifiedTimeOf(file_info),
+                                                   0, library_file});
+        }
+    }, [](const std::string &, const int) {});
+    std::cout << "Indexed " << pipeline.Library.FileCount() << " photos already in the library" << std::endl;
+}
+
+/**
+ * @brief Checks if the library already has a photo with the same contents, or if one is
+ *        being copied by this run. Only photos whose size matches a library file or another
+ *        photo in flight are hashed here, which is rarely the case for photos that are not
+ *        duplicates. A photo that is not a duplicate keeps its reservation in the index
+ *        until RecordResult, so later copies of it are matched against it.
+ *
+ * @param[in,out] pipeline The run's state
+ * @param[in,out] job The photo. DuplicateOf and SourceDigest are set if a duplicate is found,
+ *                    Reservation if it is not.
+ *
+ * @return None
+ */
+void Ingest::FindDuplicate(Pipeline &pipeline, FileJob &job)
+{
+    if (pipeline.OnDuplicate == DUPLICATE_COPY)
+    {
+        return;
+    }
+
+    uint64_t digest = 0;
+    if (!pipeline.Library.Reserve(job.Size, job.Source.string(), job.Reservation) ||
+        (Filesystem::ComputeDigest(job.Source, digest) != 0))
+    {
+        return;
+    }
+
+    // The digest is published first, so lookups of later photos never wait on this one
+    pipeline.Library.SetReservedDigest(job.Reservation, digest);
+    std::vector<DedupIndex::HashedFile> newly_hashed;
+    const std::string match = pipeline.Library.Find(job.Source, job.Size, digest, job.Reservation, newly_hashed);
+    if (pipeline.UseHistory)
+    {
+        for (const DedupIndex::HashedFile &library_file : newly_hashed)
+        {
+            pipeline.History.Record(library_file.Path, {Manifest::ENTRY_LIBRARY, library_file.Size, 0,
+                                                        library_file.Digest, library_file.Path});
+        }
+    }
+
+    if (!match.empty())
+    {
+        pipeline.Library.Release(job.Reservation);
+        job.Reservation  = 0;
+        job.DuplicateOf  = match;
+        job.SourceDigest = digest;
+    }
+}
+
+/**
+ * @brief Prefetch stage. Asks the kernel to start reading each photo found by the walk,
+ *        then passes it on to the readers. Waits whenever the readers are a full window behind.
+ *
+ * @param[in,out] pipeline The run's queues
+ *
+ * @return None
+ */
+void Ingest::PrefetchStage(Pipeline &pipeline)
+{
+    fs::path source_image;
+    while (pipeline.ToPrefetch.Pop(source_image))
+    {
+        pipeline.Prefetch.Prefetch(source_image);
+        pipeline.Paths.Push(std::move(source_image));
+    }
+}
+
+/**
+ * @brief Read stage. Reads photos until every path has been handed out.
+ *
+ * @param[in,out] pipeline The run's queues and buffers
+ *
+ * @return None
+ */
+void Ingest::ReadStage(Pipeline &pipeline)
+{
+    IoRing ring(READ_RING_DEPTH);
+    ring.RegisterBuffer(pipeline.Buffers.Storage(), pipeline.Buffers.StorageSize());
+
+    fs::path source_image;
+    while (pipeline.Paths.Pop(source_image))
+    {
+        ReadFile(pipeline, ring, source_image);
+        pipeline.Prefetch.Release();
+    }
+}
+
+/**
+ * @brief Reads one photo into pool buffers and queues them for the parse stage.
+ *        Reads of up to READ_RING_DEPTH chunks are kept in flight, and the chunks are
+ *        queued in order as they arrive. The photo is hashed as it is read so the copy
+ *        can be verified without reading the source a second time.
+ *
+ * @note Only the first buffer of a photo is waited for. Further buffers are only taken
+ *       if one is free, so readers never wait on the pool while holding buffers.
+ *
+ * @param[in,out] pipeline The run's queues and buffers
+ * @param[in,out] ring The reader's ring, with nothing in flight
+ * @param[in] source_image The photo to read
+ *
+ * @return None
+ */
+void Ingest::ReadFile(Pipeline &pipeline, IoRing &ring, const fs::path &source_image)
+{
+    std::shared_ptr<FileJob> job = std::make_shared<FileJob>();
+    job->Source = source_image;
+
+    Chunk failed_chunk;
+    failed_chunk.Job   = job;
+    failed_chunk.First = true;
+
+    const int source_fd = open(source_image.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat source_info = {};
+    if ((source_fd < 0) || (fstat(source_fd, &source_info) != 0))
+    {
+        if (source_fd >= 0)
+        {
+            close(source_fd);
+        }
+        job->ChunksRemaining.store(1, std::memory_order_relaxed);
+        SetStatus(*job, FILE_COPY_ERR);
+        pipeline.ToParse.Push(failed_chunk);
+        return;
+    }
+
+    const size_t buffer_size = pipeline.Buffers.BufferSize();
+    job->Size = static_cast<uint64_t>(source_info.st_size);
+    job->ModifiedTime = ModifiedTimeOf(source_info);
+    FindDuplicate(pipeline, *job);
+
+    // A duplicate is not copied, so only the chunk holding its EXIF data is read
+    const bool is_duplicate = !job->DuplicateOf.empty() && !pipeline.CopyDuplicates;
+    const size_t chunk_count = is_duplicate ? 1 : std::max<uint64_t>(1, (job->Size + buffer_size - 1) / buffer_size);
+    job->ChunksRemaining.store(chunk_count, std::memory_order_relaxed);
+
+    // Chunk n is tracked in slot n % READ_RING_DEPTH until it is queued
+    Chunk  in_flight[READ_RING_DEPTH];
+    size_t bytes_read[READ_RING_DEPTH] = {};
+    size_t next_read  = 0;
+    size_t next_queue = 0;
+    bool   failed     = false;
+    XxHash64 hash;
+
+    const uint64_t source_device = static_cast<uint64_t>(source_info.st_dev);
+    while (!failed && (next_queue < chunk_count))
+    {
+        const size_t first_new_read = next_read;
+        while ((next_read < chunk_count) && ((next_read - next_queue) < READ_RING_DEPTH))
+        {
+            uint8_t *buffer = (next_read == next_queue) ? pipeline.Buffers.Acquire() : pipeline.Buffers.TryAcquire();
+            if (buffer == nullptr)
+            {
+                break;
+            }
+
+            const size_t slot = next_read % READ_RING_DEPTH;
+            Chunk &chunk = in_flight[slot];
+            chunk.Job    = job;
+            chunk.Buffer = buffer;
+            chunk.Offset = static_cast<uint64_t>(next_read) * buffer_size;
+            chunk.Length = static_cast<size_t>(std::min<uint64_t>(buffer_size, job->Size - chunk.Offset));
+            chunk.First  = (next_read == 0);
+            bytes_read[slot] = 0;
+            ++next_read;
+        }
+
+        // The source device's stream is only held while this reader waits on the device,
+        // never while it waits for a buffer or for room in the parse queue
+        {
+            IoScheduler::Stream throttle(&pipeline.Scheduler, source_device, IoScheduler::TRAFFIC_COPY, IoScheduler::IO_READ);
+            for (size_t chunk_index = first_new_read; chunk_index < next_read; ++chunk_index)
+            {
+                const size_t slot = chunk_index % READ_RING_DEPTH;
+                const Chunk &chunk = in_flight[slot];
+                if (chunk.Length > 0)
+                {
+                    throttle.Throttle(chunk.Length);
+                    ring.PrepareRead(source_fd, chunk.Buffer, chunk.Length, chunk.Offset, slot);
+                }
+            }
+            ring.Submit();
+
+            // Wait for the oldest chunk, handling the others as they finish
+            const size_t oldest = next_queue % READ_RING_DEPTH;
+            while (!failed && (bytes_read[oldest] < in_flight[oldest].Length))
+            {
+                IoRing::Completion completion = {};
+                if (!ring.WaitCompletion(completion) || (completion.Result <= 0))
+                {
+                    failed = true;
+                    break;
+                }
+                const size_t slot = static_cast<size_t>(completion.UserData);
+                bytes_read[slot] += static_cast<size_t>(completion.Result);
+                const Chunk &chunk = in_flight[slot];
+                if (bytes_read[slot] < chunk.Length)
+                {
+                    ring.PrepareRead(source_fd, chunk.Buffer + bytes_read[slot], chunk.Length - bytes_read[slot],
+                                     chunk.Offset + bytes_read[slot], slot);
+                    ring.Submit();
+                }
+            }
+        }
+
+        while (!failed && (next_queue < next_read))
+        {
+            const size_t slot = next_queue % READ_RING_DEPTH;
+            Chunk &chunk = in_flight[slot];
+            if (bytes_read[slot] < chunk.Length)
+            {
+                break;
+            }
+            hash.Update(chunk.Buffer, chunk.Length);
+            ++next_queue;
+            if ((next_queue == chunk_count) && !is_duplicate)
+            {
+                job->SourceDigest = hash.Digest();
+                if (job->Reservation != 0)
+                {
+                    pipeline.Library.SetReservedDigest(job->Reservation, job->SourceDigest);
+                }
+            }
+            pipeline.ToParse.Push(std::move(chunk));
+            chunk = Chunk();
+        }
+    }
+
+    if (failed)
+    {
+        // The buffers can only be returned once the kernel is done with them
+        IoRing::Completion completion = {};
+        while ((ring.InFlight() > 0) && ring.WaitCompletion(completion))
+        {
+        }
+        for (size_t chunk_index = next_queue; chunk_index < next_read; ++chunk_index)
+        {
+            Chunk &chunk = in_flight[chunk_index % READ_RING_DEPTH];
+            pipeline.Buffers.Release(chunk.Buffer);
+            chunk = Chunk();
+        }
+
+        // The chunks that will never be queued are retired along with this one,
+        // so the writers still see the photo finish
+        SetStatus(*job, FILE_COPY_ERR);
+        failed_chunk.Offset        = static_cast<uint64_t>(next_queue) * buffer_size;
+        failed_chunk.ChunksRetired = chunk_count - next_queue;
+        failed_chunk.First         = (next_queue == 0);
+        pipeline.ToParse.Push(failed_chunk);
+    }
+
+    close(source_fd);
+}
+
+/**
+ * @brief Parse stage. Prepares the destination of each photo from its first chunk,
+ *        then passes every chunk on to the writers.
+ *        Runs on a single thread, so a photo's first chunk is always handled before
+ *        the rest of its chunks reach the writers. Problems the parser found in a
+ *        photo are printed once the photo's destination is prepared.
+ *
+ * @param[in,out] pipeline The run's queues and buffers
+ *
+ * @return None
+ */
+void Ingest::ParseStage(Pipeline &pipeline)
+{
+    cExifParser Parser;
+    cRingDiagnosticSink Diagnostics(SEVERITY_WARNING);
+    Parser.SetDiagnosticSink(Diagnostics);
+    std::vector<Diagnostic> found;
+    Chunk chunk;
+    while (pipeline.ToParse.Pop(chunk))
+    {
+        if (chunk.First && (chunk.Job->Status.load(std::memory_order_acquire) == STATUS_PENDING))
+        {
+            PrepareDestination(pipeline, chunk, Parser);
+            found.clear();
+            Diagnostics.Drain(found);
+            if (!found.empty())
+            {
+                std::lock_guard<std::mutex> lock(pipeline.OutputMutex);
+                for (const Diagnostic &diagnostic : found)
+                {
+                    std::cout << chunk.Job->Source << ": " << DiagnosticMessage(diagnostic.Code);
+                    if (diagnostic.Value != 0)
+                    {
+                        std::cout << " (" << diagnostic.Value << ")";
+                    }
+                    std::cout << std::endl;
+                }
+            }
+        }
+        pipeline.ToWrite.Push(std::move(chunk));
+    }
+}
+
+/**
+ * @brief Finds a date in a photo's file name, as many cameras and phones name their photos,
+ *        such as IMG_20230429_193833.jpg or PXL_20230429_193833123.jpg. The date is eight
+ *        digits on their own, optionally followed by a separator and six digits of time.
+ *
+ * @param[in] file The photo
+ * @param[out] date_time The date, and the time if the name holds one
+ *
+ * @return True if the name holds a valid date
+ */
+const bool Ingest::DateFromFileName(const fs::path &file, tm &date_time)
+{
+    static constexpr size_t DATE_DIGITS = 8;
+    static constexpr size_t TIME_DIGITS = 6;
+    static constexpr int DAYS_IN_MONTH[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    const std::string name = file.stem().string();
+    const auto is_digit = [&name](const size_t index) {return (index < name.size()) && isdigit(static_cast<unsigned char>(name[index]));};
+    const auto digits_at = [&name](const size_t start, const size_t count)
+    {
+        int value = 0;
+        for (size_t index = start; index < (start + count); ++index)
+        {
+            value = (value * 10) + (name[index] - '0');
+        }
+        return value;
+    };
+    const auto run_end = [&is_digit](size_t index)
+    {
+        while (is_digit(index))
+        {
+            ++index;
+        }
+        return index;
+    };
+
+    // A run of digits longer than a date, such as a timestamp, is not a date
+    for (size_t start = 0; start < name.size(); start = std::max(start + 1, run_end(start)))
+    {
+        const size_t end = run_end(start);
+        if ((end - start) != DATE_DIGITS)
+        {
+            continue;
+        }
+
+        const int year  = digits_at(start, 4);
+        const int month = digits_at(start + 4, 2);
+        const int day   = digits_at(start + 6, 2);
+        const bool is_leap = ((year % 4) == 0) && (((year % 100) != 0) || ((year % 400) == 0));
+        if ((year < 1970) || (year > 2199) || (month < 1) || (month > 12) || (day < 1) ||
+            (day > DAYS_IN_MONTH[month - 1]) || ((month == 2) && (day == 29) && !is_leap))
+        {
+            continue;
+        }
+
+        date_time = tm();
+        date_time.tm_year = year - 1900;
+        date_time.tm_mon  = month - 1;
+        date_time.tm_mday = day;
+
+        // The time is optional, and is left at midnight if it is not valid.
+        // Extra digits after it, such as milliseconds, are ignored.
+        const size_t time_start = end + 1;
+        if ((end < name.size()) && ((run_end(time_start) - time_start) >= TIME_DIGITS) &&
+            (digits_at(time_start, 2) < 24) && (digits_at(time_start + 2, 2) < 60) && (digits_at(time_start + 4, 2) < 60))
+        {
+            date_time.tm_hour = digits_at(time_start, 2);
+            date_time.tm_min  = digits_at(time_start + 2, 2);
+            date_time.tm_sec  = digits_at(time_start + 4, 2);
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Dates a photo that has no EXIF date by its file name, or else by its modified time.
+ *        Only the data already gathered for the photo is used, so nothing is read again.
+ *
+ * @param[in,out] job The photo. DatedBy is set to where the date came from.
+ * @param[out] date_time The date
+ *
+ * @return True if a date was found
+ */
+const bool Ingest::FallbackDate(FileJob &job, tm &date_time)
+{
+    if (DateFromFileName(job.Source, date_time))
+    {
+        job.DatedBy = DATE_FILE_NAME;
+        return true;
+    }
+
+    const time_t modified_seconds = static_cast<time_t>(job.ModifiedTime / 1000000000);
+    if ((job.ModifiedTime <= 0) || (localtime_r(&modified_seconds, &date_time) == nullptr))
+    {
+        return false;
+    }
+    job.DatedBy = DATE_MODIFIED_TIME;
+    return true;
+}
+
+/**
+ * @brief Reads the photo's date from its first chunk, creates the date folder and
+ *        creates the destination file for the writers to fill in. Saves the photo's
+ *        EXIF thumbnail if the run keeps thumbnails.
+ *
+ * @param[in,out] pipeline The run's queues and buffers
+ * @param[in] first_chunk The chunk at the start of the photo
+ * @param[in,out] parser Parser reused for every photo
+ *
+ * @return None
+ */
+void Ingest::PrepareDestination(Pipeline &pipeline, const Chunk &first_chunk, cExifParser &parser)
+{
+    FileJob &job = *first_chunk.Job;
+    const bool is_duplicate = !job.DuplicateOf.empty();
+    if (is_duplicate && (pipeline.OnDuplicate == DUPLICATE_SKIP))
+    {
+        job.Destination = job.DuplicateOf;
+        SetStatus(job, FILE_DUPLICATE);
+        return;
+    }
+
+    const ExifMetadata Metadata = parser.ParseExifData(cByteSpan(first_chunk.Buffer, first_chunk.Length));
+    job.ExifStatus = Metadata.Status;
+    tm PhotoDateTime = Metadata.DateTime;
+    if (!Metadata.HasDateTime && !(pipeline.DateFallback && FallbackDate(job, PhotoDateTime)))
+    {
+        SetStatus(job, FILE_NO_DATE);
+        return;
+    }
+    if (job.DatedBy != DATE_EXIF)
+    {
+        ++pipeline.FallbackDated;
+    }
+
+    // Only the first photo of each date touches the destination to make its folder
+    char date_folder[FolderCache::DATE_FOLDER_LENGTH];
+    if ((FolderCache::FormatDateFolder(PhotoDateTime, date_folder, sizeof(date_folder)) == 0) ||
+        !pipeline.Folders.Create(PhotoDateTime))
+    {
+        SetStatus(job, FILE_FOLDER_ERR);
+        return;
+    }
+
+    fs::path destination_path = pipeline.DestinationRoot / date_folder / job.Source.filename();
+    job.Destination = destination_path;
+
+    // Checked here so a photo already in the library is not copied, linked or given a thumbnail
+    // at all. The commit stage checks again when it renames the copy, so the photo is never overwritten.
+    struct stat destination_info = {};
+    if (lstat(destination_path.c_str(), &destination_info) == 0)
+    {
+        SetStatus(job, FILE_ALREADY_EXISTS);
+        return;
+    }
+
+    // The thumbnail is a view of the first chunk, so saving it reads nothing more from the source.
+    // It is named apart from the photo, so it can never be mistaken for one. A photo without a
+    // thumbnail, or whose thumbnail could not be saved, is still copied.
+    cByteSpan thumbnail;
+    if (!pipeline.ThumbnailRoot.empty() && parser.GetThumbnail(thumbnail) && pipeline.ThumbnailFolders.Create(PhotoDateTime))
+    {
+        fs::path thumbnail_name = job.Source.filename();
+        thumbnail_name.replace_extension(THUMBNAIL_EXTENSION);
+        parser.WriteThumbnail((pipeline.ThumbnailRoot / date_folder / thumbnail_name).string());
+    }
+
+    // The link is made by the commit stage, so the folders of a whole group are flushed together
+    if (is_duplicate && (pipeline.OnDuplicate == DUPLICATE_HARDLINK) && !pipeline.CopyDuplicates)
+    {
+        job.Method = COPY_LINKED;
+        return;
+    }
+
+    job.TempDestination = TempNameFor(pipeline, destination_path);
+    job.DestFd = open(job.TempDestination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (job.DestFd < 0)
+    {
+        SetStatus(job, FILE_COPY_ERR);
+        return;
+    }
+    job.CreatedDestination = true;
+
+    // Recorded before any data is written, so a later run can remove the temporary file
+    // if this one does not finish it
+    if (pipeline.UseHistory)
+    {
+        pipeline.History.Record(job.Source.string(), {Manifest::ENTRY_COPYING, job.Size, job.ModifiedTime, 0,
+                                                      job.TempDestination.string()});
+    }
+
+    if (is_duplicate && (pipeline.OnDuplicate == DUPLICATE_REFLINK))
+    {
+        CloneDuplicate(job);
+    }
+}
+
+/**
+ * @brief Checks if the library's filesystem can hold hard links, by linking a scratch
+ *        file in its root. Called once before the pipeline starts.
+ *
+ * @param[in,out] pipeline The run's state
+ *
+ * @return True if the link was made
+ */
+const bool Ingest::SupportsHardLinks(Pipeline &pipeline)
+{
+    const fs::path probe = TempNameFor(pipeline, pipeline.DestinationRoot / "link-probe");
+    const fs::path probe_link = TempNameFor(pipeline, pipeline.DestinationRoot / "link-probe");
+    const int probe_fd = open(probe.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (probe_fd < 0)
+    {
+        return false;
+    }
+    close(probe_fd);
+
+    const bool linked = (link(probe.c_str(), probe_link.c_str()) == 0);
+    unlink(probe_link.c_str());
+    unlink(probe.c_str());
+    return linked;
+}
+
+/**
+ * @brief Clones the library file with the same contents as a duplicate photo into the
+ *        photo's temporary file, which is then flushed, verified and committed like any
+ *        other copy. A clone only shares the library file's extents, so one that can not
+ *        be made is not worth a full copy of the data, and the photo is skipped instead.
+ *
+ * @param[in,out] job The duplicate photo, whose temporary file is open
+ *
+ * @return None
+ */
+void Ingest::CloneDuplicate(FileJob &job)
+{
+    const int library_fd = open(job.DuplicateOf.c_str(), O_RDONLY | O_CLOEXEC);
+    const bool cloned = (library_fd >= 0) && (ioctl(job.DestFd, FICLONE, library_fd) == 0);
+    if (library_fd >= 0)
+    {
+        close(library_fd);
+    }
+    if (cloned)
+    {
+        job.Method = COPY_CLONED;
+        return;
+    }
+
+    // The temporary file is removed once the writers are done with the photo's chunk
+    job.Destination = job.DuplicateOf;
+    SetStatus(job, FILE_DUPLICATE);
+}
+
+/**
+ * @brief Write stage. Writes each chunk to its photo's destination and returns the
+ *        chunk's buffer to the pool. Chunks of one photo may be written by different
+ *        threads in any order.
+ *
+ * @param[in,out] pipeline The run's queues and buffers
+ *
+ * @return None
+ */
+void Ingest::WriteStage(Pipeline &pipeline)
+{
+    Chunk chunk;
+    while (pipeline.ToWrite.Pop(chunk))
+    {
+        FileJob &job = *chunk.Job;
+        if ((chunk.Buffer != nullptr) && (job.Method == COPY_WRITTEN) &&
+            (job.Status.load(std::memory_order_acquire) == STATUS_PENDING))
+        {
+            IoScheduler::Stream throttle(&pipeline.Scheduler, pipeline.DestinationDevice,
+                                         IoScheduler::TRAFFIC_COPY, IoScheduler::IO_WRITE);
+            throttle.Throttle(chunk.Length);
+            size_t bytes_written = 0;
+            while (bytes_written < chunk.Length)
+            {
+                const ssize_t result = pwrite(job.DestFd, chunk.Buffer + bytes_written, chunk.Length - bytes_written,
+                                              static_cast<off_t>(chunk.Offset + bytes_written));
+                if ((result < 0) && (errno == EINTR))
+                {
+                    continue;
+                }
+                if (result <= 0)
+                {
+                    SetStatus(job, FILE_COPY_ERR);
+                    break;
+                }
+                bytes_written += static_cast<size_t>(result);
+            }
+        }
+
+        if (chunk.Buffer != nullptr)
+        {
+            pipeline.Buffers.Release(chunk.Buffer);
+        }
+
+        const size_t retired = chunk.ChunksRetired;
+        if (job.ChunksRemaining.fetch_sub(retired, std::memory_order_acq_rel) == retired)
+        {
+            FinishWrites(pipeline, chunk.Job);
+        }
+        chunk = Chunk();
+    }
+}
+
+/**
+ * @brief Called once every chunk of a photo has been written. Sends the copy to be
+ *        flushed, or a duplicate to be linked straight to the commit stage, or removes
+ *        the partial copy if the photo failed. The temporary file stays open until the
+ *        flush stage has flushed it.
+ *
+ * @param[in,out] pipeline The run's queues and buffers
+ * @param[in] job The photo
+ *
+ * @return None
+ */
+void Ingest::FinishWrites(Pipeline &pipeline, const std::shared_ptr<FileJob> &job)
+{
+    if (job->Status.load(std::memory_order_acquire) == STATUS_PENDING)
+    {
+        if (job->Method == COPY_LINKED)
+        {
+            pipeline.ToCommit.Push(job);
+        }
+        else
+        {
+            pipeline.ToFlush.Push(job);
+        }
+        return;
+    }
+
+    DiscardCopy(*job);
+    RecordResult(pipeline, *job);
+}
+
+/**
+ * @brief Closes and removes the temporary file of a photo that failed.
+ *
+ * @param[in,out] job The photo
+ *
+ * @return None
+ */
+void Ingest::DiscardCopy(FileJob &job)
+{
+    if (job.DestFd >= 0)
+    {
+        close(job.DestFd);
+        job.DestFd = -1;
+    }
+    if (job.CreatedDestination)
+    {
+        unlink(job.TempDestination.c_str());
+    }
+}
+
+/**
+ * @brief Waits for a photo on a queue, then takes every other photo that is waiting,
+ *        up to SYNC_GROUP_SIZE in all.
+ *
+ * @param[in,out] queue The queue
+ * @param[out] group The photos taken. Cleared first.
+ *
+ * @return False once the queue is closed and empty
+ */
+const bool Ingest::PopGroup(LockFreeQueue<std::shared_ptr<FileJob>> &queue, std::vector<std::shared_ptr<FileJob>> &group)
+{
+    group.clear();
+    std::shared_ptr<FileJob> job;
+    if (!queue.Pop(job))
+    {
+        return false;
+    }
+    group.push_back(std::move(job));
+    while ((group.size() < SYNC_GROUP_SIZE) && queue.TryPop(job))
+    {
+        group.push_back(std::move(job));
+    }
+    return true;
+}
+
+/**
+ * @brief Flush stage. Takes every written copy that is waiting, up to SYNC_GROUP_SIZE,
+ *        and flushes them to the device together. While one group is being flushed the
+ *        next one builds up, so the slower the device, the more copies share each flush.
+ *        The manifest is flushed once per group, before the copies.
+ *        Copies that reached the device are sent to be verified.
+ *
+ * @param[in,out] pipeline The run's queues and buffers
+ *
+ * @return None
+ */
+void Ingest::FlushStage(Pipeline &pipeline)
+{
+    std::vector<std::shared_ptr<FileJob>> group;
+    group.reserve(SYNC_GROUP_SIZE);
+    while (PopGroup(pipeline.ToFlush, group))
+    {
+        // The copies' records are made durable first, so a crash can never leave a
+        // flushed temporary file that the next run does not know to remove
+        if (pipeline.UseHistory)
+        {
+            pipeline.History.Flush();
+        }
+
+        // Every copy is on the destination filesystem, so one syncfs flushes them all with a
+        // single journal commit. Network filesystems are flushed a file at a time instead.
+        const bool group_flushed = pipeline.SyncEachFile || (syncfs(group.front()->DestFd) == 0);
+
+        for (std::shared_ptr<FileJob> &job : group)
+        {
+            const bool flushed = group_flushed && (!pipeline.SyncEachFile || (fdatasync(job->DestFd) == 0));
+            const bool closed = (close(job->DestFd) == 0);
+            job->DestFd = -1;
+            if (flushed && closed)
+            {
+                pipeline.ToVerify.Push(std::move(job));
+                continue;
+            }
+
+            SetStatus(*job, FILE_COPY_ERR);
+            DiscardCopy(*job);
+            RecordResult(pipeline, *job);
+        }
+    }
+}
+
+/**
+ * @brief Verify stage. Reads each flushed copy back from the device rather than the
+ *        page cache, hashes it and compares it to the hash taken while the source was
+ *        read. Copies that match are sent to be committed.
+ *
+ * @param[in,out] pipeline The run's queues and buffers
+ *
+ * @return None
+ */
+void Ingest::VerifyStage(Pipeline &pipeline)
+{
+    std::shared_ptr<FileJob> job;
+    while (pipeline.ToVerify.Pop(job))
+    {
+        if (Filesystem::VerifyDigest(job->TempDestination, job->SourceDigest, Filesystem::VERIFY_UNCACHED) == 0)
+        {
+            pipeline.ToCommit.Push(std::move(job));
+            continue;
+        }
+
+        SetStatus(*job, FILE_VERIFY_ERR);
+        DiscardCopy(*job);
+        RecordResult(pipeline, *job);
+        job.reset();
+    }
+}
+
+/**
+ * @brief Commit stage. Takes every verified copy that is waiting, up to SYNC_GROUP_SIZE,
+ *        and commits them together.
+ *
+ * @param[in,out] pipeline The run's queues and buffers
+ *
+ * @return None
+ */
+void Ingest::CommitStage(Pipeline &pipeline)
+{
+    std::vector<std::shared_ptr<FileJob>> group;
+    group.reserve(SYNC_GROUP_SIZE);
+    while (PopGroup(pipeline.ToCommit, group))
+    {
+        CommitGroup(pipeline, group);
+    }
+}
+
+/**
+ * @brief Renames each of a group of flushed and verified copies to its destination, or
+ *        links each duplicate into place, and flushes the folders the names were made in.
+ *
+ *        The contents were flushed and read back before any copy is renamed, so a crash
+ *        can never leave a photo in the library whose contents did not reach the device.
+ *        The folders are flushed before the photos are recorded as verified, so the
+ *        manifest never skips a photo whose rename was lost. A crash part way leaves only
+ *        temporary files, which the next run removes.
+ *
+ * @param[in,out] pipeline The run's queues and counters
+ * @param[in,out] group The copies. Each one's status is set and recorded.
+ *
+ * @return None
+ */
+void Ingest::CommitGroup(Pipeline &pipeline, std::vector<std::shared_ptr<FileJob>> &group)
+{
+    std::vector<fs::path> folders;
+    for (const std::shared_ptr<FileJob> &job : group)
+    {
+        if (job->Method == COPY_LINKED)
+        {
+            // A link that can not be made leaves the photo where it is in the library
+            if (link(job->DuplicateOf.c_str(), job->Destination.c_str()) != 0)
+            {
+                if (errno == EEXIST)
+                {
+                    SetStatus(*job, FILE_ALREADY_EXISTS);
+                    continue;
+                }
+                job->Destination = job->DuplicateOf;
+                SetStatus(*job, FILE_DUPLICATE);
+                continue;
+            }
+        }
+        else
+        {
+            const int rename_error = RenameNoReplace(job->TempDestination, job->Destination);
+            if (rename_error != 0)
+            {
+                SetStatus(*job, (rename_error == EEXIST) ? FILE_ALREADY_EXISTS : FILE_COPY_ERR);
+                DiscardCopy(*job);
+                continue;
+            }
+        }
+
+        fs::path folder = job->Destination.parent_path();
+        if (std::find(folders.begin(), folders.end(), folder) == folders.end())
+        {
+            folders.push_back(std::move(folder));
+        }
+    }
+
+    for (const fs::path &folder : folders)
+    {
+        FlushFolder(folder);
+    }
+
+    for (const std::shared_ptr<FileJob> &job : group)
+    {
+        SetStatus(*job, job->DuplicateOf.empty() ? FILE_COPIED : FILE_DUPLICATE);
+        RecordResult(pipeline, *job);
+    }
+}
+
+/**
+ * @brief Picks the temporary name a photo is written under until it is committed. The name
+ *        is hidden and beside the destination, so the library walk skips it, and each name
+ *        is unique, so two photos with the same name never write the same file.
+ *        Only called by the parse stage.
+ *
+ * @param[in,out] pipeline The run's state
+ * @param[in] destination Where the photo belongs in the library
+ *
+ * @return The temporary name
+ */
+const fs::path Ingest::TempNameFor(Pipeline &pipeline, const fs::path &destination)
+{
+    std::string temp_name = ".";
+    temp_name += destination.filename().string();
+    temp_name += '.' + std::to_string(getpid()) + '.' + std::to_string(pipeline.NextTempId++) + ".partial";
+    return destination.parent_path() / temp_name;
+}
+
+/**
+ * @brief Flushes a folder, so the names just made in it survive a crash.
+ *        Some network filesystems can not flush a folder. Their servers commit names as they are made.
+ *
+ * @param[in] folder The folder
+ *
+ * @return None
+ */
+void Ingest::FlushFolder(const fs::path &folder)
+{
+    const int folder_fd = open(folder.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (folder_fd >= 0)
+    {
+        fsync(folder_fd);
+        close(folder_fd);
+    }
+}
+
+/**
+ * @brief Renames a file unless the new name is already taken.
+ *        Filesystems that can not rename that way, such as some network filesystems, get
+ *        a hard link and an unlink instead, and failing that a check followed by a rename.
+ *
+ * @param[in] from The file
+ * @param[in] to Its new name
+ *
+ * @return Zero if the file was renamed, EEXIST if the new name is taken, or another errno value
+ */
+const int Ingest::RenameNoReplace(const fs::path &from, const fs::path &to)
+{
+    if (syscall(SYS_renameat2, AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(), RENAME_NOREPLACE) == 0)
+    {
+        return 0;
+    }
+    if ((errno != EINVAL) && (errno != ENOSYS))
+    {
+        return errno;
+    }
+
+    if (link(from.c_str(), to.c_str()) == 0)
+    {
+        unlink(from.c_str());
+        return 0;
+    }
+    if (errno == EEXIST)
+    {
+        return EEXIST;
+    }
+
+    struct stat destination_info = {};
+    if (lstat(to.c_str(), &destination_info) == 0)
+    {
+        return EEXIST;
+    }
+    return (rename(from.c_str(), to.c_str()) == 0) ? 0 : errno;
+}
+
+/**
+ * @brief Counts the outcome of ingesting a photo and reports it.
+ *
+ * @param[in,out] pipeline The counters for the run
+ * @param[in] job The photo that was ingested
+ *
+ * @return None
+ */
+void Ingest::RecordResult(Pipeline &pipeline, const FileJob &job)
+{
+    const char *message = "";
+    const int status = job.Status.load(std::memory_order_acquire);
+    switch (status)
+    {
+        case FILE_COPIED:
+        {
+            ++pipeline.Copied;
+            message = "Image copied successfully";
+            break;
+        }
+        case FILE_ALREADY_EXISTS:
+        {
+            ++pipeline.AlreadyExisted;
+            message = "Image already exists in the destination";
+            break;
+        }
+        case FILE_DUPLICATE:
+        {
+            ++pipeline.Duplicates;
+            message = "Image is already in the library as ";
+            break;
+        }
+        case FILE_NO_DATE:
+        {
+            ++pipeline.NoDate;
+            message = "Could not read the image's date";
+            break;
+        }
+        case FILE_FOLDER_ERR:
+        {
+            ++pipeline.Failed;
+            message = "Could not create the date folder";
+            break;
+        }
+        case FILE_COPY_ERR:
+        {
+            ++pipeline.Failed;
+            message = "Could not copy the image";
+            break;
+        }
+        case FILE_VERIFY_ERR:
+        {
+            ++pipeline.Failed;
+            message = "Could not verify the images";
+            break;
+        }
+    }
+
+    if ((job.Reservation != 0) && (status == FILE_COPIED))
+    {
+        pipeline.Library.Commit(job.Reservation, job.Destination.string());
+    }
+    else if (job.Reservation != 0)
+    {
+        pipeline.Library.Release(job.Reservation);
+    }
+    if (pipeline.UseHistory && ((status == FILE_COPIED) || (status == FILE_DUPLICATE)))
+    {
+        pipeline.History.Record(job.Source.string(), {Manifest::ENTRY_VERIFIED, job.Size, job.ModifiedTime,
+                                                      job.SourceDigest, job.Destination.string()});
+    }
+    else if (pipeline.UseHistory && (status == FILE_ALREADY_EXISTS))
+    {
+        // Recorded so later runs skip the photo too. The file already at the destination
+        // was never compared with it, so its digest is left unknown.
+        pipeline.History.Record(job.Source.string(), {Manifest::ENTRY_VERIFIED, job.Size, job.ModifiedTime,
+                                                      0, job.Destination.string()});
+    }
+    else if (pipeline.UseHistory && (status == FILE_NO_DATE))
+    {
+        pipeline.History.Record(job.Source.string(), {Manifest::ENTRY_NO_DATE, job.Size, job.ModifiedTime, 0, ""});
+    }
+
+    std::lock_guard<std::mutex> lock(pipeline.OutputMutex);
+    std::cout << job.Source << ": " << message;
+    if (status == FILE_DUPLICATE)
+    {
+        std::cout << job.DuplicateOf;
+    }
+    else if (status == FILE_NO_DATE)
+    {
+        std::cout << " (" << ExifParseStatusMessage(job.ExifStatus) << ")";
+    }
+    if (job.DatedBy == DATE_FILE_NAME)
+    {
+        std::cout << ", dated by its file name";
+    }
+    else if (job.DatedBy == DATE_MODIFIED_TIME)
+    {
+        std::cout << ", dated by its modified time";
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * @brief Ingests every JPEG in the source folder and its subfolders.
+ *        The folders are listed by a pool of walker threads while the pipeline stages
+ *        prefetch, read, parse, write, flush, verify and commit the photos found so far.
+ *        Each stage is shut down once the stage in front of it has finished and its queue
+ *        is empty.
+ *
+ *        Photos recorded in the manifest by an earlier run are skipped without being
+ *        read, as long as their size and modified time have not changed. Photos whose
+ *        contents are already in the library are handled as options.Duplicates says.
+ *        Photos without an EXIF date are dated by their file name or modified time if
+ *        options.DateFallback is set, including those an earlier run left without a date.
+ *        The source and destination devices are read and written no faster, and by no
+ *        more threads at once, than the options' limits allow.
+ *
+ * @param[in] options Settings for the run
+ *
+ * @return The number of photos that ended with each outcome
+ */
+const Ingest::Summary Ingest::Run(const Options &options)
+{
+    const size_t reader_count = (options.ReaderCount > 0) ? options.ReaderCount : DefaultWorkerCount(options.SourceRoot);
+    const size_t writer_count = (options.WriterCount > 0) ? options.WriterCount : DefaultWorkerCount(options.DestinationRoot);
+    const size_t buffer_size  = std::max(MIN_BUFFER_SIZE, (options.BufferSize > 0) ? options.BufferSize : DEFAULT_BUFFER_SIZE);
+    const size_t buffer_count = (options.BufferCount > 0) ? options.BufferCount
+                                                          : ((reader_count + writer_count) * BUFFERS_PER_WORKER);
+
+    Pipeline pipeline(buffer_size, buffer_count);
+    pipeline.DestinationRoot = options.DestinationRoot;
+    pipeline.ThumbnailRoot = options.ThumbnailRoot;
+    pipeline.Folders.Open(pipeline.DestinationRoot);
+    if (!pipeline.ThumbnailRoot.empty())
+    {
+        pipeline.ThumbnailFolders.Open(pipeline.ThumbnailRoot);
+    }
+    pipeline.UseHistory = OpenHistory(pipeline, options);
+    pipeline.OnDuplicate = options.Duplicates;
+    pipeline.DateFallback = options.DateFallback;
+    pipeline.SyncEachFile = IsNetworkFilesystem(options.DestinationRoot);
+    if ((pipeline.OnDuplicate == DUPLICATE_HARDLINK) && !SupportsHardLinks(pipeline))
+    {
+        pipeline.CopyDuplicates = true;
+        std::cout << "The library can not hold hard links, so duplicates are copied" << std::endl;
+    }
+
+    // Limits are set on the devices the source and destination roots are on. Filesystem
+    // applies them to the hashing and verifying it does for the pipeline.
+    const uint64_t source_device = IoScheduler::DeviceOf(options.SourceRoot);
+    pipeline.DestinationDevice = IoScheduler::DeviceOf(pipeline.DestinationRoot);
+    pipeline.Scheduler.SetLimits(source_device, IoScheduler::TRAFFIC_COPY,
+                                 {options.SourceBytesPerSecond, options.MaxCopyStreams});
+    pipeline.Scheduler.SetLimits(pipeline.DestinationDevice, IoScheduler::TRAFFIC_COPY,
+                                 {options.DestinationBytesPerSecond, options.MaxCopyStreams});
+    for (const uint64_t device : {source_device, pipeline.DestinationDevice})
+    {
+        pipeline.Scheduler.SetLimits(device, IoScheduler::TRAFFIC_VERIFY, {options.VerifyBytesPerSecond, options.MaxVerifyStreams});
+    }
+    Filesystem::SetScheduler(&pipeline.Scheduler);
+
+    const size_t prefetch_count = (options.PrefetchCount > 0) ? options.PrefetchCount : (reader_count * PREFETCH_PER_READER);
+    pipeline.Prefetch.SetWindow((options.SourceBytesPerSecond > 0) ? 0 : prefetch_count, buffer_size);
+    LoadLibraryIndex(pipeline, options);
+
+    std::vector<std::thread> prefetchers;
+    std::vector<std::thread> readers;
+    std::vector<std::thread> writers;
+    std::vector<std::thread> verifiers;
+    const size_t prefetcher_count = IsNetworkFilesystem(options.SourceRoot) ? NETWORK_PREFETCHERS : 1;
+    for (size_t index = 0; index < prefetcher_count; ++index)
+    {
+        prefetchers.emplace_back(PrefetchStage, std::ref(pipeline));
+    }
+    for (size_t index = 0; index < reader_count; ++index)
+    {
+        readers.emplace_back(ReadStage, std::ref(pipeline));
+    }
+    std::thread parser(ParseStage, std::ref(pipeline));
+    std::thread flusher(FlushStage, std::ref(pipeline));
+    std::thread committer(CommitStage, std::ref(pipeline));
+    for (size_t index = 0; index < writer_count; ++index)
+    {
+        writers.emplace_back(WriteStage, std::ref(pipeline));
+        verifiers.emplace_back(VerifyStage, std::ref(pipeline));
+    }
+
+    // Photos are recorded by absolute path so runs from different working directories agree.
+    // Each photo is queued as soon as it is listed, so the prefetchers and readers start on the
+    // first folder while the walkers are still listing the rest.
+    std::error_code error;
+    const fs::path source_root = fs::absolute(options.SourceRoot, error).lexically_normal();
+    DirectoryWalker walker(DefaultWorkerCount(source_root));
+    walker.Walk(source_root.string(), [&pipeline, &options](const DirectoryWalker::Entry &file)
+    {
+        if (!IsJpeg(file.Name))
+        {
+            return;
+        }
+
+        fs::path source_image = file.Path();
+        struct stat source_info = {};
+        if (pipeline.UseHistory && (fstatat(file.DirectoryFd, file.Name, &source_info, 0) == 0) &&
+            pipeline.History.IsUnchanged(source_image.string(), static_cast<uint64_t>(source_info.st_size),
+                                         ModifiedTimeOf(source_info), !options.DateFallback))
+        {
+            ++pipeline.Unchanged;
+            return;
+        }
+        pipeline.ToPrefetch.Push(std::move(source_image));
+    }, [&pipeline](const std::string &directory, const int list_error)
+    {
+        std::lock_guard<std::mutex> lock(pipeline.OutputMutex);
+        std::cerr << "Could not list " << directory << ": " << strerror(list_error) << std::endl;
+    });
+
+    pipeline.ToPrefetch.Close();
+    for (std::thread &prefetcher : prefetchers)
+    {
+        prefetcher.join();
+    }
+    pipeline.Paths.Close();
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+    pipeline.ToParse.Close();
+    parser.join();
+    pipeline.ToWrite.Close();
+    for (std::thread &writer : writers)
+    {
+        writer.join();
+    }
+    pipeline.ToFlush.Close();
+    flusher.join();
+    pipeline.ToVerify.Close();
+    for (std::thread &verifier : verifiers)
+    {
+        verifier.join();
+    }
+    pipeline.ToCommit.Close();
+    committer.join();
+
+    Filesystem::SetScheduler(nullptr);
+    if (pipeline.UseHistory && (pipeline.History.Close() != Manifest::NO_ERROR))
+    {
+        std::cerr << "Could not save the manifest" << std::endl;
+    }
+
+    Summary summary = {};
+    summary.Copied         = pipeline.Copied;
+    summary.Unchanged      = pipeline.Unchanged;
+    summary.AlreadyExisted = pipeline.AlreadyExisted;
+    summary.Duplicates     = pipeline.Duplicates;
+    summary.NoDate         = pipeline.NoDate;
+    summary.Failed         = pipeline.Failed;
+    summary.FallbackDated  = pipeline.FallbackDated;
+    return summary;
+}
@@ -0,0 +1,278 @@
+/**
+* @file Ingest.hpp
+* @brief Copies photos from a source folder into a date sorted destination library
+*/
+
+#pragma once
+
+#include "BufferPool.hpp"
+#include "DedupIndex.hpp"
+#include "FolderCache.hpp"
+#include "IoScheduler.hpp"
+#include "LockFreeQueue.hpp"
+#include "Manifest.hpp"
+#include "Prefetcher.hpp"
+#include "XxHash64.hpp"
+#include <atomic>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fs = std::filesystem;
+
+class cExifParser;
+class IoRing;
+enum ExifParseStatus : uint8_t;
+
+/**
+ * @brief Ingests photos through a pipeline of stages, each running on its own threads:
+ *
+ *        prefetch - has the kernel start reading the next few photos into the page cache,
+ *                   so the readers do not wait on a cold round trip to a network source
+ *        read     - streams each photo from the source once, into buffers from a fixed pool,
+ *                   hashing the bytes as they are read. Each reader keeps reads of several
+ *                   chunks in flight at once through its own IoRing.
+ *        parse    - reads the EXIF date straight out of the first buffer of each photo and
+ *                   creates the photo's date folder and destination file
+ *        write    - writes the buffers to a temporary file beside the destination and returns
+ *                   them to the pool
+ *        flush    - flushes finished copies to the device in groups
+ *        verify   - reads each flushed copy back from the device, bypassing the page cache,
+ *                   and compares its hash to the hash of the source
+ *        commit   - renames verified copies to their destinations in groups, so the library
+ *                   never holds a partial photo or one that did not reach the device intact
+ *
+ *        The stages are connected by bounded lock-free queues. Once every buffer is in
+ *        use the readers wait for the writers, so memory stays bounded while both the
+ *        source and destination devices are kept busy.
+ *
+ *        Every read and write goes through an IoScheduler, so the bandwidth and streams
+ *        each device is used with can be limited, with copying and verifying limited apart.
+ */
+class Ingest
+{
+public:
+
+    /**
+     * @brief The outcome of ingesting one photo
+     */
+    enum FileStatus
+    {
+        FILE_COPIED,         ///< The photo was copied and verified
+        FILE_ALREADY_EXISTS, ///< The destination already has a photo with the same name
+        FILE_DUPLICATE,      ///< The library already has a photo with the same contents
+        FILE_NO_DATE,        ///< The photo's date could not be read from its EXIF data
+        FILE_FOLDER_ERR,     ///< The date folder could not be created
+        FILE_COPY_ERR,       ///< The photo could not be read or written
+        FILE_VERIFY_ERR      ///< The copy does not match the original
+    };
+
+    /**
+     * @brief What to do with a photo whose contents are already somewhere in the library
+     */
+    enum DuplicateAction
+    {
+        DUPLICATE_SKIP,     ///< Leave it out of the library
+        DUPLICATE_HARDLINK, ///< Hard link the library's copy into the photo's date folder, or copy it if the library can not hold hard links
+        DUPLICATE_REFLINK,  ///< Clone the library's copy into the photo's date folder, sharing its extents, or skip it if it can not be cloned
+        DUPLICATE_COPY      ///< Copy it like any other photo. Duplicates are not looked for.
+    };
+
+    /**
+     * @brief Settings for an ingest run. Zero picks a default for any of the counts and sizes,
+     *        and leaves off any of the limits.
+     */
+    struct Options
+    {
+        fs::path SourceRoot;      ///< Folder holding the photos to ingest
+        fs::path DestinationRoot; ///< Root of the date sorted library
+        size_t   ReaderCount;     ///< Threads reading from the source device
+        size_t   WriterCount;     ///< Threads writing to and verifying on the destination device
+        size_t   BufferSize;      ///< Bytes read from a photo into each buffer
+        size_t   BufferCount;     ///< Buffers shared by the whole pipeline
+        fs::path ManifestFile;    ///< Record of photos already ingested. Empty to keep it in the destination root.
+        DuplicateAction Duplicates;
+        bool     DateFallback;    ///< Date photos without an EXIF date by their file name, or else their modified time
+        fs::path ThumbnailRoot;   ///< Where to save the EXIF thumbnail of each photo, in the library's date folders.
+                                  ///< Must be outside of DestinationRoot. Empty to not save thumbnails.
+        uint64_t SourceBytesPerSecond;      ///< Most bytes read from the source device each second to copy photos
+        uint64_t DestinationBytesPerSecond; ///< Most bytes written to the destination device each second
+        uint64_t VerifyBytesPerSecond;      ///< Most bytes read each second, on each device, to verify copies and find duplicates
+        size_t   MaxCopyStreams;            ///< Most threads reading, and most writing, each device at once to copy photos
+        size_t   MaxVerifyStreams;          ///< Most threads reading each device at once to verify copies and find duplicates
+        size_t   PrefetchCount;             ///< Photos the source is read ahead of the readers. Not used if the source
+                                            ///< has a bandwidth limit, which could not count the reads started ahead.
+    };
+
+    /**
+     * @brief Number of photos that ended with each FileStatus
+     */
+    struct Summary
+    {
+        size_t Copied;
+        size_t Unchanged;
+        size_t AlreadyExisted;
+        size_t Duplicates;
+        size_t NoDate;
+        size_t Failed;
+        size_t FallbackDated; ///< Photos dated by their file name or modified time. Also counted by their outcome.
+    };
+
+    static const Summary Run(const Options &options);
+    static const size_t  DefaultWorkerCount(const fs::path &root);
+    static const bool    IsJpeg(const fs::path &file);
+    static const bool    IsJpeg(const char *name);
+    static const bool    IsWithin(const fs::path &folder, const fs::path &root);
+
+private:
+
+    // Network filesystems spend most of each request waiting on the network, so
+    // more requests are kept in flight than there are CPUs.
+    static constexpr size_t NETWORK_WORKER_COUNT   = 16;
+    static constexpr size_t MIN_LOCAL_WORKER_COUNT = 2;
+
+    // The first buffer of each photo must hold the whole EXIF segment, which can be up to 64 KiB
+    static constexpr size_t MIN_BUFFER_SIZE        = 131072;
+    static constexpr size_t DEFAULT_BUFFER_SIZE    = 1048576;
+    static constexpr size_t BUFFERS_PER_WORKER     = 4;
+    static constexpr size_t PATH_QUEUE_CAPACITY    = 1024;
+    static constexpr size_t READ_RING_DEPTH        = 16; ///< Most chunk reads one reader keeps in flight
+    static constexpr size_t PREFETCH_PER_READER    = 2;  ///< Photos prefetched for each reader by default
+    static constexpr size_t NETWORK_PREFETCHERS    = 4;  ///< Prefetch threads for a network source, where each open waits a round trip
+    static constexpr const char *THUMBNAIL_EXTENSION = ".thumb.jpg"; ///< Replaces the photo's extension in its thumbnail's name
+    static constexpr size_t SYNC_GROUP_SIZE        = 64; ///< Most copies flushed to the device, or renamed, at once
+
+    // Status of a photo that is still moving through the pipeline
+    static constexpr int STATUS_PENDING = -1;
+
+    /**
+     * @brief Where the date that picks a photo's folder came from
+     */
+    enum DateSource
+    {
+        DATE_EXIF,
+        DATE_FILE_NAME,    ///< The photo has no EXIF date, but its name holds one, such as IMG_20230429_193833.jpg
+        DATE_MODIFIED_TIME ///< The photo has no EXIF date, so its modified time in the local time zone was used
+    };
+
+    /**
+     * @brief How a photo reaches the library
+     */
+    enum CopyMethod
+    {
+        COPY_WRITTEN, ///< The writers fill in the temporary file from the photo's chunks
+        COPY_CLONED,  ///< The temporary file is a clone of DuplicateOf, so the writers leave it alone
+        COPY_LINKED   ///< DuplicateOf is hard linked into place by the commit stage. There is no temporary file.
+    };
+
+    /**
+     * @brief A photo moving through the pipeline, shared by all of its chunks
+     */
+    struct FileJob
+    {
+        fs::path            Source;
+        fs::path            Destination;
+        fs::path            TempDestination;   ///< Where the photo, or the clone of a duplicate, is written until it is committed
+        uint64_t            Size = 0;
+        int64_t             ModifiedTime = 0;  ///< Nanoseconds since the epoch
+        int                 DestFd = -1;       ///< The temporary file. Opened by the parse stage, closed by the flush stage.
+        bool                CreatedDestination = false; ///< The temporary file was created, and must be removed on failure
+        uint64_t            SourceDigest = 0;  ///< Set by the read stage before the last chunk is queued
+        fs::path            DuplicateOf;       ///< A library file with the same contents, found by the read stage
+        uint64_t            Reservation = 0;   ///< The photo's reservation in the library index, or 0 if it has none
+        CopyMethod          Method = COPY_WRITTEN; ///< Set by the parse stage
+        ExifParseStatus     ExifStatus{};      ///< Set by the parse stage
+        DateSource          DatedBy = DATE_EXIF;
+        std::atomic<size_t> ChunksRemaining{0};
+        std::atomic<int>    Status{STATUS_PENDING};
+    };
+
+    /**
+     * @brief Part of a photo held in a pool buffer
+     */
+    struct Chunk
+    {
+        std::shared_ptr<FileJob> Job;
+        uint8_t *Buffer = nullptr;
+        uint64_t Offset = 0;
+        size_t   Length = 0;
+        size_t   ChunksRetired = 1; ///< Chunks this one accounts for. More than one when a read fails part way.
+        bool     First = false;     ///< The chunk at the start of the photo, which holds its EXIF data
+    };
+
+    /**
+     * @brief Queues, buffers and counters shared by the stages during a run
+     */
+    struct Pipeline
+    {
+        Pipeline(const size_t buffer_size, const size_t buffer_count) :
+            ToPrefetch(PATH_QUEUE_CAPACITY), Paths(PATH_QUEUE_CAPACITY), ToParse(buffer_count), ToWrite(buffer_count),
+            ToFlush(buffer_count), ToVerify(buffer_count), ToCommit(buffer_count), Buffers(buffer_size, buffer_count) {};
+
+        fs::path DestinationRoot;
+        fs::path ThumbnailRoot;
+        LockFreeQueue<fs::path> ToPrefetch;
+        LockFreeQueue<fs::path> Paths;
+        LockFreeQueue<Chunk> ToParse;
+        LockFreeQueue<Chunk> ToWrite;
+        LockFreeQueue<std::shared_ptr<FileJob>> ToFlush;
+        LockFreeQueue<std::shared_ptr<FileJob>> ToVerify;
+        LockFreeQueue<std::shared_ptr<FileJob>> ToCommit;
+        BufferPool Buffers;
+        Prefetcher Prefetch;
+        IoScheduler Scheduler;
+        uint64_t DestinationDevice = IoScheduler::NO_DEVICE;
+        Manifest History;
+        bool UseHistory = false; ///< False if the manifest could not be opened
+        DedupIndex Library;
+        FolderCache Folders;          ///< Date folders of the library
+        FolderCache ThumbnailFolders; ///< Date folders of the thumbnail cache
+        DuplicateAction OnDuplicate = DUPLICATE_SKIP;
+        bool DateFallback = false;
+        bool SyncEachFile = false; ///< Flush copies one by one, for network filesystems where syncfs does not reach the server
+        bool CopyDuplicates = false; ///< Duplicates to be hard linked are copied instead, as the library can not hold hard links
+        uint64_t NextTempId = 0;   ///< Makes each temporary file name unique. Only used by the parse stage.
+
+        std::atomic<size_t> Copied{0};
+        std::atomic<size_t> Unchanged{0};
+        std::atomic<size_t> AlreadyExisted{0};
+        std::atomic<size_t> Duplicates{0};
+        std::atomic<size_t> NoDate{0};
+        std::atomic<size_t> Failed{0};
+        std::atomic<size_t> FallbackDated{0};
+        std::mutex OutputMutex; ///< Keeps the lines printed by different threads from interleaving
+    };
+
+    static const bool IsNetworkFilesystem(const fs::path &path);
+    static const bool SetStatus(FileJob &job, const FileStatus status);
+    static const int64_t ModifiedTimeOf(const struct stat &file_info);
+    static const bool OpenHistory(Pipeline &pipeline, const Options &options);
+    static void LoadLibraryIndex(Pipeline &pipeline, const Options &options);
+    static void FindDuplicate(Pipeline &pipeline, FileJob &job);
+    static const bool SupportsHardLinks(Pipeline &pipeline);
+    static void CloneDuplicate(FileJob &job);
+
+    static void PrefetchStage(Pipeline &pipeline);
+    static void ReadStage(Pipeline &pipeline);
+    static void ReadFile(Pipeline &pipeline, IoRing &ring, const fs::path &source_image);
+    static void ParseStage(Pipeline &pipeline);
+    static void PrepareDestination(Pipeline &pipeline, const Chunk &first_chunk, cExifParser &parser);
+    static const bool DateFromFileName(const fs::path &file, tm &date_time);
+    static const bool FallbackDate(FileJob &job, tm &date_time);
+    static void WriteStage(Pipeline &pipeline);
+    static void FinishWrites(Pipeline &pipeline, const std::shared_ptr<FileJob> &job);
+    static void DiscardCopy(FileJob &job);
+    static const bool PopGroup(LockFreeQueue<std::shared_ptr<FileJob>> &queue, std::vector<std::shared_ptr<FileJob>> &group);
+    static void FlushStage(Pipeline &pipeline);
+    static void VerifyStage(Pipeline &pipeline);
+    static void CommitStage(Pipeline &pipeline);
+    static void CommitGroup(Pipeline &pipeline, std::vector<std::shared_ptr<FileJob>> &group);
+    static const fs::path TempNameFor(Pipeline &pipeline, const fs::path &destination);
+    static void FlushFolder(const fs::path &folder);
+    static const int RenameNoReplace(const fs::path &from, const fs::path &to);
+    static void RecordResult(Pipeline &pipeline, const FileJob &job);
+};
@@ -0,0 +1,472 @@
+/**
+* @file IoRing.cpp
+* @brief Asynchronous file I/O through io_uring, with a blocking fallback
+*/
+
+#include "IoRing.hpp"
+#include <errno.h>          // For errno
+#include <string.h>         // For memset
+#include <unistd.h>         // For close, pread, pwrite, fdatasync, syscall
+#include <sys/mman.h>       // For mmap
+#include <sys/syscall.h>    // For __NR_io_uring_setup, __NR_io_uring_enter, __NR_io_uring_register
+#include <sys/uio.h>        // For iovec
+#include <linux/io_uring.h> // For io_uring_params, io_uring_sqe, io_uring_cqe
+#include <algorithm>        // For std::max
+
+// glibc does not wrap the io_uring system calls, so they are made directly
+static int IoUringSetup(const unsigned int entries, io_uring_params *params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int IoUringEnter(const int ring_fd, const unsigned int to_submit, const unsigned int min_complete, const unsigned int flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int IoUringRegister(const int ring_fd, const unsigned int opcode, const void *arg, const unsigned int nr_args)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+/**
+ * @param[in] queue_depth The most requests that may be in flight at once
+ */
+IoRing::IoRing(const unsigned int queue_depth) :
+    mRingFd(-1),
+    mCapacity(std::max(queue_depth, 1U)),
+    mPrepared(0),
+    mSubmitted(0),
+    mSqRing(MAP_FAILED),
+    mSqRingSize(0),
+    mCqRing(MAP_FAILED),
+    mCqRingSize(0),
+    mSqes(MAP_FAILED),
+    mSqesSize(0),
+    mSqTail(nullptr),
+    mSqMask(nullptr),
+    mSqArray(nullptr),
+    mCqHead(nullptr),
+    mCqTail(nullptr),
+    mCqMask(nullptr),
+    mCqes(nullptr),
+    mLocalSqTail(0),
+    mRegisteredData(nullptr),
+    mRegisteredLength(0),
+    mFallenBack(false),
+    mRingRequests(),
+    mFreeRingSlots(),
+    mBlockingRequests(),
+    mBlockingCompletions()
+{
+    if (SetupRing(mCapacity))
+    {
+        mRingRequests.resize(mCapacity);
+        for (unsigned int slot = mCapacity; slot > 0; --slot)
+        {
+            mFreeRingSlots.push_back(slot - 1);
+        }
+    }
+    else
+    {
+        ReleaseRing();
+    }
+    mBlockingRequests.reserve(mCapacity);
+}
+
+/**
+ * @note Requests still in flight are waited for, since the kernel may still be
+ *       reading into or writing from their buffers.
+ */
+IoRing::~IoRing()
+{
+    Submit();
+    Completion completion = {};
+    while ((mSubmitted > 0) && WaitCompletion(completion))
+    {
+    }
+    ReleaseRing();
+}
+
+/**
+ * @brief Creates the io_uring instance and maps its submission and completion rings.
+ *
+ * @param[in] queue_depth The number of submission queue entries to ask for
+ *
+ * @return True if io_uring is ready to use
+ */
+const bool IoRing::SetupRing(const unsigned int queue_depth)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    mRingFd = IoUringSetup(queue_depth, &params);
+    if (mRingFd < 0)
+    {
+        return false;
+    }
+
+    mSqRingSize = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+    mCqRingSize = params.cq_off.cqes + (params.cq_entries * sizeof(io_uring_cqe));
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+    {
+        mSqRingSize = std::max(mSqRingSize, mCqRingSize);
+        mCqRingSize = 0;
+    }
+
+    mSqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+    if (mSqRing == MAP_FAILED)
+    {
+        return false;
+    }
+    if (mCqRingSize == 0)
+    {
+        mCqRing = mSqRing;
+    }
+    else
+    {
+        mCqRing = mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING);
+        if (mCqRing == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+
+    mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    mSqes = mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQES);
+    if (mSqes == MAP_FAILED)
+    {
+        return false;
+    }
+
+    uint8_t *sq_ring = static_cast<uint8_t *>(mSqRing);
+    uint8_t *cq_ring = static_cast<uint8_t *>(mCqRing);
+    mSqTail  = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.tail);
+    mSqMask  = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.ring_mask);
+    mSqArray = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.array);
+    mCqHead  = reinterpret_cast<unsigned *>(cq_ring + params.cq_off.head);
+    mCqTail  = reinterpret_cast<unsigned *>(cq_ring + params.cq_off.tail);
+    mCqMask  = reinterpret_cast<unsigned *>(cq_ring + params.cq_off.ring_mask);
+    mCqes    = cq_ring + params.cq_off.cqes;
+    mLocalSqTail = *mSqTail;
+
+    // The completion queue holds at least twice as many entries as the submission
+    // queue, so keeping no more than sq_entries in flight means it can never overflow
+    mCapacity = params.sq_entries;
+    return SupportsOperations();
+}
+
+/**
+ * @brief Asks the kernel which operations the ring supports. Kernels 5.1 to 5.5 set up
+ *        rings, but can only read and write through a registered buffer, and can not
+ *        be asked. Those kernels, and any that lack one of the operations used, are
+ *        left to blocking mode.
+ *
+ * @return True if every operation the ring prepares is supported
+ */
+const bool IoRing::SupportsOperations() const
+{
+    static constexpr unsigned int PROBE_OP_COUNT = 256;
+    std::vector<uint8_t> probe_data(sizeof(io_uring_probe) + (PROBE_OP_COUNT * sizeof(io_uring_probe_op)), 0);
+    io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probe_data.data());
+    if (IoUringRegister(mRingFd, IORING_REGISTER_PROBE, probe, PROBE_OP_COUNT) != 0)
+    {
+        return false;
+    }
+
+    for (const unsigned int opcode : {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED,
+                                      IORING_OP_FSYNC})
+    {
+        if ((opcode > probe->last_op) || ((probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) == 0))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Unmaps the rings and closes the io_uring instance, leaving the ring in blocking mode.
+ *
+ * @return None
+ */
+void IoRing::ReleaseRing()
+{
+    if (mSqes != MAP_FAILED)
+    {
+        munmap(mSqes, mSqesSize);
+        mSqes = MAP_FAILED;
+    }
+    if ((mCqRing != MAP_FAILED) && (mCqRing != mSqRing))
+    {
+        munmap(mCqRing, mCqRingSize);
+    }
+    mCqRing = MAP_FAILED;
+    if (mSqRing != MAP_FAILED)
+    {
+        munmap(mSqRing, mSqRingSize);
+        mSqRing = MAP_FAILED;
+    }
+    if (mRingFd >= 0)
+    {
+        close(mRingFd);
+        mRingFd = -1;
+    }
+}
+
+/**
+ * @brief Registers a block of memory with the kernel so it does not have to map the
+ *        pages again for every request. Reads and writes into this block are then
+ *        issued as fixed buffer operations. Only one block can be registered.
+ *
+ * @param[in] data Start of the block. Must stay allocated for the life of the ring.
+ * @param[in] length Size of the block in bytes
+ *
+ * @return True if the block was registered. Requests still work if it was not.
+ */
+const bool IoRing::RegisterBuffer(void *data, const size_t length)
+{
+    if (!UsingIoUring() || (mRegisteredData != nullptr))
+    {
+        return false;
+    }
+
+    iovec buffer = {data, length};
+    if (IoUringRegister(mRingFd, IORING_REGISTER_BUFFERS, &buffer, 1) != 0)
+    {
+        return false;
+    }
+    mRegisteredData   = static_cast<uint8_t *>(data);
+    mRegisteredLength = length;
+    return true;
+}
+
+/**
+ * @brief Queues a request to be handed to the kernel by the next Submit.
+ *
+ * @return True if the request was queued, false if Capacity() requests are already in flight.
+ */
+const bool IoRing::Prepare(const Operation op, const int fd, uint8_t *buffer, const size_t length,
+                           const uint64_t offset, const uint64_t user_data)
+{
+    if (InFlight() >= mCapacity)
+    {
+        return false;
+    }
+
+    if (!UsingIoUring())
+    {
+        mBlockingRequests.push_back({op, fd, buffer, length, offset, user_data});
+        return true;
+    }
+
+    // The kernel is given the request's slot, so the request can be run again in blocking mode
+    const unsigned int slot = mFreeRingSlots.back();
+    mFreeRingSlots.pop_back();
+    mRingRequests[slot] = {op, fd, buffer, length, offset, user_data};
+
+    const unsigned index = mLocalSqTail & *mSqMask;
+    io_uring_sqe *sqe = static_cast<io_uring_sqe *>(mSqes) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd        = fd;
+    sqe->user_data = slot;
+
+    const bool is_registered = (mRegisteredData != nullptr) && (buffer >= mRegisteredData) &&
+                               ((buffer + length) <= (mRegisteredData + mRegisteredLength));
+    switch (op)
+    {
+        case OPERATION_READ:
+        {
+            sqe->opcode = is_registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            break;
+        }
+        case OPERATION_WRITE:
+        {
+            sqe->opcode = is_registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            break;
+        }
+        case OPERATION_FSYNC:
+        {
+            sqe->opcode      = IORING_OP_FSYNC;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            break;
+        }
+    }
+    if (op != OPERATION_FSYNC)
+    {
+        sqe->addr = reinterpret_cast<uint64_t>(buffer);
+        sqe->len  = static_cast<uint32_t>(length);
+        sqe->off  = offset;
+        sqe->buf_index = 0;
+    }
+
+    mSqArray[index] = index;
+    ++mLocalSqTail;
+    ++mPrepared;
+    return true;
+}
+
+/**
+ * @brief Queues a read of up to length bytes from fd at offset into buffer.
+ *
+ * @return True if the request was queued, false if Capacity() requests are already in flight.
+ */
+const bool IoRing::PrepareRead(const int fd, void *buffer, const size_t length, const uint64_t offset, const uint64_t user_data)
+{
+    return Prepare(OPERATION_READ, fd, static_cast<uint8_t *>(buffer), length, offset, user_data);
+}
+
+/**
+ * @brief Queues a write of up to length bytes from buffer to fd at offset.
+ *
+ * @return True if the request was queued, false if Capacity() requests are already in flight.
+ */
+const bool IoRing::PrepareWrite(const int fd, const void *buffer, const size_t length, const uint64_t offset, const uint64_t user_data)
+{
+    return Prepare(OPERATION_WRITE, fd, const_cast<uint8_t *>(static_cast<const uint8_t *>(buffer)), length, offset, user_data);
+}
+
+/**
+ * @brief Queues an fdatasync of fd.
+ *
+ * @return True if the request was queued, false if Capacity() requests are already in flight.
+ */
+const bool IoRing::PrepareFsync(const int fd, const uint64_t user_data)
+{
+    return Prepare(OPERATION_FSYNC, fd, nullptr, 0, 0, user_data);
+}
+
+/**
+ * @brief Performs one request in blocking mode.
+ *
+ * @return Bytes transferred, zero for a sync, or a negative errno value
+ */
+const int IoRing::RunBlocking(const BlockingRequest &request)
+{
+    for (;;)
+    {
+        ssize_t result = 0;
+        switch (request.Op)
+        {
+            case OPERATION_READ:
+            {
+                result = pread(request.Fd, request.Buffer, request.Length, static_cast<off_t>(request.Offset));
+                break;
+            }
+            case OPERATION_WRITE:
+            {
+                result = pwrite(request.Fd, request.Buffer, request.Length, static_cast<off_t>(request.Offset));
+                break;
+            }
+            case OPERATION_FSYNC:
+            {
+                result = fdatasync(request.Fd);
+                break;
+            }
+        }
+        if (result >= 0)
+        {
+            return static_cast<int>(result);
+        }
+        if (errno != EINTR)
+        {
+            return -errno;
+        }
+    }
+}
+
+/**
+ * @brief Hands every prepared request to the kernel.
+ *        In blocking mode the requests are performed here instead.
+ *
+ * @return The number of requests submitted, or a negative errno value if the kernel refused them
+ */
+const int IoRing::Submit()
+{
+    const unsigned int run_blocking = static_cast<unsigned int>(mBlockingRequests.size());
+    for (const BlockingRequest &request : mBlockingRequests)
+    {
+        mBlockingCompletions.push_back({request.UserData, RunBlocking(request)});
+    }
+    mBlockingRequests.clear();
+
+    const unsigned int to_submit = mPrepared;
+    if (to_submit == 0)
+    {
+        return static_cast<int>(run_blocking);
+    }
+
+    // Publish the new entries before telling the kernel about them
+    __atomic_store_n(mSqTail, mLocalSqTail, __ATOMIC_RELEASE);
+
+    unsigned int submitted = 0;
+    while (submitted < to_submit)
+    {
+        const int result = IoUringEnter(mRingFd, to_submit - submitted, 0, 0);
+        if (result < 0)
+        {
+            if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY))
+            {
+                continue;
+            }
+            const int error_number = errno;
+            mPrepared  -= submitted;
+            mSubmitted += submitted;
+            return -error_number;
+        }
+        submitted += static_cast<unsigned int>(result);
+    }
+
+    mPrepared  = 0;
+    mSubmitted += submitted;
+    return static_cast<int>(submitted + run_blocking);
+}
+
+/**
+ * @brief Waits for a submitted request to finish.
+ *
+ * @param[out] completion The finished request
+ *
+ * @return True if a completion was returned, false if no requests have been submitted
+ */
+const bool IoRing::WaitCompletion(Completion &completion)
+{
+    if (!mBlockingCompletions.empty())
+    {
+        completion = mBlockingCompletions.front();
+        mBlockingCompletions.pop_front();
+        return true;
+    }
+    if (mSubmitted == 0)
+    {
+        return false;
+    }
+
+    const unsigned head = *mCqHead;
+    while (head == __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE))
+    {
+        if ((IoUringEnter(mRingFd, 0, 1, IORING_ENTER_GETEVENTS) < 0) && (errno != EINTR) && (errno != EAGAIN))
+        {
+            return false;
+        }
+    }
+
+    const io_uring_cqe *cqe = static_cast<const io_uring_cqe *>(mCqes) + (head & *mCqMask);
+    const unsigned int slot = static_cast<unsigned int>(cqe->user_data);
+    const int result = cqe->res;
+    __atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+    --mSubmitted;
+    mFreeRingSlots.push_back(slot);
+
+    // A kernel that accepts the ring but not the request, as a probe can miss, has the
+    // request run again here. Later requests skip the ring. A request that is really
+    // invalid fails the same way again.
+    const BlockingRequest &request = mRingRequests[slot];
+    completion.UserData = request.UserData;
+    completion.Result   = result;
+    if ((result == -EINVAL) || (result == -EOPNOTSUPP))
+    {
+        mFallenBack = true;
+        completion.Result = RunBlocking(request);
+    }
+    return true;
+}
@@ -0,0 +1,123 @@
+/**
+* @file IoRing.hpp
+* @brief Asynchronous file I/O through io_uring, with a blocking fallback
+*/
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Queues reads, writes and syncs and lets a single thread keep many of them in
+ *        flight at once. Requests are prepared, handed to the kernel together by Submit,
+ *        and their results collected in any order with WaitCompletion.
+ *
+ *        Uses io_uring when the kernel allows it. Otherwise, such as on old kernels or
+ *        when io_uring is disabled by a seccomp profile, Submit performs the prepared
+ *        requests itself with pread, pwrite and fdatasync, so callers are written once
+ *        against the same interface either way. A ring whose kernel rejects a request as
+ *        invalid or unsupported runs that request, and every later one, the same way.
+ *
+ *        Reads and writes may complete with fewer bytes than requested, exactly as
+ *        pread and pwrite may. Callers re-queue the remainder.
+ *
+ *        Not thread safe. Each thread that does I/O owns its own ring.
+ */
+class IoRing
+{
+public:
+
+    /**
+     * @brief The result of one request
+     */
+    struct Completion
+    {
+        uint64_t UserData; ///< The value passed when the request was prepared
+        int      Result;   ///< Bytes transferred, zero for a sync, or a negative errno value
+    };
+
+    explicit IoRing(const unsigned int queue_depth);
+    ~IoRing();
+
+    IoRing(const IoRing &) = delete;
+    IoRing &operator=(const IoRing &) = delete;
+
+    const bool         UsingIoUring() const {return (mRingFd >= 0) && !mFallenBack;}
+    const unsigned int Capacity() const {return mCapacity;}
+    const unsigned int InFlight() const
+    {
+        return mPrepared + mSubmitted + static_cast<unsigned int>(mBlockingRequests.size() + mBlockingCompletions.size());
+    }
+
+    const bool RegisterBuffer(void *data, const size_t length);
+    const bool PrepareRead(const int fd, void *buffer, const size_t length, const uint64_t offset, const uint64_t user_data);
+    const bool PrepareWrite(const int fd, const void *buffer, const size_t length, const uint64_t offset, const uint64_t user_data);
+    const bool PrepareFsync(const int fd, const uint64_t user_data);
+    const int  Submit();
+    const bool WaitCompletion(Completion &completion);
+
+private:
+
+    enum Operation
+    {
+        OPERATION_READ,
+        OPERATION_WRITE,
+        OPERATION_FSYNC
+    };
+
+    /**
+     * @brief A request waiting for Submit when io_uring is not available, or a request
+     *        handed to the kernel, kept in case it has to be run in blocking mode
+     */
+    struct BlockingRequest
+    {
+        Operation Op;
+        int       Fd;
+        uint8_t  *Buffer;
+        size_t    Length;
+        uint64_t  Offset;
+        uint64_t  UserData;
+    };
+
+    int          mRingFd;
+    unsigned int mCapacity;
+    unsigned int mPrepared;  ///< Requests prepared but not yet handed to the kernel
+    unsigned int mSubmitted; ///< Requests handed to the kernel whose completions have not been collected
+
+    // Shared with the kernel through mmap
+    void     *mSqRing;
+    size_t    mSqRingSize;
+    void     *mCqRing;
+    size_t    mCqRingSize;
+    void     *mSqes;
+    size_t    mSqesSize;
+    unsigned *mSqTail;
+    unsigned *mSqMask;
+    unsigned *mSqArray;
+    unsigned *mCqHead;
+    unsigned *mCqTail;
+    unsigned *mCqMask;
+    void     *mCqes;
+    unsigned  mLocalSqTail; ///< Tail including prepared entries not yet published to the kernel
+
+    // Registered buffer. Requests whose buffer lies inside it use the fixed buffer operations.
+    uint8_t *mRegisteredData;
+    size_t   mRegisteredLength;
+
+    bool mFallenBack; ///< The kernel rejected a request, so new requests are run in blocking mode
+
+    std::vector<BlockingRequest> mRingRequests;  ///< Requests handed to the kernel, by the slot given as their user data
+    std::vector<unsigned int>    mFreeRingSlots;
+    std::vector<BlockingRequest> mBlockingRequests;
+    std::deque<Completion>       mBlockingCompletions;
+
+    const bool SetupRing(const unsigned int queue_depth);
+    const bool SupportsOperations() const;
+    void       ReleaseRing();
+    const bool Prepare(const Operation op, const int fd, uint8_t *buffer, const size_t length,
+                       const uint64_t offset, const uint64_t user_data);
+    const int  RunBlocking(const BlockingRequest &request);
+};
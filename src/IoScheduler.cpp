@@ -0,0 +1,214 @@
+/**
+* @file IoScheduler.cpp
+* @brief Limits how fast, and by how many threads at once, each device is read and written
+*/
+
+#include "IoScheduler.hpp"
+#include <sys/stat.h> // For stat, fstat
+#include <algorithm>  // For std::min, std::max
+#include <thread>     // For std::this_thread
+
+IoScheduler::IoScheduler() :
+    mDevices()
+{
+}
+
+/**
+ * @brief Sets the limits of one class of traffic on a device. Setting limits on a device
+ *        more than once, such as when the source and destination share a device, keeps
+ *        the stricter of each limit. Must be called before any transfers start.
+ *
+ * @param[in] device The device, from DeviceOf. NO_DEVICE is ignored.
+ * @param[in] traffic The class of traffic
+ * @param[in] limits The limits. Zero leaves a limit off.
+ *
+ * @return None
+ */
+void IoScheduler::SetLimits(const uint64_t device, const TrafficClass traffic, const Limits &limits)
+{
+    if (device == NO_DEVICE)
+    {
+        return;
+    }
+
+    Device *entry = nullptr;
+    for (const std::unique_ptr<Device> &known : mDevices)
+    {
+        if (known->Id == device)
+        {
+            entry = known.get();
+        }
+    }
+    if (entry == nullptr)
+    {
+        mDevices.emplace_back(new Device());
+        entry = mDevices.back().get();
+        entry->Id = device;
+    }
+
+    // Zero is no limit, so it loses to any other value
+    const auto stricter = [](const auto current, const auto requested)
+    {
+        return ((current == 0) || ((requested != 0) && (requested < current))) ? requested : current;
+    };
+    Lane &lane = entry->Lanes[traffic];
+    lane.Limit.BytesPerSecond = stricter(lane.Limit.BytesPerSecond, limits.BytesPerSecond);
+    lane.Limit.MaxStreams     = stricter(lane.Limit.MaxStreams, limits.MaxStreams);
+    lane.Tokens     = static_cast<double>(lane.Limit.BytesPerSecond) * BURST_SECONDS;
+    lane.LastRefill = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief Finds the state of one class of traffic on a device.
+ *
+ * @return The lane, or nullptr if the device has no limits for the traffic
+ */
+IoScheduler::Lane *IoScheduler::FindLane(const uint64_t device, const TrafficClass traffic) const
+{
+    for (const std::unique_ptr<Device> &known : mDevices)
+    {
+        if (known->Id == device)
+        {
+            Lane &lane = known->Lanes[traffic];
+            return ((lane.Limit.BytesPerSecond > 0) || (lane.Limit.MaxStreams > 0)) ? &lane : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Waits until fewer than MaxStreams threads are using the lane in the direction, then joins them.
+ *
+ * @return None
+ */
+void IoScheduler::BeginStream(Lane &lane, const Direction direction)
+{
+    if (lane.Limit.MaxStreams == 0)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(lane.Mutex);
+    lane.StreamEnded.wait(lock, [&lane, direction]() {return lane.Streams[direction] < lane.Limit.MaxStreams;});
+    ++lane.Streams[direction];
+}
+
+void IoScheduler::EndStream(Lane &lane, const Direction direction)
+{
+    if (lane.Limit.MaxStreams == 0)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(lane.Mutex);
+        --lane.Streams[direction];
+    }
+    lane.StreamEnded.notify_one();
+}
+
+/**
+ * @brief Waits until the lane's bucket is out of debt, then takes a transfer's size from it.
+ *        The transfer itself is never split, so its size may put the bucket back in debt.
+ *
+ * @param[in,out] lane The lane
+ * @param[in] bytes The size of the transfer about to be made
+ *
+ * @return None
+ */
+void IoScheduler::Throttle(Lane &lane, const size_t bytes)
+{
+    if (lane.Limit.BytesPerSecond == 0)
+    {
+        return;
+    }
+
+    const double rate  = static_cast<double>(lane.Limit.BytesPerSecond);
+    const double burst = rate * BURST_SECONDS;
+    std::unique_lock<std::mutex> lock(lane.Mutex);
+    for (;;)
+    {
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        const double elapsed = std::chrono::duration<double>(now - lane.LastRefill).count();
+        lane.Tokens = std::min(burst, lane.Tokens + (elapsed * rate));
+        lane.LastRefill = now;
+        if (lane.Tokens > 0.0)
+        {
+            lane.Tokens -= static_cast<double>(bytes);
+            return;
+        }
+
+        // Other threads may take their turn while this one sleeps off the debt
+        const std::chrono::duration<double> wait((1.0 - lane.Tokens) / rate);
+        lock.unlock();
+        std::this_thread::sleep_for(wait);
+        lock.lock();
+    }
+}
+
+/**
+ * @param[in] scheduler The scheduler, or nullptr to not limit the stream
+ * @param[in] device The device, from DeviceOf
+ * @param[in] traffic Why the device is being used
+ * @param[in] direction Whether the stream reads or writes
+ */
+IoScheduler::Stream::Stream(const IoScheduler *scheduler, const uint64_t device, const TrafficClass traffic,
+                            const Direction direction) :
+    mLane((scheduler != nullptr) ? scheduler->FindLane(device, traffic) : nullptr),
+    mDirection(direction)
+{
+    if (mLane != nullptr)
+    {
+        BeginStream(*mLane, mDirection);
+    }
+}
+
+/**
+ * @param[in] scheduler The scheduler, or nullptr to not limit the stream
+ * @param[in] fd An open file on the device. Only looked up if there is a scheduler.
+ * @param[in] traffic Why the device is being used
+ * @param[in] direction Whether the stream reads or writes
+ */
+IoScheduler::Stream::Stream(const IoScheduler *scheduler, const int fd, const TrafficClass traffic,
+                            const Direction direction) :
+    Stream(scheduler, (scheduler != nullptr) ? DeviceOf(fd) : NO_DEVICE, traffic, direction)
+{
+}
+
+IoScheduler::Stream::~Stream()
+{
+    if (mLane != nullptr)
+    {
+        EndStream(*mLane, mDirection);
+    }
+}
+
+/**
+ * @brief Waits for the device's bandwidth before a transfer. Returns at once if the device has no bandwidth limit.
+ *
+ * @param[in] bytes The size of the transfer about to be made
+ *
+ * @return None
+ */
+void IoScheduler::Stream::Throttle(const size_t bytes)
+{
+    if (mLane != nullptr)
+    {
+        IoScheduler::Throttle(*mLane, bytes);
+    }
+}
+
+/**
+ * @brief Gets the device a file or folder is on.
+ *
+ * @return The device, or NO_DEVICE if the path could not be found
+ */
+const uint64_t IoScheduler::DeviceOf(const fs::path &path)
+{
+    struct stat path_info = {};
+    return (stat(path.c_str(), &path_info) == 0) ? static_cast<uint64_t>(path_info.st_dev) : NO_DEVICE;
+}
+
+const uint64_t IoScheduler::DeviceOf(const int fd)
+{
+    struct stat file_info = {};
+    return (fstat(fd, &file_info) == 0) ? static_cast<uint64_t>(file_info.st_dev) : NO_DEVICE;
+}
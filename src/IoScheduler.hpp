@@ -0,0 +1,140 @@
+/**
+* @file IoScheduler.hpp
+* @brief Limits how fast, and by how many threads at once, each device is read and written
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Shares the bandwidth of each device between the threads using it, so an ingest
+ *        does not saturate a network link or a NAS that other people are also using.
+ *
+ *        Each device has separate limits for copy traffic and for verify traffic, which
+ *        covers reading copies back and hashing files to find duplicates. A limit has
+ *        two parts, either of which can be left off:
+ *
+ *        - a token bucket of bytes per second. Each transfer takes its size in tokens,
+ *          and may leave the bucket in debt, which the next transfer waits to pay off.
+ *          The bucket holds at most a quarter of a second of tokens, so an idle device
+ *          can not save up a long burst.
+ *        - a number of streams, which are threads reading from or writing to the device
+ *          at once. Reads and writes have their own streams, so a thread copying from a
+ *          device to itself never waits for a stream held by a thread that waits on it.
+ *
+ *        Devices are only known once limits are set for them. Transfers on any other
+ *        device are never held back. Limits are set before any transfers start. After
+ *        that, every member can be called from any thread.
+ */
+class IoScheduler
+{
+public:
+
+    /**
+     * @brief Why a device is being read or written. Each has its own limits.
+     */
+    enum TrafficClass
+    {
+        TRAFFIC_COPY,   ///< Reading photos to copy them, and writing the copies
+        TRAFFIC_VERIFY, ///< Reading copies back to verify them, and hashing files to find duplicates
+        TRAFFIC_CLASS_COUNT
+    };
+
+    enum Direction
+    {
+        IO_READ,
+        IO_WRITE,
+        DIRECTION_COUNT
+    };
+
+    /**
+     * @brief The limits of one class of traffic on one device
+     */
+    struct Limits
+    {
+        uint64_t BytesPerSecond; ///< Zero for no limit
+        size_t   MaxStreams;     ///< Most threads reading, and most threads writing, at once. Zero for no limit.
+    };
+
+    static constexpr uint64_t NO_DEVICE = UINT64_MAX;
+
+private:
+
+    static constexpr double BURST_SECONDS = 0.25; ///< Tokens an idle bucket can save up, in seconds of its rate
+
+    /**
+     * @brief The state of one class of traffic on one device
+     */
+    struct Lane
+    {
+        Limits Limit = {};
+        std::mutex Mutex;
+        std::condition_variable StreamEnded;
+        size_t Streams[DIRECTION_COUNT] = {};
+        double Tokens = 0.0; ///< Negative while the bucket is in debt
+        std::chrono::steady_clock::time_point LastRefill;
+    };
+
+    struct Device
+    {
+        uint64_t Id;
+        Lane     Lanes[TRAFFIC_CLASS_COUNT];
+    };
+
+    std::vector<std::unique_ptr<Device>> mDevices;
+
+    Lane *FindLane(const uint64_t device, const TrafficClass traffic) const;
+    static void BeginStream(Lane &lane, const Direction direction);
+    static void EndStream(Lane &lane, const Direction direction);
+    static void Throttle(Lane &lane, const size_t bytes);
+
+public:
+
+    /**
+     * @brief A thread's turn to read from or write to a device, held from construction
+     *        until destruction. Does nothing if the scheduler is null or the device has
+     *        no limits for the traffic.
+     *
+     *        A stream must not be held while waiting on another thread, such as on a
+     *        full queue, or that thread may be waiting for the stream.
+     */
+    class Stream
+    {
+    public:
+
+        Stream(const IoScheduler *scheduler, const uint64_t device, const TrafficClass traffic, const Direction direction);
+        Stream(const IoScheduler *scheduler, const int fd, const TrafficClass traffic, const Direction direction);
+        ~Stream();
+
+        Stream(const Stream &) = delete;
+        Stream &operator=(const Stream &) = delete;
+
+        const bool IsThrottled() const {return (mLane != nullptr) && (mLane->Limit.BytesPerSecond > 0);}
+        void       Throttle(const size_t bytes);
+
+    private:
+
+        Lane     *mLane;
+        Direction mDirection;
+    };
+
+    IoScheduler();
+
+    IoScheduler(const IoScheduler &) = delete;
+    IoScheduler &operator=(const IoScheduler &) = delete;
+
+    void SetLimits(const uint64_t device, const TrafficClass traffic, const Limits &limits);
+
+    static const uint64_t DeviceOf(const fs::path &path);
+    static const uint64_t DeviceOf(const int fd);
+};
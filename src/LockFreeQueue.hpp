@@ -0,0 +1,212 @@
+/**
+* @file LockFreeQueue.hpp
+* @brief Bounded multi-producer multi-consumer queue that does not take locks
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <stddef.h>
+
+/**
+ * @brief Fixed capacity queue shared by any number of producer and consumer threads.
+ *
+ *        Each slot carries a sequence number that tells producers and consumers whose
+ *        turn it is to use the slot, so pushing and popping only need one compare and
+ *        swap on the shared position. Push waits while the queue is full, which is how
+ *        a slow pipeline stage holds back the stages in front of it.
+ */
+template <typename T>
+class LockFreeQueue
+{
+private:
+
+    struct Slot
+    {
+        std::atomic<size_t> Sequence;
+        T Item;
+    };
+
+    // Keeps the producer and consumer positions on separate cache lines
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    // Waiting threads spin briefly, then yield, then sleep for increasing amounts of time
+    static constexpr unsigned int SPIN_LIMIT  = 64;
+    static constexpr unsigned int YIELD_LIMIT = 128;
+    static constexpr std::chrono::microseconds MAX_SLEEP{1000};
+
+    const size_t mMask;
+    std::unique_ptr<Slot[]> mSlots;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> mEnqueuePosition;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> mDequeuePosition;
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> mClosed;
+
+    static size_t RoundUpToPowerOfTwo(const size_t value)
+    {
+        size_t rounded = 2;
+        while (rounded < value)
+        {
+            rounded <<= 1;
+        }
+        return rounded;
+    }
+
+    static void Backoff(unsigned int &attempt)
+    {
+        ++attempt;
+        if (attempt < SPIN_LIMIT)
+        {
+            return;
+        }
+        if (attempt < YIELD_LIMIT)
+        {
+            std::this_thread::yield();
+            return;
+        }
+        const unsigned int shift = std::min(attempt - YIELD_LIMIT, 10U);
+        std::this_thread::sleep_for(std::min(std::chrono::microseconds(1U << shift), MAX_SLEEP));
+    }
+
+public:
+
+    /**
+     * @param[in] capacity The number of items the queue can hold. Rounded up to a power of two.
+     */
+    explicit LockFreeQueue(const size_t capacity) :
+        mMask(RoundUpToPowerOfTwo(capacity) - 1),
+        mSlots(new Slot[mMask + 1]),
+        mEnqueuePosition(0),
+        mDequeuePosition(0),
+        mClosed(false)
+    {
+        for (size_t index = 0; index <= mMask; ++index)
+        {
+            mSlots[index].Sequence.store(index, std::memory_order_relaxed);
+        }
+    }
+
+    LockFreeQueue(const LockFreeQueue &) = delete;
+    LockFreeQueue &operator=(const LockFreeQueue &) = delete;
+
+    /**
+     * @brief Adds an item to the queue if there is room.
+     *
+     * @return True if the item was added, false if the queue was full.
+     */
+    bool TryPush(T &item)
+    {
+        size_t position = mEnqueuePosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot &slot = mSlots[position & mMask];
+            const size_t sequence = slot.Sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0)
+            {
+                if (mEnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    slot.Item = std::move(item);
+                    slot.Sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = mEnqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Removes the oldest item from the queue if there is one.
+     *
+     * @return True if an item was removed, false if the queue was empty.
+     */
+    bool TryPop(T &item)
+    {
+        size_t position = mDequeuePosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot &slot = mSlots[position & mMask];
+            const size_t sequence = slot.Sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference == 0)
+            {
+                if (mDequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    item = std::move(slot.Item);
+                    slot.Sequence.store(position + mMask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = mDequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Adds an item to the queue, waiting while the queue is full.
+     *
+     * @return True if the item was added, false if the queue was closed.
+     */
+    bool Push(T item)
+    {
+        unsigned int attempt = 0;
+        while (!mClosed.load(std::memory_order_acquire))
+        {
+            if (TryPush(item))
+            {
+                return true;
+            }
+            Backoff(attempt);
+        }
+        return false;
+    }
+
+    /**
+     * @brief Removes the oldest item from the queue, waiting while the queue is empty.
+     *
+     * @return True if an item was removed.
+     *         False if the queue was closed and every item has been removed.
+     */
+    bool Pop(T &item)
+    {
+        unsigned int attempt = 0;
+        for (;;)
+        {
+            if (TryPop(item))
+            {
+                return true;
+            }
+            if (mClosed.load(std::memory_order_acquire))
+            {
+                // Items pushed before the queue was closed must still be handed out
+                return TryPop(item);
+            }
+            Backoff(attempt);
+        }
+    }
+
+    /**
+     * @brief Stops new items from being added. Items already in the queue can still be removed.
+     *        Call once every producer has finished pushing.
+     */
+    void Close()
+    {
+        mClosed.store(true, std::memory_order_release);
+    }
+};
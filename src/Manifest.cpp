@@ -0,0 +1,494 @@
+/**
+* @file Manifest.cpp
+* @brief On-disk record of the photos already ingested into a library
+*/
+
+#include "Manifest.hpp"
+#include <errno.h>    // For errno
+#include <fcntl.h>    // For open
+#include <stdio.h>    // For snprintf, rename
+#include <stdlib.h>   // For strtoull, strtoll
+#include <unistd.h>   // For write, fdatasync, close
+#include <fstream>    // For std::ifstream
+
+Manifest::~Manifest()
+{
+    Close();
+}
+
+/**
+ * @brief Adds text to a record, escaping the characters that separate fields and records.
+ *
+ * @param[in,out] line The record being built
+ * @param[in] text The text to add
+ *
+ * @return None
+ */
+void Manifest::AppendEscaped(std::string &line, const std::string &text)
+{
+    for (const char ch : text)
+    {
+        switch (ch)
+        {
+            case '\\':
+            {
+                line += "\\\\";
+                break;
+            }
+            case '\t':
+            {
+                line += "\\t";
+                break;
+            }
+            case '\n':
+            {
+                line += "\\n";
+                break;
+            }
+            default:
+            {
+                line += ch;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Reverses AppendEscaped.
+ *
+ * @param[in] field The escaped text
+ * @param[out] text The original text
+ *
+ * @return False if the field holds an invalid escape sequence
+ */
+const bool Manifest::Unescape(const std::string &field, std::string &text)
+{
+    text.clear();
+    for (size_t index = 0; index < field.size(); ++index)
+    {
+        if (field[index] != '\\')
+        {
+            text += field[index];
+            continue;
+        }
+        if (++index == field.size())
+        {
+            return false;
+        }
+        switch (field[index])
+        {
+            case '\\':
+            {
+                text += '\\';
+                break;
+            }
+            case 't':
+            {
+                text += '\t';
+                break;
+            }
+            case 'n':
+            {
+                text += '\n';
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Formats one record as a line of the manifest:
+ *        status, size, modified time, digest, source and destination, separated by tabs.
+ *
+ * @param[in] source The source photo
+ * @param[in] entry What is known about the photo
+ *
+ * @return The line, ending in a newline
+ */
+const std::string Manifest::FormatRecord(const std::string &source, const Entry &entry)
+{
+    char status = STATUS_COPYING;
+    switch (entry.Status)
+    {
+        case ENTRY_COPYING:
+        {
+            status = STATUS_COPYING;
+            break;
+        }
+        case ENTRY_VERIFIED:
+        {
+            status = STATUS_VERIFIED;
+            break;
+        }
+        case ENTRY_NO_DATE:
+        {
+            status = STATUS_NO_DATE;
+            break;
+        }
+        case ENTRY_LIBRARY:
+        {
+            status = STATUS_LIBRARY;
+            break;
+        }
+        case ENTRY_LIBRARY_UNHASHED:
+        {
+            status = STATUS_LIBRARY_UNHASHED;
+            break;
+        }
+    }
+
+    char numbers[80];
+    snprintf(numbers, sizeof(numbers), "%c\t%llu\t%lld\t%016llx\t", status, static_cast<unsigned long long>(entry.Size),
+             static_cast<long long>(entry.ModifiedTime), static_cast<unsigned long long>(entry.Digest));
+
+    std::string line = numbers;
+    AppendEscaped(line, source);
+    line += '\t';
+    AppendEscaped(line, entry.Destination);
+    line += '\n';
+    return line;
+}
+
+/**
+ * @brief Parses a line written by FormatRecord.
+ *
+ * @param[in] line The line, without its newline
+ * @param[out] source The source photo
+ * @param[out] entry What is known about the photo
+ *
+ * @return False if the line is not a valid record
+ */
+const bool Manifest::ParseRecord(const std::string &line, std::string &source, Entry &entry)
+{
+    static constexpr size_t FIELD_COUNT = 6;
+
+    std::string fields[FIELD_COUNT];
+    size_t field_start = 0;
+    for (size_t field_index = 0; field_index < FIELD_COUNT; ++field_index)
+    {
+        const size_t field_end = line.find('\t', field_start);
+        const bool is_last = ((field_index + 1) == FIELD_COUNT);
+        if ((field_end == std::string::npos) != is_last)
+        {
+            return false;
+        }
+        fields[field_index] = line.substr(field_start, is_last ? std::string::npos : (field_end - field_start));
+        field_start = field_end + 1;
+    }
+
+    if (fields[0].size() != 1)
+    {
+        return false;
+    }
+    switch (fields[0][0])
+    {
+        case STATUS_COPYING:
+        {
+            entry.Status = ENTRY_COPYING;
+            break;
+        }
+        case STATUS_VERIFIED:
+        {
+            entry.Status = ENTRY_VERIFIED;
+            break;
+        }
+        case STATUS_NO_DATE:
+        {
+            entry.Status = ENTRY_NO_DATE;
+            break;
+        }
+        case STATUS_LIBRARY:
+        {
+            entry.Status = ENTRY_LIBRARY;
+            break;
+        }
+        case STATUS_LIBRARY_UNHASHED:
+        {
+            entry.Status = ENTRY_LIBRARY_UNHASHED;
+            break;
+        }
+        default:
+        {
+            return false;
+        }
+    }
+
+    char *end = nullptr;
+    entry.Size = strtoull(fields[1].c_str(), &end, 10);
+    if (fields[1].empty() || (*end != '\0'))
+    {
+        return false;
+    }
+    entry.ModifiedTime = strtoll(fields[2].c_str(), &end, 10);
+    if (fields[2].empty() || (*end != '\0'))
+    {
+        return false;
+    }
+    entry.Digest = strtoull(fields[3].c_str(), &end, 16);
+    if (fields[3].empty() || (*end != '\0'))
+    {
+        return false;
+    }
+
+    return Unescape(fields[4], source) && !source.empty() && Unescape(fields[5], entry.Destination);
+}
+
+/**
+ * @brief Reads every record in the manifest. A line cut short by a crash is ignored.
+ *
+ * @param[in] manifest_file The manifest to read. A missing file holds no records.
+ *
+ * @return NO_ERROR if the manifest was read.
+ *         MANIFEST_READ_ERR if the file is not a manifest or could not be read.
+ */
+const int Manifest::Load(const fs::path &manifest_file)
+{
+    std::ifstream infile(manifest_file);
+    if (!infile.is_open())
+    {
+        std::error_code error;
+        return fs::exists(manifest_file, error) ? MANIFEST_READ_ERR : NO_ERROR;
+    }
+
+    std::string line;
+    if (!std::getline(infile, line) || (line != HEADER))
+    {
+        return MANIFEST_READ_ERR;
+    }
+
+    std::string source;
+    Entry entry = {};
+    while (std::getline(infile, line))
+    {
+        // Lines that can not be used, including a last line cut short by a crash, are
+        // still counted so the manifest is rewritten without them before appending
+        ++mRecordCount;
+        if (infile.eof())
+        {
+            break;
+        }
+        if (ParseRecord(line, source, entry))
+        {
+            mEntries[source] = entry;
+        }
+    }
+    return infile.bad() ? MANIFEST_READ_ERR : NO_ERROR;
+}
+
+/**
+ * @brief Writes all of a block of data to the manifest.
+ *
+ * @return NO_ERROR or MANIFEST_WRITE_ERR
+ */
+const int Manifest::WriteAll(const std::string &data)
+{
+    size_t bytes_written = 0;
+    while (bytes_written < data.size())
+    {
+        const ssize_t result = write(mFd, data.data() + bytes_written, data.size() - bytes_written);
+        if ((result < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            return MANIFEST_WRITE_ERR;
+        }
+        bytes_written += static_cast<size_t>(result);
+    }
+    return NO_ERROR;
+}
+
+/**
+ * @brief Replaces the manifest with one record per photo, dropping records that were
+ *        replaced by later ones. The new manifest is written beside the old one and
+ *        renamed over it, so a crash leaves one or the other intact.
+ *
+ * @param[in] manifest_file The manifest to replace
+ *
+ * @return NO_ERROR, MANIFEST_OPEN_ERR or MANIFEST_WRITE_ERR
+ */
+const int Manifest::Rewrite(const fs::path &manifest_file)
+{
+    fs::path temp_file = manifest_file;
+    temp_file += ".tmp";
+    mFd = open(temp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mFd < 0)
+    {
+        return MANIFEST_OPEN_ERR;
+    }
+
+    std::string data = HEADER;
+    data += '\n';
+    for (const auto &record : mEntries)
+    {
+        data += FormatRecord(record.first, record.second);
+    }
+
+    int result = WriteAll(data);
+    if ((result == NO_ERROR) && (fdatasync(mFd) != 0))
+    {
+        result = MANIFEST_WRITE_ERR;
+    }
+    close(mFd);
+    mFd = -1;
+
+    if ((result == NO_ERROR) && (rename(temp_file.c_str(), manifest_file.c_str()) != 0))
+    {
+        result = MANIFEST_WRITE_ERR;
+    }
+    if (result != NO_ERROR)
+    {
+        unlink(temp_file.c_str());
+        return result;
+    }
+    mRecordCount = mEntries.size();
+    return NO_ERROR;
+}
+
+/**
+ * @brief Reads the manifest and opens it to record the photos of this run.
+ *        The manifest is created if it does not exist, and compacted if photos
+ *        were recorded more than once.
+ *
+ * @param[in] manifest_file The manifest to use
+ *
+ * @return NO_ERROR if the manifest is ready, or one of the ErrorCodes otherwise
+ */
+const int Manifest::Open(const fs::path &manifest_file)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    int result = Load(manifest_file);
+    if (result != NO_ERROR)
+    {
+        return result;
+    }
+
+    std::error_code error;
+    mIsNew = !fs::exists(manifest_file, error);
+    if (mIsNew || (mRecordCount > mEntries.size()))
+    {
+        result = Rewrite(manifest_file);
+        if (result != NO_ERROR)
+        {
+            return result;
+        }
+    }
+
+    mFd = open(manifest_file.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    return (mFd >= 0) ? NO_ERROR : MANIFEST_OPEN_ERR;
+}
+
+/**
+ * @brief Flushes the manifest to the storage device and closes it.
+ *
+ * @return NO_ERROR, or MANIFEST_WRITE_ERR if the manifest could not be flushed
+ */
+const int Manifest::Close()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mFd < 0)
+    {
+        return NO_ERROR;
+    }
+
+    const int result = (fdatasync(mFd) == 0) ? NO_ERROR : MANIFEST_WRITE_ERR;
+    close(mFd);
+    mFd = -1;
+    return result;
+}
+
+/**
+ * @brief Flushes the records appended so far to the storage device. Records are not
+ *        flushed as they are appended, so many of them can share one flush.
+ *        The flush is made without holding the lock, so Record is never held up by it.
+ *        Must not be called at the same time as Close.
+ *
+ * @return NO_ERROR, or MANIFEST_WRITE_ERR if the manifest could not be flushed
+ */
+const int Manifest::Flush()
+{
+    int manifest_fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        manifest_fd = mFd;
+    }
+    if (manifest_fd < 0)
+    {
+        return MANIFEST_WRITE_ERR;
+    }
+    return (fdatasync(manifest_fd) == 0) ? NO_ERROR : MANIFEST_WRITE_ERR;
+}
+
+/**
+ * @brief Checks if a photo was already handled by an earlier run and has not changed since.
+ *
+ * @param[in] source The source photo
+ * @param[in] size The photo's current size
+ * @param[in] modified_time The photo's current modified time, in nanoseconds since the epoch
+ * @param[in] include_no_date False to treat photos found to have no date as new, so they are tried again
+ *
+ * @return True if the photo was verified or found to have no date, with the same size and modified time
+ */
+const bool Manifest::IsUnchanged(const std::string &source, const uint64_t size, const int64_t modified_time,
+                                 const bool include_no_date)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    const auto record = mEntries.find(source);
+    return (record != mEntries.end()) &&
+           ((record->second.Status == ENTRY_VERIFIED) || (include_no_date && (record->second.Status == ENTRY_NO_DATE))) &&
+           (record->second.Size == size) && (record->second.ModifiedTime == modified_time);
+}
+
+/**
+ * @brief Gets the destinations of copies that were started but never verified,
+ *        such as when an earlier run was killed part way through a copy.
+ *
+ * @return The destinations, which may or may not exist
+ */
+const std::vector<fs::path> Manifest::IncompleteCopies()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::vector<fs::path> destinations;
+    for (const auto &record : mEntries)
+    {
+        if (record.second.Status == ENTRY_COPYING)
+        {
+            destinations.push_back(record.second.Destination);
+        }
+    }
+    return destinations;
+}
+
+/**
+ * @brief Appends a record for a photo. It replaces any earlier record of the same photo.
+ *
+ * @param[in] source The source photo
+ * @param[in] entry What is now known about the photo
+ *
+ * @return NO_ERROR, or MANIFEST_WRITE_ERR if the record could not be written
+ */
+const int Manifest::Record(const std::string &source, const Entry &entry)
+{
+    const std::string line = FormatRecord(source, entry);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mFd < 0)
+    {
+        return MANIFEST_WRITE_ERR;
+    }
+    const int result = WriteAll(line);
+    if (result == NO_ERROR)
+    {
+        mEntries[source] = entry;
+        ++mRecordCount;
+    }
+    return result;
+}
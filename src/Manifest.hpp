@@ -0,0 +1,123 @@
+/**
+* @file Manifest.hpp
+* @brief On-disk record of the photos already ingested into a library
+*/
+
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Remembers every photo an ingest run has handled, so later runs can skip
+ *        photos that have not changed since without reading them again.
+ *
+ *        The manifest is an append-only text file with one record per line. A photo
+ *        that is recorded more than once takes its last record. Records are appended
+ *        as photos finish, so a run that is killed part way loses nothing it
+ *        finished. A copy is recorded before any of its data is written, and Flush
+ *        makes the record durable before the copy's data is flushed, so a copy that
+ *        was cut short can be found and removed by the next run.
+ *
+ *        Files found in the destination library that no run copied are recorded too,
+ *        under their own path, so duplicates of them can be found without listing the
+ *        library on every run.
+ *
+ *        Record and the lookups can be called from any thread.
+ */
+class Manifest
+{
+public:
+
+    enum EntryStatus
+    {
+        ENTRY_COPYING,  ///< The copy was started but not committed. Destination is its temporary file.
+        ENTRY_VERIFIED, ///< The photo was copied and the copy verified, or its destination already existed
+        ENTRY_NO_DATE,  ///< The photo has no EXIF date, so it was not copied
+        ENTRY_LIBRARY,  ///< A file already in the library, keyed by its own path, whose digest is known
+        ENTRY_LIBRARY_UNHASHED ///< A file already in the library whose digest has not been computed yet
+    };
+
+    /**
+     * @brief What is known about one source photo
+     */
+    struct Entry
+    {
+        EntryStatus Status;
+        uint64_t    Size;
+        int64_t     ModifiedTime; ///< Nanoseconds since the epoch
+        uint64_t    Digest;       ///< XXH64 of the contents. Zero unless Status is ENTRY_VERIFIED or ENTRY_LIBRARY,
+                                  ///< or for a photo whose destination already held a file of the same name.
+        std::string Destination;  ///< Empty if Status is ENTRY_NO_DATE
+    };
+
+    enum ErrorCodes
+    {
+        NO_ERROR            =  0,
+        MANIFEST_OPEN_ERR   = -1,
+        MANIFEST_READ_ERR   = -2,
+        MANIFEST_WRITE_ERR  = -3
+    };
+
+    static constexpr const char *DEFAULT_FILE_NAME = ".photoproject-manifest";
+
+    Manifest() : mFd(-1), mRecordCount(0), mIsNew(false), mEntries(), mMutex() {};
+    ~Manifest();
+
+    Manifest(const Manifest &) = delete;
+    Manifest &operator=(const Manifest &) = delete;
+
+    const int  Open(const fs::path &manifest_file);
+    const int  Close();
+    const bool IsUnchanged(const std::string &source, const uint64_t size, const int64_t modified_time,
+                           const bool include_no_date);
+    const std::vector<fs::path> IncompleteCopies();
+    const int  Record(const std::string &source, const Entry &entry);
+    const int  Flush();
+    const bool IsNew() const {return mIsNew;}
+
+    /**
+     * @brief Calls visitor(source, entry) for every photo in the manifest.
+     *        The manifest must not be changed by the visitor.
+     */
+    template <typename Visitor>
+    void ForEachEntry(Visitor visitor)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (const auto &record : mEntries)
+        {
+            visitor(record.first, record.second);
+        }
+    }
+
+private:
+
+    static constexpr const char *HEADER = "PhotoProject manifest 1";
+    static constexpr char STATUS_COPYING  = 'C';
+    static constexpr char STATUS_VERIFIED = 'V';
+    static constexpr char STATUS_NO_DATE  = 'N';
+    static constexpr char STATUS_LIBRARY  = 'L';
+    static constexpr char STATUS_LIBRARY_UNHASHED = 'U';
+
+    int    mFd;          ///< The manifest, opened for appending
+    size_t mRecordCount; ///< Lines in the file, including records replaced by later ones
+    bool   mIsNew;       ///< The manifest did not exist before Open
+    std::unordered_map<std::string, Entry> mEntries;
+    std::mutex mMutex;
+
+    static void AppendEscaped(std::string &line, const std::string &text);
+    static const bool Unescape(const std::string &field, std::string &text);
+    static const std::string FormatRecord(const std::string &source, const Entry &entry);
+    static const bool ParseRecord(const std::string &line, std::string &source, Entry &entry);
+
+    const int Load(const fs::path &manifest_file);
+    const int Rewrite(const fs::path &manifest_file);
+    const int WriteAll(const std::string &data);
+};
@@ -0,0 +1,96 @@
+/**
+* @file Prefetcher.cpp
+* @brief Has the kernel start reading the next photos before the pipeline asks for them
+*/
+
+#include "Prefetcher.hpp"
+#include <fcntl.h>    // For open, posix_fadvise
+#include <sys/stat.h> // For fstat
+#include <unistd.h>   // For close
+#include <algorithm>  // For std::min
+
+Prefetcher::Prefetcher() :
+    mWindow(0),
+    mHeaderBytes(0),
+    mInWindow(0),
+    mMutex(),
+    mReleased()
+{
+}
+
+/**
+ * @brief Sets how far ahead of the pipeline photos are prefetched. Must be called before
+ *        the first call to Prefetch.
+ *
+ * @param[in] window Most photos prefetched but not yet read. Zero to not prefetch.
+ * @param[in] header_bytes Bytes at the start of each photo to ask for before the rest
+ *
+ * @return None
+ */
+void Prefetcher::SetWindow(const size_t window, const size_t header_bytes)
+{
+    mWindow = window;
+    mHeaderBytes = header_bytes;
+}
+
+/**
+ * @brief Waits until the window has room, then asks the kernel to start reading a photo.
+ *        Returns once the request is made, without waiting for the data. A photo that can
+ *        not be opened still takes its place in the window, and is left for the reader to
+ *        report.
+ *
+ * @param[in] file The photo the pipeline will read soon
+ *
+ * @return None
+ */
+void Prefetcher::Prefetch(const fs::path &file)
+{
+    if (mWindow == 0)
+    {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mReleased.wait(lock, [this]() {return mInWindow < mWindow;});
+        ++mInWindow;
+    }
+
+    const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat file_info = {};
+    if (fstat(fd, &file_info) == 0)
+    {
+        const uint64_t length = std::min<uint64_t>(static_cast<uint64_t>(file_info.st_size), MAX_PREFETCH_BYTES);
+        const uint64_t header = std::min<uint64_t>(length, mHeaderBytes);
+        posix_fadvise(fd, 0, static_cast<off_t>(header), POSIX_FADV_WILLNEED);
+        if (length > header)
+        {
+            posix_fadvise(fd, static_cast<off_t>(header), static_cast<off_t>(length - header), POSIX_FADV_WILLNEED);
+        }
+    }
+    close(fd);
+}
+
+/**
+ * @brief Makes room in the window once the pipeline has read a photo.
+ *        Must be called once for each photo passed to Prefetch.
+ *
+ * @return None
+ */
+void Prefetcher::Release()
+{
+    if (mWindow == 0)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        --mInWindow;
+    }
+    mReleased.notify_one();
+}
@@ -0,0 +1,50 @@
+/**
+* @file Prefetcher.hpp
+* @brief Has the kernel start reading the next photos before the pipeline asks for them
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Keeps the next few photos on their way into the page cache, so reading a photo
+ *        from a network source does not start with a round trip to the server.
+ *
+ *        Each photo is opened and the kernel is asked with POSIX_FADV_WILLNEED to read its
+ *        header, which holds the EXIF data the parse stage needs first, and then its body.
+ *        The kernel reads them in the background. At most a window of photos are asked for
+ *        before the pipeline has read them, so the page cache is not filled with photos
+ *        that would be dropped again before they are used.
+ *
+ *        Prefetch and Release can be called from any thread.
+ */
+class Prefetcher
+{
+public:
+
+    Prefetcher();
+
+    Prefetcher(const Prefetcher &) = delete;
+    Prefetcher &operator=(const Prefetcher &) = delete;
+
+    void SetWindow(const size_t window, const size_t header_bytes);
+    void Prefetch(const fs::path &file);
+    void Release();
+
+private:
+
+    static constexpr uint64_t MAX_PREFETCH_BYTES = 67108864; ///< Only the start of larger files is asked for
+
+    size_t mWindow;      ///< Most photos prefetched but not yet read. Zero to not prefetch.
+    size_t mHeaderBytes; ///< Bytes at the start of each photo asked for first
+    size_t mInWindow;
+    std::mutex mMutex;
+    std::condition_variable mReleased;
+};
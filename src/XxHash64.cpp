@@ -0,0 +1,183 @@
+/**
+* @file XxHash64.cpp
+* @brief Streaming implementation of the XXH64 non-cryptographic hash
+*/
+
+#include "XxHash64.hpp"
+#include <endian.h> // For endian correction
+#include <string.h> // For memcpy
+
+static inline uint64_t RotateLeft(const uint64_t value, const int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t ReadLe64(const uint8_t *data)
+{
+    uint64_t value = 0;
+    memcpy(&value, data, sizeof(value));
+    return le64toh(value);
+}
+
+static inline uint32_t ReadLe32(const uint8_t *data)
+{
+    uint32_t value = 0;
+    memcpy(&value, data, sizeof(value));
+    return le32toh(value);
+}
+
+XxHash64::XxHash64(const uint64_t seed)
+{
+    Reset(seed);
+}
+
+/**
+ * @brief Discards all data passed to Update and starts a new hash.
+ *
+ * @param[in] seed The seed for the new hash
+ *
+ * @return None
+ */
+void XxHash64::Reset(const uint64_t seed)
+{
+    mSeed = seed;
+    mTotalLength = 0;
+    mAccumulators[0] = seed + PRIME_1 + PRIME_2;
+    mAccumulators[1] = seed + PRIME_2;
+    mAccumulators[2] = seed;
+    mAccumulators[3] = seed - PRIME_1;
+    mPendingLength = 0;
+}
+
+uint64_t XxHash64::Round(uint64_t accumulator, const uint64_t input)
+{
+    accumulator += input * PRIME_2;
+    accumulator = RotateLeft(accumulator, 31);
+    return accumulator * PRIME_1;
+}
+
+uint64_t XxHash64::MergeRound(uint64_t accumulator, const uint64_t value)
+{
+    accumulator ^= Round(0, value);
+    return (accumulator * PRIME_1) + PRIME_4;
+}
+
+void XxHash64::ConsumeStripe(const uint8_t *stripe)
+{
+    mAccumulators[0] = Round(mAccumulators[0], ReadLe64(stripe));
+    mAccumulators[1] = Round(mAccumulators[1], ReadLe64(stripe + 8));
+    mAccumulators[2] = Round(mAccumulators[2], ReadLe64(stripe + 16));
+    mAccumulators[3] = Round(mAccumulators[3], ReadLe64(stripe + 24));
+}
+
+/**
+ * @brief Adds data to the hash.
+ *
+ * @param[in] data The data to hash
+ * @param[in] length The number of bytes to hash
+ *
+ * @return None
+ */
+void XxHash64::Update(const void *data, size_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    const uint8_t *input = static_cast<const uint8_t *>(data);
+    mTotalLength += length;
+
+    // Finish the stripe left over from the previous call first
+    if (mPendingLength > 0)
+    {
+        const size_t bytes_to_copy = (length < (STRIPE_LENGTH - mPendingLength)) ? length : (STRIPE_LENGTH - mPendingLength);
+        memcpy(mPending + mPendingLength, input, bytes_to_copy);
+        mPendingLength += bytes_to_copy;
+        input += bytes_to_copy;
+        length -= bytes_to_copy;
+
+        if (mPendingLength < STRIPE_LENGTH)
+        {
+            return;
+        }
+        ConsumeStripe(mPending);
+        mPendingLength = 0;
+    }
+
+    for (; length >= STRIPE_LENGTH; length -= STRIPE_LENGTH, input += STRIPE_LENGTH)
+    {
+        ConsumeStripe(input);
+    }
+
+    memcpy(mPending, input, length);
+    mPendingLength = length;
+}
+
+/**
+ * @brief Gets the hash of all data passed to Update so far.
+ *        More data can still be added after calling this function.
+ *
+ * @return The 64 bit digest
+ */
+const uint64_t XxHash64::Digest() const
+{
+    uint64_t hash = 0;
+    if (mTotalLength >= STRIPE_LENGTH)
+    {
+        hash = RotateLeft(mAccumulators[0], 1)  + RotateLeft(mAccumulators[1], 7) +
+               RotateLeft(mAccumulators[2], 12) + RotateLeft(mAccumulators[3], 18);
+        for (const uint64_t accumulator : mAccumulators)
+        {
+            hash = MergeRound(hash, accumulator);
+        }
+    }
+    else
+    {
+        hash = mSeed + PRIME_5;
+    }
+    hash += mTotalLength;
+
+    const uint8_t *input = mPending;
+    size_t length = mPendingLength;
+    for (; length >= 8; length -= 8, input += 8)
+    {
+        hash ^= Round(0, ReadLe64(input));
+        hash = (RotateLeft(hash, 27) * PRIME_1) + PRIME_4;
+    }
+    if (length >= 4)
+    {
+        hash ^= static_cast<uint64_t>(ReadLe32(input)) * PRIME_1;
+        hash = (RotateLeft(hash, 23) * PRIME_2) + PRIME_3;
+        length -= 4;
+        input += 4;
+    }
+    for (; length > 0; --length, ++input)
+    {
+        hash ^= (*input) * PRIME_5;
+        hash = RotateLeft(hash, 11) * PRIME_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/**
+ * @brief Hashes a single block of data.
+ *
+ * @param[in] data The data to hash
+ * @param[in] length The number of bytes to hash
+ * @param[in] seed The seed for the hash
+ *
+ * @return The 64 bit digest
+ */
+const uint64_t XxHash64::Hash(const void *data, const size_t length, const uint64_t seed)
+{
+    XxHash64 hash(seed);
+    hash.Update(data, length);
+    return hash.Digest();
+}
@@ -0,0 +1,47 @@
+/**
+* @file XxHash64.hpp
+* @brief Streaming implementation of the XXH64 non-cryptographic hash
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Computes the XXH64 hash of a stream of bytes.
+ *        Data can be passed to Update in pieces of any size, and the digest
+ *        matches hashing all of the data at once.
+ */
+class XxHash64
+{
+private:
+
+    static constexpr uint64_t PRIME_1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr uint64_t PRIME_3 = 0x165667B19E3779F9ULL;
+    static constexpr uint64_t PRIME_4 = 0x85EBCA77C2B2AE63ULL;
+    static constexpr uint64_t PRIME_5 = 0x27D4EB2F165667C5ULL;
+
+    static constexpr size_t STRIPE_LENGTH = 32; ///< Bytes consumed by one round of the four accumulators
+
+    uint64_t mSeed;
+    uint64_t mTotalLength;
+    uint64_t mAccumulators[4];
+    uint8_t  mPending[STRIPE_LENGTH]; ///< Bytes that did not fill a whole stripe yet
+    size_t   mPendingLength;
+
+    static uint64_t Round(uint64_t accumulator, const uint64_t input);
+    static uint64_t MergeRound(uint64_t accumulator, const uint64_t value);
+    void ConsumeStripe(const uint8_t *stripe);
+
+public:
+
+    explicit XxHash64(const uint64_t seed = 0);
+
+    void Reset(const uint64_t seed = 0);
+    void Update(const void *data, size_t length);
+    const uint64_t Digest() const;
+
+    static const uint64_t Hash(const void *data, const size_t length, const uint64_t seed = 0);
+};
@@ -6,75 +6,204 @@
 */
 
 #include <iostream>
-#include "ExifParser/ExifParser.hpp"
-#include "Filesystem.hpp"
+#include "Ingest.hpp"
 #include <filesystem>
-#include <sstream>
-#include <fstream>
+#include <string>
+#include <cerrno>  // For errno
+#include <cstdlib> // For strtoull
 
 namespace fs = std::filesystem;
 
+static constexpr uint64_t BYTES_PER_MIB = 1048576;
+
+/**
+ * @brief Prints how the program is run.
+ *
+ * @param[in] program The name the program was run as
+ *
+ * @return None
+ */
+static void PrintUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [source folder] [destination folder] [-j workers] [-m manifest] [-d skip|link|reflink|copy] [-f] [-t thumbnail folder]"
+              << " [-s source MiB/s] [-w destination MiB/s] [-v verify MiB/s] [-c copy streams] [-V verify streams] [-p prefetch count]" << std::endl;
+}
+
+/**
+ * @brief Reads a whole number argument. std::stoull would throw on text that is not a
+ *        number and wrap a negative one, so both are rejected here instead.
+ *
+ * @param[in] text The argument
+ * @param[in] max The largest value accepted
+ * @param[out] value The number
+ *
+ * @return True if the argument is a number no larger than max
+ */
+static const bool ParseNumber(const char *text, const uint64_t max, uint64_t &value)
+{
+    if ((*text < '0') || (*text > '9'))
+    {
+        return false;
+    }
+    char *end = nullptr;
+    errno = 0;
+    value = std::strtoull(text, &end, 10);
+    return (*end == '\0') && (errno == 0) && (value <= max);
+}
+
 /**
  * This is the main function
+ *
+ * Usage: PhotoProject [source folder] [destination folder] [-j workers] [-m manifest] [-d skip|link|reflink|copy] [-f] [-t thumbnail folder]
+ *        [-s source MiB/s] [-w destination MiB/s] [-v verify MiB/s] [-c copy streams] [-V verify streams] [-p prefetch count]
  */
-int main()
+int main(int argc, char *argv[])
 {
-    cExifParser NewParser("/mnt/chromeos/MyFiles/Downloads/DSC01047.jpg");
-    // fs::path source_root_path("/mnt/chromeos/SMB/8d17eb5d7a9837aa07c6e1aadb2568ee144069f5d1d8fb032b1c1e60db4b13cd/Samsung SM-G960U1 Camera Backup/");
-    // fs::path destination_root_path("/mnt/chromeos/SMB/22927c5b089cbcbbeeeed9e3591fdcfd54f9ea40143ed0f26fde0fb8f5f2c92f/My Pictures/Camera Photos");
-    // std::cout << "Root path is a path " << fs::is_directory(source_root_path) << std::endl;
-    // if (fs::is_directory(source_root_path))
-    // {
+    Ingest::Options options = {};
+    options.SourceRoot = "/mnt/chromeos/SMB/8d17eb5d7a9837aa07c6e1aadb2568ee144069f5d1d8fb032b1c1e60db4b13cd/Samsung SM-G960U1 Camera Backup/";
+    options.DestinationRoot = "/mnt/chromeos/SMB/22927c5b089cbcbbeeeed9e3591fdcfd54f9ea40143ed0f26fde0fb8f5f2c92f/My Pictures/Camera Photos";
+
+    int positional_args = 0;
+    uint64_t number = 0;
+    for (int arg_index = 1; arg_index < argc; ++arg_index)
+    {
+        const std::string arg = argv[arg_index];
+        if ((arg == "-j") && ((arg_index + 1) < argc))
+        {
+            if (!ParseNumber(argv[++arg_index], SIZE_MAX, number))
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            options.ReaderCount = static_cast<size_t>(number);
+            options.WriterCount = options.ReaderCount;
+        }
+        else if ((arg == "-m") && ((arg_index + 1) < argc))
+        {
+            options.ManifestFile = argv[++arg_index];
+        }
+        else if ((arg == "-d") && ((arg_index + 1) < argc))
+        {
+            const std::string action = argv[++arg_index];
+            if (action == "link")
+            {
+                options.Duplicates = Ingest::DUPLICATE_HARDLINK;
+            }
+            else if (action == "reflink")
+            {
+                options.Duplicates = Ingest::DUPLICATE_REFLINK;
+            }
+            else if (action == "copy")
+            {
+                options.Duplicates = Ingest::DUPLICATE_COPY;
+            }
+            else if (action == "skip")
+            {
+                options.Duplicates = Ingest::DUPLICATE_SKIP;
+            }
+            else
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if ((arg == "-t") && ((arg_index + 1) < argc))
+        {
+            options.ThumbnailRoot = argv[++arg_index];
+        }
+        else if ((arg == "-s") && ((arg_index + 1) < argc))
+        {
+            if (!ParseNumber(argv[++arg_index], UINT64_MAX / BYTES_PER_MIB, number))
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            options.SourceBytesPerSecond = number * BYTES_PER_MIB;
+        }
+        else if ((arg == "-w") && ((arg_index + 1) < argc))
+        {
+            if (!ParseNumber(argv[++arg_index], UINT64_MAX / BYTES_PER_MIB, number))
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            options.DestinationBytesPerSecond = number * BYTES_PER_MIB;
+        }
+        else if ((arg == "-v") && ((arg_index + 1) < argc))
+        {
+            if (!ParseNumber(argv[++arg_index], UINT64_MAX / BYTES_PER_MIB, number))
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            options.VerifyBytesPerSecond = number * BYTES_PER_MIB;
+        }
+        else if ((arg == "-c") && ((arg_index + 1) < argc))
+        {
+            if (!ParseNumber(argv[++arg_index], SIZE_MAX, number))
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            options.MaxCopyStreams = static_cast<size_t>(number);
+        }
+        else if ((arg == "-V") && ((arg_index + 1) < argc))
+        {
+            if (!ParseNumber(argv[++arg_index], SIZE_MAX, number))
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            options.MaxVerifyStreams = static_cast<size_t>(number);
+        }
+        else if ((arg == "-p") && ((arg_index + 1) < argc))
+        {
+            if (!ParseNumber(argv[++arg_index], SIZE_MAX, number))
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            options.PrefetchCount = static_cast<size_t>(number);
+        }
+        else if (arg == "-f")
+        {
+            options.DateFallback = true;
+        }
+        else if (positional_args == 0)
+        {
+            options.SourceRoot = arg;
+            ++positional_args;
+        }
+        else if (positional_args == 1)
+        {
+            options.DestinationRoot = arg;
+            ++positional_args;
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::cout << "Root path is a path " << fs::is_directory(options.SourceRoot) << std::endl;
+    if (!fs::is_directory(options.SourceRoot))
+    {
+        return 1;
+    }
 
-    //     for (const fs::directory_entry& source_image : fs::directory_iterator(source_root_path))
-    //     {
-    //         if (source_image.path().extension() == ".jpg")
-    //         {
-    //             std::cout << "    " << source_image.path() << '\n';
-    //             cExifParser NewParser(source_image.path().string());
-    //             const tm &PhotoDateTime = NewParser.GetDateTime();
-    //             std::cout << "Photo's date and time is " << asctime(&PhotoDateTime) << std::endl;
-    //             std::stringstream date_folder;
-    //             date_folder << (PhotoDateTime.tm_year + 1900) << '/' << (PhotoDateTime.tm_mon + 1) << '-' << PhotoDateTime.tm_mday << '-' << (PhotoDateTime.tm_year + 1900);
-    //             fs::path destination_path = destination_root_path;
-    //             destination_path /= date_folder.str();
-    //             std::cout << destination_path << std::endl;
-    //             std::cout << "Folder exists " << fs::exists(destination_path) << std::endl;
+    // Thumbnails inside the library would be found by its walk and taken for photos
+    if (!options.ThumbnailRoot.empty() && Ingest::IsWithin(options.ThumbnailRoot, options.DestinationRoot))
+    {
+        std::cerr << "The thumbnail folder must be outside of the destination folder" << std::endl;
+        return 1;
+    }
 
-    //             if (!fs::exists(destination_path))
-    //             {
-    //                try
-    //                {
-    //                    fs::create_directories(destination_path);
-    //                }
-    //                catch(const fs::filesystem_error& e)
-    //                {
-    //                    std::cerr << e.what() << '\n';
-    //                    break;
-    //                }
+    const Ingest::Summary summary = Ingest::Run(options);
+    std::cout << "Copied " << summary.Copied << ", unchanged " << summary.Unchanged << ", already existed " << summary.AlreadyExisted
+              << ", duplicates " << summary.Duplicates
+              << ", no date " << summary.NoDate << ", failed " << summary.Failed
+              << ", dated without EXIF " << summary.FallbackDated << std::endl;
 
-    //             }
-    //             destination_path /= source_image.path().filename();
-    //             std::cout << destination_path << std::endl;
-    //             std::cout << "File exists " << fs::exists(source_image.path()) << ' ' << fs::exists(destination_path) << std::endl;
-    //             std::cout << "Source file is regular file " << fs::is_regular_file(source_image.path()) << " Filesize " << fs::file_size(source_image.path()) << std::endl;
-    //             if (Filesystem::CopyFile(source_image.path(), destination_path) == 0)
-    //             {
-    //                 if (Filesystem::Verify(source_image.path(), destination_path) == 0)
-    //                 {
-    //                     std::cout << "Image copied successfully" << std::endl;
-    //                 }
-    //                 else
-    //                 {
-    //                     std::cout << "Could not verify the images" << std::endl;
-    //                 }
-    //             }
-    //             else
-    //             {
-    //                 std::cout << "Could not copy the image" << std::endl;
-    //             }
-    //         }
-    //         break;
-    //     }
-    // }
+    return (summary.Failed == 0) ? 0 : 1;
 }